@@ -0,0 +1,133 @@
+#!/bin/sh
+#
+# NVIDIA Persistence Daemon benchmark: emulated kernel interface generator
+#
+# Copyright (c) 2026 NVIDIA Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+#
+#
+# Generates a directory tree that mimics the parts of procfs, sysfs and /dev
+# used by the NUMA code of nvidia-persistenced, for a daemon built with
+# NVPD_KERNEL_ROOT pointing at it. The device files hold the NUMA state that
+# numa-ioctl-shim.so reports through NV_ESC_NUMA_INFO.
+#
+# Usage: gen-kernel-root.sh [options] ROOT
+#
+#   -g GPUS       number of GPUs (default 1)
+#   -m MEMBLOCKS  number of memory blocks per GPU (default 512)
+#   -s GB         size of the memory of each GPU, instead of -m
+#   -b MB         memory block size in MB (default 128)
+#   -p            create a memory probe file
+#   -o            start with the memory of each GPU online, as left by a
+#                 daemon with --warm-restart
+#
+# Any existing tree under ROOT is removed first.
+
+set -e
+
+gpus=1
+memblocks=512
+size_gb=
+memblock_mb=128
+probe=0
+online=0
+
+while getopts "g:m:s:b:po" opt; do
+    case $opt in
+        g) gpus=$OPTARG ;;
+        m) memblocks=$OPTARG ;;
+        s) size_gb=$OPTARG ;;
+        b) memblock_mb=$OPTARG ;;
+        p) probe=1 ;;
+        o) online=1 ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 [-g GPUS] [-m MEMBLOCKS | -s GB] [-b MB] [-p] [-o] ROOT" >&2
+    exit 1
+fi
+
+root=$1
+
+if [ -n "$size_gb" ]; then
+    memblocks=$((size_gb * 1024 / memblock_mb))
+fi
+
+memblock_size=$((memblock_mb * 1024 * 1024))
+
+# Leave a gap of one memory block between the memory of the GPUs, above the
+# first 256 GB of system memory
+stride=$(((memblocks + 1) * memblock_size))
+first_base=$((256 * 1024 * 1024 * 1024))
+
+if [ $online -eq 1 ]; then
+    numa_status=3
+    block_state=online
+else
+    numa_status=1
+    block_state=offline
+fi
+
+rm -rf "$root/proc" "$root/sys" "$root/dev" "$root/run"
+
+mem="$root/sys/devices/system/memory"
+mkdir -p "$root/proc/driver/nvidia/gpus" "$root/dev" "$mem" \
+         "$root/run"
+
+printf '%x\n' $memblock_size > "$mem/block_size_bytes"
+echo offline > "$mem/auto_online_blocks"
+: > "$mem/hard_offline_page"
+if [ $probe -eq 1 ]; then
+    : > "$mem/probe"
+fi
+
+gpu=0
+while [ $gpu -lt "$gpus" ]; do
+    bdf=$(printf '0000:%02x:00.0' $((gpu + 1)))
+    nid=$((gpu + 1))
+    base=$((first_base + gpu * stride))
+    first_id=$((base / memblock_size))
+
+    mkdir -p "$root/proc/driver/nvidia/gpus/$bdf"
+    echo "Device Minor: $gpu" > "$root/proc/driver/nvidia/gpus/$bdf/information"
+
+    printf 'nid=%d status=%d base=0x%x size=0x%x memblock_size=0x%x auto_online=0\n' \
+        $nid $numa_status $base $((memblocks * memblock_size)) \
+        $memblock_size > "$root/dev/nvidia$gpu"
+
+    for size_kb in 2048 1048576; do
+        dir="$root/sys/devices/system/node/node$nid/hugepages/hugepages-${size_kb}kB"
+        mkdir -p "$dir"
+        echo 0 > "$dir/nr_hugepages"
+    done
+
+    id=$first_id
+    while [ $id -lt $((first_id + memblocks)) ]; do
+        mkdir "$mem/memory$id"
+        echo $block_state > "$mem/memory$id/state"
+        echo Movable > "$mem/memory$id/valid_zones"
+        id=$((id + 1))
+    done
+
+    gpu=$((gpu + 1))
+done
@@ -0,0 +1,203 @@
+#!/bin/sh
+#
+# NVIDIA Persistence Daemon benchmark: NUMA onlining and offlining
+#
+# Copyright (c) 2026 NVIDIA Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+#
+#
+# Times bringing up and tearing down nvidia-persistenced against an emulated
+# kernel interface: the daemon onlines the NUMA memory of every GPU before
+# it reports that it is ready, and offlines it on SIGTERM.
+#
+# Usage: numa-bench.sh [options] -d DAEMON -c CFG_DIR -s SHIM -r ROOT
+#                      [-- DAEMON_ARGS]
+#
+#   -d DAEMON      daemon built with NVPD_KERNEL_ROOT=ROOT
+#   -c CFG_DIR     directory of the stub libnvidia-cfg.so.1
+#   -s SHIM        numa-ioctl-shim.so
+#   -r ROOT        emulated kernel root, regenerated for each run
+#   -g GPUS        number of GPUs (default 1)
+#   -m MEMBLOCKS   number of memory blocks per GPU (default 512)
+#   -S GB          size of the memory of each GPU, instead of -m
+#   -b MB          memory block size in MB (default 128)
+#   -l US          latency of each memory block state write (default 100)
+#   -t THREADS     value of --numa-online-threads (default 1)
+#   -n RUNS        number of runs (default 3)
+#   -T SECONDS     test canceling the offlining: stop the daemon with
+#                  --shutdown-timeout=SECONDS, expect every block to be back
+#                  online, then check that a new instance takes the memory
+#                  over and offlines it when stopped in turn
+#
+# The failure injection variables of numa-ioctl-shim.c are passed through
+# from the environment.
+
+set -e
+
+daemon=
+cfg_dir=
+shim=
+root=
+gpus=1
+memblocks=512
+size_gb=
+memblock_mb=128
+latency_us=100
+threads=1
+runs=3
+cancel_timeout=
+
+while getopts "d:c:s:r:g:m:S:b:l:t:n:T:" opt; do
+    case $opt in
+        d) daemon=$OPTARG ;;
+        c) cfg_dir=$OPTARG ;;
+        s) shim=$OPTARG ;;
+        r) root=$OPTARG ;;
+        g) gpus=$OPTARG ;;
+        m) memblocks=$OPTARG ;;
+        S) size_gb=$OPTARG ;;
+        b) memblock_mb=$OPTARG ;;
+        l) latency_us=$OPTARG ;;
+        t) threads=$OPTARG ;;
+        n) runs=$OPTARG ;;
+        T) cancel_timeout=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ -z "$daemon" ] || [ -z "$cfg_dir" ] || [ -z "$shim" ] || [ -z "$root" ]; then
+    echo "Usage: $0 [options] -d DAEMON -c CFG_DIR -s SHIM -r ROOT [-- DAEMON_ARGS]" >&2
+    exit 1
+fi
+
+if [ -n "$size_gb" ]; then
+    memblocks=$((size_gb * 1024 / memblock_mb))
+fi
+
+# The daemon changes to / once started
+cfg_dir=$(cd "$cfg_dir" && pwd)
+shim="$(cd "$(dirname "$shim")" && pwd)/$(basename "$shim")"
+
+gen="$(dirname "$0")/gen-kernel-root.sh"
+pid_file="$root/run/nvidia-persistenced/nvidia-persistenced.pid"
+mem="$root/sys/devices/system/memory"
+total=$((gpus * memblocks))
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+# Whether the process is still running; it may stay a zombie until reaped
+running() {
+    [ -r "/proc/$1/stat" ] && ! grep -q '^[0-9]* (.*) Z' "/proc/$1/stat"
+}
+
+# Prints the number of memory blocks in the given state
+count_blocks() {
+    cat "$mem"/memory*/state | grep -c "^$1\$" || true
+}
+
+# Starts the daemon against the tree, returning once it is ready
+start_daemon() {
+    env NVPD_BENCH_ROOT="$root" \
+        NVPD_BENCH_WRITE_LATENCY_US="$latency_us" \
+        LD_PRELOAD="$shim" \
+        "$daemon" --nvidia-cfg-path="$cfg_dir" \
+                  --numa-online-threads="$threads" \
+                  --setup-threads="$gpus" "$@"
+}
+
+# Stops the daemon, returning once it has exited
+stop_daemon() {
+    pid=$(cat "$pid_file")
+    kill -TERM "$pid"
+    while running "$pid"; do
+        sleep 0.01
+    done
+}
+
+echo "$gpus GPUs, $memblocks memory blocks of $memblock_mb MB each," \
+     "$latency_us us per write, $threads onlining threads"
+
+if [ -n "$cancel_timeout" ]; then
+    sh "$gen" -g "$gpus" -m "$memblocks" -b "$memblock_mb" "$root"
+
+    start_daemon --shutdown-timeout="$cancel_timeout" "$@"
+    start=$(now_ms)
+    stop_daemon
+    echo "canceled after $(($(now_ms) - start)) ms:" \
+         "$(count_blocks online) of $total blocks online"
+    if [ "$(count_blocks online)" -ne $total ]; then
+        echo "canceling the offlining did not leave all blocks online" >&2
+        exit 1
+    fi
+
+    start_daemon "$@"
+    echo "restarted: $(count_blocks online) of $total blocks online"
+    stop_daemon
+    echo "stopped: $(count_blocks offline) of $total blocks offline"
+    if [ "$(count_blocks offline)" -ne $total ]; then
+        echo "the restarted daemon did not offline all blocks" >&2
+        exit 1
+    fi
+
+    exit 0
+fi
+
+run=1
+online_sum=0
+offline_sum=0
+failed=0
+
+while [ $run -le "$runs" ]; do
+    sh "$gen" -g "$gpus" -m "$memblocks" -b "$memblock_mb" "$root"
+
+    start=$(now_ms)
+    if ! start_daemon "$@"; then
+        echo "run $run: the daemon failed to start" >&2
+        exit 1
+    fi
+    online_ms=$(($(now_ms) - start))
+    online=$(count_blocks online)
+
+    start=$(now_ms)
+    stop_daemon
+    offline_ms=$(($(now_ms) - start))
+    offline=$(count_blocks offline)
+
+    echo "run $run: online $online_ms ms ($online of $total blocks)," \
+         "offline $offline_ms ms ($offline of $total blocks)"
+
+    if [ "$online" -ne $total ] || [ "$offline" -ne $total ]; then
+        failed=$((failed + 1))
+    fi
+
+    online_sum=$((online_sum + online_ms))
+    offline_sum=$((offline_sum + offline_ms))
+    run=$((run + 1))
+done
+
+echo "average: online $((online_sum / runs)) ms, offline $((offline_sum / runs)) ms"
+
+if [ $failed -gt 0 ]; then
+    echo "$failed of $runs runs did not change the state of every block" >&2
+    exit 1
+fi
@@ -0,0 +1,430 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * numa-ioctl-shim.c
+ *
+ * An LD_PRELOAD library emulating the parts of the kernel that the NUMA code
+ * of the daemon talks to, on top of the regular files generated by
+ * gen-kernel-root.sh under $NVPD_BENCH_ROOT:
+ *
+ * - NV_ESC_NUMA_INFO and NV_ESC_SET_NUMA_STATUS on the /dev/nvidiaN device
+ *   files, whose contents hold the NUMA state of the device.
+ *
+ * - Writes to the memoryN/state files of the memory hotplug interface, which
+ *   leave the file reading "online" or "offline" as sysfs would. Each write
+ *   takes $NVPD_BENCH_WRITE_LATENCY_US, and writes are serialized as the
+ *   kernel serializes them on device_hotplug_lock, unless
+ *   $NVPD_BENCH_SERIALIZE is 0.
+ *
+ * Failures are injected with:
+ *
+ * - $NVPD_BENCH_FAIL_BLOCKS, a list of memblock IDs and ranges such as
+ *   "1024,2048-2055", whose writes fail with EBUSY.
+ * - $NVPD_BENCH_FAIL_EVERY, to fail every Nth write with EBUSY.
+ * - $NVPD_BENCH_FAIL_ON, "online" or "offline", to only fail writes in that
+ *   direction.
+ * - $NVPD_BENCH_STRICT_MOVABLE, to refuse onlining a block as movable while
+ *   the block above it is offline, as older kernels do.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nv-ioctl-numa.h"
+
+#define DEVICE_FILE_FMT       "/dev/nvidia%u"
+#define MEMORY_DIR            "/sys/devices/system/memory"
+#define MEMBLK_DIR_FMT        MEMORY_DIR "/memory%" SCNu32
+#define MEMBLK_STATE_FILE_FMT MEMBLK_DIR_FMT "/state"
+#define MAX_TRACKED_FDS       65536
+#define MAX_FAIL_RANGES       64
+#define DEVICE_STATE_LEN      256
+
+typedef enum
+{
+    FD_UNKNOWN = 0,
+    FD_OTHER,
+    FD_DEVICE,
+    FD_MEMBLOCK_STATE,
+} FdKind;
+
+/*
+ * What each file descriptor refers to, looked up from /proc/self/fd once per
+ * open file. Closes done inside the C library cannot be intercepted, so an
+ * entry is only trusted while the descriptor still refers to the same file.
+ */
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    FdKind kind;
+    uint32_t block_id;
+} FdInfo;
+
+static struct {
+    const char *root;
+    size_t root_len;
+    unsigned long write_latency_us;
+    int serialize;
+    int strict_movable;
+    unsigned long fail_every;
+    int fail_online;
+    int fail_offline;
+    int num_fail_ranges;
+    uint32_t fail_ranges[MAX_FAIL_RANGES][2];
+} config;
+
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t fds_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t hotplug_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
+static FdInfo fds[MAX_TRACKED_FDS];
+static unsigned long num_writes;
+
+static int (*real_ioctl)(int, unsigned long, ...);
+static ssize_t (*real_pwrite)(int, const void *, size_t, off_t);
+
+static unsigned long env_ulong(const char *name, unsigned long def)
+{
+    const char *value = getenv(name);
+
+    return ((value != NULL) && (value[0] != '\0')) ?
+               strtoul(value, NULL, 0) : def;
+}
+
+static void parse_fail_ranges(const char *list)
+{
+    const char *p = list;
+    char *end;
+    unsigned long first, last;
+
+    while ((p != NULL) && (*p != '\0') &&
+           (config.num_fail_ranges < MAX_FAIL_RANGES)) {
+        first = strtoul(p, &end, 0);
+        if (end == p) {
+            break;
+        }
+        last = first;
+        p = end;
+
+        if (*p == '-') {
+            last = strtoul(p + 1, &end, 0);
+            p = end;
+        }
+
+        config.fail_ranges[config.num_fail_ranges][0] = first;
+        config.fail_ranges[config.num_fail_ranges][1] = last;
+        config.num_fail_ranges++;
+
+        if (*p == ',') {
+            p++;
+        }
+    }
+}
+
+static void load_config(void)
+{
+    const char *fail_on = getenv("NVPD_BENCH_FAIL_ON");
+
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+    real_pwrite = dlsym(RTLD_NEXT, "pwrite");
+
+    config.root = getenv("NVPD_BENCH_ROOT");
+    config.root_len = (config.root != NULL) ? strlen(config.root) : 0;
+    config.write_latency_us = env_ulong("NVPD_BENCH_WRITE_LATENCY_US", 0);
+    config.serialize = env_ulong("NVPD_BENCH_SERIALIZE", 1);
+    config.strict_movable = env_ulong("NVPD_BENCH_STRICT_MOVABLE", 0);
+    config.fail_every = env_ulong("NVPD_BENCH_FAIL_EVERY", 0);
+    config.fail_online = (fail_on == NULL) || (strcmp(fail_on, "offline") != 0);
+    config.fail_offline = (fail_on == NULL) || (strcmp(fail_on, "online") != 0);
+    parse_fail_ranges(getenv("NVPD_BENCH_FAIL_BLOCKS"));
+}
+
+/*
+ * Finds out whether fd is one of the emulated files, from its path under
+ * NVPD_BENCH_ROOT.
+ */
+static FdKind classify_fd(int fd, uint32_t *block_id)
+{
+    char link[64], path[4096];
+    struct stat st;
+    unsigned int minor;
+    const char *rel;
+    FdInfo *info;
+    ssize_t len;
+    int n;
+
+    pthread_once(&config_once, load_config);
+
+    if ((config.root == NULL) || (fd < 0) || (fd >= MAX_TRACKED_FDS) ||
+        (fstat(fd, &st) < 0)) {
+        return FD_OTHER;
+    }
+
+    info = &fds[fd];
+
+    pthread_mutex_lock(&fds_lock);
+
+    if ((info->kind == FD_UNKNOWN) || (info->dev != st.st_dev) ||
+        (info->ino != st.st_ino)) {
+        info->dev = st.st_dev;
+        info->ino = st.st_ino;
+        info->kind = FD_OTHER;
+
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        len = readlink(link, path, sizeof(path) - 1);
+
+        if ((len > (ssize_t)config.root_len) &&
+            (strncmp(path, config.root, config.root_len) == 0)) {
+            path[len] = '\0';
+            rel = path + config.root_len;
+
+            if ((sscanf(rel, DEVICE_FILE_FMT "%n", &minor, &n) == 1) &&
+                (rel[n] == '\0')) {
+                info->kind = FD_DEVICE;
+            } else if ((sscanf(rel, MEMBLK_DIR_FMT "%n",
+                               &info->block_id, &n) == 1) &&
+                       (strcmp(rel + n, "/state") == 0)) {
+                info->kind = FD_MEMBLOCK_STATE;
+            }
+        }
+    }
+
+    *block_id = info->block_id;
+
+    pthread_mutex_unlock(&fds_lock);
+
+    return info->kind;
+}
+
+static int block_fails(uint32_t block_id, int online)
+{
+    int i;
+
+    if (online ? !config.fail_online : !config.fail_offline) {
+        return 0;
+    }
+
+    for (i = 0; i < config.num_fail_ranges; i++) {
+        if ((block_id >= config.fail_ranges[i][0]) &&
+            (block_id <= config.fail_ranges[i][1])) {
+            return 1;
+        }
+    }
+
+    return (config.fail_every > 0) &&
+           ((__sync_add_and_fetch(&num_writes, 1) % config.fail_every) == 0);
+}
+
+/*
+ * Older kernels only online a block into ZONE_MOVABLE if the block above it
+ * is already movable, or if it is the last block of the memory range.
+ */
+static int above_block_offline(uint32_t block_id)
+{
+    char path[4096], buf[16];
+    int fd, offline;
+    ssize_t len;
+
+    snprintf(path, sizeof(path), "%s" MEMBLK_STATE_FILE_FMT, config.root,
+             block_id + 1);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    offline = (len > 0) && (strncmp(buf, "offline", 7) == 0);
+    close(fd);
+
+    return offline;
+}
+
+static ssize_t write_memblock_state(int fd, uint32_t block_id,
+                                    const char *cmd, size_t count)
+{
+    const char *state;
+    ssize_t ret = count;
+    int online;
+
+    if ((count >= 6) && (strncmp(cmd, "online", 6) == 0)) {
+        online = 1;
+        state = "online\n";
+    } else if ((count == 7) && (strncmp(cmd, "offline", 7) == 0)) {
+        online = 0;
+        state = "offline\n";
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (config.serialize) {
+        pthread_mutex_lock(&hotplug_lock);
+    }
+
+    if (config.write_latency_us > 0) {
+        usleep(config.write_latency_us);
+    }
+
+    if (block_fails(block_id, online) ||
+        (online && config.strict_movable && above_block_offline(block_id))) {
+        errno = online ? EINVAL : EBUSY;
+        ret = -1;
+    } else if ((ftruncate(fd, 0) < 0) ||
+               (real_pwrite(fd, state, strlen(state), 0) < 0)) {
+        ret = -1;
+    }
+
+    if (config.serialize) {
+        pthread_mutex_unlock(&hotplug_lock);
+    }
+
+    return ret;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    uint32_t block_id;
+
+    if (classify_fd(fd, &block_id) == FD_MEMBLOCK_STATE) {
+        return write_memblock_state(fd, block_id, buf, count);
+    }
+
+    return real_pwrite(fd, buf, count, offset);
+}
+
+ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset)
+{
+    return pwrite(fd, buf, count, offset);
+}
+
+/*
+ * The NUMA state of an emulated device, as kept in its device file:
+ *   nid=N status=N base=ADDR size=SIZE memblock_size=SIZE auto_online=N
+ */
+static int read_device_state(int fd, nv_ioctl_numa_info_t *info)
+{
+    char buf[DEVICE_STATE_LEN];
+    unsigned int auto_online;
+    ssize_t len;
+
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+        errno = EIO;
+        return -1;
+    }
+    buf[len] = '\0';
+
+    if (sscanf(buf, "nid=%" SCNd32 " status=%" SCNd32 " base=%" SCNx64
+               " size=%" SCNx64 " memblock_size=%" SCNx64 " auto_online=%u",
+               &info->nid, &info->status, &info->numa_mem_addr,
+               &info->numa_mem_size, &info->memblock_size,
+               &auto_online) != 6) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    info->use_auto_online = auto_online;
+
+    return 0;
+}
+
+static int write_device_state(int fd, const nv_ioctl_numa_info_t *info)
+{
+    char buf[DEVICE_STATE_LEN];
+    int len;
+
+    len = snprintf(buf, sizeof(buf),
+                   "nid=%" PRId32 " status=%" PRId32 " base=0x%" PRIx64
+                   " size=0x%" PRIx64 " memblock_size=0x%" PRIx64
+                   " auto_online=%u\n", info->nid, info->status,
+                   info->numa_mem_addr, info->numa_mem_size,
+                   info->memblock_size, info->use_auto_online);
+
+    if ((ftruncate(fd, 0) < 0) || (real_pwrite(fd, buf, len, 0) != len)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int device_ioctl(int fd, unsigned long request, void *arg)
+{
+    nv_ioctl_numa_info_t info;
+    int ret = 0;
+
+    if ((_IOC_TYPE(request) != NV_IOCTL_MAGIC) ||
+        ((_IOC_NR(request) != NV_ESC_NUMA_INFO) &&
+         (_IOC_NR(request) != NV_ESC_SET_NUMA_STATUS))) {
+        errno = ENOTTY;
+        return -1;
+    }
+
+    pthread_mutex_lock(&device_lock);
+
+    memset(&info, 0, sizeof(info));
+
+    if (read_device_state(fd, &info) < 0) {
+        ret = -1;
+    } else if (_IOC_NR(request) == NV_ESC_NUMA_INFO) {
+        memcpy(arg, &info, sizeof(info));
+    } else {
+        info.status = ((nv_ioctl_set_numa_status_t *)arg)->status;
+        ret = write_device_state(fd, &info);
+    }
+
+    pthread_mutex_unlock(&device_lock);
+
+    return ret;
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    uint32_t block_id;
+    va_list ap;
+    void *arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if (classify_fd(fd, &block_id) == FD_DEVICE) {
+        return device_ioctl(fd, request, arg);
+    }
+
+    return real_ioctl(fd, request, arg);
+}
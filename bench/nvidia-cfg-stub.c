@@ -0,0 +1,175 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-cfg-stub.c
+ *
+ * A stand-in for libnvidia-cfg.so.1, for running the daemon against the
+ * emulated kernel interface generated by gen-kernel-root.sh. The devices are
+ * those found under $NVPD_BENCH_ROOT/proc/driver/nvidia/gpus, and opening,
+ * closing and registering them with UVM always succeeds, after the optional
+ * delay given by $NVPD_BENCH_OPEN_LATENCY_US.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvidia-cfg.h"
+
+#define GPUS_DIR "/proc/driver/nvidia/gpus"
+
+typedef struct
+{
+    NvCfgPciDevice pci_info;
+} StubDevice;
+
+static unsigned long env_ulong(const char *name)
+{
+    const char *value = getenv(name);
+
+    return (value != NULL) ? strtoul(value, NULL, 0) : 0;
+}
+
+static int compare_devices(const void *a, const void *b)
+{
+    const NvCfgPciDevice *da = a, *db = b;
+
+    if (da->domain != db->domain) {
+        return da->domain - db->domain;
+    }
+    if (da->bus != db->bus) {
+        return da->bus - db->bus;
+    }
+    if (da->slot != db->slot) {
+        return da->slot - db->slot;
+    }
+    return da->function - db->function;
+}
+
+NvCfgBool nvCfgGetPciDevices(int *n, NvCfgPciDevice **devs)
+{
+    const char *root = getenv("NVPD_BENCH_ROOT");
+    char path[4096];
+    struct dirent *entry;
+    NvCfgPciDevice *list = NULL, *new_list;
+    int count = 0;
+    DIR *dir;
+
+    if (root == NULL) {
+        return NVCFG_FALSE;
+    }
+
+    snprintf(path, sizeof(path), "%s" GPUS_DIR, root);
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        return NVCFG_FALSE;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        NvCfgPciDevice pci_info;
+
+        if (sscanf(entry->d_name, "%x:%x:%x.%x", &pci_info.domain,
+                   &pci_info.bus, &pci_info.slot, &pci_info.function) != 4) {
+            continue;
+        }
+
+        new_list = realloc(list, (count + 1) * sizeof(NvCfgPciDevice));
+        if (new_list == NULL) {
+            free(list);
+            closedir(dir);
+            return NVCFG_FALSE;
+        }
+
+        list = new_list;
+        list[count++] = pci_info;
+    }
+
+    closedir(dir);
+
+    if (count > 0) {
+        qsort(list, count, sizeof(NvCfgPciDevice), compare_devices);
+    }
+
+    *n = count;
+    *devs = (list != NULL) ? list : calloc(1, sizeof(NvCfgPciDevice));
+
+    return (*devs != NULL) ? NVCFG_TRUE : NVCFG_FALSE;
+}
+
+NvCfgBool nvCfgOpenPciDevice(int domain, int bus, int device, int function,
+                             NvCfgDeviceHandle *handle)
+{
+    StubDevice *stub = malloc(sizeof(StubDevice));
+
+    if (stub == NULL) {
+        return NVCFG_FALSE;
+    }
+
+    stub->pci_info.domain = domain;
+    stub->pci_info.bus = bus;
+    stub->pci_info.slot = device;
+    stub->pci_info.function = function;
+
+    usleep(env_ulong("NVPD_BENCH_OPEN_LATENCY_US"));
+
+    *handle = stub;
+
+    return NVCFG_TRUE;
+}
+
+NvCfgBool nvCfgCloseDevice(NvCfgDeviceHandle handle)
+{
+    free(handle);
+
+    return NVCFG_TRUE;
+}
+
+NvCfgBool nvCfgGetDeviceUUID(NvCfgDeviceHandle handle, char **uuid)
+{
+    const StubDevice *stub = handle;
+
+    *uuid = malloc(64);
+    if (*uuid == NULL) {
+        return NVCFG_FALSE;
+    }
+
+    snprintf(*uuid, 64, "GPU-%04x%02x%02x-0000-0000-0000-00000000000%x",
+             stub->pci_info.domain, stub->pci_info.bus, stub->pci_info.slot,
+             stub->pci_info.function);
+
+    return NVCFG_TRUE;
+}
+
+unsigned int nvCfgEnableUVMPersistence(NvCfgDeviceHandle handle)
+{
+    return 0;
+}
+
+unsigned int nvCfgDisableUVMPersistence(NvCfgDeviceHandle handle)
+{
+    return 0;
+}
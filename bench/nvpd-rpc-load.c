@@ -0,0 +1,590 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvpd-rpc-load.c
+ *
+ * A load generator for the RPC interface of the daemon. It forks a number of
+ * clients, each with its own connections to the daemon, which issue a mix of
+ * requests through the rpcgen client stubs as fast as the daemon answers
+ * them, for a given time or number of requests. The throughput and latency
+ * percentiles of each kind of request are reported once all clients are done.
+ *
+ * Clients are processes rather than threads, as the rpcgen stubs return
+ * their results in static storage, and as the daemon is meant to be used by
+ * many independent processes.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvpd_defs.h"
+#include "nvpd_rpc.h"
+
+#define DEFAULT_MIX             "get=90,states=10"
+#define DEFAULT_MAX_SAMPLES     (1 << 20)
+
+typedef enum
+{
+    OP_GET = 0,         /* V1 nvPdGetPersistenceMode */
+    OP_SET,             /* V1 nvPdSetPersistenceMode, enabled */
+    OP_TOGGLE,          /* V1 nvPdSetPersistenceMode, alternating */
+    OP_SET_ONLY,        /* V2 nvPdSetPersistenceModeOnly, enabled */
+    OP_NUMA,            /* V2 nvPdSetNumaStatus, online */
+    OP_STATES,          /* V3 nvPdGetDeviceStates */
+    OP_STATS,           /* V4 nvPdGetStats */
+    NUM_OPS,
+} Op;
+
+static const struct {
+    const char *name;
+    unsigned long version;
+} ops[NUM_OPS] = {
+    [OP_GET]      = { "get",      VersionOne },
+    [OP_SET]      = { "set",      VersionOne },
+    [OP_TOGGLE]   = { "toggle",   VersionOne },
+    [OP_SET_ONLY] = { "set-only", VersionTwo },
+    [OP_NUMA]     = { "numa",     VersionTwo },
+    [OP_STATES]   = { "states",   VersionThree },
+    [OP_STATS]    = { "stats",    VersionFour },
+};
+
+#define NUM_VERSIONS 4
+
+typedef struct
+{
+    uint64_t latency_ns;
+    uint8_t op;
+    uint8_t failed;
+} Sample;
+
+typedef struct
+{
+    const char *socket_path;
+    int num_clients;
+    double duration;
+    long requests;
+    long timeout;
+    unsigned int weights[NUM_OPS];
+    unsigned int total_weight;
+    NvPciDevice device;
+    int has_device;
+} Config;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    int i;
+
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "  -c CLIENTS   number of concurrent clients (default 10)\n"
+            "  -d SECONDS   how long to run (default 10)\n"
+            "  -n REQUESTS  requests per client, instead of -d\n"
+            "  -m MIX       weighted request mix (default \"" DEFAULT_MIX "\")\n"
+            "  -D BUS_ID    device to target, as domain:bus:slot\n"
+            "               (default: the first device of the daemon)\n"
+            "  -s SOCKET    RPC socket of the daemon (default "
+            NVPD_SOCKET_PATH ")\n"
+            "  -T SECONDS   timeout of each request (default 25)\n"
+            "\n"
+            "Requests of the mix:", name);
+
+    for (i = 0; i < NUM_OPS; i++) {
+        fprintf(stderr, " %s", ops[i].name);
+    }
+
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+static int parse_mix(const char *mix, Config *config)
+{
+    char *copy, *item, *save = NULL, *value;
+    int i, found;
+
+    memset(config->weights, 0, sizeof(config->weights));
+    config->total_weight = 0;
+
+    copy = strdup(mix);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    for (item = strtok_r(copy, ",", &save); item != NULL;
+         item = strtok_r(NULL, ",", &save)) {
+        value = strchr(item, '=');
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+
+        for (i = 0, found = 0; i < NUM_OPS; i++) {
+            if (strcmp(item, ops[i].name) == 0) {
+                config->weights[i] = (value != NULL) ? atoi(value) : 1;
+                config->total_weight += config->weights[i];
+                found = 1;
+            }
+        }
+
+        if (!found) {
+            fprintf(stderr, "Unknown request '%s'\n", item);
+            free(copy);
+            return -1;
+        }
+    }
+
+    free(copy);
+
+    return (config->total_weight > 0) ? 0 : -1;
+}
+
+static CLIENT *connect_daemon(const char *socket_path, unsigned long version,
+                              long timeout)
+{
+    struct sockaddr_un addr;
+    struct timeval tv = { timeout, 0 };
+    int sock = RPC_ANYSOCK;
+    CLIENT *clnt;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    clnt = clntunix_create(&addr, NVPD_PROG, version, &sock, 0, 0);
+    if (clnt == NULL) {
+        clnt_pcreateerror(socket_path);
+        return NULL;
+    }
+
+    clnt_control(clnt, CLSET_TIMEOUT, (char *)&tv);
+
+    return clnt;
+}
+
+/* Finds the first device of the daemon, to target when none is given */
+static int find_device(Config *config)
+{
+    GetDeviceStatesRes *res;
+    CLIENT *clnt;
+    int ret = -1;
+
+    clnt = connect_daemon(config->socket_path, VersionThree, config->timeout);
+    if (clnt == NULL) {
+        return -1;
+    }
+
+    res = nvpdgetdevicestates_3(NULL, clnt);
+    if (res == NULL) {
+        clnt_perror(clnt, "Failed to query the devices of the daemon");
+    } else if ((res->status != NVPD_SUCCESS) ||
+               (res->devices.devices_len == 0)) {
+        fprintf(stderr, "The daemon has no devices (status %d)\n",
+                res->status);
+    } else {
+        config->device = res->devices.devices_val[0].device;
+        ret = 0;
+    }
+
+    if (res != NULL) {
+        clnt_freeres(clnt, (xdrproc_t)xdr_GetDeviceStatesRes, (caddr_t)res);
+    }
+    clnt_destroy(clnt);
+
+    return ret;
+}
+
+/* Issues a single request, returning whether it failed */
+static int issue_request(Op op, CLIENT *clnt, const NvPciDevice *device,
+                         int *toggle)
+{
+    SetPersistenceModeArgs set_args;
+    GetPersistenceModeArgs get_args;
+    SetNumaStatusArgs numa_args;
+    GetPersistenceModeRes *get_res;
+    GetDeviceStatesRes *states_res;
+    GetStatsRes *stats_res;
+    NvPdStatus *status = NULL;
+    int failed;
+
+    set_args.device = *device;
+    set_args.mode = NV_PERSISTENCE_MODE_ENABLED;
+
+    switch (op) {
+    case OP_GET:
+        get_args.device = *device;
+        get_res = nvpdgetpersistencemode_1(&get_args, clnt);
+        return (get_res == NULL) || (get_res->status != NVPD_SUCCESS);
+    case OP_TOGGLE:
+        *toggle = !*toggle;
+        set_args.mode = *toggle ? NV_PERSISTENCE_MODE_DISABLED :
+                                  NV_PERSISTENCE_MODE_ENABLED;
+        /* fall through */
+    case OP_SET:
+        status = nvpdsetpersistencemode_1(&set_args, clnt);
+        break;
+    case OP_SET_ONLY:
+        status = nvpdsetpersistencemodeonly_2(&set_args, clnt);
+        break;
+    case OP_NUMA:
+        numa_args.device = *device;
+        numa_args.status = NV_NUMA_STATUS_ONLINE;
+        status = nvpdsetnumastatus_2(&numa_args, clnt);
+        break;
+    case OP_STATES:
+        states_res = nvpdgetdevicestates_3(NULL, clnt);
+        if (states_res == NULL) {
+            return 1;
+        }
+        failed = (states_res->status != NVPD_SUCCESS);
+        clnt_freeres(clnt, (xdrproc_t)xdr_GetDeviceStatesRes,
+                     (caddr_t)states_res);
+        return failed;
+    case OP_STATS:
+        stats_res = nvpdgetstats_4(NULL, clnt);
+        if (stats_res == NULL) {
+            return 1;
+        }
+        failed = (stats_res->status != NVPD_SUCCESS);
+        clnt_freeres(clnt, (xdrproc_t)xdr_GetStatsRes, (caddr_t)stats_res);
+        return failed;
+    default:
+        return 1;
+    }
+
+    return (status == NULL) || (*status != NVPD_SUCCESS);
+}
+
+static Op pick_op(const Config *config, unsigned int *seed)
+{
+    unsigned int r = rand_r(seed) % config->total_weight;
+    int i;
+
+    for (i = 0; i < NUM_OPS - 1; i++) {
+        if (r < config->weights[i]) {
+            break;
+        }
+        r -= config->weights[i];
+    }
+
+    return i;
+}
+
+/*
+ * Runs one client: connects to the daemon, reports that it is ready on
+ * ready_fd, waits for the start signal on start_fd, then issues requests
+ * until done, recording a sample for each.
+ */
+static int run_client(const Config *config, int index, int ready_fd,
+                      int start_fd, Sample *samples, size_t max_samples,
+                      size_t *num_samples)
+{
+    CLIENT *clnts[NUM_VERSIONS + 1] = { NULL };
+    unsigned int seed = index + 1;
+    uint64_t start, deadline = 0;
+    size_t n = 0;
+    int toggle = 0;
+    char c = 0;
+    Op op;
+    int i;
+
+    for (i = 0; i < NUM_OPS; i++) {
+        if ((config->weights[i] > 0) && (clnts[ops[i].version] == NULL)) {
+            clnts[ops[i].version] = connect_daemon(config->socket_path,
+                                                   ops[i].version,
+                                                   config->timeout);
+            if (clnts[ops[i].version] == NULL) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if ((write(ready_fd, &c, 1) != 1) || (read(start_fd, &c, 1) < 0)) {
+        return EXIT_FAILURE;
+    }
+
+    if (config->requests == 0) {
+        deadline = now_ns() + (uint64_t)(config->duration * 1e9);
+    }
+
+    while (n < max_samples) {
+        if ((config->requests > 0) ? (n >= (size_t)config->requests) :
+                                     (now_ns() >= deadline)) {
+            break;
+        }
+
+        op = pick_op(config, &seed);
+
+        start = now_ns();
+        samples[n].failed = issue_request(op, clnts[ops[op].version],
+                                          &config->device, &toggle);
+        samples[n].latency_ns = now_ns() - start;
+        samples[n].op = op;
+        n++;
+    }
+
+    *num_samples = n;
+
+    for (i = 0; i <= NUM_VERSIONS; i++) {
+        if (clnts[i] != NULL) {
+            clnt_destroy(clnts[i]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, double p)
+{
+    size_t i = (size_t)(p * n + 0.999999);
+
+    return sorted[(i > 0) ? (i - 1) : 0];
+}
+
+static void print_row(const char *name, uint64_t *latencies, size_t n,
+                      size_t failed, double elapsed)
+{
+    if (n == 0) {
+        return;
+    }
+
+    qsort(latencies, n, sizeof(uint64_t), compare_u64);
+
+    printf("%-9s %9zu %7zu %11.1f %9.1f %9.1f %9.1f %9.1f\n", name, n,
+           failed, n / elapsed,
+           percentile(latencies, n, 0.50) / 1000.0,
+           percentile(latencies, n, 0.99) / 1000.0,
+           percentile(latencies, n, 0.999) / 1000.0,
+           latencies[n - 1] / 1000.0);
+}
+
+/* Prints the throughput and latency percentiles of each kind of request */
+static void report(const Config *config, const Sample *samples,
+                   size_t max_samples, const size_t *num_samples,
+                   double elapsed)
+{
+    uint64_t *latencies, *all;
+    size_t n, n_all = 0, failed, failed_all = 0, total = 0;
+    int client, i;
+    size_t j;
+
+    for (client = 0; client < config->num_clients; client++) {
+        total += num_samples[client];
+    }
+
+    latencies = malloc((total + 1) * sizeof(uint64_t));
+    all = malloc((total + 1) * sizeof(uint64_t));
+    if ((latencies == NULL) || (all == NULL)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%d clients, %.1f s, %zu requests, %.1f requests/s\n\n",
+           config->num_clients, elapsed, total, total / elapsed);
+    printf("%-9s %9s %7s %11s %9s %9s %9s %9s\n", "request", "count",
+           "errors", "requests/s", "p50 us", "p99 us", "p999 us", "max us");
+
+    for (i = 0; i < NUM_OPS; i++) {
+        n = 0;
+        failed = 0;
+
+        for (client = 0; client < config->num_clients; client++) {
+            const Sample *s = &samples[client * max_samples];
+
+            for (j = 0; j < num_samples[client]; j++) {
+                if (s[j].op != i) {
+                    continue;
+                }
+                latencies[n++] = s[j].latency_ns;
+                all[n_all++] = s[j].latency_ns;
+                failed += s[j].failed;
+            }
+        }
+
+        failed_all += failed;
+        print_row(ops[i].name, latencies, n, failed, elapsed);
+    }
+
+    print_row("all", all, n_all, failed_all, elapsed);
+
+    free(latencies);
+    free(all);
+}
+
+int main(int argc, char *argv[])
+{
+    Config config = {
+        .socket_path = NVPD_SOCKET_PATH,
+        .num_clients = 10,
+        .duration = 10.0,
+        .requests = 0,
+        .timeout = 25,
+    };
+    const char *mix = DEFAULT_MIX;
+    int ready_pipe[2], start_pipe[2];
+    size_t max_samples, *num_samples;
+    Sample *samples;
+    uint64_t start;
+    pid_t *pids;
+    char c;
+    int opt, i, status, num_failed = 0;
+
+    while ((opt = getopt(argc, argv, "c:d:n:m:D:s:T:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            config.num_clients = atoi(optarg);
+            break;
+        case 'd':
+            config.duration = atof(optarg);
+            break;
+        case 'n':
+            config.requests = atol(optarg);
+            break;
+        case 'm':
+            mix = optarg;
+            break;
+        case 'D':
+            if (sscanf(optarg, "%x:%x:%x", &config.device.domain,
+                       &config.device.bus, &config.device.slot) != 3) {
+                usage(argv[0]);
+            }
+            config.has_device = 1;
+            break;
+        case 's':
+            config.socket_path = optarg;
+            break;
+        case 'T':
+            config.timeout = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ((config.num_clients < 1) || (config.duration <= 0) ||
+        (config.requests < 0) || (parse_mix(mix, &config) < 0)) {
+        usage(argv[0]);
+    }
+
+    if (!config.has_device && (find_device(&config) < 0)) {
+        return EXIT_FAILURE;
+    }
+
+    max_samples = (config.requests > 0) ? (size_t)config.requests :
+                                          DEFAULT_MAX_SAMPLES;
+
+    /* Shared with the clients, and only touched as far as they get */
+    samples = mmap(NULL, config.num_clients * max_samples * sizeof(Sample),
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    num_samples = mmap(NULL, config.num_clients * sizeof(size_t),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                       -1, 0);
+    pids = calloc(config.num_clients, sizeof(pid_t));
+    if ((samples == MAP_FAILED) || (num_samples == MAP_FAILED) ||
+        (pids == NULL)) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((pipe(ready_pipe) < 0) || (pipe(start_pipe) < 0)) {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+
+    /* Requests on a connection the daemon closed are counted as failed */
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < config.num_clients; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        } else if (pids[i] == 0) {
+            close(ready_pipe[0]);
+            close(start_pipe[1]);
+            _exit(run_client(&config, i, ready_pipe[1], start_pipe[0],
+                             &samples[i * max_samples], max_samples,
+                             &num_samples[i]));
+        }
+    }
+
+    close(ready_pipe[1]);
+    close(start_pipe[0]);
+
+    /* Start all of the clients at once, once they are all connected */
+    for (i = 0; i < config.num_clients; i++) {
+        if (read(ready_pipe[0], &c, 1) != 1) {
+            fprintf(stderr, "Not all clients could connect\n");
+            close(start_pipe[1]);
+            for (i = 0; i < config.num_clients; i++) {
+                kill(pids[i], SIGTERM);
+            }
+            return EXIT_FAILURE;
+        }
+    }
+
+    start = now_ns();
+    close(start_pipe[1]);
+
+    for (i = 0; i < config.num_clients; i++) {
+        if ((waitpid(pids[i], &status, 0) < 0) || !WIFEXITED(status) ||
+            (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+            num_failed++;
+        }
+    }
+
+    if (num_failed > 0) {
+        fprintf(stderr, "%d clients failed\n", num_failed);
+    }
+
+    report(&config, samples, max_samples, num_samples,
+           (now_ns() - start) / 1e9);
+
+    return (num_failed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
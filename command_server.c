@@ -26,14 +26,98 @@
  */
 
 #define _GNU_SOURCE
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <sys/socket.h>
+#include <time.h>
 
+#include "nvidia-event-loop.h"
 #include "nvidia-persistenced.h"
+#include "nvidia-stats.h"
+#include "nvidia-trace.h"
 #include "nvpd_rpc.h"
 
+typedef enum {
+    NVPD_COMMAND_SET_PERSISTENCE_MODE,
+    NVPD_COMMAND_SET_PERSISTENCE_MODE_ONLY,
+    NVPD_COMMAND_SET_NUMA_STATUS,
+} NvPdCommandType;
+
+/*
+ * State of a command that changes device state. These commands may take a
+ * long time to complete, so they are executed by the worker thread of the
+ * target device, which also sends the reply to the client.
+ */
+typedef struct
+{
+    NvPdCommandType type;
+    SVCXPRT *transp;
+    NvPciDevice device;
+    int value;
+    NvPdStatus result;
+    NvPdRpcPhase phase;
+    uint64_t start_time;
+} NvPdDeferredCommand;
+
+struct _NvPdBatchCommand;
+
+/* Operation on a single device of a batched command */
+typedef struct
+{
+    struct _NvPdBatchCommand *batch;
+    NvPdDeviceStatus *entry;
+} NvPdBatchTask;
+
+/*
+ * State of a batched command. The operation on each device is executed by the
+ * worker thread of that device, and whichever operation completes last sends
+ * the reply to the client.
+ */
+typedef struct _NvPdBatchCommand
+{
+    NvPdCommandType type;
+    SVCXPRT *transp;
+    int value;
+    pthread_mutex_t lock;
+    int remaining;
+    NvPdBatchTask *tasks;
+    BatchRes result;
+    NvPdRpcPhase phase;
+    uint64_t start_time;
+} NvPdBatchCommand;
+
+/* Number of NUMA jobs whose state is kept, including finished jobs */
+#define NVPD_MAX_NUMA_JOBS 64
+
+/*
+ * State of an asynchronous NUMA status change. The job is executed by the
+ * worker thread of its device, and its state is kept in the job table until
+ * its slot is reused by a newer job once the job is done, least recently
+ * finished jobs first.
+ */
+typedef struct
+{
+    unsigned int id;            /* 0 if the slot is unused */
+    NvPciDevice device;
+    NvNumaStatus target_status;
+    NvPdJobState state;
+    NvPdStatus result;
+    uint64_t start_time;        /* monotonic time in ms, once running */
+    uint64_t end_time;          /* monotonic time in ms, once done */
+    NvNumaProgress progress;
+} NvPdNumaJob;
+
+static struct {
+    pthread_mutex_t lock;
+    unsigned int next_id;
+    NvPdNumaJob jobs[NVPD_MAX_NUMA_JOBS];
+} numa_jobs = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .next_id = 1,
+};
+
 static NvPdStatus _nvpdIsClientRoot(struct svc_req *req)
 {
     struct ucred ucred = { -1, -1, -1 };
@@ -52,6 +136,513 @@ static NvPdStatus _nvpdIsClientRoot(struct svc_req *req)
     return NVPD_SUCCESS;
 }
 
+/*
+ * _nvpdRunCommand() - Executes a command that changes the state of a device.
+ */
+static NvPdStatus _nvpdRunCommand(NvPdCommandType type,
+                                  const NvPciDevice *device, int value)
+{
+    switch (type) {
+    case NVPD_COMMAND_SET_PERSISTENCE_MODE:
+        return nvPdSetDevicePersistenceMode(device->domain,
+                                            device->bus,
+                                            device->slot,
+                                            device->function,
+                                            value);
+    case NVPD_COMMAND_SET_PERSISTENCE_MODE_ONLY:
+        return nvPdSetDevicePersistenceModeOnly(device->domain,
+                                                device->bus,
+                                                device->slot,
+                                                device->function,
+                                                value);
+    case NVPD_COMMAND_SET_NUMA_STATUS:
+        return nvPdSetDeviceNumaStatus(device->domain,
+                                       device->bus,
+                                       device->slot,
+                                       device->function,
+                                       value);
+    }
+
+    return NVPD_ERR_UNKNOWN;
+}
+
+/*
+ * _nvpdRunDeferredCommand() - Executes a deferred command on the worker
+ * thread of its device and sends the reply to the client.
+ */
+static void _nvpdRunDeferredCommand(void *data)
+{
+    NvPdDeferredCommand *cmd = data;
+
+    cmd->result = _nvpdRunCommand(cmd->type, &cmd->device, cmd->value);
+
+    if (!svc_sendreply(cmd->transp, (xdrproc_t) xdr_NvPdStatus,
+                       (char *) &cmd->result)) {
+        svcerr_systemerr(cmd->transp);
+    }
+
+    nvPdStatsRecordRpc(cmd->phase, cmd->start_time);
+
+    nvPdEventLoopResume(cmd->transp);
+
+    free(cmd);
+}
+
+/*
+ * _nvpdQueueDeferredCommand() - Called by the event loop once the request of
+ * a deferred command has been dispatched, to hand the command off to the
+ * worker thread of its device.
+ */
+static void _nvpdQueueDeferredCommand(void *data)
+{
+    NvPdDeferredCommand *cmd = data;
+    NvPdStatus status;
+
+    status = nvPdQueueDeviceWork(cmd->device.domain,
+                                 cmd->device.bus,
+                                 cmd->device.slot,
+                                 cmd->device.function,
+                                 _nvpdRunDeferredCommand, cmd);
+    if (status != NVPD_SUCCESS) {
+        cmd->result = status;
+
+        if (!svc_sendreply(cmd->transp, (xdrproc_t) xdr_NvPdStatus,
+                           (char *) &cmd->result)) {
+            svcerr_systemerr(cmd->transp);
+        }
+
+        nvPdStatsRecordRpc(cmd->phase, cmd->start_time);
+
+        nvPdEventLoopResume(cmd->transp);
+
+        free(cmd);
+    }
+}
+
+/*
+ * _nvpdDeferCommand() - Defers the reply to the request being dispatched
+ * until the command has been executed by the worker thread of the device.
+ * Returns NULL on success, which tells the RPC dispatcher not to reply.
+ */
+static NvPdStatus *_nvpdDeferCommand(struct svc_req *req, NvPdCommandType type,
+                                     const NvPciDevice *device, int value,
+                                     NvPdRpcPhase phase, uint64_t start_time,
+                                     NvPdStatus *result)
+{
+    NvPdDeferredCommand *cmd;
+
+    cmd = malloc(sizeof(*cmd));
+    if (cmd == NULL) {
+        *result = NVPD_ERR_INSUFFICIENT_RESOURCES;
+        nvPdStatsRecordRpc(phase, start_time);
+        return result;
+    }
+
+    cmd->type = type;
+    cmd->transp = req->rq_xprt;
+    cmd->device = *device;
+    cmd->value = value;
+    cmd->result = NVPD_SUCCESS;
+    cmd->phase = phase;
+    cmd->start_time = start_time;
+
+    if (nvPdEventLoopDeferReply(req->rq_xprt, _nvpdQueueDeferredCommand,
+                                cmd) != NVPD_SUCCESS) {
+        free(cmd);
+        *result = NVPD_ERR_RPC;
+        nvPdStatsRecordRpc(phase, start_time);
+        return result;
+    }
+
+    return NULL;
+}
+
+/*
+ * _nvpdCompleteBatchTask() - Called once the operation on a device of a
+ * batched command is done. The last call sends the reply to the client and
+ * frees the command.
+ */
+static void _nvpdCompleteBatchTask(NvPdBatchCommand *batch)
+{
+    BatchRes *result = &batch->result;
+    unsigned int i;
+    int done;
+
+    pthread_mutex_lock(&batch->lock);
+    done = (--batch->remaining == 0);
+    pthread_mutex_unlock(&batch->lock);
+
+    if (!done) {
+        return;
+    }
+
+    /* The overall status is that of the first device that failed */
+    result->status = NVPD_SUCCESS;
+    for (i = 0; i < result->results.results_len; i++) {
+        if (result->results.results_val[i].status != NVPD_SUCCESS) {
+            result->status = result->results.results_val[i].status;
+            break;
+        }
+    }
+
+    if (!svc_sendreply(batch->transp, (xdrproc_t) xdr_BatchRes,
+                       (char *) result)) {
+        svcerr_systemerr(batch->transp);
+    }
+
+    nvPdStatsRecordRpc(batch->phase, batch->start_time);
+
+    nvPdEventLoopResume(batch->transp);
+
+    pthread_mutex_destroy(&batch->lock);
+    free(result->results.results_val);
+    free(batch->tasks);
+    free(batch);
+}
+
+/*
+ * _nvpdRunBatchTask() - Executes the operation on a single device of a
+ * batched command on the worker thread of the device.
+ */
+static void _nvpdRunBatchTask(void *data)
+{
+    NvPdBatchTask *task = data;
+
+    task->entry->status = _nvpdRunCommand(task->batch->type,
+                                          &task->entry->device,
+                                          task->batch->value);
+
+    _nvpdCompleteBatchTask(task->batch);
+}
+
+/*
+ * _nvpdQueueBatchCommand() - Called by the event loop once the request of a
+ * batched command has been dispatched, to hand the operation on each device
+ * off to the worker thread of that device.
+ */
+static void _nvpdQueueBatchCommand(void *data)
+{
+    NvPdBatchCommand *batch = data;
+    NvPdDeviceStatus *entry;
+    NvPdStatus status;
+    unsigned int i;
+
+    for (i = 0; i < batch->result.results.results_len; i++) {
+        entry = &batch->result.results.results_val[i];
+
+        status = nvPdQueueDeviceWork(entry->device.domain,
+                                     entry->device.bus,
+                                     entry->device.slot,
+                                     entry->device.function,
+                                     _nvpdRunBatchTask, &batch->tasks[i]);
+        if (status != NVPD_SUCCESS) {
+            entry->status = status;
+            _nvpdCompleteBatchTask(batch);
+        }
+    }
+
+    /* Drop the reference that kept the command alive while queueing */
+    _nvpdCompleteBatchTask(batch);
+}
+
+/*
+ * _nvpdDeferBatchCommand() - Defers the reply to the batched command being
+ * dispatched until the command has been executed on all requested devices,
+ * or all devices managed by the daemon if all_devices is set. Returns NULL on
+ * success, which tells the RPC dispatcher not to reply.
+ */
+static BatchRes *_nvpdDeferBatchCommand(struct svc_req *req,
+                                        NvPdCommandType type,
+                                        bool_t all_devices,
+                                        const NvPciDevice *devices,
+                                        unsigned int num_devices,
+                                        int value, NvPdRpcPhase phase,
+                                        uint64_t start_time, BatchRes *result)
+{
+    NvPdBatchCommand *batch;
+    NvPciDevice *all = NULL;
+    int num_all = 0;
+    unsigned int i;
+
+    result->results.results_len = 0;
+    result->results.results_val = NULL;
+
+    if (all_devices) {
+        result->status = nvPdGetDevices(&all, &num_all);
+        if (result->status != NVPD_SUCCESS) {
+            nvPdStatsRecordRpc(phase, start_time);
+            return result;
+        }
+        devices = all;
+        num_devices = num_all;
+    }
+
+    if (num_devices == 0) {
+        result->status = NVPD_SUCCESS;
+        nvPdStatsRecordRpc(phase, start_time);
+        return result;
+    }
+
+    batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) {
+        goto fail;
+    }
+
+    batch->tasks = calloc(num_devices, sizeof(NvPdBatchTask));
+    batch->result.results.results_val = calloc(num_devices,
+                                               sizeof(NvPdDeviceStatus));
+    if ((batch->tasks == NULL) || (batch->result.results.results_val == NULL)) {
+        free(batch->tasks);
+        free(batch->result.results.results_val);
+        free(batch);
+        goto fail;
+    }
+
+    batch->type = type;
+    batch->transp = req->rq_xprt;
+    batch->value = value;
+    batch->remaining = num_devices + 1;
+    batch->phase = phase;
+    batch->start_time = start_time;
+    batch->result.results.results_len = num_devices;
+    pthread_mutex_init(&batch->lock, NULL);
+
+    for (i = 0; i < num_devices; i++) {
+        batch->result.results.results_val[i].device = devices[i];
+        batch->result.results.results_val[i].status = NVPD_SUCCESS;
+        batch->tasks[i].batch = batch;
+        batch->tasks[i].entry = &batch->result.results.results_val[i];
+    }
+
+    free(all);
+
+    if (nvPdEventLoopDeferReply(req->rq_xprt, _nvpdQueueBatchCommand,
+                                batch) != NVPD_SUCCESS) {
+        pthread_mutex_destroy(&batch->lock);
+        free(batch->result.results.results_val);
+        free(batch->tasks);
+        free(batch);
+        result->status = NVPD_ERR_RPC;
+        nvPdStatsRecordRpc(phase, start_time);
+        return result;
+    }
+
+    return NULL;
+
+fail:
+    free(all);
+    result->status = NVPD_ERR_INSUFFICIENT_RESOURCES;
+    nvPdStatsRecordRpc(phase, start_time);
+    return result;
+}
+
+/*
+ * _nvpdGetTimeMs() - Returns the monotonic time in ms.
+ */
+static uint64_t _nvpdGetTimeMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * _nvpdFindNumaJob() - Returns the job with the given ID. The job table lock
+ * must be held.
+ */
+static NvPdNumaJob *_nvpdFindNumaJob(unsigned int id)
+{
+    int i;
+
+    if (id == 0) {
+        return NULL;
+    }
+
+    for (i = 0; i < NVPD_MAX_NUMA_JOBS; i++) {
+        if (numa_jobs.jobs[i].id == id) {
+            return &numa_jobs.jobs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * _nvpdAllocNumaJob() - Returns an unused slot of the job table, or else the
+ * slot of the job that finished first, or NULL if no job is done. The job
+ * table lock must be held.
+ */
+static NvPdNumaJob *_nvpdAllocNumaJob(void)
+{
+    NvPdNumaJob *job, *oldest = NULL;
+    int i;
+
+    for (i = 0; i < NVPD_MAX_NUMA_JOBS; i++) {
+        job = &numa_jobs.jobs[i];
+
+        if (job->id == 0) {
+            return job;
+        }
+
+        if ((job->state == NVPD_JOB_DONE) &&
+            ((oldest == NULL) || (job->end_time < oldest->end_time))) {
+            oldest = job;
+        }
+    }
+
+    return oldest;
+}
+
+/*
+ * _nvpdRunNumaJob() - Executes a NUMA job on the worker thread of its device.
+ * A job canceled while it was queued completes without being started.
+ */
+static void _nvpdRunNumaJob(void *data)
+{
+    NvPdNumaJob *job = data;
+    NvPdStatus result;
+
+    pthread_mutex_lock(&numa_jobs.lock);
+    job->state = NVPD_JOB_RUNNING;
+    job->start_time = _nvpdGetTimeMs();
+    pthread_mutex_unlock(&numa_jobs.lock);
+
+    if (job->progress.cancel) {
+        result = NVPD_ERR_CANCELED;
+    } else {
+        result = nvPdSetDeviceNumaStatusTracked(job->device.domain,
+                                                job->device.bus,
+                                                job->device.slot,
+                                                job->device.function,
+                                                job->target_status,
+                                                &job->progress);
+    }
+
+    pthread_mutex_lock(&numa_jobs.lock);
+    job->result = result;
+    job->end_time = _nvpdGetTimeMs();
+    job->state = NVPD_JOB_DONE;
+    pthread_mutex_unlock(&numa_jobs.lock);
+}
+
+/*
+ * _nvpdSubmitNumaJob() - Queues a job to the worker thread of the device that
+ * changes the NUMA status of the device, and returns the ID of the job. The
+ * slot of the job is taken over from a job that is done, if the table is
+ * full; the submission only fails if no job in the table is done.
+ */
+static NvPdStatus _nvpdSubmitNumaJob(const NvPciDevice *device,
+                                     NvNumaStatus status, unsigned int *id)
+{
+    NvPdNumaJob *job;
+    NvPdStatus ret;
+
+    if ((status != NV_NUMA_STATUS_ONLINE) &&
+        (status != NV_NUMA_STATUS_OFFLINE)) {
+        return NVPD_ERR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&numa_jobs.lock);
+
+    job = _nvpdAllocNumaJob();
+    if (job == NULL) {
+        pthread_mutex_unlock(&numa_jobs.lock);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    memset(job, 0, sizeof(*job));
+    job->id = numa_jobs.next_id;
+    job->device = *device;
+    job->target_status = status;
+    job->state = NVPD_JOB_QUEUED;
+    job->result = NVPD_SUCCESS;
+
+    /* Zero is never a valid job ID */
+    numa_jobs.next_id++;
+    if (numa_jobs.next_id == 0) {
+        numa_jobs.next_id = 1;
+    }
+
+    pthread_mutex_unlock(&numa_jobs.lock);
+
+    ret = nvPdQueueDeviceWork(device->domain, device->bus, device->slot,
+                              device->function, _nvpdRunNumaJob, job);
+    if (ret != NVPD_SUCCESS) {
+        pthread_mutex_lock(&numa_jobs.lock);
+        job->id = 0;
+        pthread_mutex_unlock(&numa_jobs.lock);
+        return ret;
+    }
+
+    *id = job->id;
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * _nvpdGetNumaJob() - Returns the progress of a NUMA job.
+ */
+static NvPdStatus _nvpdGetNumaJob(unsigned int id,
+                                  NvPdNumaJobProgress *progress)
+{
+    NvPdNumaJob *job;
+    uint64_t end_time;
+
+    pthread_mutex_lock(&numa_jobs.lock);
+
+    job = _nvpdFindNumaJob(id);
+    if (job == NULL) {
+        pthread_mutex_unlock(&numa_jobs.lock);
+        return NVPD_ERR_INVALID_ARGUMENT;
+    }
+
+    progress->job_id = job->id;
+    progress->device = job->device;
+    progress->target_status = job->target_status;
+    progress->state = job->state;
+    progress->result = job->result;
+    progress->memblocks_done = job->progress.memblocks_done;
+    progress->memblocks_total = job->progress.memblocks_total;
+    progress->bytes_done = (uint64_t)progress->memblocks_done *
+                           job->progress.memblock_size;
+    progress->elapsed_ms = 0;
+
+    if (job->state != NVPD_JOB_QUEUED) {
+        end_time = (job->state == NVPD_JOB_DONE) ? job->end_time :
+                                                   _nvpdGetTimeMs();
+        progress->elapsed_ms = end_time - job->start_time;
+    }
+
+    pthread_mutex_unlock(&numa_jobs.lock);
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * _nvpdCancelNumaJob() - Asks a NUMA job to stop. The job completes with
+ * NVPD_ERR_CANCELED once it has stopped, unless it completed already.
+ */
+static NvPdStatus _nvpdCancelNumaJob(unsigned int id)
+{
+    NvPdNumaJob *job;
+
+    pthread_mutex_lock(&numa_jobs.lock);
+
+    job = _nvpdFindNumaJob(id);
+    if (job == NULL) {
+        pthread_mutex_unlock(&numa_jobs.lock);
+        return NVPD_ERR_INVALID_ARGUMENT;
+    }
+
+    job->progress.cancel = 1;
+
+    pthread_mutex_unlock(&numa_jobs.lock);
+
+    return NVPD_SUCCESS;
+}
+
 /*!
  * nvpdsetpersistencemode_1_svc() - This service is an RPC function
  * implementation to set the persistence mode of a specific device.
@@ -60,19 +651,21 @@ NvPdStatus* nvpdsetpersistencemode_1_svc(SetPersistenceModeArgs *args,
                                          struct svc_req *req)
 {
     static NvPdStatus result;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_SET_PERSISTENCE_MODE,
+                NVPD_TRACE_BDF(&args->device));
 
     result = _nvpdIsClientRoot(req);
     if (result != NVPD_SUCCESS) {
+        nvPdStatsRecordRpc(NVPD_PHASE_RPC_SET_PERSISTENCE_MODE, start);
         return &result;
     }
 
-    result = nvPdSetDevicePersistenceMode(args->device.domain,
-                                          args->device.bus,
-                                          args->device.slot,
-                                          args->device.function,
-                                          args->mode);
-
-    return &result;
+    return _nvpdDeferCommand(req, NVPD_COMMAND_SET_PERSISTENCE_MODE,
+                             &args->device, args->mode,
+                             NVPD_PHASE_RPC_SET_PERSISTENCE_MODE, start,
+                             &result);
 }
 
 /*!
@@ -84,6 +677,10 @@ GetPersistenceModeRes* nvpdgetpersistencemode_1_svc(GetPersistenceModeArgs *args
 {
     static GetPersistenceModeRes result;
     NvPersistenceMode *mode = &result.GetPersistenceModeRes_u.mode;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_GET_PERSISTENCE_MODE,
+                NVPD_TRACE_BDF(&args->device));
 
     result.status = nvPdGetDevicePersistenceMode(args->device.domain,
                                                  args->device.bus,
@@ -91,6 +688,8 @@ GetPersistenceModeRes* nvpdgetpersistencemode_1_svc(GetPersistenceModeArgs *args
                                                  args->device.function,
                                                  mode);
 
+    nvPdStatsRecordRpc(NVPD_PHASE_RPC_GET_PERSISTENCE_MODE, start);
+
     return &result;
 }
 
@@ -104,19 +703,21 @@ NvPdStatus* nvpdsetpersistencemodeonly_2_svc(SetPersistenceModeArgs *args,
                                              struct svc_req *req)
 {
     static NvPdStatus result;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_ONLY,
+                NVPD_TRACE_BDF(&args->device));
 
     result = _nvpdIsClientRoot(req);
     if (result != NVPD_SUCCESS) {
+        nvPdStatsRecordRpc(NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_ONLY, start);
         return &result;
     }
 
-    result = nvPdSetDevicePersistenceModeOnly(args->device.domain,
-                                              args->device.bus,
-                                              args->device.slot,
-                                              args->device.function,
-                                              args->mode);
-
-    return &result;
+    return _nvpdDeferCommand(req, NVPD_COMMAND_SET_PERSISTENCE_MODE_ONLY,
+                             &args->device, args->mode,
+                             NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_ONLY, start,
+                             &result);
 }
 
 /*!
@@ -127,17 +728,251 @@ NvPdStatus* nvpdsetnumastatus_2_svc(SetNumaStatusArgs *args,
                                     struct svc_req *req)
 {
     static NvPdStatus result;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_SET_NUMA_STATUS,
+                NVPD_TRACE_BDF(&args->device));
 
     result = _nvpdIsClientRoot(req);
     if (result != NVPD_SUCCESS) {
+        nvPdStatsRecordRpc(NVPD_PHASE_RPC_SET_NUMA_STATUS, start);
+        return &result;
+    }
+
+    return _nvpdDeferCommand(req, NVPD_COMMAND_SET_NUMA_STATUS,
+                             &args->device, args->status,
+                             NVPD_PHASE_RPC_SET_NUMA_STATUS, start, &result);
+}
+
+/*!
+ * nvpdsetpersistencemodebatch_3_svc() - This service is an RPC function
+ * implementation to set the persistence mode of a list of devices, or of all
+ * devices, at once.
+ */
+BatchRes* nvpdsetpersistencemodebatch_3_svc(SetPersistenceModeBatchArgs *args,
+                                            struct svc_req *req)
+{
+    static BatchRes result;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_BATCH,
+                NVPD_TRACE_NO_BDF);
+
+    result.status = _nvpdIsClientRoot(req);
+    if (result.status != NVPD_SUCCESS) {
+        result.results.results_len = 0;
+        result.results.results_val = NULL;
+        nvPdStatsRecordRpc(NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_BATCH, start);
+        return &result;
+    }
+
+    return _nvpdDeferBatchCommand(req, NVPD_COMMAND_SET_PERSISTENCE_MODE,
+                                  args->all_devices,
+                                  args->devices.devices_val,
+                                  args->devices.devices_len,
+                                  args->mode,
+                                  NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_BATCH,
+                                  start, &result);
+}
+
+/*!
+ * nvpdsetnumastatusbatch_3_svc() - This service is an RPC function
+ * implementation to set the NUMA status of a list of devices, or of all
+ * devices, at once.
+ */
+BatchRes* nvpdsetnumastatusbatch_3_svc(SetNumaStatusBatchArgs *args,
+                                       struct svc_req *req)
+{
+    static BatchRes result;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_SET_NUMA_STATUS_BATCH,
+                NVPD_TRACE_NO_BDF);
+
+    result.status = _nvpdIsClientRoot(req);
+    if (result.status != NVPD_SUCCESS) {
+        result.results.results_len = 0;
+        result.results.results_val = NULL;
+        nvPdStatsRecordRpc(NVPD_PHASE_RPC_SET_NUMA_STATUS_BATCH, start);
         return &result;
     }
 
-    result = nvPdSetDeviceNumaStatus(args->device.domain,
-                                     args->device.bus,
-                                     args->device.slot,
-                                     args->device.function,
-                                     args->status);
+    return _nvpdDeferBatchCommand(req, NVPD_COMMAND_SET_NUMA_STATUS,
+                                  args->all_devices,
+                                  args->devices.devices_val,
+                                  args->devices.devices_len,
+                                  args->status,
+                                  NVPD_PHASE_RPC_SET_NUMA_STATUS_BATCH,
+                                  start, &result);
+}
+
+/*!
+ * nvpdgetdevicestates_3_svc() - This service is an RPC function
+ * implementation to get a snapshot of the state of all devices at once.
+ */
+GetDeviceStatesRes* nvpdgetdevicestates_3_svc(void *args, struct svc_req *req)
+{
+    static GetDeviceStatesRes result;
+    static int max_states = 0;
+    NvPdDeviceState *states;
+    int count = max_states;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_GET_DEVICE_STATES,
+                NVPD_TRACE_NO_BDF);
+
+    /* The buffer is reused across calls, and grows with the device count */
+    result.status = nvPdGetDeviceStateSnapshot(result.devices.devices_val,
+                                               &count);
+    if (result.status == NVPD_ERR_INSUFFICIENT_RESOURCES) {
+        states = realloc(result.devices.devices_val,
+                         count * sizeof(NvPdDeviceState));
+        if (states == NULL) {
+            result.devices.devices_len = 0;
+            nvPdStatsRecordRpc(NVPD_PHASE_RPC_GET_DEVICE_STATES, start);
+            return &result;
+        }
+        result.devices.devices_val = states;
+        max_states = count;
+
+        result.status = nvPdGetDeviceStateSnapshot(result.devices.devices_val,
+                                               &count);
+    }
+
+    result.devices.devices_len = (result.status == NVPD_SUCCESS) ? count : 0;
+
+    nvPdStatsRecordRpc(NVPD_PHASE_RPC_GET_DEVICE_STATES, start);
+
+    return &result;
+}
+
+/*!
+ * nvpdsubmitnumajob_4_svc() - This service is an RPC function implementation
+ * to start changing the NUMA status of a device in the background. The
+ * returned job ID is used to follow the progress of the change, or cancel it.
+ */
+SubmitNumaJobRes* nvpdsubmitnumajob_4_svc(SubmitNumaJobArgs *args,
+                                          struct svc_req *req)
+{
+    static SubmitNumaJobRes result;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_SUBMIT_NUMA_JOB,
+                NVPD_TRACE_BDF(&args->device));
+
+    result.status = _nvpdIsClientRoot(req);
+    if (result.status == NVPD_SUCCESS) {
+        result.status = _nvpdSubmitNumaJob(&args->device, args->status,
+                                           &result.SubmitNumaJobRes_u.job_id);
+    }
+
+    nvPdStatsRecordRpc(NVPD_PHASE_RPC_SUBMIT_NUMA_JOB, start);
+
+    return &result;
+}
+
+/*!
+ * nvpdgetnumajob_4_svc() - This service is an RPC function implementation to
+ * get the progress of a NUMA job.
+ */
+GetNumaJobRes* nvpdgetnumajob_4_svc(NumaJobArgs *args, struct svc_req *req)
+{
+    static GetNumaJobRes result;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_GET_NUMA_JOB, NVPD_TRACE_NO_BDF);
+
+    result.status = _nvpdGetNumaJob(args->job_id,
+                                    &result.GetNumaJobRes_u.progress);
+
+    nvPdStatsRecordRpc(NVPD_PHASE_RPC_GET_NUMA_JOB, start);
+
+    return &result;
+}
+
+/*!
+ * nvpdcancelnumajob_4_svc() - This service is an RPC function implementation
+ * to cancel a NUMA job.
+ */
+NvPdStatus* nvpdcancelnumajob_4_svc(NumaJobArgs *args, struct svc_req *req)
+{
+    static NvPdStatus result;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_CANCEL_NUMA_JOB, NVPD_TRACE_NO_BDF);
+
+    result = _nvpdIsClientRoot(req);
+    if (result == NVPD_SUCCESS) {
+        result = _nvpdCancelNumaJob(args->job_id);
+    }
+
+    nvPdStatsRecordRpc(NVPD_PHASE_RPC_CANCEL_NUMA_JOB, start);
+
+    return &result;
+}
+
+/*!
+ * nvpdgetstats_4_svc() - This service is an RPC function implementation to
+ * get the latency histograms of the RPC handlers, and of the bring-up phases
+ * of all devices.
+ */
+GetStatsRes* nvpdgetstats_4_svc(void *args, struct svc_req *req)
+{
+    static GetStatsRes result;
+    static int max_devices = 0;
+    NvPdDeviceStats *devices;
+    int count = max_devices;
+    uint64_t start = nvPdStatsTime();
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_GET_STATS, NVPD_TRACE_NO_BDF);
+
+    nvPdStatsGetRpc(result.rpc);
+
+    /* The buffer is reused across calls, and grows with the device count */
+    result.status = nvPdGetDeviceStats(result.devices.devices_val, &count);
+    if (result.status == NVPD_ERR_INSUFFICIENT_RESOURCES) {
+        devices = realloc(result.devices.devices_val,
+                          count * sizeof(NvPdDeviceStats));
+        if (devices == NULL) {
+            result.devices.devices_len = 0;
+            nvPdStatsRecordRpc(NVPD_PHASE_RPC_GET_STATS, start);
+            return &result;
+        }
+        result.devices.devices_val = devices;
+        max_devices = count;
+
+        result.status = nvPdGetDeviceStats(result.devices.devices_val, &count);
+    }
+
+    result.devices.devices_len = (result.status == NVPD_SUCCESS) ? count : 0;
+
+    nvPdStatsRecordRpc(NVPD_PHASE_RPC_GET_STATS, start);
+
+    return &result;
+}
+
+/*!
+ * nvpdgetdriverfeatures_4_svc() - This service is an RPC function
+ * implementation to get which optional features the installed driver
+ * supports.
+ */
+GetDriverFeaturesRes* nvpdgetdriverfeatures_4_svc(void *args,
+                                                  struct svc_req *req)
+{
+    static GetDriverFeaturesRes result;
+    uint64_t start = nvPdStatsTime();
+    int i;
+
+    NVPD_TRACE2(rpc__entry, NVPD_PHASE_RPC_GET_DRIVER_FEATURES,
+                NVPD_TRACE_NO_BDF);
+
+    for (i = 0; i < NVPD_NUM_DRIVER_FEATURES; i++) {
+        result.supported[i] = nvPdIsDriverFeatureSupported(i) ? TRUE : FALSE;
+    }
+
+    result.status = NVPD_SUCCESS;
+
+    nvPdStatsRecordRpc(NVPD_PHASE_RPC_GET_DRIVER_FEATURES, start);
 
     return &result;
 }
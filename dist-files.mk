@@ -32,31 +32,72 @@ RPC_DIR ?= .
 RPC_SRC := $(RPC_DIR)/nvpd_rpc_server.c
 RPC_SRC += $(RPC_DIR)/nvpd_rpc_xdr.c
 
+# Client stubs, only used by the RPC load generator of the benchmark
+RPC_CLIENT_SRC := $(RPC_DIR)/nvpd_rpc_client.c
+
 # Sources
 SRC += command_server.c
 SRC += nvidia-persistenced.c
 SRC += options.c
 SRC += nvidia-syslog-utils.c
+SRC += nvidia-work-queue.c
+SRC += nvidia-event-loop.c
+SRC += nvidia-hotplug.c
+SRC += nvidia-journal.c
+SRC += nvidia-handoff.c
+SRC += nvidia-stats.c
+SRC += nvidia-metrics.c
+SRC += nvidia-msg-server.c
+SRC += nvidia-systemd.c
+SRC += nvidia-policy.c
 SRC += $(RPC_SRC)
 SRC += $(NVIDIA_NUMA_DIR)/nvidia-numa.c
 
+# Source files of the client library, and its public headers
+CLIENT_LIB_SRC := nvpd_client.c
+CLIENT_LIB_HEADERS := nvpd_client.h
+CLIENT_LIB_HEADERS += nvpd_msg.h
+
 # Sample files included in the distribution
 SAMPLE_FILES := init/README
 SAMPLE_FILES += init/install.sh
 SAMPLE_FILES += init/systemd/nvidia-persistenced.service.template
+SAMPLE_FILES += init/systemd/nvidia-persistenced.socket
 SAMPLE_FILES += init/sysv/nvidia-persistenced.template
 SAMPLE_FILES += init/upstart/nvidia-persistenced.conf.template
 
+# Benchmark files included in the distribution
+BENCH_FILES := bench/README
+BENCH_FILES += bench/gen-kernel-root.sh
+BENCH_FILES += bench/numa-bench.sh
+BENCH_FILES += bench/nvidia-cfg-stub.c
+BENCH_FILES += bench/numa-ioctl-shim.c
+BENCH_FILES += bench/nvpd-rpc-load.c
+
 # Other distributed files
 DIST_FILES := $(SRC)
+DIST_FILES += $(CLIENT_LIB_SRC)
+DIST_FILES += $(CLIENT_LIB_HEADERS)
 DIST_FILES += COPYING
 DIST_FILES += README
 DIST_FILES += dist-files.mk
 DIST_FILES += nvpd_defs.h
 DIST_FILES += nvidia-persistenced.h
 DIST_FILES += nvidia-syslog-utils.h
+DIST_FILES += nvidia-work-queue.h
+DIST_FILES += nvidia-event-loop.h
+DIST_FILES += nvidia-hotplug.h
+DIST_FILES += nvidia-journal.h
+DIST_FILES += nvidia-handoff.h
+DIST_FILES += nvidia-stats.h
+DIST_FILES += nvidia-metrics.h
+DIST_FILES += nvidia-trace.h
+DIST_FILES += nvidia-msg-server.h
+DIST_FILES += nvidia-systemd.h
+DIST_FILES += nvidia-policy.h
 DIST_FILES += option-table.h
 DIST_FILES += nvidia-persistenced.1.m4
 DIST_FILES += gen-manpage-opts.c
 DIST_FILES += $(RPC_DIR)/nvpd_rpc.h
+DIST_FILES += $(RPC_CLIENT_SRC)
 DIST_FILES += $(NVIDIA_NUMA_DIR)/nvidia-numa.h
@@ -0,0 +1,604 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-event-loop.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "common-utils.h"
+#include "nvidia-event-loop.h"
+
+#define NVPD_MAX_EVENTS 16
+
+/* Number of distinct RPC transport implementations whose replies we defer */
+#define NVPD_MAX_PARKED_OPS 4
+
+/* Number of resumed transports picked up at once */
+#define NVPD_MAX_RESUMED 64
+
+typedef enum {
+    EVENT_SOURCE_NONE = 0,
+    EVENT_SOURCE_RPC,
+    EVENT_SOURCE_CALLBACK,
+} NvPdEventSourceType;
+
+/* Per file descriptor event loop state, indexed by file descriptor */
+typedef struct
+{
+    NvPdEventSourceType type;
+    NvPdEventFunc func;
+    void *data;
+    unsigned int generation;
+    int parked;     /* RPC transport whose reply is deferred */
+} NvPdEventSource;
+
+static int epoll_fd = -1;
+static int wakeup_fd = -1;
+
+/*
+ * Transports whose deferred reply has been sent are handed back to the event
+ * loop through this pipe, since only the event loop thread may let the RPC
+ * library read from them.
+ */
+static int resume_fds[2] = { -1, -1 };
+static volatile sig_atomic_t running = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static NvPdEventSource *sources = NULL;
+static int num_sources = 0;
+static unsigned int generation = 0;
+
+/*
+ * Load of the RPC service: the number of RPC sockets, and the number of
+ * requests whose reply is deferred, now and at most so far. Replies are only
+ * deferred on the event loop, but may be sent from any thread.
+ */
+static int num_rpc_sockets = 0;
+static volatile int num_deferred = 0;
+static int max_deferred = 0;
+
+/* The deferred reply of the RPC request currently being dispatched */
+static struct {
+    NvPdWorkFunc func;
+    void *data;
+} deferred;
+
+/*
+ * The RPC library keeps dispatching the requests already read from a
+ * transport for as long as the transport reports XPRT_MOREREQS. A transport
+ * whose reply is deferred is parked instead: its operations are replaced by
+ * a copy that reports it as idle while parked, which leaves the requests
+ * still buffered to be dispatched once the transport is resumed. Transports
+ * of the same kind share their operations, so only few copies are needed;
+ * they are only used on the event loop thread.
+ */
+static struct {
+    const struct xp_ops *orig;
+    struct xp_ops ops;
+} parked_ops[NVPD_MAX_PARKED_OPS];
+static int num_parked_ops = 0;
+
+/*
+ * get_source() - returns the event source state for the given file
+ * descriptor, growing the table as needed. Returns NULL on failure.
+ */
+static NvPdEventSource *get_source(int fd)
+{
+    NvPdEventSource *new_sources;
+    int new_num_sources;
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fd >= num_sources) {
+        new_num_sources = NV_MAX(fd + 1, num_sources * 2);
+        new_sources = realloc(sources,
+                              new_num_sources * sizeof(NvPdEventSource));
+        if (new_sources == NULL) {
+            return NULL;
+        }
+
+        memset(&new_sources[num_sources], 0,
+               (new_num_sources - num_sources) * sizeof(NvPdEventSource));
+
+        sources = new_sources;
+        num_sources = new_num_sources;
+    }
+
+    return &sources[fd];
+}
+
+/*
+ * arm_fd() - (re-)enables delivery of the next input event on fd. RPC
+ * sockets are registered as one-shot, so that they are not polled while a
+ * request read from them is still being processed.
+ */
+static int arm_fd(int fd, int op)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = fd;
+
+    return epoll_ctl(epoll_fd, op, fd, &event);
+}
+
+/*
+ * sync_rpc_sources() - the RPC library adds and removes sockets on its own
+ * as clients connect and disconnect. This function brings the epoll set in
+ * line with the sockets currently registered with the RPC library.
+ */
+static void sync_rpc_sources(void)
+{
+    NvPdEventSource *source;
+    int i, fd, count = 0;
+
+    generation++;
+
+    for (i = 0; i < svc_max_pollfd; i++) {
+        fd = svc_pollfd[i].fd;
+        if (fd < 0) {
+            continue;
+        }
+
+        source = get_source(fd);
+        if (source == NULL) {
+            syslog(LOG_ERR, "Failed to track RPC socket %d", fd);
+            continue;
+        }
+
+        if (source->type == EVENT_SOURCE_NONE) {
+            if (arm_fd(fd, EPOLL_CTL_ADD) < 0) {
+                syslog(LOG_ERR, "Failed to poll RPC socket %d: %s", fd,
+                       strerror(errno));
+                continue;
+            }
+            source->type = EVENT_SOURCE_RPC;
+        }
+
+        source->generation = generation;
+        count++;
+    }
+
+    num_rpc_sockets = count;
+
+    /*
+     * Sockets that the RPC library has closed have already been dropped from
+     * the epoll set by the kernel; just forget about them.
+     */
+    for (fd = 0; fd < num_sources; fd++) {
+        if ((sources[fd].type == EVENT_SOURCE_RPC) &&
+            (sources[fd].generation != generation)) {
+            sources[fd].type = EVENT_SOURCE_NONE;
+            sources[fd].parked = 0;
+        }
+    }
+}
+
+/*
+ * dispatch_rpc() - lets the RPC library process the input on one of its
+ * sockets, which either accepts a new connection or reads and dispatches a
+ * request.
+ */
+static void dispatch_rpc(int fd)
+{
+    NvPdWorkFunc func;
+    void *data;
+
+    deferred.func = NULL;
+    deferred.data = NULL;
+
+    svc_getreq_common(fd);
+
+    sync_rpc_sources();
+
+    func = deferred.func;
+    data = deferred.data;
+    deferred.func = NULL;
+    deferred.data = NULL;
+
+    if (func != NULL) {
+        /* The transport is resumed once the reply has been sent */
+        func(data);
+    } else if ((fd < num_sources) && (sources[fd].type == EVENT_SOURCE_RPC)) {
+        if (arm_fd(fd, EPOLL_CTL_MOD) < 0) {
+            syslog(LOG_ERR, "Failed to poll RPC socket %d: %s", fd,
+                   strerror(errno));
+        }
+    }
+}
+
+/*
+ * find_parked_ops() - returns the original operations of a transport whose
+ * operations have been replaced by park_transport(), or NULL.
+ */
+static const struct xp_ops *find_parked_ops(const SVCXPRT *transp)
+{
+    int i;
+
+    for (i = 0; i < num_parked_ops; i++) {
+        if (transp->xp_ops == &parked_ops[i].ops) {
+            return parked_ops[i].orig;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * parked_stat() - reports a parked transport with requests still buffered as
+ * idle, so that the RPC library returns to the event loop.
+ */
+static enum xprt_stat parked_stat(SVCXPRT *transp)
+{
+    const struct xp_ops *orig = find_parked_ops(transp);
+    enum xprt_stat stat = orig->xp_stat(transp);
+
+    if ((stat == XPRT_MOREREQS) && (transp->xp_fd < num_sources) &&
+        sources[transp->xp_fd].parked) {
+        return XPRT_IDLE;
+    }
+
+    return stat;
+}
+
+/*
+ * park_transport() - stops the RPC library from dispatching further requests
+ * from the transport until it is resumed. Returns 0 on success, or -1 if the
+ * operations of the transport cannot be replaced.
+ */
+static int park_transport(SVCXPRT *transp)
+{
+    NvPdEventSource *source = get_source(transp->xp_fd);
+    int i;
+
+    if (source == NULL) {
+        return -1;
+    }
+
+    if (find_parked_ops(transp) == NULL) {
+        for (i = 0; i < num_parked_ops; i++) {
+            if (parked_ops[i].orig == transp->xp_ops) {
+                break;
+            }
+        }
+
+        if (i == num_parked_ops) {
+            if (num_parked_ops == NVPD_MAX_PARKED_OPS) {
+                return -1;
+            }
+            parked_ops[i].orig = transp->xp_ops;
+            parked_ops[i].ops = *transp->xp_ops;
+            parked_ops[i].ops.xp_stat = parked_stat;
+            num_parked_ops++;
+        }
+
+        transp->xp_ops = &parked_ops[i].ops;
+    }
+
+    source->parked = 1;
+
+    return 0;
+}
+
+/*
+ * handle_resumed() - picks up the transports resumed with
+ * nvPdEventLoopResume(), and dispatches the requests still buffered on them,
+ * or polls them again if there are none.
+ */
+static void handle_resumed(void)
+{
+    SVCXPRT *transps[NVPD_MAX_RESUMED];
+    ssize_t len;
+    int i, fd;
+
+    len = read(resume_fds[0], transps, sizeof(transps));
+    if (len <= 0) {
+        return;
+    }
+
+    for (i = 0; i < (int)(len / sizeof(SVCXPRT *)); i++) {
+        fd = transps[i]->xp_fd;
+
+        if ((fd < num_sources) && sources[fd].parked) {
+            sources[fd].parked = 0;
+        }
+
+        if (SVC_STAT(transps[i]) == XPRT_MOREREQS) {
+            dispatch_rpc(fd);
+        } else if (arm_fd(fd, EPOLL_CTL_MOD) < 0) {
+            syslog(LOG_ERR, "Failed to poll RPC socket %d: %s", fd,
+                   strerror(errno));
+        }
+    }
+}
+
+/*
+ * nvPdEventLoopInit() - sets up the event loop. The sockets of the RPC
+ * services are picked up once the event loop runs, so they may be created
+ * after this is called.
+ */
+NvPdStatus nvPdEventLoopInit(void)
+{
+    struct epoll_event event;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        syslog(LOG_ERR, "Failed to create event loop: %s", strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_fd < 0) {
+        syslog(LOG_ERR, "Failed to create event loop wakeup: %s",
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = wakeup_fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event) < 0) {
+        syslog(LOG_ERR, "Failed to poll event loop wakeup: %s",
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    /* Resuming a transport only blocks if the event loop falls far behind */
+    if ((pipe2(resume_fds, O_CLOEXEC) < 0) ||
+        (fcntl(resume_fds[0], F_SETFL, O_NONBLOCK) < 0)) {
+        syslog(LOG_ERR, "Failed to create event loop resume pipe: %s",
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    event.data.fd = resume_fds[0];
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, resume_fds[0], &event) < 0) {
+        syslog(LOG_ERR, "Failed to poll event loop resume pipe: %s",
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdEventLoopRun() - runs the event loop until nvPdEventLoopStop() is
+ * called, or an unrecoverable error occurs.
+ */
+NvPdStatus nvPdEventLoopRun(void)
+{
+    struct epoll_event events[NVPD_MAX_EVENTS];
+    NvPdEventSource *source;
+    uint64_t value;
+    int i, n, fd;
+
+    sync_rpc_sources();
+
+    running = 1;
+
+    while (!stop_requested) {
+        n = epoll_wait(epoll_fd, events, NVPD_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_ERR, "Failed to wait for events: %s", strerror(errno));
+            running = 0;
+            return NVPD_ERR_IO;
+        }
+
+        for (i = 0; (i < n) && !stop_requested; i++) {
+            fd = events[i].data.fd;
+
+            if (fd == wakeup_fd) {
+                while (read(wakeup_fd, &value, sizeof(value)) > 0);
+                continue;
+            }
+
+            if (fd == resume_fds[0]) {
+                handle_resumed();
+                continue;
+            }
+
+            if (fd >= num_sources) {
+                continue;
+            }
+
+            source = &sources[fd];
+
+            switch (source->type) {
+            case EVENT_SOURCE_RPC:
+                dispatch_rpc(fd);
+                break;
+            case EVENT_SOURCE_CALLBACK:
+                source->func(fd, source->data);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    /* The event loop may be run again after it has been stopped */
+    stop_requested = 0;
+    running = 0;
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdEventLoopStop() - asks the event loop to return. This function is
+ * async-signal-safe.
+ */
+void nvPdEventLoopStop(void)
+{
+    uint64_t value = 1;
+
+    stop_requested = 1;
+
+    if (wakeup_fd >= 0) {
+        (void) write(wakeup_fd, &value, sizeof(value));
+    }
+}
+
+/*
+ * nvPdEventLoopIsRunning() - returns whether the event loop is running.
+ */
+int nvPdEventLoopIsRunning(void)
+{
+    return running;
+}
+
+/*
+ * nvPdEventLoopAddFd() - calls func(fd, data) on the event loop whenever fd
+ * becomes readable.
+ */
+NvPdStatus nvPdEventLoopAddFd(int fd, NvPdEventFunc func, void *data)
+{
+    struct epoll_event event;
+    NvPdEventSource *source = get_source(fd);
+
+    if (source == NULL) {
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    if (source->type != EVENT_SOURCE_NONE) {
+        return NVPD_ERR_INVALID_ARGUMENT;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        syslog(LOG_ERR, "Failed to poll file descriptor %d: %s", fd,
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    source->type = EVENT_SOURCE_CALLBACK;
+    source->func = func;
+    source->data = data;
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdEventLoopRemoveFd() - stops watching a file descriptor added with
+ * nvPdEventLoopAddFd(). This must be called before fd is closed.
+ */
+void nvPdEventLoopRemoveFd(int fd)
+{
+    if ((fd < 0) || (fd >= num_sources) ||
+        (sources[fd].type != EVENT_SOURCE_CALLBACK)) {
+        return;
+    }
+
+    (void) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+    memset(&sources[fd], 0, sizeof(sources[fd]));
+}
+
+/*
+ * update_max_deferred() - raises max_deferred to count, unless another
+ * thread raised it higher already.
+ */
+static void update_max_deferred(int count)
+{
+    int max = max_deferred;
+
+    while (count > max) {
+        if (__sync_bool_compare_and_swap(&max_deferred, max, count)) {
+            break;
+        }
+        max = max_deferred;
+    }
+}
+
+/*
+ * nvPdEventLoopDeferReply() - called by an RPC service routine to defer the
+ * reply to the request being dispatched. The transport is parked until the
+ * reply has been sent, so that the RPC library neither reads nor dispatches
+ * further requests from it meanwhile: it keeps the ID of the request to
+ * reply to per transport. Returns an error if the transport cannot be
+ * parked, in which case the caller is to reply right away.
+ */
+NvPdStatus nvPdEventLoopDeferReply(SVCXPRT *transp, NvPdWorkFunc func,
+                                   void *data)
+{
+    if ((deferred.func != NULL) || (park_transport(transp) < 0)) {
+        syslog(LOG_ERR, "Failed to defer reply on RPC socket %d",
+               transp->xp_fd);
+        return NVPD_ERR_RPC;
+    }
+
+    deferred.func = func;
+    deferred.data = data;
+
+    update_max_deferred(__sync_add_and_fetch(&num_deferred, 1));
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdEventLoopResume() - resumes reading requests from a transport whose
+ * reply was deferred. This may be called from any thread.
+ */
+void nvPdEventLoopResume(SVCXPRT *transp)
+{
+    __sync_sub_and_fetch(&num_deferred, 1);
+
+    while ((write(resume_fds[1], &transp, sizeof(transp)) < 0) &&
+           (errno == EINTR));
+}
+
+/*
+ * nvPdEventLoopGetLoad() - returns the current load of the RPC service. This
+ * may be called from any thread; the values are not a consistent snapshot.
+ */
+void nvPdEventLoopGetLoad(NvPdEventLoopLoad *load)
+{
+    __sync_synchronize();
+
+    load->num_rpc_sockets = num_rpc_sockets;
+    load->num_deferred = num_deferred;
+    load->max_deferred = max_deferred;
+}
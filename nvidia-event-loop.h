@@ -0,0 +1,79 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-event-loop.h
+ */
+
+#ifndef _NVIDIA_EVENT_LOOP_H_
+#define _NVIDIA_EVENT_LOOP_H_
+
+#include "nvpd_rpc.h"
+#include "nvidia-work-queue.h"
+
+/*
+ * The event loop runs on the main thread of the daemon, and services the
+ * sockets of the RPC library along with any other file descriptors added
+ * with nvPdEventLoopAddFd().
+ */
+typedef void (*NvPdEventFunc)(int fd, void *data);
+
+NvPdStatus nvPdEventLoopInit(void);
+NvPdStatus nvPdEventLoopRun(void);
+void nvPdEventLoopStop(void);
+int nvPdEventLoopIsRunning(void);
+
+NvPdStatus nvPdEventLoopAddFd(int fd, NvPdEventFunc func, void *data);
+void nvPdEventLoopRemoveFd(int fd);
+
+/*
+ * RPC requests that cannot be answered right away are deferred by their
+ * service routine with nvPdEventLoopDeferReply(), and the service routine
+ * returns NULL instead of a result. Once the RPC library is done with the
+ * request, the event loop calls func(data), which is then responsible for
+ * sending the reply and calling nvPdEventLoopResume() on the transport.
+ *
+ * No further requests are read from the transport until it is resumed, so
+ * the reply may be sent from any thread. Requests the client has sent
+ * already are dispatched once the transport is resumed, while the event loop
+ * keeps serving other clients. If the reply cannot be deferred, an error is
+ * returned, and the service routine is to reply right away.
+ */
+NvPdStatus nvPdEventLoopDeferReply(SVCXPRT *transp, NvPdWorkFunc func,
+                                   void *data);
+void nvPdEventLoopResume(SVCXPRT *transp);
+
+/*
+ * Load of the RPC service, to tell how many clients are connected and how
+ * many of their requests are waiting for device work to complete.
+ */
+typedef struct
+{
+    int num_rpc_sockets;
+    int num_deferred;
+    int max_deferred;
+} NvPdEventLoopLoad;
+
+void nvPdEventLoopGetLoad(NvPdEventLoopLoad *load);
+
+#endif /* _NVIDIA_EVENT_LOOP_H_ */
@@ -0,0 +1,437 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-handoff.c
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "nvidia-handoff.h"
+
+#define NVPD_HANDOFF_MAGIC      0x4e565048 /* "NVPH" */
+#define NVPD_HANDOFF_VERSION    3
+#define NVPD_HANDOFF_MAX_FDS    2
+#define NVPD_HANDOFF_ACK        'A'
+
+/*
+ * The handoff is a sequence of messages over a SOCK_SEQPACKET socket: a
+ * header, carrying the RPC socket and the binary protocol socket, followed
+ * by one message per device, carrying the file descriptors of that device,
+ * and one message per binary protocol client, carrying its connection. The
+ * receiving instance acknowledges the handoff with a single byte once it has
+ * everything.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t remove_dir;
+    int32_t num_devices;
+    int32_t has_socket;
+    int32_t socket_activated;
+    int32_t has_msg_socket;
+    int32_t num_msg_clients;
+    uint32_t msg_last_seq;
+} NvPdHandoffHeader;
+
+typedef struct
+{
+    NvPdJournalEntry state;
+    int32_t has_device_fd;
+    int32_t has_numa_fd;
+} NvPdHandoffDeviceMsg;
+
+typedef struct
+{
+    int32_t subscribed;
+} NvPdHandoffMsgClientMsg;
+
+/*
+ * send_msg() - sends a single message with the given file descriptors.
+ */
+static int send_msg(int fd, const void *buf, size_t len,
+                    const int *fds, int num_fds)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * NVPD_HANDOFF_MAX_FDS)];
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (num_fds > 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+    }
+
+    while (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * recv_msg() - receives a single message of exactly len bytes, along with
+ * up to NVPD_HANDOFF_MAX_FDS file descriptors.
+ */
+static int recv_msg(int fd, void *buf, size_t len, int *fds, int *num_fds)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * NVPD_HANDOFF_MAX_FDS)];
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof(msg));
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do {
+        ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret < 0) {
+        return -errno;
+    }
+
+    *num_fds = 0;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) &&
+            (cmsg->cmsg_type == SCM_RIGHTS)) {
+            *num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *num_fds);
+        }
+    }
+
+    if ((ret != len) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        while (*num_fds > 0) {
+            close(fds[--(*num_fds)]);
+        }
+        return -EPROTO;
+    }
+
+    return 0;
+}
+
+/*
+ * nvPdHandoffSend() - sends the state of the daemon, and waits up to
+ * timeout_ms for the receiving instance to acknowledge it. The file
+ * descriptors in state remain owned by the caller.
+ */
+NvPdStatus nvPdHandoffSend(int fd, const NvPdHandoffState *state,
+                           int timeout_ms)
+{
+    NvPdHandoffHeader header;
+    NvPdHandoffDeviceMsg device_msg;
+    NvPdHandoffMsgClientMsg client_msg;
+    struct pollfd pfd;
+    int fds[NVPD_HANDOFF_MAX_FDS];
+    int i, num_fds, ret;
+    char ack;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = NVPD_HANDOFF_MAGIC;
+    header.version = NVPD_HANDOFF_VERSION;
+    header.remove_dir = state->remove_dir;
+    header.num_devices = state->num_devices;
+    header.has_socket = (state->socket_fd >= 0);
+    header.socket_activated = state->socket_activated;
+    header.has_msg_socket = (state->msg_socket_fd >= 0);
+    header.num_msg_clients = state->num_msg_clients;
+    header.msg_last_seq = state->msg_last_seq;
+
+    num_fds = 0;
+    if (header.has_socket) {
+        fds[num_fds++] = state->socket_fd;
+    }
+    if (header.has_msg_socket) {
+        fds[num_fds++] = state->msg_socket_fd;
+    }
+
+    ret = send_msg(fd, &header, sizeof(header), fds, num_fds);
+
+    for (i = 0; (ret == 0) && (i < state->num_devices); i++) {
+        const NvPdHandoffDevice *device = &state->devices[i];
+
+        memset(&device_msg, 0, sizeof(device_msg));
+        device_msg.state = device->state;
+        device_msg.has_device_fd = (device->device_fd >= 0);
+        device_msg.has_numa_fd = (device->numa_fd >= 0);
+
+        num_fds = 0;
+        if (device_msg.has_device_fd) {
+            fds[num_fds++] = device->device_fd;
+        }
+        if (device_msg.has_numa_fd) {
+            fds[num_fds++] = device->numa_fd;
+        }
+
+        ret = send_msg(fd, &device_msg, sizeof(device_msg), fds, num_fds);
+    }
+
+    for (i = 0; (ret == 0) && (i < state->num_msg_clients); i++) {
+        memset(&client_msg, 0, sizeof(client_msg));
+        client_msg.subscribed = state->msg_clients[i].subscribed;
+
+        ret = send_msg(fd, &client_msg, sizeof(client_msg),
+                       &state->msg_clients[i].fd, 1);
+    }
+
+    if (ret < 0) {
+        syslog(LOG_ERR, "Failed to send daemon state: %s", strerror(-ret));
+        return NVPD_ERR_IO;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if ((ret <= 0) || (read(fd, &ack, sizeof(ack)) != sizeof(ack)) ||
+        (ack != NVPD_HANDOFF_ACK)) {
+        syslog(LOG_ERR, "The new daemon instance did not take over");
+        return NVPD_ERR_IO;
+    }
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdHandoffReceive() - receives the state sent with nvPdHandoffSend(). The
+ * state is to be released with nvPdHandoffFree().
+ */
+NvPdStatus nvPdHandoffReceive(int fd, NvPdHandoffState *state)
+{
+    NvPdHandoffHeader header;
+    NvPdHandoffDeviceMsg device_msg;
+    NvPdHandoffMsgClientMsg client_msg;
+    int fds[NVPD_HANDOFF_MAX_FDS];
+    int i, num_fds, ret;
+
+    memset(state, 0, sizeof(*state));
+    state->socket_fd = -1;
+    state->msg_socket_fd = -1;
+
+    ret = recv_msg(fd, &header, sizeof(header), fds, &num_fds);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    if ((header.magic != NVPD_HANDOFF_MAGIC) ||
+        (header.version != NVPD_HANDOFF_VERSION) ||
+        (header.num_devices < 0) || (header.num_msg_clients < 0) ||
+        (num_fds != (!!header.has_socket + !!header.has_msg_socket))) {
+        while (num_fds > 0) {
+            close(fds[--num_fds]);
+        }
+        ret = -EPROTO;
+        goto fail;
+    }
+
+    num_fds = 0;
+    if (header.has_socket) {
+        state->socket_fd = fds[num_fds++];
+    }
+    if (header.has_msg_socket) {
+        state->msg_socket_fd = fds[num_fds++];
+    }
+
+    state->remove_dir = header.remove_dir;
+    state->socket_activated = header.socket_activated;
+    state->msg_last_seq = header.msg_last_seq;
+
+    if (header.num_devices > 0) {
+        state->devices = calloc(header.num_devices,
+                                sizeof(NvPdHandoffDevice));
+        if (state->devices == NULL) {
+            ret = -ENOMEM;
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < header.num_devices; i++) {
+        NvPdHandoffDevice *device = &state->devices[i];
+
+        device->device_fd = -1;
+        device->numa_fd = -1;
+        state->num_devices++;
+
+        ret = recv_msg(fd, &device_msg, sizeof(device_msg), fds, &num_fds);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        if (num_fds != (!!device_msg.has_device_fd +
+                        !!device_msg.has_numa_fd)) {
+            while (num_fds > 0) {
+                close(fds[--num_fds]);
+            }
+            ret = -EPROTO;
+            goto fail;
+        }
+
+        num_fds = 0;
+        device->state = device_msg.state;
+        if (device_msg.has_device_fd) {
+            device->device_fd = fds[num_fds++];
+        }
+        if (device_msg.has_numa_fd) {
+            device->numa_fd = fds[num_fds++];
+        }
+    }
+
+    if (header.num_msg_clients > 0) {
+        state->msg_clients = calloc(header.num_msg_clients,
+                                    sizeof(NvPdHandoffMsgClient));
+        if (state->msg_clients == NULL) {
+            ret = -ENOMEM;
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < header.num_msg_clients; i++) {
+        ret = recv_msg(fd, &client_msg, sizeof(client_msg), fds, &num_fds);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        if (num_fds != 1) {
+            while (num_fds > 0) {
+                close(fds[--num_fds]);
+            }
+            ret = -EPROTO;
+            goto fail;
+        }
+
+        state->msg_clients[i].fd = fds[0];
+        state->msg_clients[i].subscribed = client_msg.subscribed;
+        state->num_msg_clients++;
+    }
+
+    return NVPD_SUCCESS;
+
+fail:
+    syslog(LOG_ERR, "Failed to receive daemon state: %s", strerror(-ret));
+    nvPdHandoffFree(state);
+    return NVPD_ERR_IO;
+}
+
+/*
+ * nvPdHandoffAcknowledge() - tells the sending instance that the handoff is
+ * complete, and that it should exit.
+ */
+NvPdStatus nvPdHandoffAcknowledge(int fd)
+{
+    char ack = NVPD_HANDOFF_ACK;
+
+    if (write(fd, &ack, sizeof(ack)) != sizeof(ack)) {
+        syslog(LOG_ERR, "Failed to acknowledge daemon state: %s",
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdHandoffFree() - closes any file descriptors of the received state that
+ * were not taken over, and frees the state.
+ */
+void nvPdHandoffFree(NvPdHandoffState *state)
+{
+    int i;
+
+    if (state->socket_fd >= 0) {
+        close(state->socket_fd);
+        state->socket_fd = -1;
+    }
+
+    for (i = 0; i < state->num_devices; i++) {
+        if (state->devices[i].device_fd >= 0) {
+            close(state->devices[i].device_fd);
+        }
+        if (state->devices[i].numa_fd >= 0) {
+            close(state->devices[i].numa_fd);
+        }
+    }
+
+    free(state->devices);
+    state->devices = NULL;
+    state->num_devices = 0;
+
+    if (state->msg_socket_fd >= 0) {
+        close(state->msg_socket_fd);
+        state->msg_socket_fd = -1;
+    }
+
+    for (i = 0; i < state->num_msg_clients; i++) {
+        if (state->msg_clients[i].fd >= 0) {
+            close(state->msg_clients[i].fd);
+        }
+    }
+
+    free(state->msg_clients);
+    state->msg_clients = NULL;
+    state->num_msg_clients = 0;
+}
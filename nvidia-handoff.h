@@ -0,0 +1,71 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-handoff.h
+ */
+
+#ifndef _NVIDIA_HANDOFF_H_
+#define _NVIDIA_HANDOFF_H_
+
+#include "nvpd_rpc.h"
+#include "nvidia-journal.h"
+
+/*
+ * A running daemon can hand its state over to a newly executed instance of
+ * the daemon over a Unix socket, e.g., to upgrade the daemon without tearing
+ * down device state. Open file descriptors are passed with SCM_RIGHTS.
+ */
+typedef struct
+{
+    NvPdJournalEntry state;
+    int device_fd;  /* keeps the device initialized during the handoff */
+    int numa_fd;    /* device file descriptor of the onlined NUMA memory */
+} NvPdHandoffDevice;
+
+typedef struct
+{
+    int fd;         /* connection of a binary protocol client */
+    int subscribed; /* whether the client is subscribed to events */
+} NvPdHandoffMsgClient;
+
+typedef struct
+{
+    int socket_fd;  /* RPC listening socket */
+    int socket_activated; /* whether the socket is owned by systemd */
+    int remove_dir; /* whether the runtime data directory is to be removed */
+    int num_devices;
+    NvPdHandoffDevice *devices;
+    int msg_socket_fd; /* binary protocol listening socket */
+    unsigned int msg_last_seq; /* number of the last event sent */
+    int num_msg_clients;
+    NvPdHandoffMsgClient *msg_clients;
+} NvPdHandoffState;
+
+NvPdStatus nvPdHandoffSend(int fd, const NvPdHandoffState *state,
+                           int timeout_ms);
+NvPdStatus nvPdHandoffReceive(int fd, NvPdHandoffState *state);
+NvPdStatus nvPdHandoffAcknowledge(int fd);
+void nvPdHandoffFree(NvPdHandoffState *state);
+
+#endif /* _NVIDIA_HANDOFF_H_ */
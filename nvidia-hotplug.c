@@ -0,0 +1,268 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-hotplug.c
+ */
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+
+#include "nvidia-event-loop.h"
+#include "nvidia-hotplug.h"
+#include "nvidia-syslog-utils.h"
+#include "nvpd_defs.h"
+
+#define NVPD_UEVENT_BUFFER_SIZE  8192
+#define NVPD_UEVENT_RCVBUF_SIZE  (1024 * 1024)
+#define NVPD_NVIDIA_DRIVER_NAME  "nvidia"
+#define NVPD_NVIDIA_VENDOR_ID    0x10de
+#define NVPD_PCI_CLASS_DISPLAY   0x03
+
+static int uevent_fd = -1;
+static NvPdHotplugFunc hotplug_func = NULL;
+
+/*
+ * parse_uevent() - parses a kernel uevent message, which consists of an
+ * "action@devpath" header followed by KEY=VALUE strings, each terminated by a
+ * NUL character. Returns 1 and fills in action and device if the message
+ * describes an NVIDIA GPU being added or removed, and 0 otherwise.
+ *
+ * Events of devices that are not bound to a driver, such as "add" and
+ * "remove", carry no DRIVER key, so the vendor and class of the device are
+ * checked as well: other PCI devices, and the other functions of NVIDIA
+ * GPUs, such as their audio controllers, do not need the devices to be
+ * enumerated again.
+ */
+static int parse_uevent(const char *buf, size_t len, NvPdHotplugAction *action,
+                        NvPciDevice *device)
+{
+    const char *key, *end = buf + len;
+    const char *action_str = NULL;
+    const char *subsystem = NULL;
+    const char *driver = NULL;
+    const char *slot_name = NULL;
+    const char *pci_id = NULL;
+    const char *pci_class = NULL;
+    unsigned int domain, bus, slot, function;
+    unsigned int vendor_id, device_id, class_code;
+
+    /* Skip the header, all of its information is repeated in the keys */
+    key = memchr(buf, '\0', len);
+    if (key == NULL) {
+        return 0;
+    }
+
+    for (key++; key < end; key += strlen(key) + 1) {
+        if (memchr(key, '\0', end - key) == NULL) {
+            return 0;
+        }
+
+        if (strncmp(key, "ACTION=", 7) == 0) {
+            action_str = key + 7;
+        } else if (strncmp(key, "SUBSYSTEM=", 10) == 0) {
+            subsystem = key + 10;
+        } else if (strncmp(key, "DRIVER=", 7) == 0) {
+            driver = key + 7;
+        } else if (strncmp(key, "PCI_SLOT_NAME=", 14) == 0) {
+            slot_name = key + 14;
+        } else if (strncmp(key, "PCI_ID=", 7) == 0) {
+            pci_id = key + 7;
+        } else if (strncmp(key, "PCI_CLASS=", 10) == 0) {
+            pci_class = key + 10;
+        }
+    }
+
+    if ((action_str == NULL) || (subsystem == NULL) || (slot_name == NULL) ||
+        (pci_id == NULL) || (pci_class == NULL) ||
+        (strcmp(subsystem, "pci") != 0)) {
+        return 0;
+    }
+
+    /* PCI_ID is "VENDOR:DEVICE", PCI_CLASS the 24-bit class code, in hex */
+    if ((sscanf(pci_id, "%x:%x", &vendor_id, &device_id) != 2) ||
+        (vendor_id != NVPD_NVIDIA_VENDOR_ID) ||
+        (sscanf(pci_class, "%x", &class_code) != 1) ||
+        ((class_code >> 16) != NVPD_PCI_CLASS_DISPLAY)) {
+        return 0;
+    }
+
+    /* Devices bound to other drivers are of no interest */
+    if ((driver != NULL) && (strcmp(driver, NVPD_NVIDIA_DRIVER_NAME) != 0)) {
+        return 0;
+    }
+
+    if ((strcmp(action_str, "add") == 0) || (strcmp(action_str, "bind") == 0)) {
+        *action = NVPD_HOTPLUG_ADD;
+    } else if ((strcmp(action_str, "remove") == 0) ||
+               (strcmp(action_str, "unbind") == 0)) {
+        *action = NVPD_HOTPLUG_REMOVE;
+    } else {
+        return 0;
+    }
+
+    if (sscanf(slot_name, "%x:%x:%x.%x",
+               &domain, &bus, &slot, &function) != 4) {
+        return 0;
+    }
+
+    device->domain = domain;
+    device->bus = bus;
+    device->slot = slot;
+    device->function = function;
+
+    return 1;
+}
+
+/*
+ * handle_uevents() - called by the event loop when uevents are pending on the
+ * netlink socket. If the socket overflowed, a rescan is reported after the
+ * events still received, since any of the lost events may have been for an
+ * NVIDIA device.
+ */
+static void handle_uevents(int fd, void *data)
+{
+    char buf[NVPD_UEVENT_BUFFER_SIZE];
+    struct sockaddr_nl addr;
+    struct iovec iov;
+    struct msghdr msg;
+    NvPdHotplugAction action;
+    NvPciDevice device;
+    ssize_t len;
+    int rescan = 0;
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buf;
+        iov.iov_len = sizeof(buf);
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        len = recvmsg(fd, &msg, 0);
+        if (len < 0) {
+            if (errno == ENOBUFS) {
+                rescan = 1;
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EINTR)) {
+                syslog(LOG_ERR, "Failed to receive hotplug event: %s\n",
+                       strerror(errno));
+            }
+            break;
+        }
+
+        /* Only trust messages sent by the kernel */
+        if ((msg.msg_namelen != sizeof(addr)) || (addr.nl_pid != 0) ||
+            (msg.msg_flags & MSG_TRUNC)) {
+            continue;
+        }
+
+        if (parse_uevent(buf, len, &action, &device)) {
+            SYSLOG_VERBOSE(LOG_DEBUG, "Hotplug %s event for device "
+                           PCI_DEVICE_FMT "\n",
+                           (action == NVPD_HOTPLUG_ADD) ? "add" : "remove",
+                           device.domain, device.bus, device.slot,
+                           device.function);
+            hotplug_func(action, &device);
+        }
+    }
+
+    if (rescan) {
+        syslog(LOG_WARNING, "Hotplug events were dropped, enumerating "
+                            "devices again\n");
+        hotplug_func(NVPD_HOTPLUG_RESCAN, NULL);
+    }
+}
+
+/*
+ * nvPdHotplugInit() - starts listening for kernel uevents of PCI devices on
+ * the event loop. func is called from the event loop for each NVIDIA device
+ * added or removed, and whenever the devices need to be enumerated again.
+ */
+NvPdStatus nvPdHotplugInit(NvPdHotplugFunc func)
+{
+    struct sockaddr_nl addr;
+    int rcvbuf = NVPD_UEVENT_RCVBUF_SIZE;
+    NvPdStatus status;
+
+    uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       NETLINK_KOBJECT_UEVENT);
+    if (uevent_fd < 0) {
+        syslog(LOG_WARNING, "Failed to create hotplug event socket: %s\n",
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    /* Bursts of events are expected when many devices change at once */
+    (void) setsockopt(uevent_fd, SOL_SOCKET, SO_RCVBUF,
+                      &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; /* kernel uevents */
+
+    if (bind(uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        syslog(LOG_WARNING, "Failed to bind hotplug event socket: %s\n",
+               strerror(errno));
+        close(uevent_fd);
+        uevent_fd = -1;
+        return NVPD_ERR_IO;
+    }
+
+    hotplug_func = func;
+
+    status = nvPdEventLoopAddFd(uevent_fd, handle_uevents, NULL);
+    if (status != NVPD_SUCCESS) {
+        close(uevent_fd);
+        uevent_fd = -1;
+        return status;
+    }
+
+    SYSLOG_VERBOSE(LOG_INFO, "Listening for hotplug events\n");
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdHotplugShutdown() - stops listening for kernel uevents.
+ */
+void nvPdHotplugShutdown(void)
+{
+    if (uevent_fd < 0) {
+        return;
+    }
+
+    nvPdEventLoopRemoveFd(uevent_fd);
+    close(uevent_fd);
+    uevent_fd = -1;
+}
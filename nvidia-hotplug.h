@@ -0,0 +1,54 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-hotplug.h
+ */
+
+
+#ifndef _NVIDIA_HOTPLUG_H_
+#define _NVIDIA_HOTPLUG_H_
+
+#include "nvpd_rpc.h"
+
+typedef enum {
+    NVPD_HOTPLUG_ADD,
+    NVPD_HOTPLUG_REMOVE,
+    NVPD_HOTPLUG_RESCAN,
+} NvPdHotplugAction;
+
+/*
+ * Kernel uevents for NVIDIA PCI devices are received on the event loop, and
+ * reported through the callback passed to nvPdHotplugInit(). An add event is
+ * reported when a device is added or bound to the NVIDIA driver, and a remove
+ * event when it is unbound or removed. A rescan event, without a device, is
+ * reported when events were lost, and the devices need to be enumerated
+ * again.
+ */
+typedef void (*NvPdHotplugFunc)(NvPdHotplugAction action,
+                                const NvPciDevice *device);
+
+NvPdStatus nvPdHotplugInit(NvPdHotplugFunc func);
+void nvPdHotplugShutdown(void);
+
+#endif /* _NVIDIA_HOTPLUG_H_ */
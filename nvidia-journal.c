@@ -0,0 +1,300 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-journal.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "nvidia-journal.h"
+
+#define NVPD_JOURNAL_MAGIC          0x4e56504a /* "NVPJ" */
+#define NVPD_JOURNAL_VERSION        1
+#define NVPD_JOURNAL_MAX_RECORDS    256
+
+/*
+ * A record is updated in place. Its sequence number is odd while the update
+ * is in progress, so that a record left half-written by a crash is ignored by
+ * the next instance of the daemon.
+ */
+typedef struct
+{
+    uint32_t sequence;
+    uint32_t in_use;
+    NvPdJournalEntry entry;
+} NvPdJournalRecord;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t num_records;
+    NvPdJournalRecord records[NVPD_JOURNAL_MAX_RECORDS];
+} NvPdJournalFile;
+
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static NvPdJournalFile *journal = NULL;
+static char *journal_path = NULL;
+static int journal_full_reported = 0;
+
+/* Entries recorded by the previous instance of the daemon */
+static NvPdJournalEntry *previous = NULL;
+static int num_previous = 0;
+
+/*
+ * load_previous_entries() - copies the valid records left behind by the
+ * previous instance of the daemon, if the journal file is one it understands.
+ */
+static void load_previous_entries(const NvPdJournalFile *file)
+{
+    int i;
+
+    if ((file->magic != NVPD_JOURNAL_MAGIC) ||
+        (file->version != NVPD_JOURNAL_VERSION) ||
+        (file->record_size != sizeof(NvPdJournalRecord)) ||
+        (file->num_records != NVPD_JOURNAL_MAX_RECORDS)) {
+        return;
+    }
+
+    previous = calloc(NVPD_JOURNAL_MAX_RECORDS, sizeof(NvPdJournalEntry));
+    if (previous == NULL) {
+        return;
+    }
+
+    for (i = 0; i < NVPD_JOURNAL_MAX_RECORDS; i++) {
+        const NvPdJournalRecord *record = &file->records[i];
+
+        if (record->in_use && ((record->sequence & 1) == 0)) {
+            previous[num_previous++] = record->entry;
+        }
+    }
+}
+
+/*
+ * nvPdJournalOpen() - opens the state journal at the given path, picks up
+ * the state recorded by the previous instance of the daemon, if any, and
+ * starts recording the state of this instance. Without a journal, the daemon
+ * keeps working, but cannot adopt state on its next start.
+ */
+NvPdStatus nvPdJournalOpen(const char *path)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        syslog(LOG_WARNING, "Failed to open state journal %s: %s", path,
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    if ((fstat(fd, &st) < 0) ||
+        ((st.st_size != sizeof(NvPdJournalFile)) &&
+         (ftruncate(fd, sizeof(NvPdJournalFile)) < 0))) {
+        syslog(LOG_WARNING, "Failed to size state journal %s: %s", path,
+               strerror(errno));
+        close(fd);
+        return NVPD_ERR_IO;
+    }
+
+    map = mmap(NULL, sizeof(NvPdJournalFile), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        syslog(LOG_WARNING, "Failed to map state journal %s: %s", path,
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    if (st.st_size == sizeof(NvPdJournalFile)) {
+        load_previous_entries(map);
+    }
+
+    /* Start over; devices are recorded again as they are brought up */
+    memset(map, 0, sizeof(NvPdJournalFile));
+
+    journal = map;
+    journal->version = NVPD_JOURNAL_VERSION;
+    journal->record_size = sizeof(NvPdJournalRecord);
+    journal->num_records = NVPD_JOURNAL_MAX_RECORDS;
+    __sync_synchronize();
+    journal->magic = NVPD_JOURNAL_MAGIC;
+
+    journal_path = strdup(path);
+
+    if (num_previous > 0) {
+        syslog(LOG_INFO, "Found the recorded state of %d devices",
+               num_previous);
+    }
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdJournalClose() - stops recording device state. The journal file is
+ * kept for the next instance of the daemon if requested, and removed
+ * otherwise.
+ */
+void nvPdJournalClose(int keep)
+{
+    pthread_mutex_lock(&journal_lock);
+
+    if (journal != NULL) {
+        munmap(journal, sizeof(NvPdJournalFile));
+        journal = NULL;
+
+        if (!keep && (unlink(journal_path) < 0)) {
+            syslog(LOG_WARNING, "Failed to unlink state journal: %s",
+                   strerror(errno));
+        }
+    }
+
+    free(journal_path);
+    journal_path = NULL;
+
+    free(previous);
+    previous = NULL;
+    num_previous = 0;
+
+    pthread_mutex_unlock(&journal_lock);
+}
+
+/*
+ * nvPdJournalLookup() - looks up the state that the previous instance of the
+ * daemon recorded for the given device. Returns 1 if an entry was found.
+ */
+int nvPdJournalLookup(int domain, int bus, int slot, NvPdJournalEntry *entry)
+{
+    int i, found = 0;
+
+    pthread_mutex_lock(&journal_lock);
+
+    for (i = 0; i < num_previous; i++) {
+        if ((previous[i].domain == domain) &&
+            (previous[i].bus == bus) &&
+            (previous[i].slot == slot)) {
+            *entry = previous[i];
+            found = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&journal_lock);
+
+    return found;
+}
+
+/*
+ * find_record() - returns the record of the given device, or NULL.
+ */
+static NvPdJournalRecord *find_record(int domain, int bus, int slot)
+{
+    int i;
+
+    for (i = 0; i < NVPD_JOURNAL_MAX_RECORDS; i++) {
+        NvPdJournalRecord *record = &journal->records[i];
+
+        if (record->in_use &&
+            (record->entry.domain == domain) &&
+            (record->entry.bus == bus) &&
+            (record->entry.slot == slot)) {
+            return record;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * nvPdJournalUpdate() - records the current state of a device.
+ */
+void nvPdJournalUpdate(const NvPdJournalEntry *entry)
+{
+    NvPdJournalRecord *record;
+    int i;
+
+    pthread_mutex_lock(&journal_lock);
+
+    if (journal == NULL) {
+        goto done;
+    }
+
+    record = find_record(entry->domain, entry->bus, entry->slot);
+
+    for (i = 0; (record == NULL) && (i < NVPD_JOURNAL_MAX_RECORDS); i++) {
+        if (!journal->records[i].in_use) {
+            record = &journal->records[i];
+        }
+    }
+
+    if (record == NULL) {
+        if (!journal_full_reported) {
+            syslog(LOG_WARNING, "State journal is full, the state of some "
+                                "devices will not be recorded");
+            journal_full_reported = 1;
+        }
+        goto done;
+    }
+
+    record->sequence++;
+    __sync_synchronize();
+    record->entry = *entry;
+    record->in_use = 1;
+    __sync_synchronize();
+    record->sequence++;
+
+done:
+    pthread_mutex_unlock(&journal_lock);
+}
+
+/*
+ * nvPdJournalRemove() - forgets the state of a device that went away.
+ */
+void nvPdJournalRemove(int domain, int bus, int slot)
+{
+    NvPdJournalRecord *record;
+
+    pthread_mutex_lock(&journal_lock);
+
+    if (journal != NULL) {
+        record = find_record(domain, bus, slot);
+        if (record != NULL) {
+            record->in_use = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&journal_lock);
+}
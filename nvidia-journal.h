@@ -0,0 +1,61 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-journal.h
+ */
+
+#ifndef _NVIDIA_JOURNAL_H_
+#define _NVIDIA_JOURNAL_H_
+
+#include "nvpd_rpc.h"
+#include "nvidia-numa.h"
+
+/*
+ * The state journal records the state of every device in a small memory
+ * mapped file in the runtime data directory. It is kept across a restart of
+ * the daemon, either because the daemon crashed or because it was stopped
+ * with --warm-restart, so that the next instance can adopt device state, in
+ * particular onlined NUMA memory, instead of rebuilding it.
+ */
+typedef struct
+{
+    int domain;
+    int bus;
+    int slot;
+    int function;
+    NvPersistenceMode mode;
+    NvUVMPersistenceMode uvm_mode;
+    NvNumaStatus numa_status;
+    uint8_t use_auto_online;
+    NvNumaRange numa_range;
+} NvPdJournalEntry;
+
+NvPdStatus nvPdJournalOpen(const char *path);
+void nvPdJournalClose(int keep);
+
+int nvPdJournalLookup(int domain, int bus, int slot, NvPdJournalEntry *entry);
+void nvPdJournalUpdate(const NvPdJournalEntry *entry);
+void nvPdJournalRemove(int domain, int bus, int slot);
+
+#endif /* _NVIDIA_JOURNAL_H_ */
@@ -0,0 +1,433 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-metrics.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "common-utils.h"
+#include "nvidia-event-loop.h"
+#include "nvidia-metrics.h"
+#include "nvidia-persistenced.h"
+#include "nvidia-stats.h"
+#include "nvidia-syslog-utils.h"
+#include "nvidia-work-queue.h"
+
+#define NVPD_METRICS_PREFIX "nvidia_persistenced_"
+
+/* Names of the phase label values, indexed by NvPdDevicePhase */
+static const char *device_phase_names[NVPD_NUM_DEVICE_PHASES] = {
+    "open_device",
+    "uvm_persistence",
+    "probe_memory",
+    "check_auto_online",
+    "change_node_state",
+    "retire_pages",
+};
+
+/* Names of the handler label values, indexed by NvPdRpcPhase */
+static const char *rpc_phase_names[NVPD_NUM_RPC_PHASES] = {
+    "set_persistence_mode",
+    "get_persistence_mode",
+    "set_persistence_mode_only",
+    "set_numa_status",
+    "set_persistence_mode_batch",
+    "set_numa_status_batch",
+    "get_device_states",
+    "submit_numa_job",
+    "get_numa_job",
+    "cancel_numa_job",
+    "get_stats",
+    "get_driver_features",
+};
+
+static int timer_fd = -1;
+static NvPdWorkQueue *export_queue = NULL;
+static char *metrics_path = NULL;
+static char *temp_path = NULL;
+
+/* Set while an export is queued or in progress */
+static volatile int export_pending = 0;
+
+/* Whether the last export failed, to only report the first failure */
+static int export_failed = 0;
+
+/* Device metrics buffer of the export thread, grown as needed */
+static NvPdDeviceMetrics *devices = NULL;
+static int max_devices = 0;
+
+/*
+ * write_header() - writes the HELP and TYPE lines of a metric.
+ */
+static void write_header(FILE *file, const char *name, const char *type,
+                         const char *help)
+{
+    fprintf(file, "# HELP " NVPD_METRICS_PREFIX "%s %s\n", name, help);
+    fprintf(file, "# TYPE " NVPD_METRICS_PREFIX "%s %s\n", name, type);
+}
+
+/*
+ * write_histogram() - writes the samples of a latency histogram, with the
+ * given labels, in seconds. The last bucket of a histogram is unbounded, so
+ * it is only written as the +Inf bucket.
+ */
+static void write_histogram(FILE *file, const char *name, const char *labels,
+                            const NvPdHistogram *histogram)
+{
+    uint64_t cumulative = 0;
+    int i;
+
+    for (i = 0; i < NVPD_STATS_NUM_BUCKETS - 1; i++) {
+        cumulative += histogram->buckets[i];
+        fprintf(file, NVPD_METRICS_PREFIX "%s_bucket{%s,le=\"%g\"} %llu\n",
+                name, labels, (double)(1ULL << i) / 1000000.0,
+                (unsigned long long)cumulative);
+    }
+
+    fprintf(file, NVPD_METRICS_PREFIX "%s_bucket{%s,le=\"+Inf\"} %llu\n",
+            name, labels, (unsigned long long)histogram->count);
+    fprintf(file, NVPD_METRICS_PREFIX "%s_sum{%s} %.6f\n",
+            name, labels, (double)histogram->total_us / 1000000.0);
+    fprintf(file, NVPD_METRICS_PREFIX "%s_count{%s} %llu\n",
+            name, labels, (unsigned long long)histogram->count);
+}
+
+/*
+ * WRITE_DEVICE_SAMPLES() - writes a gauge or counter metric, with one sample
+ * per device given by expr, where _i is the index of the device.
+ */
+#define WRITE_DEVICE_SAMPLES(file, name, type, help, labels, expr)          \
+    do {                                                                    \
+        int _i;                                                             \
+        write_header(file, name, type, help);                               \
+        for (_i = 0; _i < num_devices; _i++) {                              \
+            fprintf(file, NVPD_METRICS_PREFIX "%s{%s} %llu\n", name,        \
+                    labels[_i], (unsigned long long)(expr));               \
+        }                                                                   \
+    } while (0)
+
+/*
+ * write_metrics() - writes all metrics to file.
+ */
+static void write_metrics(FILE *file, const NvPdDeviceMetrics *metrics,
+                          int num_devices)
+{
+    NvPdHistogram rpc[NVPD_NUM_RPC_PHASES];
+    NvPdEventLoopLoad load;
+    char (*labels)[32];
+    char phase_labels[64];
+    int i, j;
+
+    labels = calloc(NV_MAX(num_devices, 1), sizeof(*labels));
+    if (labels == NULL) {
+        num_devices = 0;
+    }
+
+    for (i = 0; i < num_devices; i++) {
+        snprintf(labels[i], sizeof(labels[i]),
+                 "device=\"%04x:%02x:%02x.%x\"",
+                 metrics[i].state.device.domain, metrics[i].state.device.bus,
+                 metrics[i].state.device.slot,
+                 metrics[i].state.device.function);
+    }
+
+    WRITE_DEVICE_SAMPLES(file, "persistence_mode", "gauge",
+                         "Whether persistence mode is enabled on the device.",
+                         labels, metrics[_i].state.mode ==
+                                 NV_PERSISTENCE_MODE_ENABLED);
+
+    WRITE_DEVICE_SAMPLES(file, "uvm_persistence_mode", "gauge",
+                         "Whether UVM persistence mode is enabled on the "
+                         "device.",
+                         labels, metrics[_i].state.uvm_mode ==
+                                 NV_UVM_PERSISTENCE_MODE_ENABLED);
+
+    WRITE_DEVICE_SAMPLES(file, "numa_online", "gauge",
+                         "Whether the NUMA memory of the device is online.",
+                         labels, metrics[_i].state.numa_status ==
+                                 NV_NUMA_STATUS_ONLINE);
+
+    WRITE_DEVICE_SAMPLES(file, "transitions_total", "counter",
+                         "Number of state changes of the device.",
+                         labels, metrics[_i].num_transitions);
+
+    WRITE_DEVICE_SAMPLES(file, "failures_total", "counter",
+                         "Number of failed attempts at changing the state "
+                         "of the device.",
+                         labels, metrics[_i].num_failures);
+
+    write_header(file, "phase_duration_seconds", "histogram",
+                 "Time taken by the phases of changing the state of the "
+                 "device.");
+
+    for (i = 0; i < num_devices; i++) {
+        for (j = 0; j < NVPD_NUM_DEVICE_PHASES; j++) {
+            snprintf(phase_labels, sizeof(phase_labels), "%s,phase=\"%s\"",
+                     labels[i], device_phase_names[j]);
+            write_histogram(file, "phase_duration_seconds", phase_labels,
+                            &metrics[i].phases[j]);
+        }
+    }
+
+    write_header(file, "rpc_duration_seconds", "histogram",
+                 "Time taken by RPC requests, until the reply is sent.");
+
+    nvPdStatsGetRpc(rpc);
+
+    for (j = 0; j < NVPD_NUM_RPC_PHASES; j++) {
+        snprintf(phase_labels, sizeof(phase_labels), "handler=\"%s\"",
+                 rpc_phase_names[j]);
+        write_histogram(file, "rpc_duration_seconds", phase_labels, &rpc[j]);
+    }
+
+    nvPdEventLoopGetLoad(&load);
+
+    write_header(file, "rpc_sockets", "gauge",
+                 "Number of open RPC sockets, including the listening "
+                 "socket.");
+    fprintf(file, NVPD_METRICS_PREFIX "rpc_sockets %d\n",
+            load.num_rpc_sockets);
+
+    write_header(file, "rpc_deferred_requests", "gauge",
+                 "Number of RPC requests waiting for device work to "
+                 "complete.");
+    fprintf(file, NVPD_METRICS_PREFIX "rpc_deferred_requests %d\n",
+            load.num_deferred);
+
+    write_header(file, "rpc_deferred_requests_max", "gauge",
+                 "Largest number of RPC requests that waited for device "
+                 "work at the same time.");
+    fprintf(file, NVPD_METRICS_PREFIX "rpc_deferred_requests_max %d\n",
+            load.max_deferred);
+
+    free(labels);
+}
+
+/*
+ * export_metrics() - rewrites the metrics file, on the export thread. The
+ * metrics are written to a temporary file first, which then replaces the
+ * metrics file.
+ */
+static void export_metrics(void *data)
+{
+    NvPdDeviceMetrics *new_devices;
+    NvPdStatus status;
+    FILE *file;
+    int count = max_devices;
+    int fd, err = 0;
+
+    status = nvPdGetDeviceMetrics(devices, &count);
+    if (status == NVPD_ERR_INSUFFICIENT_RESOURCES) {
+        new_devices = realloc(devices, count * sizeof(NvPdDeviceMetrics));
+        if (new_devices != NULL) {
+            devices = new_devices;
+            max_devices = count;
+            status = nvPdGetDeviceMetrics(devices, &count);
+        }
+    }
+    if (status != NVPD_SUCCESS) {
+        count = 0;
+    }
+
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    file = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if (file == NULL) {
+        err = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        goto done;
+    }
+
+    write_metrics(file, devices, count);
+
+    if (ferror(file)) {
+        err = EIO;
+    }
+    if ((fclose(file) != 0) && (err == 0)) {
+        err = errno;
+    }
+
+    if ((err == 0) && (rename(temp_path, metrics_path) < 0)) {
+        err = errno;
+    }
+
+    if (err != 0) {
+        (void) unlink(temp_path);
+    }
+
+done:
+    if ((err != 0) && !export_failed) {
+        syslog(LOG_WARNING, "Failed to write metrics file %s: %s",
+               metrics_path, strerror(err));
+    } else if ((err == 0) && export_failed) {
+        syslog(LOG_NOTICE, "Metrics file %s written again", metrics_path);
+    }
+    export_failed = (err != 0);
+
+    __sync_synchronize();
+    export_pending = 0;
+}
+
+/*
+ * queue_export() - queues an export to the export thread, unless one is still
+ * pending.
+ */
+static void queue_export(void)
+{
+    if (!__sync_bool_compare_and_swap(&export_pending, 0, 1)) {
+        return;
+    }
+
+    if (nvPdWorkQueueSubmit(export_queue, export_metrics,
+                            NULL) != NVPD_SUCCESS) {
+        export_pending = 0;
+    }
+}
+
+/*
+ * handle_timer() - called by the event loop each time the export interval
+ * elapses.
+ */
+static void handle_timer(int fd, void *data)
+{
+    uint64_t expirations;
+
+    while (read(fd, &expirations, sizeof(expirations)) > 0);
+
+    queue_export();
+}
+
+/*
+ * nvPdMetricsInit() - starts exporting metrics to the file at path, every
+ * interval seconds, beginning right away.
+ */
+NvPdStatus nvPdMetricsInit(const char *path, int interval)
+{
+    struct itimerspec spec;
+    NvPdStatus status;
+
+    metrics_path = strdup(path);
+    temp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if ((metrics_path == NULL) || (temp_path == NULL)) {
+        status = NVPD_ERR_INSUFFICIENT_RESOURCES;
+        goto fail;
+    }
+    sprintf(temp_path, "%s.tmp", path);
+
+    export_queue = nvPdWorkQueueCreate(1);
+    if (export_queue == NULL) {
+        syslog(LOG_WARNING, "Failed to create metrics export thread");
+        status = NVPD_ERR_INSUFFICIENT_RESOURCES;
+        goto fail;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        syslog(LOG_WARNING, "Failed to create metrics export timer: %s",
+               strerror(errno));
+        status = NVPD_ERR_IO;
+        goto fail;
+    }
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = interval;
+    spec.it_interval.tv_sec = interval;
+
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) < 0) {
+        syslog(LOG_WARNING, "Failed to start metrics export timer: %s",
+               strerror(errno));
+        status = NVPD_ERR_IO;
+        goto fail;
+    }
+
+    status = nvPdEventLoopAddFd(timer_fd, handle_timer, NULL);
+    if (status != NVPD_SUCCESS) {
+        goto fail;
+    }
+
+    queue_export();
+
+    SYSLOG_VERBOSE(LOG_INFO, "Exporting metrics to %s every %d seconds",
+                   metrics_path, interval);
+
+    return NVPD_SUCCESS;
+
+fail:
+    if (timer_fd >= 0) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+    nvPdWorkQueueDestroy(export_queue);
+    export_queue = NULL;
+    free(metrics_path);
+    free(temp_path);
+    metrics_path = NULL;
+    temp_path = NULL;
+
+    return status;
+}
+
+/*
+ * nvPdMetricsShutdown() - stops exporting metrics, and removes the metrics
+ * file, so that stale metrics are not collected after the daemon exits.
+ */
+void nvPdMetricsShutdown(void)
+{
+    if (export_queue == NULL) {
+        return;
+    }
+
+    if (timer_fd >= 0) {
+        nvPdEventLoopRemoveFd(timer_fd);
+        close(timer_fd);
+        timer_fd = -1;
+    }
+
+    /* Wait for the export in progress, if any */
+    nvPdWorkQueueDestroy(export_queue);
+    export_queue = NULL;
+
+    if ((unlink(metrics_path) < 0) && (errno != ENOENT)) {
+        syslog(LOG_WARNING, "Failed to remove metrics file %s: %s",
+               metrics_path, strerror(errno));
+    }
+
+    free(metrics_path);
+    free(temp_path);
+    metrics_path = NULL;
+    temp_path = NULL;
+
+    free(devices);
+    devices = NULL;
+    max_devices = 0;
+}
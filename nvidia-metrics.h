@@ -0,0 +1,43 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-metrics.h
+ */
+
+#ifndef _NVIDIA_METRICS_H_
+#define _NVIDIA_METRICS_H_
+
+#include "nvpd_rpc.h"
+
+/*
+ * The metrics exporter periodically rewrites a file in the Prometheus text
+ * exposition format, for collection by the textfile collector of a node
+ * exporter. The file is replaced atomically, so that a collector never reads
+ * a partial file. The export is timed by the event loop but written from a
+ * separate thread, so that a slow filesystem does not hold up RPC requests.
+ */
+NvPdStatus nvPdMetricsInit(const char *path, int interval);
+void nvPdMetricsShutdown(void);
+
+#endif /* _NVIDIA_METRICS_H_ */
@@ -0,0 +1,637 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-msg-server.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "nvidia-event-loop.h"
+#include "nvidia-msg-server.h"
+#include "nvidia-persistenced.h"
+#include "nvidia-stats.h"
+#include "nvidia-syslog-utils.h"
+#include "nvidia-trace.h"
+#include "nvpd_msg.h"
+
+/* Length of the part of a request that identifies it in the reply */
+#define NVPD_MSG_HEADER_SIZE    offsetof(NvPdMsgRequest, domain)
+
+/*
+ * State of a client connection. The connection is referenced by the event
+ * loop while its socket is polled, and by each of its requests still queued
+ * to a device worker thread. The socket is only closed once the last
+ * reference is dropped, so that a reply is never sent on a file descriptor
+ * that has been reused meanwhile.
+ */
+typedef struct _NvPdMsgClient
+{
+    int fd;
+    NvPdStatus root_status;     /* whether the client may change state */
+    int refcount;
+    int num_pending;
+    int subscribed;
+    struct _NvPdMsgClient *next;
+    struct _NvPdMsgClient *next_subscriber;
+} NvPdMsgClient;
+
+/* A request that changes device state, queued to the device worker thread */
+typedef struct
+{
+    NvPdMsgClient *client;
+    NvPdMsgRequest request;
+    NvPdRpcPhase phase;
+    uint64_t start_time;
+} NvPdMsgCommand;
+
+static int listen_fd = -1;
+
+/* Connections polled by the event loop; only used on the event loop thread */
+static NvPdMsgClient *clients = NULL;
+
+/*
+ * Connections subscribed to events, each holding a reference to its client.
+ * Events are sent from whichever thread changed the device, so the list is
+ * only used with the lock held, which also keeps the numbering of events in
+ * the order they are sent.
+ */
+static struct {
+    pthread_mutex_t lock;
+    uint32_t last_seq;
+    NvPdMsgClient *list;
+} subscribers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * put_client() - drops a reference to the client, and closes the connection
+ * once the last one is dropped.
+ */
+static void put_client(NvPdMsgClient *client)
+{
+    if (__sync_sub_and_fetch(&client->refcount, 1) == 0) {
+        close(client->fd);
+        free(client);
+    }
+}
+
+/*
+ * remove_client() - stops polling the connection of the client. Requests
+ * still queued are executed, but their replies fail once the connection is
+ * closed.
+ */
+static void remove_client(NvPdMsgClient *client)
+{
+    NvPdMsgClient **iter;
+
+    for (iter = &clients; *iter != NULL; iter = &(*iter)->next) {
+        if (*iter == client) {
+            *iter = client->next;
+            break;
+        }
+    }
+
+    if (client->subscribed) {
+        pthread_mutex_lock(&subscribers.lock);
+        for (iter = &subscribers.list; *iter != NULL;
+             iter = &(*iter)->next_subscriber) {
+            if (*iter == client) {
+                *iter = client->next_subscriber;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&subscribers.lock);
+
+        client->subscribed = 0;
+        put_client(client);
+    }
+
+    nvPdEventLoopRemoveFd(client->fd);
+    put_client(client);
+}
+
+/*
+ * send_reply() - sends the reply to a request. This never blocks, so that a
+ * client that does not read its replies cannot hold up a device worker
+ * thread; the connection is shut down instead, which the event loop then
+ * sees as the client hanging up.
+ */
+static void send_reply(NvPdMsgClient *client, const NvPdMsgRequest *request,
+                       NvPdStatus status, int value)
+{
+    NvPdMsgReply reply;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.version = NVPD_MSG_VERSION;
+    reply.type = request->type;
+    reply.seq = request->seq;
+    reply.status = status;
+    reply.value = value;
+
+    if (send(client->fd, &reply, sizeof(reply),
+             MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) sizeof(reply)) {
+        SYSLOG_VERBOSE(LOG_DEBUG, "Failed to send binary protocol reply: %s",
+                       strerror(errno));
+        (void) shutdown(client->fd, SHUT_RDWR);
+    }
+}
+
+/*
+ * get_request_phase() - returns the RPC phase whose statistics the request
+ * is accounted to, or -1 if the request type is unknown.
+ */
+static int get_request_phase(const NvPdMsgRequest *request)
+{
+    switch (request->type) {
+    case NVPD_MSG_SET_PERSISTENCE_MODE:
+        return NVPD_PHASE_RPC_SET_PERSISTENCE_MODE;
+    case NVPD_MSG_GET_PERSISTENCE_MODE:
+        return NVPD_PHASE_RPC_GET_PERSISTENCE_MODE;
+    case NVPD_MSG_SET_PERSISTENCE_MODE_ONLY:
+        return NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_ONLY;
+    case NVPD_MSG_SET_NUMA_STATUS:
+        return NVPD_PHASE_RPC_SET_NUMA_STATUS;
+    }
+
+    return -1;
+}
+
+/*
+ * run_command() - executes a request that changes device state.
+ */
+static NvPdStatus run_command(const NvPdMsgRequest *request)
+{
+    switch (request->type) {
+    case NVPD_MSG_SET_PERSISTENCE_MODE:
+        return nvPdSetDevicePersistenceMode(request->domain,
+                                            request->bus,
+                                            request->slot,
+                                            request->function,
+                                            request->value);
+    case NVPD_MSG_SET_PERSISTENCE_MODE_ONLY:
+        return nvPdSetDevicePersistenceModeOnly(request->domain,
+                                                request->bus,
+                                                request->slot,
+                                                request->function,
+                                                request->value);
+    case NVPD_MSG_SET_NUMA_STATUS:
+        return nvPdSetDeviceNumaStatus(request->domain,
+                                       request->bus,
+                                       request->slot,
+                                       request->function,
+                                       request->value);
+    }
+
+    return NVPD_ERR_INVALID_ARGUMENT;
+}
+
+/*
+ * run_queued_command() - executes a request on the worker thread of its
+ * device, and sends the reply to the client.
+ */
+static void run_queued_command(void *data)
+{
+    NvPdMsgCommand *cmd = data;
+    NvPdMsgClient *client = cmd->client;
+
+    send_reply(client, &cmd->request, run_command(&cmd->request), 0);
+
+    nvPdStatsRecordRpc(cmd->phase, cmd->start_time);
+
+    __sync_fetch_and_sub(&client->num_pending, 1);
+    put_client(client);
+    free(cmd);
+}
+
+/*
+ * subscribe_client() - subscribes the client to events. The reply is sent
+ * with the lock held, so that it comes before any event numbered after it.
+ */
+static void subscribe_client(NvPdMsgClient *client,
+                             const NvPdMsgRequest *request)
+{
+    pthread_mutex_lock(&subscribers.lock);
+
+    if (!client->subscribed) {
+        __sync_fetch_and_add(&client->refcount, 1);
+        client->subscribed = 1;
+        client->next_subscriber = subscribers.list;
+        subscribers.list = client;
+    }
+
+    send_reply(client, request, NVPD_SUCCESS, (int) subscribers.last_seq);
+
+    pthread_mutex_unlock(&subscribers.lock);
+}
+
+/*
+ * handle_request() - answers a request right away if it only queries device
+ * state, or queues it to the worker thread of its device otherwise.
+ */
+static void handle_request(NvPdMsgClient *client,
+                           const NvPdMsgRequest *request)
+{
+    NvPdMsgCommand *cmd;
+    NvPersistenceMode mode;
+    NvPdStatus status;
+    uint64_t start = nvPdStatsTime();
+    int phase;
+
+    if ((request->version == NVPD_MSG_VERSION) &&
+        (request->type == NVPD_MSG_SUBSCRIBE)) {
+        subscribe_client(client, request);
+        return;
+    }
+
+    phase = get_request_phase(request);
+    if ((request->version != NVPD_MSG_VERSION) || (phase < 0) ||
+        (request->reserved != 0)) {
+        send_reply(client, request, NVPD_ERR_INVALID_ARGUMENT, 0);
+        return;
+    }
+
+    NVPD_TRACE2(rpc__entry, phase, NVPD_TRACE_BDF(request));
+
+    if (request->type == NVPD_MSG_GET_PERSISTENCE_MODE) {
+        status = nvPdGetDevicePersistenceMode(request->domain,
+                                              request->bus,
+                                              request->slot,
+                                              request->function,
+                                              &mode);
+        send_reply(client, request, status,
+                   (status == NVPD_SUCCESS) ? mode : 0);
+        nvPdStatsRecordRpc(phase, start);
+        return;
+    }
+
+    status = client->root_status;
+    if (status != NVPD_SUCCESS) {
+        goto reply;
+    }
+
+    if (__sync_add_and_fetch(&client->num_pending, 1) > NVPD_MSG_MAX_PENDING) {
+        status = NVPD_ERR_INSUFFICIENT_RESOURCES;
+        goto unpend;
+    }
+
+    cmd = malloc(sizeof(*cmd));
+    if (cmd == NULL) {
+        status = NVPD_ERR_INSUFFICIENT_RESOURCES;
+        goto unpend;
+    }
+
+    cmd->client = client;
+    cmd->request = *request;
+    cmd->phase = phase;
+    cmd->start_time = start;
+
+    __sync_fetch_and_add(&client->refcount, 1);
+
+    status = nvPdQueueDeviceWork(request->domain, request->bus,
+                                 request->slot, request->function,
+                                 run_queued_command, cmd);
+    if (status == NVPD_SUCCESS) {
+        return;
+    }
+
+    /* The event loop still holds a reference to the client */
+    put_client(client);
+    free(cmd);
+
+unpend:
+    __sync_fetch_and_sub(&client->num_pending, 1);
+
+reply:
+    send_reply(client, request, status, 0);
+    nvPdStatsRecordRpc(phase, start);
+}
+
+/*
+ * handle_client() - called by the event loop when a client sent a request
+ * or hung up. Messages too short to be answered are ignored.
+ */
+static void handle_client(int fd, void *data)
+{
+    NvPdMsgClient *client = data;
+    NvPdMsgRequest request;
+    ssize_t len;
+
+    memset(&request, 0, sizeof(request));
+
+    /* With MSG_TRUNC, the length of longer messages is returned in full */
+    len = recv(fd, &request, sizeof(request), MSG_DONTWAIT | MSG_TRUNC);
+    if (len < 0) {
+        if ((errno == EAGAIN) || (errno == EINTR)) {
+            return;
+        }
+        SYSLOG_VERBOSE(LOG_DEBUG, "Failed to receive binary protocol "
+                       "request: %s", strerror(errno));
+        remove_client(client);
+        return;
+    }
+
+    if (len == 0) {
+        remove_client(client);
+        return;
+    }
+
+    if (len < (ssize_t) NVPD_MSG_HEADER_SIZE) {
+        return;
+    }
+
+    if (len != (ssize_t) sizeof(request)) {
+        send_reply(client, &request, NVPD_ERR_INVALID_ARGUMENT, 0);
+        return;
+    }
+
+    handle_request(client, &request);
+}
+
+/*
+ * add_client() - starts polling the connection of a client. The credentials
+ * of the client are those it had when it connected, so they are only checked
+ * once. Returns NULL on failure, in which case the caller still owns
+ * client_fd.
+ */
+static NvPdMsgClient *add_client(int client_fd)
+{
+    NvPdMsgClient *client;
+    struct ucred ucred = { -1, -1, -1 };
+    socklen_t ucred_len = sizeof(struct ucred);
+
+    client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        return NULL;
+    }
+
+    client->fd = client_fd;
+    client->refcount = 1;
+
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED,
+                   &ucred, &ucred_len) < 0) {
+        client->root_status = NVPD_ERR_UNKNOWN;
+    } else if (ucred.uid != 0) {
+        client->root_status = NVPD_ERR_PERMISSIONS;
+    } else {
+        client->root_status = NVPD_SUCCESS;
+    }
+
+    if (nvPdEventLoopAddFd(client_fd, handle_client, client) !=
+        NVPD_SUCCESS) {
+        free(client);
+        return NULL;
+    }
+
+    client->next = clients;
+    clients = client;
+
+    return client;
+}
+
+/*
+ * handle_connection() - called by the event loop when a client connects to
+ * the listening socket.
+ */
+static void handle_connection(int fd, void *data)
+{
+    int client_fd;
+
+    client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+        if ((errno != EAGAIN) && (errno != EINTR)) {
+            syslog(LOG_WARNING, "Failed to accept binary protocol "
+                   "connection: %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (add_client(client_fd) == NULL) {
+        close(client_fd);
+    }
+}
+
+/*
+ * take_over_clients() - continues serving the clients of the previous
+ * instance of the daemon, and sending events to those that subscribed to
+ * them. Events are numbered after the last event the previous instance sent,
+ * and those this instance sent before taking over, which the subscribers
+ * then see as missed.
+ */
+static void take_over_clients(NvPdHandoffState *handoff)
+{
+    NvPdMsgClient *client;
+    int i;
+
+    pthread_mutex_lock(&subscribers.lock);
+
+    subscribers.last_seq += handoff->msg_last_seq;
+
+    for (i = 0; i < handoff->num_msg_clients; i++) {
+        NvPdHandoffMsgClient *entry = &handoff->msg_clients[i];
+
+        client = add_client(entry->fd);
+        if (client == NULL) {
+            continue;
+        }
+        entry->fd = -1;
+
+        if (entry->subscribed) {
+            client->refcount++;
+            client->subscribed = 1;
+            client->next_subscriber = subscribers.list;
+            subscribers.list = client;
+        }
+    }
+
+    pthread_mutex_unlock(&subscribers.lock);
+}
+
+/*
+ * nvPdMsgServerInit() - starts serving the binary protocol on
+ * NVPD_MSG_SOCKET_PATH, on the socket handed over by the previous instance of
+ * the daemon if there is one.
+ */
+NvPdStatus nvPdMsgServerInit(NvPdHandoffState *handoff)
+{
+    struct sockaddr_un addr;
+    NvPdStatus status;
+
+    if (handoff->msg_socket_fd >= 0) {
+        status = nvPdEventLoopAddFd(handoff->msg_socket_fd,
+                                    handle_connection, NULL);
+        if (status != NVPD_SUCCESS) {
+            return status;
+        }
+
+        listen_fd = handoff->msg_socket_fd;
+        handoff->msg_socket_fd = -1;
+
+        take_over_clients(handoff);
+
+        SYSLOG_VERBOSE(LOG_INFO, "Binary protocol service taken over, with "
+                       "%d clients", handoff->num_msg_clients);
+
+        return NVPD_SUCCESS;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, NVPD_MSG_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    /* Remove any stale socket of a previous instance */
+    (void) unlink(NVPD_MSG_SOCKET_PATH);
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       0);
+    if (listen_fd < 0) {
+        syslog(LOG_WARNING, "Failed to create binary protocol socket: %s",
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    if ((bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+        (listen(listen_fd, SOMAXCONN) < 0)) {
+        syslog(LOG_WARNING, "Failed to listen on %s: %s",
+               NVPD_MSG_SOCKET_PATH, strerror(errno));
+        status = NVPD_ERR_IO;
+        goto fail;
+    }
+
+    status = nvPdEventLoopAddFd(listen_fd, handle_connection, NULL);
+    if (status != NVPD_SUCCESS) {
+        goto fail;
+    }
+
+    SYSLOG_VERBOSE(LOG_INFO, "Binary protocol service initialized");
+
+    return NVPD_SUCCESS;
+
+fail:
+    close(listen_fd);
+    listen_fd = -1;
+    (void) unlink(NVPD_MSG_SOCKET_PATH);
+
+    return status;
+}
+
+/*
+ * nvPdMsgServerShutdown() - stops serving the binary protocol, and removes
+ * the socket. The connections of clients with requests still queued are
+ * closed once these requests are done.
+ */
+void nvPdMsgServerShutdown(void)
+{
+    if (listen_fd < 0) {
+        return;
+    }
+
+    nvPdEventLoopRemoveFd(listen_fd);
+    close(listen_fd);
+    listen_fd = -1;
+
+    if (unlink(NVPD_MSG_SOCKET_PATH) < 0) {
+        syslog(LOG_WARNING, "Failed to unlink %s: %s", NVPD_MSG_SOCKET_PATH,
+               strerror(errno));
+    }
+
+    while (clients != NULL) {
+        remove_client(clients);
+    }
+}
+
+/*
+ * nvPdMsgServerGetHandoff() - fills in the binary protocol part of the state
+ * handed over to a new instance of the daemon. The list of clients is to be
+ * freed by the caller.
+ */
+NvPdStatus nvPdMsgServerGetHandoff(NvPdHandoffState *state)
+{
+    NvPdMsgClient *client;
+    int num_clients = 0;
+
+    state->msg_socket_fd = listen_fd;
+    state->num_msg_clients = 0;
+    state->msg_clients = NULL;
+
+    pthread_mutex_lock(&subscribers.lock);
+    state->msg_last_seq = subscribers.last_seq;
+    pthread_mutex_unlock(&subscribers.lock);
+
+    for (client = clients; client != NULL; client = client->next) {
+        num_clients++;
+    }
+
+    if (num_clients == 0) {
+        return NVPD_SUCCESS;
+    }
+
+    state->msg_clients = calloc(num_clients, sizeof(NvPdHandoffMsgClient));
+    if (state->msg_clients == NULL) {
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    for (client = clients; client != NULL; client = client->next) {
+        NvPdHandoffMsgClient *entry =
+            &state->msg_clients[state->num_msg_clients++];
+
+        entry->fd = client->fd;
+        entry->subscribed = client->subscribed;
+    }
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdMsgServerNotify() - sends the event to all subscribed clients. This
+ * never blocks; a client whose socket is full misses the event, which it
+ * sees as a gap in the event numbers.
+ */
+void nvPdMsgServerNotify(NvPdMsgEvent *event)
+{
+    NvPdMsgClient *client;
+
+    pthread_mutex_lock(&subscribers.lock);
+
+    event->version = NVPD_MSG_VERSION;
+    event->type = NVPD_MSG_EVENT;
+    event->seq = ++subscribers.last_seq;
+
+    for (client = subscribers.list; client != NULL;
+         client = client->next_subscriber) {
+        (void) send(client->fd, event, sizeof(*event),
+                    MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    pthread_mutex_unlock(&subscribers.lock);
+}
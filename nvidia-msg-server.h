@@ -0,0 +1,60 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-msg-server.h
+ */
+
+#ifndef _NVIDIA_MSG_SERVER_H_
+#define _NVIDIA_MSG_SERVER_H_
+
+#include "nvidia-handoff.h"
+#include "nvpd_msg.h"
+#include "nvpd_rpc.h"
+
+/*
+ * The message server implements the binary protocol of nvpd_msg.h. Requests
+ * are read by the event loop, and requests that change device state are
+ * executed by the worker thread of the device, which sends the reply, as
+ * with the RPC interface.
+ */
+NvPdStatus nvPdMsgServerInit(NvPdHandoffState *handoff);
+void nvPdMsgServerShutdown(void);
+
+/*
+ * The listening socket and the client connections are handed over to a new
+ * instance of the daemon along with the rest of its state, so that clients
+ * stay connected, and subscribed to events. This is only called with the
+ * event loop stopped, and once no request is queued to a device anymore; the
+ * file descriptors remain owned by the message server.
+ */
+NvPdStatus nvPdMsgServerGetHandoff(NvPdHandoffState *state);
+
+/*
+ * Sends the event to all subscribed clients, after filling in its header.
+ * May be called from any thread; events are numbered in the order of the
+ * calls.
+ */
+void nvPdMsgServerNotify(NvPdMsgEvent *event);
+
+#endif /* _NVIDIA_MSG_SERVER_H_ */
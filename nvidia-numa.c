@@ -25,43 +25,68 @@
  * NUMA memory
  */
 
+#define _GNU_SOURCE
+
 #include <dirent.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 
 #include "common-utils.h"
 #include "nv-ioctl-numa.h"
 #include "nvidia-numa.h"
+#include "nvidia-trace.h"
+#include "nvidia-work-queue.h"
+
+/*
+ * All kernel interfaces used here are found under NVPD_KERNEL_ROOT, which is
+ * empty unless given at build time. Pointing it at a directory tree that
+ * mimics procfs, sysfs and the device files allows exercising and timing
+ * NUMA onlining and offlining without the real hardware.
+ */
+#ifndef NVPD_KERNEL_ROOT
+#define NVPD_KERNEL_ROOT             ""
+#endif
 
 #define NV_DEVICE_INFO_PATH_FMT \
-    "/proc/driver/nvidia/gpus/%04x:%02x:%02x.%x/information"
-#define NV_DEVICE_FILE_NAME          "/dev/nvidia%d"
+    NVPD_KERNEL_ROOT "/proc/driver/nvidia/gpus/%04x:%02x:%02x.%x/information"
+#define NV_DEVICE_FILE_NAME          NVPD_KERNEL_ROOT "/dev/nvidia%d"
 
 #define BUF_SIZE                     100
 #define BRING_OFFLINE_CMD            "offline"
 #define BRING_ONLINE_CMD             "online_movable"
-#define MEMORY_PATH_FMT              "/sys/devices/system/memory"
-#define MEMORY_HARD_OFFLINE_PATH_FMT MEMORY_PATH_FMT "/hard_offline_page"
-#define MEMORY_PROBE_PATH_FMT        MEMORY_PATH_FMT "/probe"
-#define AUTO_ONLINE_PATH             MEMORY_PATH_FMT "/auto_online_blocks"
+#define MEMORY_PATH_FMT              NVPD_KERNEL_ROOT "/sys/devices/system/memory"
+
+/* Paths relative to MEMORY_PATH_FMT */
+#define MEMORY_HARD_OFFLINE_FILE     "hard_offline_page"
+#define MEMORY_PROBE_FILE            "probe"
+#define AUTO_ONLINE_FILE             "auto_online_blocks"
+#define MEMORY_BLOCK_SIZE_FILE       "block_size_bytes"
 #define MEMBLK_FILE_FMT              "memory%d"
-#define MEMBLK_DIR_PATH_FMT          MEMORY_PATH_FMT "/" MEMBLK_FILE_FMT
-#define MEMBLK_STATE_PATH_FMT        MEMBLK_DIR_PATH_FMT "/state"
-#define MEMBLK_VALID_ZONES_PATH_FMT  MEMBLK_DIR_PATH_FMT "/valid_zones"
-#define NID_PATH_FMT                 "/sys/devices/system/node/node%d"
+#define MEMBLK_STATE_FILE_FMT        MEMBLK_FILE_FMT "/state"
+#define MEMBLK_VALID_ZONES_FILE_FMT  MEMBLK_FILE_FMT "/valid_zones"
 #define STATE_ONLINE                 "online"
 #define VALID_MOVABLE_STATE          "Movable"
 
-#define SYSFS_NVIDIA_DIR             "/sys/bus/pci/drivers/nvidia/"
+#define SYSFS_NVIDIA_DIR             NVPD_KERNEL_ROOT "/sys/bus/pci/drivers/nvidia/"
 #define SYSFS_ID_PATH                SYSFS_NVIDIA_DIR "%s/%s"
+#define PCI_LOCAL_CPULIST_PATH_FMT \
+    NVPD_KERNEL_ROOT "/sys/bus/pci/devices/%04x:%02x:%02x.%x/local_cpulist"
+#define CPULIST_BUF_SIZE             4096
+#define NODE_HUGEPAGES_PATH_FMT \
+    NVPD_KERNEL_ROOT "/sys/devices/system/node/node%d/hugepages/" \
+    "hugepages-%ukB/nr_hugepages"
 
 #ifndef NV_IS_ALIGNED
 #define NV_IS_ALIGNED(v, gran)       (0 == ((v) & ((gran) - 1)))
@@ -69,6 +94,60 @@
 
 typedef int mem_state_t;
 
+static NvNumaConfig numa_config = {
+    .online_threads = 1,
+};
+
+/* Huge page sizes that a pool can be reserved for, in kB */
+static const unsigned int hugepage_sizes_kb[NV_NUMA_NUM_HUGEPAGE_SIZES] = {
+    2048,
+    1048576,
+};
+
+/*
+ * Snapshot of the state of the memblocks backing the device NUMA memory. It is
+ * gathered once per transition, and kept up to date as blocks are changed, so
+ * that the state of each block is only read from sysfs once. A negative state
+ * is the error encountered reading the state of the block.
+ *
+ * The state file of each block is kept open between the read and the write,
+ * as long as the budget of cached file descriptors allows; state_fds[i] is -1
+ * otherwise.
+ *
+ * Bit i of the changed bitmap is set while block i is in a different state
+ * than when the snapshot was gathered, so that a failed transition can be
+ * undone for exactly the blocks that it moved.
+ *
+ * The blocks changed and failed by each pass over the range are logged in
+ * one summary each, rather than one record per block. While defer_failures
+ * is set, failed blocks are left for the caller to retry, and only logged if
+ * the retry fails too.
+ */
+typedef struct {
+    uint32_t bdf;
+    uint32_t start_id;
+    uint32_t num_blocks;
+    uint64_t memblock_size;
+    mem_state_t *states;
+    int *state_fds;
+    uint64_t *changed;
+    NvNumaProgress *progress;
+    NvPdLogSummary changed_log;
+    NvPdLogSummary failed_log;
+    int defer_failures;
+} memblock_snapshot_t;
+
+#define MEMBLK_BITMAP_WORDS(n)       (((n) + 63) / 64)
+
+/* A contiguous range of memblocks onlined by one thread */
+typedef struct {
+    memblock_snapshot_t *snapshot;
+    uint32_t first;
+    uint32_t count;
+    int status;
+    uint64_t elapsed_us;
+} memblock_chunk_t;
+
 static inline char* mem_state_to_string(mem_state_t state)
 {
     switch (state)
@@ -99,9 +178,10 @@ int get_gpu_minor_number(int domain, int bus, int slot, int function,
     FILE *fp;
     int status = 0;
     char *last_str = NULL;
-    char info_path[BUF_SIZE], read_buf[BUF_SIZE];
+    char info_path[PATH_MAX], read_buf[BUF_SIZE];
 
-    sprintf(info_path, NV_DEVICE_INFO_PATH_FMT, domain, bus, slot, function);
+    snprintf(info_path, sizeof(info_path), NV_DEVICE_INFO_PATH_FMT,
+             domain, bus, slot, function);
 
     fp = fopen(info_path, "r");
     if (!fp) {
@@ -130,48 +210,78 @@ int get_gpu_minor_number(int domain, int bus, int slot, int function,
     return status;
 }
 
+/*
+ * Resolves the minor number of the device, unless it is already cached in
+ * numa_info.
+ */
 static
-int get_gpu_device_file(int domain, int bus, int slot, int function,
-                        char *dev_file)
+int get_gpu_minor_number_cached(NvNumaDevice *numa_info)
 {
-    int status = 0;
+    int status;
     int minor_num = 0;
+    NvCfgPciDevice *pci_info = numa_info->pci_info;
 
-    status = get_gpu_minor_number(domain, bus, slot, function, &minor_num);
+    if (numa_info->minor_number >= 0)
+        return 0;
+
+    status = get_gpu_minor_number(pci_info->domain, pci_info->bus,
+                                  pci_info->slot, pci_info->function,
+                                  &minor_num);
     if (status < 0) {
         syslog(LOG_ERR, "NUMA: Failed to get device minor number\n");
         return status;
     }
 
-    sprintf(dev_file, NV_DEVICE_FILE_NAME, minor_num);
+    numa_info->minor_number = minor_num;
 
-    return status;
+    return 0;
 }
 
+/*
+ * Opens the device file of the device. If the cached minor number turns out
+ * to be stale, e.g., because the device was reset and came back as a
+ * different device file, it is resolved again.
+ */
 static
-int get_gpu_device_file_fd(int domain, int bus, int slot, int function, int *fd)
+int get_gpu_device_file_fd(NvNumaDevice *numa_info, int *fd)
 {
     int status;
-    char dev_file[BUF_SIZE];
+    int cached = (numa_info->minor_number >= 0);
+    char dev_file[PATH_MAX];
 
-    status = get_gpu_device_file(domain, bus, slot, function, dev_file);
-    if (status < 0) {
-        syslog(LOG_ERR, "NUMA: Failed to get device file\n");
-        return status;
-    }
+    while (1) {
+        status = get_gpu_minor_number_cached(numa_info);
+        if (status < 0) {
+            syslog(LOG_ERR, "NUMA: Failed to get device file\n");
+            return status;
+        }
 
-    *fd = open(dev_file, O_RDWR);
-    if (*fd < 0) {
-        syslog(LOG_ERR, "NUMA: Failed to open %s: %s\n", dev_file,
-               strerror(errno));
-        return -errno;
+        snprintf(dev_file, sizeof(dev_file), NV_DEVICE_FILE_NAME,
+                 numa_info->minor_number);
+
+        *fd = open(dev_file, O_RDWR);
+        if (*fd >= 0)
+            return 0;
+
+        status = -errno;
+
+        if (!cached || ((status != -ENOENT) && (status != -ENODEV) &&
+                        (status != -ENXIO))) {
+            break;
+        }
+
+        nvNumaInvalidateDevice(numa_info);
+        cached = 0;
     }
 
+    syslog(LOG_ERR, "NUMA: Failed to open %s: %s\n", dev_file,
+           strerror(-status));
+
     return status;
 }
 
 static
-int get_gpu_numa_info(int fd, nv_ioctl_numa_info_t *numa_info)
+int get_gpu_numa_info(int fd, uint32_t bdf, nv_ioctl_numa_info_t *numa_info)
 {
     int status = 0;
     uint32_t request;
@@ -189,11 +299,13 @@ int get_gpu_numa_info(int fd, nv_ioctl_numa_info_t *numa_info)
         status = -errno;
     }
 
+    NVPD_TRACE3(numa__info, bdf, status, numa_info->status);
+
     return status;
 }
 
 static
-int set_gpu_numa_status(int fd, mem_state_t numa_state)
+int set_gpu_numa_status(int fd, uint32_t bdf, mem_state_t numa_state)
 {
     int status = 0;
     uint32_t request;
@@ -212,36 +324,150 @@ int set_gpu_numa_status(int fd, mem_state_t numa_state)
         status = -errno;
     }
 
+    NVPD_TRACE3(numa__status, bdf, numa_state, status);
+
     return status;
 }
 
+/*
+ * sysfs I/O
+ *
+ * All sysfs files used for memory hotplug live under MEMORY_PATH_FMT, so they
+ * are opened relative to a directory file descriptor for it, which is opened
+ * once and kept for the lifetime of the daemon. This saves walking the full
+ * path on each of the many accesses made while changing the state of a large
+ * memory range. Files accessed more than once during a transition are kept
+ * open, and read and written at offset 0 with pread()/pwrite().
+ */
+static pthread_once_t memory_dirfd_once = PTHREAD_ONCE_INIT;
+static int memory_dirfd = -ENOENT;
+
+/* Errors accessing the files of single memblocks may repeat for each block */
+static NvPdLogRateLimit sysfs_error_rate_limit =
+    NVPD_LOG_RATE_LIMIT_INIT(1000, 10);
+
 static
-int read_string_from_file(const char *path_to_file, char *read_buffer,
-                          size_t read_buffer_size)
+void open_memory_dirfd(void)
 {
-    int fd;
-    int read_count = 0;
+    int fd = open(MEMORY_PATH_FMT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-    fd = open(path_to_file, O_RDONLY, S_IRUSR);
+    /* Reported by the callers, as it is checked on startup */
     if (fd < 0) {
-        syslog(LOG_ERR, "NUMA: Failed to open %s: %s\n",
-               path_to_file, strerror(errno));
+        memory_dirfd = -errno;
+        return;
+    }
+
+    memory_dirfd = fd;
+}
+
+/*
+ * Opens a file relative to MEMORY_PATH_FMT, returning the file descriptor or
+ * a negative error code.
+ */
+static
+int sysfs_open(const char *file, int flags)
+{
+    int fd;
+
+    pthread_once(&memory_dirfd_once, open_memory_dirfd);
+
+    if (memory_dirfd < 0)
+        return memory_dirfd;
+
+    fd = openat(memory_dirfd, file, flags | O_CLOEXEC);
+    if (fd < 0)
         return -errno;
+
+    return fd;
+}
+
+/*
+ * Checks that a file exists relative to MEMORY_PATH_FMT, returning 0 or a
+ * negative error code.
+ */
+static
+int sysfs_access(const char *file)
+{
+    pthread_once(&memory_dirfd_once, open_memory_dirfd);
+
+    if (memory_dirfd < 0)
+        return memory_dirfd;
+
+    if (faccessat(memory_dirfd, file, F_OK, 0) != 0)
+        return -errno;
+
+    return 0;
+}
+
+/*
+ * Memblock state files kept open during transitions are taken out of a
+ * budget shared by all concurrent transitions, a fraction of RLIMIT_NOFILE,
+ * so that the daemon never runs out of file descriptors for accepting
+ * clients and opening devices, however many devices are being changed at
+ * once. Blocks beyond the budget have their state file opened on each
+ * access instead.
+ */
+#define STATE_FD_BUDGET_DIVISOR      4
+#define STATE_FD_BUDGET_MAX          16384
+
+static pthread_once_t state_fd_budget_once = PTHREAD_ONCE_INIT;
+static int state_fd_budget;
+static int state_fds_cached;
+
+static
+void init_state_fd_budget(void)
+{
+    struct rlimit rlim;
+    rlim_t limit = 1024;
+
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == 0)
+        limit = (rlim.rlim_cur == RLIM_INFINITY) ?
+                STATE_FD_BUDGET_MAX * STATE_FD_BUDGET_DIVISOR : rlim.rlim_cur;
+
+    state_fd_budget = NV_MIN(limit / STATE_FD_BUDGET_DIVISOR,
+                             STATE_FD_BUDGET_MAX);
+}
+
+/*
+ * Takes a file descriptor out of the budget, returning whether one was left.
+ */
+static
+int reserve_state_fd(void)
+{
+    pthread_once(&state_fd_budget_once, init_state_fd_budget);
+
+    if (__sync_add_and_fetch(&state_fds_cached, 1) > state_fd_budget) {
+        __sync_sub_and_fetch(&state_fds_cached, 1);
+        return 0;
     }
 
-    memset(read_buffer, 0, read_buffer_size);
-    read_count = read(fd, read_buffer, read_buffer_size - 1);
+    return 1;
+}
 
-    close(fd);
+static
+void release_state_fd(void)
+{
+    __sync_sub_and_fetch(&state_fds_cached, 1);
+}
+
+static
+int sysfs_read_fd(int fd, const char *file, char *read_buffer,
+                  size_t read_buffer_size)
+{
+    ssize_t read_count;
+
+    memset(read_buffer, 0, read_buffer_size);
+    read_count = pread(fd, read_buffer, read_buffer_size - 1, 0);
 
     if (read_count <= 0) {
-        syslog(LOG_ERR, "NUMA: Failed to read %s: %s\n", path_to_file,
-               strerror(errno));
-        return -errno;
+        SYSLOG_RATE_LIMITED(&sysfs_error_rate_limit, LOG_ERR,
+                            "NUMA: Failed to read " MEMORY_PATH_FMT "/%s: %s\n",
+                            file, strerror(errno));
+        return (read_count < 0) ? -errno : -EIO;
     }
 
     /* Trim trailing newlines */
-    while (read_buffer[read_count - 1] == '\n') {
+    while ((read_count > 0) && (read_buffer[read_count - 1] == '\n')) {
         read_count--;
     }
 
@@ -251,55 +477,234 @@ int read_string_from_file(const char *path_to_file, char *read_buffer,
 }
 
 static
-int write_string_to_file(const char *path_to_file, const char *write_buffer,
+int sysfs_write_fd(int fd, const char *write_buffer, size_t strLength)
+{
+    ssize_t write_count;
+
+    write_count = pwrite(fd, write_buffer, strLength, 0);
+
+    if (write_count < 0) {
+        return -errno;
+    }
+
+    if (write_count < strLength) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static
+int read_string_from_file(const char *file, char *read_buffer,
+                          size_t read_buffer_size)
+{
+    int fd, status;
+
+    fd = sysfs_open(file, O_RDONLY);
+    if (fd < 0) {
+        SYSLOG_RATE_LIMITED(&sysfs_error_rate_limit, LOG_ERR,
+                            "NUMA: Failed to open " MEMORY_PATH_FMT "/%s: %s\n",
+                            file, strerror(-fd));
+        return fd;
+    }
+
+    status = sysfs_read_fd(fd, file, read_buffer, read_buffer_size);
+
+    close(fd);
+
+    return status;
+}
+
+static
+int write_string_to_file(const char *file, const char *write_buffer,
                          size_t strLength)
 {
-    int fd;
-    int write_count;
+    int fd, status;
 
-    fd = open(path_to_file, O_WRONLY | O_TRUNC, S_IWUSR);
+    fd = sysfs_open(file, O_WRONLY | O_TRUNC);
     if (fd < 0) {
-        syslog(LOG_ERR, "NUMA: Failed to open %s: %s\n",
-               path_to_file, strerror(errno));
-        return -errno;
+        SYSLOG_RATE_LIMITED(&sysfs_error_rate_limit, LOG_ERR,
+                            "NUMA: Failed to open " MEMORY_PATH_FMT "/%s: %s\n",
+                            file, strerror(-fd));
+        return fd;
     }
 
-    write_count = write(fd, write_buffer, strLength);
+    status = sysfs_write_fd(fd, write_buffer, strLength);
 
     close(fd);
 
-    if (((write_count > 0) && (write_count < strLength)) || (write_count < 0)) {
-        return -errno;
+    return status;
+}
+
+/*
+ * Reads the current state of a memory block, returning a negative error code
+ * on failure. The state is read from fd if it is an open file descriptor for
+ * the state file, otherwise the file is opened for the read.
+ */
+static
+mem_state_t read_memblock_state(uint32_t mem_block_id, int fd)
+{
+    int status;
+    char buf[BUF_SIZE];
+    char numa_file_path[BUF_SIZE];
+
+    sprintf(numa_file_path, MEMBLK_STATE_FILE_FMT, mem_block_id);
+
+    if (fd >= 0)
+        status = sysfs_read_fd(fd, numa_file_path, buf, sizeof(buf));
+    else
+        status = read_string_from_file(numa_file_path, buf, sizeof(buf));
+
+    if (status < 0)
+        return status;
+
+    return !!strstr(buf, STATE_ONLINE) ?
+           NV_IOCTL_NUMA_STATUS_ONLINE : NV_IOCTL_NUMA_STATUS_OFFLINE;
+}
+
+/*
+ * Gathers the state of all memory blocks of the given memory range.
+ */
+static
+int snapshot_memblocks(uint64_t base_addr,
+                       uint64_t region_gpu_size,
+                       uint64_t memblock_size,
+                       memblock_snapshot_t *snapshot)
+{
+    uint32_t i;
+    int fd, keep_open = 1;
+    char numa_file_path[BUF_SIZE];
+
+    snapshot->start_id = base_addr / memblock_size;
+    snapshot->num_blocks = region_gpu_size / memblock_size;
+    snapshot->memblock_size = memblock_size;
+    snapshot->states = calloc(NV_MAX(snapshot->num_blocks, 1),
+                              sizeof(mem_state_t));
+    snapshot->state_fds = malloc(NV_MAX(snapshot->num_blocks, 1) *
+                                 sizeof(int));
+    snapshot->changed = calloc(NV_MAX(MEMBLK_BITMAP_WORDS(snapshot->num_blocks),
+                                      1), sizeof(uint64_t));
+    if ((snapshot->states == NULL) || (snapshot->state_fds == NULL) ||
+        (snapshot->changed == NULL)) {
+        syslog(LOG_ERR, "NUMA: Failed to allocate memblock snapshot\n");
+        free(snapshot->states);
+        free(snapshot->state_fds);
+        free(snapshot->changed);
+        snapshot->states = NULL;
+        snapshot->state_fds = NULL;
+        snapshot->changed = NULL;
+        snapshot->num_blocks = 0;
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < snapshot->num_blocks; i++) {
+        fd = -1;
+
+        /*
+         * Once the budget or the file descriptors are exhausted, fall back to
+         * opening the state file of the remaining blocks on each access.
+         */
+        if (keep_open && !reserve_state_fd()) {
+            SYSLOG_VERBOSE(LOG_DEBUG,
+                           "NUMA: File descriptor budget exhausted, not "
+                           "keeping the state files of memblocks %u-%u "
+                           "open\n", snapshot->start_id + i,
+                           snapshot->start_id + snapshot->num_blocks - 1);
+            keep_open = 0;
+        }
+
+        if (keep_open) {
+            sprintf(numa_file_path, MEMBLK_STATE_FILE_FMT,
+                    snapshot->start_id + i);
+            fd = sysfs_open(numa_file_path, O_RDWR);
+            if (fd < 0)
+                release_state_fd();
+
+            if ((fd == -EMFILE) || (fd == -ENFILE)) {
+                SYSLOG_VERBOSE(LOG_DEBUG,
+                               "NUMA: Out of file descriptors, not keeping "
+                               "memblock state files open\n");
+                keep_open = 0;
+            }
+        }
+
+        snapshot->state_fds[i] = (fd < 0) ? -1 : fd;
+        snapshot->states[i] = read_memblock_state(snapshot->start_id + i,
+                                                  snapshot->state_fds[i]);
     }
 
     return 0;
 }
 
+static
+void free_memblock_snapshot(memblock_snapshot_t *snapshot)
+{
+    uint32_t i;
+
+    if (snapshot->state_fds != NULL) {
+        for (i = 0; i < snapshot->num_blocks; i++) {
+            if (snapshot->state_fds[i] >= 0) {
+                close(snapshot->state_fds[i]);
+                release_state_fd();
+            }
+        }
+    }
+
+    free(snapshot->states);
+    free(snapshot->state_fds);
+    free(snapshot->changed);
+    snapshot->states = NULL;
+    snapshot->state_fds = NULL;
+    snapshot->changed = NULL;
+    snapshot->num_blocks = 0;
+}
+
+static
+inline int memblock_changed(const memblock_snapshot_t *snapshot,
+                            uint32_t index)
+{
+    return (snapshot->changed[index / 64] >> (index % 64)) & 1;
+}
+
+/*
+ * Blocks of the same bitmap word may be changed from different threads, so
+ * the bitmap is updated atomically.
+ */
+static
+inline void toggle_memblock_changed(memblock_snapshot_t *snapshot,
+                                    uint32_t index)
+{
+    __sync_fetch_and_xor(&snapshot->changed[index / 64],
+                         (uint64_t)1 << (index % 64));
+}
+
 /*
  * Brings memory block online/offline using the sysfs memory-hotplug interface
  *   https://www.kernel.org/doc/Documentation/memory-hotplug.txt
+ *
+ * The current state of the block is taken from the snapshot, which is updated
+ * once the block has been changed.
  */
 static
-int change_memblock_state(uint32_t mem_block_id, mem_state_t new_state)
+int change_memblock_state(memblock_snapshot_t *snapshot, uint32_t index,
+                          mem_state_t new_state)
 {
     int status = 0;
     const char *cmd;
-    mem_state_t cur_state;
-    char buf[BUF_SIZE];
+    mem_state_t cur_state = snapshot->states[index];
+    uint32_t mem_block_id = snapshot->start_id + index;
     char numa_file_path[BUF_SIZE];
 
-    sprintf(numa_file_path, MEMBLK_STATE_PATH_FMT, mem_block_id);
-
-    status = read_string_from_file(numa_file_path, buf, sizeof(buf));
-    if (status < 0)
+    if (cur_state < 0) {
+        status = cur_state;
         goto done;
-
-    cur_state = !!strstr(buf, STATE_ONLINE) ?
-                NV_IOCTL_NUMA_STATUS_ONLINE : NV_IOCTL_NUMA_STATUS_OFFLINE;
+    }
 
     if (cur_state == new_state)
         goto done;
 
+    NVPD_TRACE3(memblock__entry, snapshot->bdf, mem_block_id, new_state);
+
     switch (new_state)
     {
         case NV_IOCTL_NUMA_STATUS_ONLINE:
@@ -312,24 +717,37 @@ int change_memblock_state(uint32_t mem_block_id, mem_state_t new_state)
             return -EINVAL;
     }
 
-    status = write_string_to_file(numa_file_path, cmd, strlen(cmd));
+    if (snapshot->state_fds[index] >= 0) {
+        status = sysfs_write_fd(snapshot->state_fds[index], cmd, strlen(cmd));
+    } else {
+        sprintf(numa_file_path, MEMBLK_STATE_FILE_FMT, mem_block_id);
+        status = write_string_to_file(numa_file_path, cmd, strlen(cmd));
+    }
+
+    NVPD_TRACE4(memblock__return, snapshot->bdf, mem_block_id, new_state,
+                status);
 
-done:
     if (status == 0) {
-        SYSLOG_VERBOSE(LOG_DEBUG,
-                       "NUMA: Successfully changed memblock state of %s to %s\n",
-                       numa_file_path, mem_state_to_string(new_state));
-    }
-    else {
-        SYSLOG_VERBOSE(LOG_DEBUG,
-                       "NUMA: Failed to change state of %s to %s: %s\n",
-                       numa_file_path, mem_state_to_string(new_state),
-                       strerror(-status));
+        snapshot->states[index] = new_state;
+        toggle_memblock_changed(snapshot, index);
+        if (snapshot->progress != NULL)
+            __sync_fetch_and_add(&snapshot->progress->memblocks_done, 1);
+        nvPdLogSummaryAdd(&snapshot->changed_log, mem_block_id, 0);
     }
 
+done:
+    if ((status != 0) && !snapshot->defer_failures)
+        nvPdLogSummaryAdd(&snapshot->failed_log, mem_block_id, status);
+
     return status;
 }
 
+static
+inline int transition_canceled(const memblock_snapshot_t *snapshot)
+{
+    return (snapshot->progress != NULL) && snapshot->progress->cancel;
+}
+
 static
 inline int get_memblock_id_from_dirname(const char *dirname, uint32_t *block_id)
 {
@@ -337,55 +755,262 @@ inline int get_memblock_id_from_dirname(const char *dirname, uint32_t *block_id)
 }
 
 static
-int change_numa_node_state(uint32_t node_id,
-                           uint64_t base_addr, 
-                           uint64_t region_gpu_size, 
-                           uint64_t memblock_size, 
+uint64_t get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Onlines the given range of memblocks, walking backwards to allow placement
+ * into zone movable. Issue discussed here:
+ *   https://patchwork.kernel.org/patch/9625081/
+ *
+ * Returns the last error encountered, if any, or -ECANCELED if the
+ * transition was canceled.
+ */
+static
+int online_memblock_range(memblock_snapshot_t *snapshot, uint32_t first,
+                          uint32_t count)
+{
+    uint32_t index;
+    int status, err_status = 0;
+
+    for (index = first + count; index-- > first;) {
+        if (transition_canceled(snapshot))
+            return -ECANCELED;
+
+        status = change_memblock_state(snapshot, index,
+                                       NV_IOCTL_NUMA_STATUS_ONLINE);
+        if (status != 0)
+            err_status = status;
+    }
+
+    return err_status;
+}
+
+static
+void online_memblock_chunk(void *data)
+{
+    memblock_chunk_t *chunk = data;
+    uint64_t start = get_time_us();
+
+    chunk->status = online_memblock_range(chunk->snapshot, chunk->first,
+                                          chunk->count);
+    chunk->elapsed_us = get_time_us() - start;
+}
+
+/*
+ * Onlines the memblocks of the snapshot from several threads.
+ *
+ * The top block is onlined first, so that ZONE_MOVABLE starts at the end of
+ * the range. The blocks below it are then split into contiguous chunks, and
+ * each chunk is walked backwards by its own thread. On kernels that only
+ * allow a block to be onlined movable when the block above it is movable
+ * already, some writes may be refused while a neighbouring chunk is still in
+ * progress; these blocks are retried with a single backward walk once all of
+ * the chunks are done, at which point that constraint is met. Failures are
+ * only logged once the retry has failed as well.
+ *
+ * Note that the kernel serializes memblock state writes on
+ * device_hotplug_lock, so this only helps where the writes spend time outside
+ * of it. With the writes serialized, as emulated by "make bench", onlining
+ * from 4 threads takes as long as from one; see bench/README.
+ */
+static
+int online_memblocks_parallel(memblock_snapshot_t *snapshot, int threads)
+{
+    NvPdWorkQueue *queue;
+    memblock_chunk_t *chunks;
+    uint32_t i, num_chunks, remaining, num_retried = 0, num_online = 0;
+    int status;
+    uint64_t start = get_time_us();
+
+    remaining = snapshot->num_blocks - 1;
+    num_chunks = NV_MIN((uint32_t)threads, remaining);
+
+    status = change_memblock_state(snapshot, remaining,
+                                   NV_IOCTL_NUMA_STATUS_ONLINE);
+    if (status != 0)
+        return online_memblock_range(snapshot, 0, snapshot->num_blocks);
+
+    chunks = calloc(num_chunks, sizeof(memblock_chunk_t));
+    queue = (chunks != NULL) ? nvPdWorkQueueCreate(num_chunks) : NULL;
+    if (queue == NULL) {
+        syslog(LOG_WARNING,
+               "NUMA: Failed to start memory onlining threads; onlining "
+               "memory from a single thread\n");
+        free(chunks);
+        return online_memblock_range(snapshot, 0, remaining);
+    }
+
+    snapshot->defer_failures = 1;
+
+    for (i = 0; i < num_chunks; i++) {
+        chunks[i].snapshot = snapshot;
+        chunks[i].first = (uint64_t)remaining * i / num_chunks;
+        chunks[i].count = (uint64_t)remaining * (i + 1) / num_chunks -
+                          chunks[i].first;
+
+        if (nvPdWorkQueueSubmit(queue, online_memblock_chunk,
+                                &chunks[i]) != NVPD_SUCCESS) {
+            online_memblock_chunk(&chunks[i]);
+        }
+    }
+
+    /* Wait for all of the chunks to complete */
+    nvPdWorkQueueDestroy(queue);
+
+    for (i = 0; i < num_chunks; i++) {
+        SYSLOG_VERBOSE(LOG_INFO,
+                       "NUMA: Onlined memblocks %"PRIu32"-%"PRIu32
+                       " in %"PRIu64" us\n",
+                       snapshot->start_id + chunks[i].first,
+                       snapshot->start_id + chunks[i].first +
+                       chunks[i].count - 1,
+                       chunks[i].elapsed_us);
+    }
+
+    free(chunks);
+
+    snapshot->defer_failures = 0;
+
+    for (i = remaining; i-- > 0;) {
+        if (transition_canceled(snapshot))
+            return -ECANCELED;
+
+        /* Blocks whose state could not be read are not retried */
+        if (snapshot->states[i] < 0) {
+            nvPdLogSummaryAdd(&snapshot->failed_log, snapshot->start_id + i,
+                              snapshot->states[i]);
+            continue;
+        }
+
+        if (snapshot->states[i] != NV_IOCTL_NUMA_STATUS_OFFLINE)
+            continue;
+
+        num_retried++;
+        status = change_memblock_state(snapshot, i,
+                                       NV_IOCTL_NUMA_STATUS_ONLINE);
+    }
+
+    for (i = 0; i < snapshot->num_blocks; i++) {
+        if (snapshot->states[i] == NV_IOCTL_NUMA_STATUS_ONLINE)
+            num_online++;
+    }
+
+    SYSLOG_VERBOSE(LOG_INFO,
+                   "NUMA: Onlined %"PRIu32" of %"PRIu32" memblocks from %"PRIu32
+                   " threads in %"PRIu64" us (%"PRIu32" retried)\n",
+                   num_online, snapshot->num_blocks, num_chunks,
+                   get_time_us() - start, num_retried);
+
+    /* Report any block that still failed to come online */
+    for (i = 0; i < snapshot->num_blocks; i++) {
+        if (snapshot->states[i] < 0)
+            return snapshot->states[i];
+        if (snapshot->states[i] != NV_IOCTL_NUMA_STATUS_ONLINE)
+            return (status != 0) ? status : -EIO;
+    }
+
+    return 0;
+}
+
+static
+int change_numa_node_state(memblock_snapshot_t *snapshot,
                            mem_state_t new_state)
 {
-    uint32_t memblock_id;
+    uint32_t index;
     int status = 0, err_status = 0;
     uint64_t blocks_changed = 0;
-    uint32_t memblock_start_id = base_addr / memblock_size;
-    uint32_t memblock_end_id = (base_addr + region_gpu_size) / memblock_size - 1;
+    uint64_t memblock_size = snapshot->memblock_size;
+    uint64_t region_gpu_size = snapshot->num_blocks * memblock_size;
 
     SYSLOG_VERBOSE(LOG_DEBUG,
                    "NUMA: memblock ID range: %"PRIu32"-%"PRIu32
                    ", memblock size: 0x%"PRIx64"\n",
-                   memblock_start_id, memblock_end_id, memblock_size);
+                   snapshot->start_id,
+                   snapshot->start_id + snapshot->num_blocks - 1,
+                   memblock_size);
 
-    if (new_state == NV_IOCTL_NUMA_STATUS_ONLINE) {
+    /*
+     * Blocks that are in the requested state already, e.g. those changed by
+     * an earlier attempt that failed partway, are skipped and count as done.
+     */
+    for (index = 0; index < snapshot->num_blocks; index++) {
+        if (snapshot->states[index] == new_state)
+            blocks_changed++;
+    }
 
-        /*
-         * Online ALL memblocks backwards first to allow placement into zone
-         * movable. Issue discussed here:
-         * https://patchwork.kernel.org/patch/9625081/
-         */
-        for (memblock_id = memblock_end_id;
-             memblock_id >= memblock_start_id;
-             memblock_id--) {
-            status = change_memblock_state(memblock_id,
-                                           NV_IOCTL_NUMA_STATUS_ONLINE);
-            if (status == 0)
-                blocks_changed++;
-            else
-                err_status = status;
+    if ((blocks_changed > 0) && (blocks_changed < snapshot->num_blocks)) {
+        SYSLOG_VERBOSE(LOG_INFO,
+                       "NUMA: Resuming: %"PRIu64" of %"PRIu32" memblocks "
+                       "are %s already\n",
+                       blocks_changed, snapshot->num_blocks,
+                       mem_state_to_string(new_state));
+    }
+
+    if (snapshot->progress != NULL) {
+        snapshot->progress->memblock_size = memblock_size;
+        snapshot->progress->memblocks_total = snapshot->num_blocks;
+        snapshot->progress->memblocks_done = blocks_changed;
+    }
+
+    blocks_changed = 0;
+
+    nvPdLogSummaryBegin(&snapshot->changed_log, LOG_DEBUG,
+                        (new_state == NV_IOCTL_NUMA_STATUS_ONLINE) ?
+                            "NUMA: Onlined memblocks" :
+                            "NUMA: Offlined memblocks");
+    nvPdLogSummaryBegin(&snapshot->failed_log, LOG_DEBUG,
+                        (new_state == NV_IOCTL_NUMA_STATUS_ONLINE) ?
+                            "NUMA: Failed to online memblocks" :
+                            "NUMA: Failed to offline memblocks");
+
+    if (new_state == NV_IOCTL_NUMA_STATUS_ONLINE) {
+        if ((numa_config.online_threads > 1) && (snapshot->num_blocks > 2)) {
+            err_status = online_memblocks_parallel(snapshot,
+                                                   numa_config.online_threads);
+        } else {
+            err_status = online_memblock_range(snapshot, 0,
+                                               snapshot->num_blocks);
         }
     }
     else if (new_state == NV_IOCTL_NUMA_STATUS_OFFLINE) {
-        for (memblock_id = memblock_start_id;
-             memblock_id <= memblock_end_id;
-             memblock_id++) {
-            status = change_memblock_state(memblock_id,
-                                           NV_IOCTL_NUMA_STATUS_OFFLINE);
+        for (index = 0; index < snapshot->num_blocks; index++) {
+            if (transition_canceled(snapshot)) {
+                err_status = -ECANCELED;
+                break;
+            }
 
-            if (status == 0)
-                blocks_changed++;
-            else
+            status = change_memblock_state(snapshot, index,
+                                           NV_IOCTL_NUMA_STATUS_OFFLINE);
+            if (status != 0)
                 err_status = status;
         }
     }
 
+    nvPdLogSummaryEnd(&snapshot->changed_log);
+    nvPdLogSummaryEnd(&snapshot->failed_log);
+
+    if (transition_canceled(snapshot)) {
+        syslog(LOG_NOTICE,
+               "NUMA: Changing the state of numa memory to %s canceled after "
+               "%"PRIu32" of %"PRIu32" blocks\n",
+               mem_state_to_string(new_state),
+               snapshot->progress->memblocks_done, snapshot->num_blocks);
+        return -ECANCELED;
+    }
+
+    /* Verify the final state of the range against the snapshot */
+    for (index = 0; index < snapshot->num_blocks; index++) {
+        if (snapshot->states[index] == new_state)
+            blocks_changed++;
+    }
+
     /*
      * If not all of the requested blocks were changed, fail onlining
      */
@@ -406,116 +1031,540 @@ int change_numa_node_state(uint32_t node_id,
         return -ENOMEM;
     }
 
-    return 0;
+    return 0;
+}
+
+/*
+ * Retires the pages of device memory reported by the driver, through a single
+ * open hard offline file. The retired pages are logged in one record once
+ * done, rather than one record per page.
+ *
+ * The driver reports at most NV_IOCTL_NUMA_INFO_MAX_OFFLINE_ADDRESSES pages,
+ * and the ioctl interface has no way to ask for the pages beyond these; a
+ * full list is reported as possibly incomplete.
+ */
+static
+int offline_blacklisted_pages(nv_offline_addresses_t *blacklist_addresses)
+{
+    uint32_t index, num_entries;
+    int fd;
+    int status = 0;
+    size_t len = 0;
+    char blacklisted_addr_str[BUF_SIZE];
+    char summary[NV_IOCTL_NUMA_INFO_MAX_OFFLINE_ADDRESSES * 20];
+
+    num_entries = NV_MIN(blacklist_addresses->numEntries,
+                         ARRAY_LEN(blacklist_addresses->addresses));
+    if (num_entries == 0)
+        return 0;
+
+    fd = sysfs_open(MEMORY_HARD_OFFLINE_FILE, O_WRONLY);
+    if (fd < 0) {
+        syslog(LOG_ERR, "NUMA: Failed to open " MEMORY_PATH_FMT "/"
+               MEMORY_HARD_OFFLINE_FILE ": %s\n", strerror(-fd));
+        return fd;
+    }
+
+    summary[0] = '\0';
+
+    for (index = 0; index < num_entries; index++) {
+
+        sprintf(blacklisted_addr_str, "0x%"PRIx64,
+                blacklist_addresses->addresses[index]);
+
+        status = sysfs_write_fd(fd, blacklisted_addr_str,
+                                strlen(blacklisted_addr_str));
+        if (status < 0) {
+            syslog(LOG_ERR,
+                   "NUMA: Failed to retire memory address %s: %s\n",
+                   blacklisted_addr_str, strerror(-status));
+            break;
+        }
+
+        len += snprintf(summary + len, sizeof(summary) - len, "%s%s",
+                        (index > 0) ? " " : "", blacklisted_addr_str);
+    }
+
+    close(fd);
+
+    syslog(LOG_NOTICE,
+           "NUMA: Retired %"PRIu32" of %"PRIu32" memory pages%s%s\n",
+           index, num_entries, (index > 0) ? ": " : "", summary);
+
+    if (num_entries == ARRAY_LEN(blacklist_addresses->addresses)) {
+        syslog(LOG_WARNING,
+               "NUMA: The driver reported the maximum of %"PRIu32" retired "
+               "memory pages; more pages may be retired than can be "
+               "reported\n", num_entries);
+    }
+
+    return status;
+}
+
+/*
+ * Memory hotplug environment
+ *
+ * How the kernel hotplugs memory does not change while the daemon runs, so
+ * it is probed once, ideally on startup, rather than rediscovered by every
+ * transition. Each transition then skips the steps the system does not need,
+ * and configurations that cannot work are rejected before any memory is
+ * probed or onlined.
+ */
+typedef enum {
+    AUTO_ONLINE_UNKNOWN = 0,    /* no auto_online_blocks file */
+    AUTO_ONLINE_OFFLINE,        /* hotplugged memory is left offline */
+    AUTO_ONLINE_DEFAULT_ZONE,   /* onlined into the default zone */
+    AUTO_ONLINE_KERNEL,         /* onlined into a kernel zone */
+    AUTO_ONLINE_MOVABLE,        /* onlined into ZONE_MOVABLE */
+} auto_online_policy_t;
+
+typedef struct {
+    int status;                 /* why memory hotplug is unusable, or 0 */
+    int has_probe_file;         /* memory is probed by the daemon */
+    auto_online_policy_t auto_online;
+    char auto_online_str[BUF_SIZE];
+    int movable_zone;           /* 1 if supported, 0 if not, -1 if unknown */
+    uint64_t memblock_size;     /* 0 if unknown */
+} hotplug_env_t;
+
+static pthread_once_t hotplug_env_once = PTHREAD_ONCE_INIT;
+static hotplug_env_t hotplug_env;
+
+/*
+ * Reads a file relative to MEMORY_PATH_FMT without logging failures, for
+ * files that older kernels do not have.
+ */
+static
+int sysfs_read_optional(const char *file, char *read_buffer,
+                        size_t read_buffer_size)
+{
+    int fd, status;
+
+    fd = sysfs_open(file, O_RDONLY);
+    if (fd < 0)
+        return fd;
+
+    status = sysfs_read_fd(fd, file, read_buffer, read_buffer_size);
+
+    close(fd);
+
+    return status;
+}
+
+/*
+ * Finds out whether memory can be onlined as movable, from the valid_zones
+ * file of any memblock; the file only exists with memory hot-remove support.
+ */
+static
+int probe_movable_zone(void)
+{
+    DIR *dir;
+    struct dirent *entry;
+    uint32_t block_id;
+    char valid_zones_file[BUF_SIZE];
+    int fd, movable_zone = -1;
+
+    fd = openat(memory_dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (get_memblock_id_from_dirname(entry->d_name, &block_id) < 0)
+            continue;
+
+        sprintf(valid_zones_file, MEMBLK_VALID_ZONES_FILE_FMT, block_id);
+        movable_zone = (sysfs_access(valid_zones_file) == 0);
+        break;
+    }
+
+    closedir(dir);
+
+    return movable_zone;
+}
+
+static
+void probe_hotplug_env(void)
+{
+    char buf[BUF_SIZE];
+    char *end;
+
+    hotplug_env.movable_zone = -1;
+
+    pthread_once(&memory_dirfd_once, open_memory_dirfd);
+    if (memory_dirfd < 0) {
+        hotplug_env.status = memory_dirfd;
+        SYSLOG_VERBOSE(LOG_INFO, "NUMA: Memory hotplug is not available: "
+                       "%s: %s\n", MEMORY_PATH_FMT, strerror(-memory_dirfd));
+        return;
+    }
+
+    /*
+     * It is normal for the 'probe' file not to exist on systems where the
+     * driver handles probe of the NUMA memory.
+     */
+    hotplug_env.has_probe_file = (sysfs_access(MEMORY_PROBE_FILE) == 0);
+
+    if (sysfs_read_optional(AUTO_ONLINE_FILE, hotplug_env.auto_online_str,
+                            sizeof(hotplug_env.auto_online_str)) == 0) {
+        if (strcmp(hotplug_env.auto_online_str, "offline") == 0)
+            hotplug_env.auto_online = AUTO_ONLINE_OFFLINE;
+        else if (strcmp(hotplug_env.auto_online_str, "online_kernel") == 0)
+            hotplug_env.auto_online = AUTO_ONLINE_KERNEL;
+        else if (strcmp(hotplug_env.auto_online_str, "online_movable") == 0)
+            hotplug_env.auto_online = AUTO_ONLINE_MOVABLE;
+        else if (strcmp(hotplug_env.auto_online_str, "online") == 0)
+            hotplug_env.auto_online = AUTO_ONLINE_DEFAULT_ZONE;
+    } else {
+        strcpy(hotplug_env.auto_online_str, "unknown");
+    }
+
+    hotplug_env.movable_zone = probe_movable_zone();
+
+    if (sysfs_read_optional(MEMORY_BLOCK_SIZE_FILE, buf, sizeof(buf)) == 0) {
+        hotplug_env.memblock_size = strtoull(buf, &end, 16);
+        if ((end == buf) || (*end != '\0'))
+            hotplug_env.memblock_size = 0;
+    }
+
+    SYSLOG_VERBOSE(LOG_INFO, "NUMA: Memory hotplug: memblock size 0x%"PRIx64
+                   ", %s probe file, auto-online policy %s, movable zone %s\n",
+                   hotplug_env.memblock_size,
+                   hotplug_env.has_probe_file ? "with" : "without",
+                   hotplug_env.auto_online_str,
+                   (hotplug_env.movable_zone > 0) ? "supported" :
+                   (hotplug_env.movable_zone == 0) ? "not supported" :
+                                                     "unknown");
+}
+
+/*
+ * nvNumaProbeEnvironment() - probes how the kernel hotplugs memory, unless
+ * it was already. Transitions probe it on first use otherwise.
+ */
+void nvNumaProbeEnvironment(void)
+{
+    pthread_once(&hotplug_env_once, probe_hotplug_env);
+}
+
+/*
+ * Checks that the device NUMA memory described by the driver can be onlined
+ * on this system, before anything is changed.
+ */
+static
+int check_hotplug_env(NvCfgPciDevice *pci_info,
+                      const nv_ioctl_numa_info_t *numa_info_params)
+{
+    nvNumaProbeEnvironment();
+
+    if (hotplug_env.status < 0) {
+        syslog_device(pci_info, LOG_ERR,
+                      "NUMA: Memory hotplug is not available: %s: %s\n",
+                      MEMORY_PATH_FMT, strerror(-hotplug_env.status));
+        return hotplug_env.status;
+    }
+
+    if ((hotplug_env.memblock_size != 0) &&
+        (hotplug_env.memblock_size != numa_info_params->memblock_size)) {
+        syslog_device(pci_info, LOG_ERR,
+                      "NUMA: Device memblock size 0x%"PRIx64" does not "
+                      "match the memblock size 0x%"PRIx64" of the kernel\n",
+                      numa_info_params->memblock_size,
+                      hotplug_env.memblock_size);
+        return -EINVAL;
+    }
+
+    if (hotplug_env.movable_zone == 0) {
+        syslog_device(pci_info, LOG_ERR,
+                      "NUMA: The kernel does not support memory hot-remove, "
+                      "so device memory cannot be onlined as movable\n");
+        return -ENOTSUP;
+    }
+
+    if (hotplug_env.auto_online == AUTO_ONLINE_KERNEL) {
+        syslog_device(pci_info, LOG_ERR,
+                      "NUMA: The kernel onlines hotplugged memory into a "
+                      "zone that is not movable (" MEMORY_PATH_FMT "/"
+                      AUTO_ONLINE_FILE " is %s). Please check if the "
+                      "CONFIG_MEMORY_HOTPLUG_DEFAULT_ONLINE kernel config "
+                      "option or the memhp_default_state kernel parameter "
+                      "is set.\n", hotplug_env.auto_online_str);
+        return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+static
+int probe_node_memory(uint64_t probe_base_addr, uint64_t region_gpu_size,
+                      uint64_t memblock_size)
+{
+    int status = 0;
+    int memory_num;
+    int probe_fd;
+    char start_addr_str[BUF_SIZE];
+    uint64_t start_addr, numa_end_addr;
+    NvPdLogSummary probed_log, already_probed_log;
+
+    numa_end_addr = probe_base_addr + region_gpu_size;
+
+    if ((!NV_IS_ALIGNED(probe_base_addr, memblock_size)) ||
+        (!NV_IS_ALIGNED(numa_end_addr, memblock_size))) {
+        syslog(LOG_ERR, "NUMA: Probe ranges not aligned to memblock size!\n");
+        return -EFAULT;
+    }
+
+    /* Without a 'probe' file, the driver handles probe of the NUMA memory */
+    if (!hotplug_env.has_probe_file)
+        return 0;
+
+    probe_fd = sysfs_open(MEMORY_PROBE_FILE, O_WRONLY);
+    if (probe_fd < 0) {
+        syslog(LOG_ERR, "NUMA: Failed to open " MEMORY_PATH_FMT "/"
+               MEMORY_PROBE_FILE ": %s\n", strerror(-probe_fd));
+        return probe_fd;
+    }
+
+    nvPdLogSummaryBegin(&probed_log, LOG_DEBUG, "NUMA: Probed memblocks");
+    nvPdLogSummaryBegin(&already_probed_log, LOG_INFO,
+                        "NUMA: Memblocks already probed");
+
+    /*
+     * A successful probe creates the memblock, and the snapshot of the range
+     * taken next fails for any memblock that is missing, so the memblocks are
+     * not checked for one by one here.
+     */
+    for (start_addr = probe_base_addr;
+         start_addr + memblock_size <= numa_end_addr;
+         start_addr += memblock_size) {
+
+        sprintf(start_addr_str, "0x%"PRIx64, start_addr);
+
+        status = sysfs_write_fd(probe_fd, start_addr_str,
+                                strlen(start_addr_str));
+
+        memory_num = start_addr / memblock_size;
+
+        if (status == -EEXIST) {
+            nvPdLogSummaryAdd(&already_probed_log, memory_num, 0);
+            status = 0;
+            continue;
+        } else if (status < 0) {
+            syslog(LOG_ERR,
+                   "NUMA: Failed to probe memory address %s: %s\n",
+                   start_addr_str, strerror(-status));
+            goto done;
+        }
+
+        nvPdLogSummaryAdd(&probed_log, memory_num, 0);
+    }
+
+done:
+    nvPdLogSummaryEnd(&probed_log);
+    nvPdLogSummaryEnd(&already_probed_log);
+
+    close(probe_fd);
+
+    return status;
+}
+
+/*
+ * Undoes a failed or canceled transition of the device NUMA memory by moving
+ * only the memblocks that the transition changed, as recorded in the snapshot,
+ * back to restore_state; blocks that were in the target state before it
+ * started are left alone. Blocks that fail to change back keep their bit set,
+ * and are left to a later attempt. Blocks are onlined backwards, as when
+ * onlining the whole range, to keep them movable.
+ */
+static
+int rollback_memory(int fd, memblock_snapshot_t *snapshot,
+                    mem_state_t restore_state)
+{
+    uint32_t i, index, num_changed = 0, num_failed = 0;
+    int status, err_status = 0;
+    int online = (restore_state == NV_IOCTL_NUMA_STATUS_ONLINE);
+    mem_state_t in_progress = online ?
+                              NV_IOCTL_NUMA_STATUS_ONLINE_IN_PROGRESS :
+                              NV_IOCTL_NUMA_STATUS_OFFLINE_IN_PROGRESS;
+    const char *undone = online ? "offlined" : "onlined";
+
+    status = set_gpu_numa_status(fd, snapshot->bdf, in_progress);
+    if (status < 0) {
+        syslog(LOG_ERR,
+               "NUMA: Failed to set NUMA status to %s\n",
+               mem_state_to_string(in_progress));
+        return status;
+    }
+
+    /* The rollback is neither tracked nor canceled */
+    snapshot->progress = NULL;
+
+    nvPdLogSummaryBegin(&snapshot->changed_log, LOG_DEBUG,
+                        "NUMA: Rolled back memblocks");
+    nvPdLogSummaryBegin(&snapshot->failed_log, LOG_DEBUG,
+                        "NUMA: Failed to roll back memblocks");
+
+    for (i = 0; i < snapshot->num_blocks; i++) {
+        index = online ? (snapshot->num_blocks - 1 - i) : i;
+
+        if (!memblock_changed(snapshot, index))
+            continue;
+
+        num_changed++;
+
+        status = change_memblock_state(snapshot, index, restore_state);
+        if (status != 0) {
+            num_failed++;
+            err_status = status;
+        }
+    }
+
+    nvPdLogSummaryEnd(&snapshot->changed_log);
+    nvPdLogSummaryEnd(&snapshot->failed_log);
+
+    if (num_failed > 0) {
+        syslog(LOG_ERR,
+               "NUMA: Failed to roll back %"PRIu32" of %"PRIu32
+               " %s memblocks\n", num_failed, num_changed, undone);
+    } else {
+        SYSLOG_VERBOSE(LOG_INFO,
+                       "NUMA: Rolled back %"PRIu32" %s memblocks\n",
+                       num_changed, undone);
+    }
+
+    return err_status;
 }
 
+/*
+ * Sets the size of the pool of huge pages of size_kb on node nid, returning
+ * the resulting size of the pool or a negative error code. The kernel may
+ * reserve fewer pages than asked for, if the node has too little contiguous
+ * free memory.
+ */
 static
-int offline_blacklisted_pages(nv_offline_addresses_t *blacklist_addresses)
+int set_node_hugepages(int nid, unsigned int size_kb, unsigned int count)
 {
-    int index;
-    int status = 0;
-    char blacklisted_addr_str[BUF_SIZE];
+    char path[PATH_MAX];
+    char buf[BUF_SIZE];
+    ssize_t len;
+    int fd, status = 0;
 
-    for (index = 0; index < blacklist_addresses->numEntries; index++) {
+    snprintf(path, sizeof(path), NODE_HUGEPAGES_PATH_FMT, nid, size_kb);
 
-        sprintf(blacklisted_addr_str, "0x%"PRIx64,
-                blacklist_addresses->addresses[index]);
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
 
-        SYSLOG_VERBOSE(LOG_NOTICE,
-                       "NUMA: retiring memory address %s\n",
-                       blacklisted_addr_str);
+    len = snprintf(buf, sizeof(buf), "%u", count);
+    if (pwrite(fd, buf, len, 0) != len) {
+        status = -errno;
+        goto done;
+    }
 
-        status = write_string_to_file(MEMORY_HARD_OFFLINE_PATH_FMT,
-                                      blacklisted_addr_str,
-                                      strlen(blacklisted_addr_str));
-        if (status < 0) {
-            syslog(LOG_ERR,
-                   "NUMA: Failed to retire memory address %s: %s\n",
-                   blacklisted_addr_str, strerror(-status));
-            return status;
-        }
+    memset(buf, 0, sizeof(buf));
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+        status = (len < 0) ? -errno : -EIO;
+        goto done;
     }
 
+    status = atoi(buf);
+
+done:
+    close(fd);
     return status;
 }
 
+/*
+ * Reserves count huge pages of the i-th size on node nid. Failing to reserve
+ * them is only reported.
+ */
 static
-int probe_node_memory(uint64_t probe_base_addr, uint64_t region_gpu_size,
-                      uint64_t memblock_size)
+void reserve_node_hugepage_pool(NvCfgPciDevice *pci_info, int nid, int i,
+                                unsigned int count)
 {
-    int status = 0;
-    int memory_num;
-    char start_addr_str[BUF_SIZE];
-    char memory_file_str[BUF_SIZE];
-    uint64_t start_addr, numa_end_addr;
-
-    numa_end_addr = probe_base_addr + region_gpu_size;
+    int status;
 
-    if ((!NV_IS_ALIGNED(probe_base_addr, memblock_size)) ||
-        (!NV_IS_ALIGNED(numa_end_addr, memblock_size))) {
-        syslog(LOG_ERR, "NUMA: Probe ranges not aligned to memblock size!\n");
-        return -EFAULT;
+    status = set_node_hugepages(nid, hugepage_sizes_kb[i], count);
+    if (status < 0) {
+        syslog_device(pci_info, LOG_WARNING,
+                      "NUMA: Failed to reserve %u %u kB huge pages on "
+                      "node%d: %s\n", count, hugepage_sizes_kb[i], nid,
+                      strerror(-status));
+    } else if ((unsigned int)status < count) {
+        syslog_device(pci_info, LOG_WARNING,
+                      "NUMA: Reserved only %d of %u %u kB huge pages on "
+                      "node%d\n", status, count, hugepage_sizes_kb[i],
+                      nid);
+    } else {
+        SYSLOG_VERBOSE(LOG_INFO,
+                       "NUMA: Reserved %u %u kB huge pages on node%d\n",
+                       count, hugepage_sizes_kb[i], nid);
     }
+}
 
-    if (access(MEMORY_PROBE_PATH_FMT, F_OK) != 0 && errno == ENOENT)
-        /*
-         * It is not an error when the 'probe' file is not found, since this
-         * situation is normal for systems where the driver handles probe of
-         * the NUMA memory.
-         */
-        goto done;
-
-    for (start_addr = probe_base_addr;
-         start_addr + memblock_size <= numa_end_addr;
-         start_addr += memblock_size) {
-
-        sprintf(start_addr_str, "0x%"PRIx64, start_addr);
-
-        SYSLOG_VERBOSE(LOG_DEBUG, "NUMA: Probing memory address %s\n",
-                       start_addr_str);
+/*
+ * Reserves the configured pools of huge pages on the node of the device
+ * memory just onlined, so that applications find them ready. Failing to
+ * reserve the pools does not fail onlining.
+ */
+static
+void reserve_node_hugepages(NvCfgPciDevice *pci_info, int nid,
+                            const unsigned int *hugepages)
+{
+    int i;
 
-        status = write_string_to_file(MEMORY_PROBE_PATH_FMT, start_addr_str,
-                                      strlen(start_addr_str));
+    for (i = 0; i < NV_NUMA_NUM_HUGEPAGE_SIZES; i++) {
+        if (hugepages[i] == 0)
+            continue;
 
-        memory_num = start_addr / memblock_size;
-        sprintf(memory_file_str, MEMBLK_DIR_PATH_FMT, memory_num);
+        reserve_node_hugepage_pool(pci_info, nid, i, hugepages[i]);
+    }
+}
 
-        /* Check if memory node was created */
-        if (access(memory_file_str, F_OK) != 0) {
-            syslog(LOG_ERR,
-                   "NUMA: Failed to verify memory node %d was probed: %s\n",
-                   memory_num, strerror(errno));
-            status = -errno;
-            goto done;
-        }
+/*
+ * Releases the pools reserved by reserve_node_hugepages(), so that the memory
+ * backing them can be offlined. Pages still in use by applications are not
+ * released, in which case offlining fails as it would otherwise.
+ */
+static
+void release_node_hugepages(int nid, const unsigned int *hugepages)
+{
+    int i, status;
 
-        if (status == -EEXIST) {
-            SYSLOG_VERBOSE(LOG_INFO,
-                           "NUMA: Memory address %s already probed\n",
-                           start_addr_str);
-            status = 0;
+    for (i = 0; i < NV_NUMA_NUM_HUGEPAGE_SIZES; i++) {
+        if (hugepages[i] == 0)
             continue;
-        } else if (status < 0) {
-            syslog(LOG_ERR,
-                   "NUMA: Failed to probe memory address %s: %s\n",
-                   start_addr_str, strerror(-status));
-            goto done;
+
+        status = set_node_hugepages(nid, hugepage_sizes_kb[i], 0);
+        if (status < 0) {
+            syslog(LOG_WARNING,
+                   "NUMA: Failed to release %u kB huge pages on node%d: %s\n",
+                   hugepage_sizes_kb[i], nid, strerror(-status));
+        } else if (status > 0) {
+            syslog(LOG_WARNING,
+                   "NUMA: %d %u kB huge pages on node%d are still in use\n",
+                   status, hugepage_sizes_kb[i], nid);
         }
     }
-
-done:
-    return status;
 }
 
 static
-int offline_memory(int fd)
+int offline_memory(int fd, uint32_t bdf, const unsigned int *hugepages,
+                   NvNumaProgress *progress, NvPdHistogram *stats)
 {
     int status = 0;
+    uint64_t start;
     nv_ioctl_numa_info_t numa_info_params;
+    memblock_snapshot_t snapshot = { 0 };
 
     memset(&numa_info_params, 0, sizeof(numa_info_params));
 
-    status = get_gpu_numa_info(fd, &numa_info_params);
+    status = get_gpu_numa_info(fd, bdf, &numa_info_params);
     if (status < 0)
     {
         syslog(LOG_ERR, "NUMA: Failed to get device NUMA info\n");
@@ -542,7 +1591,11 @@ int offline_memory(int fd)
             goto driver_fail;
     }
 
-    status = set_gpu_numa_status(fd, NV_IOCTL_NUMA_STATUS_OFFLINE_IN_PROGRESS);
+    if ((numa_info_params.nid >= 0) && (hugepages != NULL))
+        release_node_hugepages(numa_info_params.nid, hugepages);
+
+    status = set_gpu_numa_status(fd, bdf,
+                                 NV_IOCTL_NUMA_STATUS_OFFLINE_IN_PROGRESS);
     if (status < 0) {
         syslog(LOG_ERR,
                "NUMA: Failed to set NUMA status to %s\n",
@@ -550,11 +1603,46 @@ int offline_memory(int fd)
         goto driver_fail;
     }
 
-    status = change_numa_node_state(numa_info_params.nid,
-                                    numa_info_params.numa_mem_addr,
-                                    numa_info_params.numa_mem_size,
-                                    numa_info_params.memblock_size,
-                                    NV_IOCTL_NUMA_STATUS_OFFLINE);
+    snapshot.bdf = bdf;
+    status = snapshot_memblocks(numa_info_params.numa_mem_addr,
+                                numa_info_params.numa_mem_size,
+                                numa_info_params.memblock_size,
+                                &snapshot);
+    if (status < 0) {
+        goto offline_failed;
+    }
+
+    snapshot.progress = progress;
+
+    start = nvPdStatsTime();
+    status = change_numa_node_state(&snapshot, NV_IOCTL_NUMA_STATUS_OFFLINE);
+    nvPdStatsRecordDevice(stats, NVPD_PHASE_CHANGE_NODE_STATE, start);
+
+    /*
+     * A canceled offlining brings back online the blocks it offlined, so that
+     * the memory is left online, as it was, for the device to stay in use or
+     * to be offlined or adopted again later.
+     */
+    if (status == -ECANCELED) {
+        status = rollback_memory(fd, &snapshot, NV_IOCTL_NUMA_STATUS_ONLINE);
+        free_memblock_snapshot(&snapshot);
+        if (status < 0)
+            goto offline_failed;
+
+        status = set_gpu_numa_status(fd, bdf, NV_IOCTL_NUMA_STATUS_ONLINE);
+        if (status < 0) {
+            syslog(LOG_ERR, "NUMA: Failed to set NUMA status to %s\n",
+                   mem_state_to_string(NV_IOCTL_NUMA_STATUS_ONLINE));
+            goto offline_failed;
+        }
+
+        syslog(LOG_NOTICE,
+               "NUMA: Memory offlining canceled, memory left online\n");
+        return -ECANCELED;
+    }
+
+    free_memblock_snapshot(&snapshot);
+
     if (status < 0) {
         syslog(LOG_ERR, "NUMA: Changing node%d state to %s failed\n",
                numa_info_params.nid,
@@ -562,7 +1650,7 @@ int offline_memory(int fd)
         goto offline_failed;
     }
 
-    status = set_gpu_numa_status(fd, NV_IOCTL_NUMA_STATUS_OFFLINE);
+    status = set_gpu_numa_status(fd, bdf, NV_IOCTL_NUMA_STATUS_OFFLINE);
     if (status < 0) {
         syslog(LOG_ERR, "NUMA: Failed to set NUMA status to %s\n",
                mem_state_to_string(NV_IOCTL_NUMA_STATUS_OFFLINE));
@@ -574,7 +1662,7 @@ int offline_memory(int fd)
     return 0;
 
 offline_failed:
-    if (set_gpu_numa_status(fd, NV_IOCTL_NUMA_STATUS_OFFLINE_FAILED) < 0) {
+    if (set_gpu_numa_status(fd, bdf, NV_IOCTL_NUMA_STATUS_OFFLINE_FAILED) < 0) {
         syslog(LOG_ERR, "NUMA: Failed to set NUMA status to %s\n",
                mem_state_to_string(NV_IOCTL_NUMA_STATUS_OFFLINE_FAILED));
     }
@@ -591,56 +1679,36 @@ driver_fail:
     "/lib/udev/rules.d/."
 
 static
-int check_memory_auto_online(uint32_t node_id, 
-                             uint64_t base_addr, 
-                             uint64_t region_gpu_size, 
-                             uint64_t memblock_size,
+int check_memory_auto_online(uint32_t node_id,
+                             memblock_snapshot_t *snapshot,
                              NvCfgBool *auto_online_success)
 {
-    DIR     *dir_ptr;
     int     status = 0;
     char    read_buf[BUF_SIZE];
-    char    numa_file_path[BUF_SIZE];
     char    memory_file_path[BUF_SIZE];
-    int     num_memory_node_in_dir = 0;
     int     num_memory_online_movable = 0;
-    uint32_t block_id;
-    uint32_t memblock_start_id = base_addr / memblock_size;
-    uint32_t memblock_end_id = (base_addr + region_gpu_size) / memblock_size - 1;
+    uint32_t index, block_id;
 
     *auto_online_success = NVCFG_FALSE;
 
-    sprintf(numa_file_path, NID_PATH_FMT, node_id);
-
-    dir_ptr = opendir(numa_file_path);
-    if (!dir_ptr) {
-        syslog(LOG_ERR, "NUMA: Failed to open directory %s: %s\n",
-               numa_file_path, strerror(errno));
-        return -errno;
-    }
-
     /* Iterate through the blocks */
-    for (block_id = memblock_start_id; block_id <= memblock_end_id; block_id++) {
-
-        num_memory_node_in_dir++;
+    for (index = 0; index < snapshot->num_blocks; index++) {
 
-        sprintf(memory_file_path, MEMBLK_STATE_PATH_FMT, block_id);
+        block_id = snapshot->start_id + index;
 
-        status = read_string_from_file(memory_file_path,
-                                       read_buf, sizeof(read_buf));
-        if (status < 0) {
+        if (snapshot->states[index] < 0) {
             syslog(LOG_ERR,
                    "NUMA: Failed to read " MEMBLK_FILE_FMT " state\n", block_id);
-            goto cleanup;
+            return snapshot->states[index];
         }
 
         /* Check if state has already been auto onlined */
-        if (strstr(read_buf, STATE_ONLINE)) {
+        if (snapshot->states[index] == NV_IOCTL_NUMA_STATUS_ONLINE) {
 
             SYSLOG_VERBOSE(LOG_NOTICE,
                            "NUMA: Device NUMA memory is already online\n");
 
-            sprintf(memory_file_path, MEMBLK_VALID_ZONES_PATH_FMT, block_id);
+            sprintf(memory_file_path, MEMBLK_VALID_ZONES_FILE_FMT, block_id);
 
             status = read_string_from_file(memory_file_path,
                                            read_buf, sizeof(read_buf));
@@ -648,15 +1716,14 @@ int check_memory_auto_online(uint32_t node_id,
                 syslog(LOG_ERR,
                        "NUMA: Failed to read " MEMBLK_FILE_FMT " valid_zones\n",
                        block_id);
-                goto cleanup;
+                return status;
             }
 
             /* If memory was auto-onlined, check if valid_zones is Movable */
             if (strstr(read_buf, VALID_MOVABLE_STATE) != read_buf) {
                 syslog(LOG_NOTICE, MEMORY_AUTO_ONLINE_WARNING_FMT,
                        block_id, read_buf);
-                status = -ENOTSUP;
-                break;
+                return -ENOTSUP;
             } else {
                 num_memory_online_movable++;
             }
@@ -664,23 +1731,254 @@ int check_memory_auto_online(uint32_t node_id,
     }
 
     /* Check if any memory nodes exist */
-    if (num_memory_node_in_dir == 0) {
+    if (snapshot->num_blocks == 0) {
         syslog(LOG_ERR,
                "NUMA: No memory nodes in node%d directory!\n", node_id);
-        status = -ENOENT;
-        goto cleanup;
+        return -ENOENT;
     }
 
     /* Check if all the memory are set to online movable */
-    if (num_memory_online_movable == num_memory_node_in_dir) {
+    if (num_memory_online_movable == snapshot->num_blocks) {
         *auto_online_success = NVCFG_TRUE;
     }
 
-cleanup:
-    closedir(dir_ptr);
     return status;
 }
 
+/*
+ * CPU placement
+ *
+ * Onlining and offlining memory does the page migration and hotplug work in
+ * the context of the calling thread, so threads working on a device are
+ * bound to the CPUs local to it. Memory the daemon allocates from those
+ * threads is then also local to the device, as the kernel places pages on
+ * the node of the CPU that first touches them.
+ */
+static pthread_once_t process_cpus_once = PTHREAD_ONCE_INIT;
+static cpu_set_t process_cpus;
+static int process_cpus_valid = 0;
+
+static
+void get_process_cpus(void)
+{
+    /* The main thread, which is never bound, has the ID of the process */
+    if (sched_getaffinity(getpid(), sizeof(process_cpus), &process_cpus) == 0)
+        process_cpus_valid = 1;
+}
+
+/*
+ * Parses a CPU list such as "0-3,8-11" into cpus, returning 0 or a negative
+ * error code.
+ */
+static
+int parse_cpulist(const char *cpulist, cpu_set_t *cpus)
+{
+    const char *p = cpulist;
+    char *end;
+    long first, last, cpu;
+
+    CPU_ZERO(cpus);
+
+    while ((*p != '\0') && (*p != '\n')) {
+        first = strtol(p, &end, 10);
+        if ((end == p) || (first < 0))
+            return -EINVAL;
+
+        last = first;
+        p = end;
+
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if ((end == p) || (last < first))
+                return -EINVAL;
+            p = end;
+        }
+
+        for (cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); cpu++)
+            CPU_SET(cpu, cpus);
+
+        if (*p == ',')
+            p++;
+        else if ((*p != '\0') && (*p != '\n'))
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+/*
+ * Determines the CPUs local to the device that the daemon may run on,
+ * returning 0 or a negative error code.
+ */
+static
+int get_local_cpus(NvCfgPciDevice *pci_info, cpu_set_t *cpus)
+{
+    char path[PATH_MAX];
+    char cpulist[CPULIST_BUF_SIZE];
+    FILE *fp;
+    int status;
+
+    pthread_once(&process_cpus_once, get_process_cpus);
+    if (!process_cpus_valid)
+        return -ENOENT;
+
+    snprintf(path, sizeof(path), PCI_LOCAL_CPULIST_PATH_FMT,
+             pci_info->domain, pci_info->bus, pci_info->slot,
+             pci_info->function);
+
+    fp = fopen(path, "r");
+    if (!fp)
+        return -errno;
+
+    status = (fgets(cpulist, sizeof(cpulist), fp) != NULL) ?
+                 parse_cpulist(cpulist, cpus) : -EIO;
+    fclose(fp);
+
+    if (status < 0)
+        return status;
+
+    /* Stay within the CPUs the daemon was started on, e.g., in a cpuset */
+    CPU_AND(cpus, cpus, &process_cpus);
+
+    /*
+     * A device that is not attached to any node lists all CPUs; binding to
+     * them would only give up the CPUs the scheduler would otherwise use.
+     */
+    if ((CPU_COUNT(cpus) == 0) || CPU_EQUAL(cpus, &process_cpus))
+        return -ENODEV;
+
+    return 0;
+}
+
+/*
+ * nvNumaBindToLocalCpus() - binds the calling thread to the CPUs local to the
+ * device. The thread is left as it is if the device has no local CPUs the
+ * daemon may run on.
+ */
+void nvNumaBindToLocalCpus(NvNumaDevice *numa_info)
+{
+    NvCfgPciDevice *pci_info = numa_info->pci_info;
+    cpu_set_t cpus;
+    int status;
+
+    status = get_local_cpus(pci_info, &cpus);
+    if (status < 0) {
+        SYSLOG_VERBOSE(LOG_DEBUG,
+                       "NUMA: Not binding thread for device "
+                       "%04x:%02x:%02x.%x to local CPUs: %s\n",
+                       pci_info->domain, pci_info->bus, pci_info->slot,
+                       pci_info->function, strerror(-status));
+        return;
+    }
+
+    status = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (status != 0) {
+        syslog(LOG_WARNING,
+               "NUMA: Failed to bind thread for device %04x:%02x:%02x.%x "
+               "to local CPUs: %s\n", pci_info->domain, pci_info->bus,
+               pci_info->slot, pci_info->function, strerror(status));
+        return;
+    }
+
+    SYSLOG_VERBOSE(LOG_DEBUG,
+                   "NUMA: Bound thread for device %04x:%02x:%02x.%x to %d "
+                   "local CPUs\n", pci_info->domain, pci_info->bus,
+                   pci_info->slot, pci_info->function, CPU_COUNT(&cpus));
+}
+
+/*
+ * nvNumaUnbindCpus() - lets the calling thread run on any of the CPUs of the
+ * daemon again, after nvNumaBindToLocalCpus().
+ */
+void nvNumaUnbindCpus(void)
+{
+    pthread_once(&process_cpus_once, get_process_cpus);
+    if (!process_cpus_valid)
+        return;
+
+    (void) pthread_setaffinity_np(pthread_self(), sizeof(process_cpus),
+                                  &process_cpus);
+}
+
+/*
+ * nvNumaInitDevice() - initializes the NUMA context of a device, and resolves
+ * its device file once, so that NUMA transitions do not have to look it up in
+ * procfs every time. A failure is not fatal, as the lookup is retried on the
+ * next transition.
+ */
+void nvNumaInitDevice(NvNumaDevice *numa_info, NvCfgPciDevice *pci_info)
+{
+    numa_info->fd = -1;
+    numa_info->minor_number = -1;
+    numa_info->pci_info = pci_info;
+    numa_info->use_auto_online = 0;
+    numa_info->progress = NULL;
+    numa_info->stats = NULL;
+    memcpy(numa_info->hugepages, numa_config.hugepages,
+           sizeof(numa_info->hugepages));
+
+    (void) get_gpu_minor_number_cached(numa_info);
+}
+
+/*
+ * nvNumaOpenDevice() - opens the device file of a device. Returns the file
+ * descriptor, or -1 on failure.
+ */
+int nvNumaOpenDevice(NvNumaDevice *numa_info)
+{
+    int fd;
+
+    if (get_gpu_device_file_fd(numa_info, &fd) < 0)
+        return -1;
+
+    return fd;
+}
+
+/*
+ * nvNumaInvalidateDevice() - drops the cached device file of a device, e.g.,
+ * after the device was reset.
+ */
+void nvNumaInvalidateDevice(NvNumaDevice *numa_info)
+{
+    numa_info->minor_number = -1;
+}
+
+/*
+ * nvNumaSetHugepages() - sets the number of huge pages of each size to
+ * reserve on the node of the device memory. If the memory is online, the
+ * pools are resized right away.
+ */
+void nvNumaSetHugepages(NvNumaDevice *numa_info,
+                        const unsigned int *hugepages)
+{
+    int i;
+
+    for (i = 0; i < NV_NUMA_NUM_HUGEPAGE_SIZES; i++) {
+        if (hugepages[i] == numa_info->hugepages[i])
+            continue;
+
+        numa_info->hugepages[i] = hugepages[i];
+
+        if ((numa_info->fd >= 0) && (numa_info->range.nid >= 0))
+            reserve_node_hugepage_pool(numa_info->pci_info,
+                                       numa_info->range.nid, i,
+                                       hugepages[i]);
+    }
+}
+
+/*
+ * nvNumaSetConfig() - sets the configuration used for all subsequent NUMA
+ * memory transitions.
+ */
+void nvNumaSetConfig(const NvNumaConfig *config)
+{
+    numa_config = *config;
+
+    if (numa_config.online_threads < 1)
+        numa_config.online_threads = 1;
+}
+
 /*! @brief
  *  We assume the physical memory has been allocated from RM before calling this
  *  function.
@@ -689,17 +1987,18 @@ NvPdStatus nvNumaOnlineMemory(NvNumaDevice *numa_info)
 {
     int fd;
     int status = 0;
+    NvPdStatus ret = NVPD_ERR_NUMA_FAILURE;
     NvCfgPciDevice *device_pci_info = numa_info->pci_info;
+    uint32_t bdf = NVPD_TRACE_BDF(device_pci_info);
     NvCfgBool auto_online_success;
+    uint64_t start;
+    int hugepages_reserved = 0;
     nv_ioctl_numa_info_t numa_info_params;
+    memblock_snapshot_t snapshot = { 0 };
 
     memset(&numa_info_params, 0, sizeof(numa_info_params));
 
-    status = get_gpu_device_file_fd(device_pci_info->domain,
-                                    device_pci_info->bus,
-                                    device_pci_info->slot,
-                                    device_pci_info->function,
-                                    &fd);
+    status = get_gpu_device_file_fd(numa_info, &fd);
     if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
@@ -707,7 +2006,7 @@ NvPdStatus nvNumaOnlineMemory(NvNumaDevice *numa_info)
         return NVPD_ERR_NUMA_FAILURE;
     }
 
-    status = get_gpu_numa_info(fd, &numa_info_params);
+    status = get_gpu_numa_info(fd, bdf, &numa_info_params);
     if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
@@ -757,7 +2056,14 @@ NvPdStatus nvNumaOnlineMemory(NvNumaDevice *numa_info)
         goto driver_fail;
     }
 
-    status = set_gpu_numa_status(fd, NV_IOCTL_NUMA_STATUS_ONLINE_IN_PROGRESS);
+    /* Reject systems that cannot online the memory before changing it */
+    status = check_hotplug_env(device_pci_info, &numa_info_params);
+    if (status < 0) {
+        goto driver_fail;
+    }
+
+    status = set_gpu_numa_status(fd, bdf,
+                                 NV_IOCTL_NUMA_STATUS_ONLINE_IN_PROGRESS);
     if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
@@ -777,9 +2083,11 @@ NvPdStatus nvNumaOnlineMemory(NvNumaDevice *numa_info)
         goto error;
     }
 
+    start = nvPdStatsTime();
     status = probe_node_memory(numa_info_params.numa_mem_addr,
                                numa_info_params.numa_mem_size,
                                numa_info_params.memblock_size);
+    nvPdStatsRecordDevice(numa_info->stats, NVPD_PHASE_PROBE_MEMORY, start);
     if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
@@ -787,12 +2095,24 @@ NvPdStatus nvNumaOnlineMemory(NvNumaDevice *numa_info)
         goto online_failed;
     }
 
+    /* Gather the state of the probed memory once for the whole transition */
+    snapshot.bdf = bdf;
+    status = snapshot_memblocks(numa_info_params.numa_mem_addr,
+                                numa_info_params.numa_mem_size,
+                                numa_info_params.memblock_size,
+                                &snapshot);
+    if (status < 0) {
+        goto error;
+    }
+
+    snapshot.progress = numa_info->progress;
+
     /* Check if probed memory has been auto-onlined */
-    status = check_memory_auto_online(numa_info_params.nid,
-                                      numa_info_params.numa_mem_addr,
-                                      numa_info_params.numa_mem_size,
-                                      numa_info_params.memblock_size,
+    start = nvPdStatsTime();
+    status = check_memory_auto_online(numa_info_params.nid, &snapshot,
                                       &auto_online_success);
+    nvPdStatsRecordDevice(numa_info->stats, NVPD_PHASE_CHECK_AUTO_ONLINE,
+                          start);
     if (status < 0) {
         if (status != -ENOTSUP) {
             syslog_device(device_pci_info,
@@ -807,15 +2127,19 @@ NvPdStatus nvNumaOnlineMemory(NvNumaDevice *numa_info)
     if (auto_online_success) {
         syslog_device(device_pci_info, LOG_NOTICE,
                       "NUMA: All device NUMA memory onlined and movable\n");
+        /* Nothing was onlined here, so a failure offlines the whole range */
+        free_memblock_snapshot(&snapshot);
         goto set_driver_status;
     }
 
-    status = change_numa_node_state(numa_info_params.nid,
-                                    numa_info_params.numa_mem_addr,
-                                    numa_info_params.numa_mem_size,
-                                    numa_info_params.memblock_size,
-                                    NV_IOCTL_NUMA_STATUS_ONLINE);
-    if (status < 0) {
+    start = nvPdStatsTime();
+    status = change_numa_node_state(&snapshot, NV_IOCTL_NUMA_STATUS_ONLINE);
+    nvPdStatsRecordDevice(numa_info->stats, NVPD_PHASE_CHANGE_NODE_STATE,
+                          start);
+    if (status == -ECANCELED) {
+        ret = NVPD_ERR_CANCELED;
+        goto online_failed;
+    } else if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
                       "NUMA: Changing node%d state to %s failed\n",
@@ -825,7 +2149,9 @@ NvPdStatus nvNumaOnlineMemory(NvNumaDevice *numa_info)
     }
 
 set_driver_status:
+    start = nvPdStatsTime();
     status = offline_blacklisted_pages(&numa_info_params.offline_addresses);
+    nvPdStatsRecordDevice(numa_info->stats, NVPD_PHASE_RETIRE_PAGES, start);
     if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
@@ -833,7 +2159,11 @@ set_driver_status:
         goto online_failed;
     }
 
-    status = set_gpu_numa_status(fd, NV_IOCTL_NUMA_STATUS_ONLINE);
+    reserve_node_hugepages(device_pci_info, numa_info_params.nid,
+                           numa_info->hugepages);
+    hugepages_reserved = 1;
+
+    status = set_gpu_numa_status(fd, bdf, NV_IOCTL_NUMA_STATUS_ONLINE);
     if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
@@ -844,14 +2174,30 @@ set_driver_status:
 
     syslog(LOG_NOTICE, "NUMA: Memory onlining completed!\n");
 done:
+    free_memblock_snapshot(&snapshot);
     numa_info->fd = fd;
     numa_info->use_auto_online = numa_info_params.use_auto_online;
+    numa_info->range.nid = numa_info_params.nid;
+    numa_info->range.base = numa_info_params.numa_mem_addr;
+    numa_info->range.size = numa_info_params.numa_mem_size;
+    numa_info->range.memblock_size = numa_info_params.memblock_size;
     return NVPD_SUCCESS;
 
 online_failed:
-    offline_memory(fd);
+    if (hugepages_reserved)
+        release_node_hugepages(numa_info_params.nid, numa_info->hugepages);
+
+    /*
+     * Once the state of the memory is known, only undo what was changed, so
+     * that a retry resumes from the memblocks that are still pending.
+     */
+    if (snapshot.num_blocks > 0)
+        rollback_memory(fd, &snapshot, NV_IOCTL_NUMA_STATUS_OFFLINE);
+    else
+        offline_memory(fd, bdf, NULL, NULL, NULL);
+    free_memblock_snapshot(&snapshot);
 error:
-    status = set_gpu_numa_status(fd, NV_IOCTL_NUMA_STATUS_ONLINE_FAILED);
+    status = set_gpu_numa_status(fd, bdf, NV_IOCTL_NUMA_STATUS_ONLINE_FAILED);
     if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
@@ -859,8 +2205,65 @@ error:
                       mem_state_to_string(NV_IOCTL_NUMA_STATUS_ONLINE_FAILED));
     }
 driver_fail:
+    free_memblock_snapshot(&snapshot);
     close(fd);
-    return NVPD_ERR_NUMA_FAILURE;
+    return ret;
+}
+
+/*! @brief
+ *  Takes over device NUMA memory that was onlined by a previous instance of
+ *  the daemon, after validating that the driver still reports it as online,
+ *  with the given memory range. Fails without changing the state of the
+ *  memory otherwise, in which case it is to be onlined as usual.
+ *
+ *  If fd is not -1, it is the device file descriptor the previous instance
+ *  used for the memory, and it is consumed either way.
+ */
+NvPdStatus nvNumaAdoptMemory(NvNumaDevice *numa_info,
+                             const NvNumaRange *range, int fd)
+{
+    int status;
+    NvCfgPciDevice *device_pci_info = numa_info->pci_info;
+    uint32_t bdf = NVPD_TRACE_BDF(device_pci_info);
+    nv_ioctl_numa_info_t numa_info_params;
+
+    memset(&numa_info_params, 0, sizeof(numa_info_params));
+
+    if (fd < 0) {
+        status = get_gpu_device_file_fd(numa_info, &fd);
+        if (status < 0) {
+            return NVPD_ERR_NUMA_FAILURE;
+        }
+    }
+
+    status = get_gpu_numa_info(fd, bdf, &numa_info_params);
+    if (status < 0) {
+        close(fd);
+        return NVPD_ERR_NUMA_FAILURE;
+    }
+
+    if ((numa_info_params.status != NV_IOCTL_NUMA_STATUS_ONLINE) ||
+        numa_info_params.use_auto_online ||
+        (numa_info_params.nid != range->nid) ||
+        (numa_info_params.numa_mem_addr != range->base) ||
+        (numa_info_params.numa_mem_size != range->size) ||
+        (numa_info_params.memblock_size != range->memblock_size)) {
+        syslog_device(device_pci_info, LOG_NOTICE,
+                      "NUMA: Recorded NUMA memory state is stale (status "
+                      "%s), not adopting it\n",
+                      mem_state_to_string(numa_info_params.status));
+        close(fd);
+        return NVPD_ERR_NUMA_FAILURE;
+    }
+
+    numa_info->fd = fd;
+    numa_info->use_auto_online = 0;
+    numa_info->range = *range;
+
+    syslog_device(device_pci_info, LOG_NOTICE,
+                  "NUMA: Adopted online device NUMA memory\n");
+
+    return NVPD_SUCCESS;
 }
 
 NvPdStatus nvNumaOfflineMemory(NvNumaDevice *numa_info)
@@ -868,6 +2271,7 @@ NvPdStatus nvNumaOfflineMemory(NvNumaDevice *numa_info)
     int fd = numa_info->fd;
     int status = 0;
     NvCfgPciDevice *device_pci_info = numa_info->pci_info;
+    uint32_t bdf = NVPD_TRACE_BDF(device_pci_info);
 
     if (fd < 0) {
         syslog_device(device_pci_info,
@@ -880,8 +2284,17 @@ NvPdStatus nvNumaOfflineMemory(NvNumaDevice *numa_info)
     if (numa_info->use_auto_online)
         goto done;
 
-    status = offline_memory(fd);
-    if (status < 0) {
+    status = offline_memory(fd, bdf, numa_info->hugepages,
+                            numa_info->progress, numa_info->stats);
+    if (status == -ECANCELED) {
+        /*
+         * The memory was left online, so give back the huge pages released
+         * for offlining it, and keep the fd, to avoid shutting down the device
+         */
+        reserve_node_hugepages(device_pci_info, numa_info->range.nid,
+                               numa_info->hugepages);
+        return NVPD_ERR_CANCELED;
+    } else if (status < 0) {
         syslog_device(device_pci_info,
                       LOG_ERR,
                       "NUMA: Failed to offline memory\n");
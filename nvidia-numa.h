@@ -24,18 +24,94 @@
 #define _NV_GPU_NUMA_H_
 
 #include "nvpd_rpc.h"
+#include "nvidia-stats.h"
 #include "nvidia-syslog-utils.h"
 
+/* device NUMA memory range, as reported by the driver */
+typedef struct
+{
+    int32_t nid;
+    uint64_t base;
+    uint64_t size;
+    uint64_t memblock_size;
+} NvNumaRange;
+
+/*
+ * Progress of a NUMA memory transition. The counters are updated as memblocks
+ * change state, and may be read from any thread while the transition is in
+ * progress. Setting cancel from any thread stops the transition before the
+ * next memblock; it then fails with NVPD_ERR_CANCELED, after bringing the
+ * memblocks changed so far back to their previous state, so that a canceled
+ * offlining leaves the memory online.
+ */
+typedef struct
+{
+    volatile uint32_t memblocks_done;
+    volatile uint32_t memblocks_total;
+    volatile uint64_t memblock_size;
+    volatile int cancel;
+} NvNumaProgress;
+
+/* Huge page sizes of NvNumaConfig::hugepages */
+#define NV_NUMA_HUGEPAGE_SIZE_2M      0
+#define NV_NUMA_HUGEPAGE_SIZE_1G      1
+#define NV_NUMA_NUM_HUGEPAGE_SIZES    2
+
 /* per-device NUMA context */
 typedef struct
 {
     int fd;
+    int minor_number;   /* -1 until resolved */
+    NvNumaRange range;  /* valid while fd is open */
     NvCfgPciDevice *pci_info;
     uint8_t use_auto_online;
+    NvNumaProgress *progress;   /* tracks the next transition, if not NULL */
+    NvPdHistogram *stats;       /* phase latencies, if not NULL */
+
+    /* huge pages to reserve once onlined, from NvNumaConfig by default */
+    unsigned int hugepages[NV_NUMA_NUM_HUGEPAGE_SIZES];
 } NvNumaDevice;
 
+void nvNumaInitDevice(NvNumaDevice *numa_info, NvCfgPciDevice *pci_info);
+void nvNumaInvalidateDevice(NvNumaDevice *numa_info);
+
+/*
+ * Binds the calling thread to the CPUs local to the device, so that the work
+ * of changing the state of its memory stays on the node of the device.
+ */
+void nvNumaBindToLocalCpus(NvNumaDevice *numa_info);
+void nvNumaUnbindCpus(void);
+
+/* NUMA memory management configuration, shared by all devices */
+typedef struct
+{
+    /*
+     * Number of threads used to online the memory of a device; memory is
+     * onlined from a single thread when this is 1.
+     */
+    int online_threads;
+
+    /*
+     * Number of huge pages of each size, 2 MB and 1 GB, to reserve on the
+     * node of the device memory once it is onlined; none when 0. This is
+     * the default of devices initialized afterwards, which
+     * nvNumaSetHugepages() overrides.
+     */
+    unsigned int hugepages[NV_NUMA_NUM_HUGEPAGE_SIZES];
+} NvNumaConfig;
+
+void nvNumaSetConfig(const NvNumaConfig *config);
+void nvNumaProbeEnvironment(void);
+void nvNumaSetHugepages(NvNumaDevice *numa_info,
+                        const unsigned int *hugepages);
+
 NvPdStatus nvNumaOnlineMemory(NvNumaDevice *numa_info);
 
+NvPdStatus nvNumaAdoptMemory(NvNumaDevice *numa_info,
+                             const NvNumaRange *range, int fd);
+
+int nvNumaOpenDevice(NvNumaDevice *numa_info);
+
 NvPdStatus nvNumaOfflineMemory(NvNumaDevice *numa_info);
 
 #endif
@@ -45,6 +45,9 @@ the NVIDIA management utilities, such as
 .B nvidia\-smi,
 can communicate with it automatically as necessary to manage persistence mode.
 .PP
+When started as a systemd service of Type=notify, the daemon does not fork, and notifies systemd once it is ready, reporting the device it is setting up in the status of the service until then.
+The daemon also accepts its listening socket from systemd (socket activation), so that clients may connect to /var/run/nvidia-persistenced/socket before the devices have been set up.
+.PP
 See the "Using the nvidia-persistenced Utility" section of the NVIDIA Linux Graphics Driver README for more background, information about installing the
 .B nvidia\-persistenced
 utility to run on system initialization, and troubleshooting tips.
@@ -25,9 +25,12 @@
  * nvidia-persistenced.c
  */
 
+#include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -36,14 +39,26 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <time.h>
 
+#include "nvidia-event-loop.h"
+#include "nvidia-handoff.h"
+#include "nvidia-hotplug.h"
+#include "nvidia-journal.h"
+#include "nvidia-metrics.h"
+#include "nvidia-msg-server.h"
 #include "nvidia-persistenced.h"
+#include "nvidia-policy.h"
 #include "nvpd_defs.h"
 #include "nvpd_rpc.h"
 #include "nvidia-numa.h"
+#include "nvidia-stats.h"
 #include "nvidia-syslog-utils.h"
+#include "nvidia-systemd.h"
+#include "nvidia-trace.h"
+#include "nvidia-work-queue.h"
 #include "nvstatus.h"
 #include "nvstatuscodes.h"
 
@@ -51,9 +66,19 @@
  * Local Definitions
  */
 #define NVPD_PID_FILE   NVPD_VAR_RUNTIME_DATA_PATH "/" NVPD_DAEMON_NAME ".pid"
+#define NVPD_JOURNAL_FILE NVPD_VAR_RUNTIME_DATA_PATH "/state"
 #define NVIDIA_CFG_LIB  "libnvidia-cfg.so.1"
 
-typedef struct
+/* Upper bound on the interval between NVLink fabric readiness checks */
+#define NVPD_UVM_RETRY_MAX_INTERVAL_MS 8000
+
+/* Number of buckets of the device registry hash table */
+#define NVPD_DEVICE_HASH_SIZE 64
+
+/* How long to wait for a new daemon instance to take over */
+#define NVPD_HANDOFF_TIMEOUT_MS 30000
+
+typedef struct _NvPdDevice
 {
     NvCfgDeviceHandle nv_cfg_handle;
     NvCfgPciDevice pci_info;
@@ -61,8 +86,103 @@ typedef struct
     NvUVMPersistenceMode uvm_pm_mode;
     NvNumaStatus numa_status;
     NvNumaDevice numa_info;
+
+    /* UVM persistence mode to enable along with persistence mode */
+    NvUVMPersistenceMode uvm_policy;
+
+    /* UUID of the device, set once it is first opened, or empty */
+    char uuid[NVPD_POLICY_UUID_LEN];
+
+    /*
+     * Serializes state changes of the device. Readers of the mode and status
+     * fields may observe them without holding the lock.
+     */
+    pthread_mutex_t lock;
+
+    /* Worker thread that executes RPC commands targeting the device */
+    NvPdWorkQueue *work_queue;
+
+    /* Wall clock time of the last state change, in ms since the epoch */
+    uint64_t last_transition_time;
+
+    /* Latencies of the bring-up phases, indexed by NvPdDevicePhase */
+    NvPdHistogram stats[NVPD_NUM_DEVICE_PHASES];
+
+    /* Number of state changes, and of failed attempts at changing state */
+    uint64_t num_transitions;
+    uint64_t num_failures;
+
+    /* Start of enabling UVM persistence mode, including fabric retries */
+    uint64_t uvm_enable_start;
+
+    /* State recorded by the previous instance of the daemon, if any */
+    int has_previous_state;
+    NvPdJournalEntry previous_state;
+
+    /* File descriptors handed over by the previous instance, or -1 */
+    int handoff_device_fd;
+    int handoff_numa_fd;
+
+    /* Deferred UVM persistence state, protected by uvm_retry.lock */
+    int uvm_retry_pending;
+    uint64_t uvm_retry_deadline;
+    uint64_t uvm_retry_time;
+    uint64_t uvm_retry_interval;
+
+    /* Registry state, protected by registry.lock */
+    int refcount;
+    struct _NvPdDevice *hash_next;
+    struct _NvPdDevice *next;
 } NvPdDevice;
 
+/* Hotplug work item for adding or removing a single device, or a rescan */
+typedef struct
+{
+    NvPdHotplugAction action;
+    NvPciDevice device;
+} NvPdHotplugTask;
+
+/* Startup work item for bringing up a single device */
+typedef struct
+{
+    NvPdDevice *device;
+    NvPersistenceMode mode;
+    NvPdStatus status;
+    int skip;
+    int release_numa;
+    int *num_done;
+    int num_total;
+} NvPdSetupTask;
+
+/* Shutdown work item for tearing down a single device */
+typedef struct
+{
+    NvPdDevice *device;
+    NvNumaProgress progress;
+    uint64_t start_time;
+    int done;
+} NvPdTeardownTask;
+
+/* Handoff work item for quiescing a single device */
+typedef struct
+{
+    NvPdDevice *device;
+    NvPdHandoffDevice *state;
+} NvPdQuiesceTask;
+
+/* Arguments of a new instance of the daemon, prepared before forking */
+typedef struct
+{
+    char **argv;
+    char fd_arg[32];
+    int fd;         /* handoff socket */
+    int null_fd;    /* /dev/null, for the standard file descriptors */
+    sigset_t signal_set;
+} NvPdExecArgs;
+
+/* How often to report the progress of tearing down devices on shutdown */
+#define NVPD_TEARDOWN_REPORT_MS       5000
+
 /*
  * Static Variables
  */
@@ -70,10 +190,85 @@ static void *libnvidia_cfg = NULL;
 static pid_t pid = 0;
 static int pid_fd = -1;
 static int socket_fd = -1;
-static NvPdDevice *devices = NULL;
-static int num_devices = 0;
+static int socket_activated = 0;
 static int remove_dir = 0;
 static NvUVMPersistenceMode set_uvm_pm = NV_UVM_PERSISTENCE_MODE_DISABLED;
+static NvPersistenceMode default_persistence_mode = NV_PERSISTENCE_MODE_ENABLED;
+static NvPdWorkQueue *hotplug_queue = NULL;
+static uint64_t uvm_fabric_timeout_ms = 30000;
+static uint64_t uvm_fabric_retry_interval_ms = 1000;
+static int warm_restart = 0;
+static int shutdown_timeout = 0;
+static int seqpacket_socket = 0;
+static volatile sig_atomic_t terminate_requested = 0;
+static volatile sig_atomic_t handoff_requested = 0;
+static volatile sig_atomic_t reload_requested = 0;
+
+/*
+ * The policy file given with --policy-file, if any. The policy is replaced
+ * under policy_lock when the file is reloaded, while worker threads look up
+ * the policy of their device.
+ */
+static const char *policy_path = NULL;
+static NvPdPolicyFile *policy_file = NULL;
+static pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The daemon binary and command line, used to execute a new instance of the
+ * daemon when handing over to it, and the state received from the previous
+ * instance, if this instance was started by a handoff.
+ */
+static char self_exe[PATH_MAX];
+static char **self_argv = NULL;
+static int handoff_fd = -1;
+static NvPdHandoffState handoff_state = {
+    .socket_fd = -1,
+    .msg_socket_fd = -1,
+};
+
+/*
+ * State of a handoff to a new instance of the daemon, from start_handoff()
+ * until the daemon exits or the handoff is canceled. No device work is queued
+ * while the handoff is active, which only changes with the registry lock
+ * held; the rest of the state is protected by the lock.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int active;
+    int canceled;
+    int num_devices;    /* devices whose quiescing is queued */
+    int num_quiesced;
+    int num_done;       /* worker threads done with the handoff */
+    NvPdDevice **devices;
+    NvPdQuiesceTask *tasks;
+    NvPdHandoffState state;
+} pending_handoff = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/*
+ * Registry of the devices managed by the daemon. Devices are looked up by PCI
+ * location through the hash table, and iterated in PCI order through the
+ * list. The registry holds a reference to each registered device, and each
+ * successful get_device() holds another until the matching put_device().
+ */
+static struct {
+    pthread_mutex_t lock;
+    NvPdDevice *hash[NVPD_DEVICE_HASH_SIZE];
+    NvPdDevice *list;
+    int num_devices;
+} registry = { PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * State of the thread that retries enabling UVM persistence mode on devices
+ * whose NVLink fabric was not yet ready.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int thread_started;
+    int shutdown;
+} uvm_retry = { PTHREAD_MUTEX_INITIALIZER };
 
 static struct {
     NvCfgBool (*get_pci_devices)(int *, NvCfgPciDevice **);
@@ -81,22 +276,75 @@ static struct {
     NvCfgBool (*close_device)(NvCfgDeviceHandle);
     unsigned int (*nvCfgEnableUVMPersistence)(NvCfgDeviceHandle);
     unsigned int (*nvCfgDisableUVMPersistence)(NvCfgDeviceHandle);
+    NvCfgBool (*get_device_uuid)(NvCfgDeviceHandle, char **);
 } nv_cfg_api;
 
+/*
+ * Optional features of libnvidia-cfg, which older drivers lack, indexed by
+ * NvPdDriverFeature. The entry points of a feature are resolved into
+ * nv_cfg_api the first time the feature is needed, and whether the driver
+ * supports it is recorded in the state, under nv_cfg_features_lock.
+ */
+#define NVPD_MAX_FEATURE_SYMBOLS 2
+
+typedef enum
+{
+    NVPD_FEATURE_UNKNOWN = 0,
+    NVPD_FEATURE_SUPPORTED,
+    NVPD_FEATURE_UNSUPPORTED,
+} NvPdFeatureState;
+
+static struct {
+    const char *name;
+    struct {
+        void **ptr;
+        const char *name;
+    } symbols[NVPD_MAX_FEATURE_SYMBOLS];
+    NvPdFeatureState state;
+} nv_cfg_features[NVPD_NUM_DRIVER_FEATURES] = {
+    [NVPD_DRIVER_FEATURE_UVM_PERSISTENCE] = {
+        "UVM Persistence mode",
+        { { (void **)&nv_cfg_api.nvCfgEnableUVMPersistence,
+            "nvCfgEnableUVMPersistence" },
+          { (void **)&nv_cfg_api.nvCfgDisableUVMPersistence,
+            "nvCfgDisableUVMPersistence" } } },
+    [NVPD_DRIVER_FEATURE_DEVICE_UUID] = {
+        "device UUIDs",
+        { { (void **)&nv_cfg_api.get_device_uuid, "nvCfgGetDeviceUUID" } } },
+};
+
+static pthread_mutex_t nv_cfg_features_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Local Functions
  */
 static int daemonize(uid_t uid, gid_t gid);
 static int load_nvidia_cfg_sym(void **sym_ptr, const char *sym_name);
 static NvPdDevice *get_device(int domain, int bus, int slot);
+static void put_device(NvPdDevice *device);
+static NvPdDevice *find_device(int domain, int bus, int slot);
+static void lock_registry(sigset_t *old_signal_set);
+static void unlock_registry(sigset_t *old_signal_set);
 static NvPdStatus setup_nvidia_cfg_api(const char *nvidia_cfg_path);
-static NvPdStatus setup_devices(NvPersistenceMode default_mode);
+static NvPdStatus setup_devices(NvPersistenceMode default_mode,
+                                int setup_threads);
 static NvPdStatus setup_rpc(void);
 static NvPdStatus set_device_mode(NvPdDevice *device, NvPersistenceMode mode);
+static NvPdStatus set_device_persistence_mode(NvPdDevice *device,
+                                              NvPersistenceMode mode);
 static NvPdStatus set_device_numa_status(NvPdDevice *device,
                                          NvNumaStatus numa_status);
 static NV_STATUS current_timestamp(uint64_t *);
 static void enable_uvm_persistence_mode(NvPdDevice *device);
+static void cancel_uvm_persistence_mode_retry(NvPdDevice *device);
+static void stop_uvm_retry_thread(void);
+static void lock_device(NvPdDevice *device, sigset_t *old_signal_set);
+static void unlock_device(NvPdDevice *device, sigset_t *old_signal_set);
+static void mark_device_transition(NvPdDevice *device);
+static void notify_device_change(NvPdDevice *device, NvPdStatus status);
+static void release_handoff_fds(NvPdDevice *device);
+static void free_exec_args(NvPdExecArgs *args);
+static void cancel_handoff(void);
 
 /*
  * nvPdSetDevicePersistenceMode() - This function implements the daemon
@@ -110,31 +358,15 @@ NvPdStatus nvPdSetDevicePersistenceMode(int domain, int bus, int slot,
                                         int function, NvPersistenceMode mode)
 {
     NvPdStatus ret;
-    NvPersistenceMode old_mode;
     NvPdDevice *device = get_device(domain, bus, slot);
 
     if (device == NULL) {
         return NVPD_ERR_DEVICE_NOT_FOUND;
     }
 
-    old_mode = device->mode;
+    ret = set_device_persistence_mode(device, mode);
 
-    /*
-     * Set the device mode always before changing the NUMA state.
-     * For onlining, this is needed since libnvidia-cfg needs to create the
-     * device nodes before nvidia-numa can interact with them.
-     * For offlining, this is needed since the libnvidia-cfg device handle
-     * will need to be released for nvidia-numa to proceed with the offlining.
-     */
-    ret = set_device_mode(device, mode);
-    if (ret == NVPD_SUCCESS) {
-        NvNumaStatus status = (mode == NV_PERSISTENCE_MODE_ENABLED) ?
-                                NV_NUMA_STATUS_ONLINE : NV_NUMA_STATUS_OFFLINE;
-        ret = set_device_numa_status(device, status);
-        if ((ret != NVPD_SUCCESS) && (old_mode != mode)) {
-            (void) set_device_mode(device, old_mode);
-        }
-    }
+    put_device(device);
 
     return ret;
 }
@@ -151,13 +383,21 @@ NvPdStatus nvPdSetDevicePersistenceModeOnly(int domain, int bus, int slot,
                                             int function,
                                             NvPersistenceMode mode)
 {
+    NvPdStatus ret;
+    sigset_t old_signal_set;
     NvPdDevice *device = get_device(domain, bus, slot);
 
     if (device == NULL) {
         return NVPD_ERR_DEVICE_NOT_FOUND;
     }
 
-    return set_device_mode(device, mode);
+    lock_device(device, &old_signal_set);
+    ret = set_device_mode(device, mode);
+    unlock_device(device, &old_signal_set);
+
+    put_device(device);
+
+    return ret;
 }
 
 /*
@@ -171,13 +411,36 @@ NvPdStatus nvPdSetDevicePersistenceModeOnly(int domain, int bus, int slot,
 NvPdStatus nvPdSetDeviceNumaStatus(int domain, int bus, int slot, int function,
                                    NvNumaStatus status)
 {
+    return nvPdSetDeviceNumaStatusTracked(domain, bus, slot, function, status,
+                                          NULL);
+}
+
+/*
+ * nvPdSetDeviceNumaStatusTracked() - This function is the same as
+ * nvPdSetDeviceNumaStatus(), but reports the progress of the NUMA memory
+ * transition in progress, if not NULL, which also allows canceling it.
+ */
+NvPdStatus nvPdSetDeviceNumaStatusTracked(int domain, int bus, int slot,
+                                          int function, NvNumaStatus status,
+                                          NvNumaProgress *progress)
+{
+    NvPdStatus ret;
+    sigset_t old_signal_set;
     NvPdDevice *device = get_device(domain, bus, slot);
 
     if (device == NULL) {
         return NVPD_ERR_DEVICE_NOT_FOUND;
     }
 
-    return set_device_numa_status(device, status);
+    lock_device(device, &old_signal_set);
+    device->numa_info.progress = progress;
+    ret = set_device_numa_status(device, status);
+    device->numa_info.progress = NULL;
+    unlock_device(device, &old_signal_set);
+
+    put_device(device);
+
+    return ret;
 }
 
 /*
@@ -198,533 +461,2933 @@ NvPdStatus nvPdGetDevicePersistenceMode(int domain, int bus, int slot,
     }
 
     *mode = device->mode;
+
+    put_device(device);
+
     return NVPD_SUCCESS;
 }
 
 /*
- * get_device() - looks up and returns a pointer to the NvPdDevice structure
- * for the device at the specified PCI location.
+ * nvPdQueueDeviceWork() - This function queues work to the worker thread of
+ * the device at the specified PCI location. Work queued to the same device is
+ * executed in order, while work queued to different devices may execute
+ * concurrently.
+ *
+ * The function parameter is ignored for the time being, and provided for
+ * completeness of the API.
  */
-static NvPdDevice *get_device(int domain, int bus, int slot)
+NvPdStatus nvPdQueueDeviceWork(int domain, int bus, int slot, int function,
+                               NvPdWorkFunc func, void *data)
 {
-    int i;
+    NvPdDevice *device;
+    NvPdStatus status;
+    sigset_t old_signal_set;
 
-    if (devices != NULL) {
-        for (i = 0; i < num_devices; i++) {
-            if ((devices[i].pci_info.domain == domain) &&
-                (devices[i].pci_info.bus == bus) &&
-                (devices[i].pci_info.slot == slot)) {
-                return &devices[i];
-            }
-        }
-    }
+    /*
+     * Submit the work with the registry locked, so that the device cannot be
+     * unregistered and its worker thread stopped in the meantime.
+     */
+    lock_registry(&old_signal_set);
 
-    return NULL;
-}
+    device = find_device(domain, bus, slot);
+    if (device == NULL) {
+        unlock_registry(&old_signal_set);
+        return NVPD_ERR_DEVICE_NOT_FOUND;
+    }
 
-/*
- * init_complete() - called by the child (daemon) process to signal to the
- * parent process, via the init pipe created during daemonize(), that
- * initialization has completed successfully.
- */
-static NvPdStatus init_complete(int pipe_write_fd)
-{
-    unsigned char success = 1;
-    int bytes;
-    
-    bytes = write(pipe_write_fd, &success, sizeof(success));
-    
-    close(pipe_write_fd);
+    /* The work would only run once the device has been handed over */
+    if (pending_handoff.active) {
+        unlock_registry(&old_signal_set);
+        return NVPD_ERR_CANCELED;
+    }
 
-    if (bytes < 0) {
-        fprintf(stderr, "Failed to write init pipe: %s\n", strerror(errno));
-        return NVPD_ERR_IO;
+    if (device->work_queue != NULL) {
+        status = nvPdWorkQueueSubmit(device->work_queue, func, data);
+        unlock_registry(&old_signal_set);
+        return status;
     }
 
+    unlock_registry(&old_signal_set);
+
+    /* Without a worker thread, fall back to executing the work right away */
+    func(data);
+
     return NVPD_SUCCESS;
 }
 
 /*
- * wait_for_init_complete() - called by the parent process to block on the
- * init pipe and wait for the child process to signal its successful
- * initialization.
- *
- * The init pipe will be closed upon return from this function.
+ * nvPdGetDevices() - This function returns a newly allocated list of the PCI
+ * locations of all devices managed by the daemon. The caller is responsible
+ * for freeing the list.
  */
-static NvPdStatus wait_for_init_complete(int pipe_read_fd)
+NvPdStatus nvPdGetDevices(NvPciDevice **list, int *count)
 {
-    unsigned char success = 0;
-    int bytes;
+    NvPdDevice *device;
+    sigset_t old_signal_set;
+    int i = 0;
 
-    bytes = read(pipe_read_fd, &success, sizeof(success));
+    *list = NULL;
+    *count = 0;
 
-    close(pipe_read_fd);
+    lock_registry(&old_signal_set);
 
-    if (bytes < 0) {
-        fprintf(stderr, "Failed to read init pipe: %s\n", strerror(errno));
-        return NVPD_ERR_IO;
+    if (registry.num_devices > 0) {
+        *list = malloc(registry.num_devices * sizeof(NvPciDevice));
+        if (*list == NULL) {
+            unlock_registry(&old_signal_set);
+            return NVPD_ERR_INSUFFICIENT_RESOURCES;
+        }
     }
 
-    if (bytes != sizeof(success) || !success) {
-        fprintf(stderr, "nvidia-persistenced failed to initialize. "
-                        "Check syslog for more details.\n");
-        return NVPD_ERR_UNKNOWN;
+    for (device = registry.list; device != NULL; device = device->next) {
+        (*list)[i].domain = device->pci_info.domain;
+        (*list)[i].bus = device->pci_info.bus;
+        (*list)[i].slot = device->pci_info.slot;
+        (*list)[i].function = device->pci_info.function;
+        i++;
     }
 
+    *count = i;
+
+    unlock_registry(&old_signal_set);
+
     return NVPD_SUCCESS;
 }
 
-static NV_STATUS current_timestamp(uint64_t *ts) {
-    struct timespec te;
-    NV_STATUS ret = 0;
-
-    ret = clock_gettime(CLOCK_MONOTONIC, &te);
-    if (ret == 0) {
-        *ts = te.tv_sec * 1000ULL + te.tv_nsec / 1000000ULL; // calculate milliseconds
-        return NV_OK;
-    } else {
-        return NV_ERR_OPERATING_SYSTEM;
-    }
+/*
+ * fill_device_state() - fills in the RPC representation of the state of a
+ * device.
+ */
+static void fill_device_state(NvPdDevice *device, NvPdDeviceState *state)
+{
+    state->device.domain = device->pci_info.domain;
+    state->device.bus = device->pci_info.bus;
+    state->device.slot = device->pci_info.slot;
+    state->device.function = device->pci_info.function;
+    state->mode = device->mode;
+    state->uvm_mode = device->uvm_pm_mode;
+    state->numa_status = device->numa_status;
+    state->use_auto_online = device->numa_info.use_auto_online;
+    state->last_transition_time = device->last_transition_time;
 }
 
-static void enable_uvm_persistence_mode(NvPdDevice *device) {
-    NV_STATUS status;
-    uint64_t fabricProbeTimeoutMs = 30000, startTime = 0, elapsedTime = 0;
+/*
+ * nvPdGetDeviceStateSnapshot() - This function implements the daemon command
+ * to get a snapshot of the state of all devices managed by the daemon. On
+ * input, *count is the number of entries available in states; on output, it
+ * is the number of devices. If states is too small,
+ * NVPD_ERR_INSUFFICIENT_RESOURCES is returned and no entries are filled in.
+ *
+ * The device locks are not taken, so that the snapshot does not wait for
+ * state changes in progress; each entry reflects the last completed change.
+ */
+NvPdStatus nvPdGetDeviceStateSnapshot(NvPdDeviceState *states, int *count)
+{
+    NvPdDevice *device;
+    sigset_t old_signal_set;
+    int i = 0;
 
-    status = current_timestamp(&startTime);
-    if (status != NV_OK) {
-        goto out;
+    lock_registry(&old_signal_set);
+
+    if (*count < registry.num_devices) {
+        *count = registry.num_devices;
+        unlock_registry(&old_signal_set);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
     }
 
-    while(1) {
-        status = nv_cfg_api.nvCfgEnableUVMPersistence(device->nv_cfg_handle);
-        if (status == NV_OK) {
-            syslog_device(&device->pci_info, LOG_INFO,
-                    "Enabled UVM Persistence mode.");
-            device->uvm_pm_mode = NV_UVM_PERSISTENCE_MODE_ENABLED;
-            break;
-        } else if (status == NV_ERR_NVLINK_FABRIC_NOT_READY) {
-            status = current_timestamp(&elapsedTime);
-            if (status != NV_OK) {
-                break;
-            }
+    for (device = registry.list; device != NULL; device = device->next) {
+        fill_device_state(device, &states[i]);
+        i++;
+    }
 
-            // restore the original error
-            status = NV_ERR_NVLINK_FABRIC_NOT_READY;
+    *count = i;
 
-            // giving up after timeout exceeded, otherwise retry
-            if ((elapsedTime - startTime) >= fabricProbeTimeoutMs) {
-                break;
-            } else {
-                sleep(1);
-            }
-        } else {
-            // Some other error occurred
-            break;
-        }
-    }
+    unlock_registry(&old_signal_set);
 
-out:
-    if (status == NV_ERR_NVLINK_FABRIC_NOT_READY) {
-        syslog_device(&device->pci_info, LOG_WARNING,
-                "Could not Enable UVM Persistence mode because"
-                "the NVLink fabric is not ready: 0x%x", status);
-    } else if (status != NV_OK) {
-        syslog_device(&device->pci_info, LOG_WARNING,
-        "Could not Enable UVM Persistence mode : 0x%x", status);
-    }
+    return NVPD_SUCCESS;
 }
 
 /*
- * set_device_mode() - This function performs the heavy lifting in enabling or
- * disabling device mode for a given device by performing mode checks and
- * calling libnvidia-cfg to open and close the device.
+ * nvPdGetDeviceStats() - This function implements the daemon command to get
+ * the phase latency histograms of all devices managed by the daemon. *count
+ * is handled as with nvPdGetDeviceStateSnapshot().
  */
-static NvPdStatus set_device_mode(NvPdDevice *device, NvPersistenceMode mode)
+NvPdStatus nvPdGetDeviceStats(NvPdDeviceStats *stats, int *count)
 {
-    NvPdStatus status = NVPD_SUCCESS;
-    NvCfgBool success;
-    unsigned int ret;
+    NvPdDevice *device;
+    sigset_t old_signal_set;
+    int i = 0;
 
-    /* If the device is already in the mode specified, just abort */
-    if (mode == device->mode) {
-        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_NOTICE,
-                              "already in requested persistence mode.");
-        return status;
+    lock_registry(&old_signal_set);
+
+    if (*count < registry.num_devices) {
+        *count = registry.num_devices;
+        unlock_registry(&old_signal_set);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
     }
 
-    switch (mode) {
+    for (device = registry.list; device != NULL; device = device->next) {
+        stats[i].device.domain = device->pci_info.domain;
+        stats[i].device.bus = device->pci_info.bus;
+        stats[i].device.slot = device->pci_info.slot;
+        stats[i].device.function = device->pci_info.function;
+        nvPdStatsCopy(stats[i].phases, device->stats, NVPD_NUM_DEVICE_PHASES);
+        i++;
+    }
 
-    case NV_PERSISTENCE_MODE_DISABLED:
+    *count = i;
 
-        /* If UVM persistence is enabled at this point, we must disable it */
-        if (device->uvm_pm_mode == NV_UVM_PERSISTENCE_MODE_ENABLED) {
-            ret = nv_cfg_api.nvCfgDisableUVMPersistence(device->nv_cfg_handle);
-            if (ret != 0) {
-                syslog_device(&device->pci_info, LOG_WARNING,
-                        "Failed to disable UVM Persistence mode: 0x%x", ret);
-            } else {
-                syslog_device(&device->pci_info, LOG_INFO,
-                        "Disabled UVM Persistence mode.");
-                device->uvm_pm_mode = NV_UVM_PERSISTENCE_MODE_DISABLED;
-            }
-        }
-        /* If the new mode is disabled, we must close the device. */
-        success = nv_cfg_api.close_device(device->nv_cfg_handle);
-        if (!success) {
-            syslog_device(&device->pci_info, LOG_ERR, "failed to close.");
-            status = NVPD_ERR_DRIVER;
-        } else {
-            device->nv_cfg_handle = NULL;
-        }
+    unlock_registry(&old_signal_set);
 
-        break;
+    return NVPD_SUCCESS;
+}
 
-    case NV_PERSISTENCE_MODE_ENABLED:
+/*
+ * nvPdGetDeviceMetrics() - This function returns the state, counters and
+ * phase latencies of all devices managed by the daemon, for the metrics
+ * file. *count is handled as with nvPdGetDeviceStateSnapshot().
+ */
+NvPdStatus nvPdGetDeviceMetrics(NvPdDeviceMetrics *metrics, int *count)
+{
+    NvPdDevice *device;
+    sigset_t old_signal_set;
+    int i = 0;
 
-        /* If the new mode is enabled, we must open the device. */
-        success = nv_cfg_api.open_pci_device(device->pci_info.domain,
-                                             device->pci_info.bus,
-                                             device->pci_info.slot,
-                                             device->pci_info.function,
-                                             &device->nv_cfg_handle);
-        if (!success) {
-            syslog_device(&device->pci_info, LOG_ERR, "failed to open.");
-            status = NVPD_ERR_DRIVER;
-        }
+    lock_registry(&old_signal_set);
 
-        /* If UVM-PM is enabled by user, we must register with UVM */
-        if (success && set_uvm_pm == NV_UVM_PERSISTENCE_MODE_ENABLED) {
-            enable_uvm_persistence_mode(device);
-        }
+    if (*count < registry.num_devices) {
+        *count = registry.num_devices;
+        unlock_registry(&old_signal_set);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
 
-        break;
+    for (device = registry.list; device != NULL; device = device->next) {
+        fill_device_state(device, &metrics[i].state);
+        metrics[i].num_transitions = device->num_transitions;
+        metrics[i].num_failures = device->num_failures;
+        nvPdStatsCopy(metrics[i].phases, device->stats,
+                      NVPD_NUM_DEVICE_PHASES);
+        i++;
+    }
 
-    default:
+    *count = i;
 
-        syslog_device(&device->pci_info, LOG_ERR,
-                      "requested invalid mode %d", mode);
-        status = NVPD_ERR_INVALID_ARGUMENT;
-        break;
+    unlock_registry(&old_signal_set);
 
-    }
+    return NVPD_SUCCESS;
+}
 
-    if (status == NVPD_SUCCESS) {
+/*
+ * set_device_persistence_mode() - sets the persistence mode of the device,
+ * and brings its NUMA status in line with the new mode.
+ */
+static NvPdStatus set_device_persistence_mode(NvPdDevice *device,
+                                              NvPersistenceMode mode)
+{
+    NvPdStatus ret;
+    NvPersistenceMode old_mode;
+    sigset_t old_signal_set;
+
+    lock_device(device, &old_signal_set);
+
+    old_mode = device->mode;
+
+    /*
+     * Set the device mode always before changing the NUMA state.
+     * For onlining, this is needed since libnvidia-cfg needs to create the
+     * device nodes before nvidia-numa can interact with them.
+     * For offlining, this is needed since the libnvidia-cfg device handle
+     * will need to be released for nvidia-numa to proceed with the offlining.
+     */
+    ret = set_device_mode(device, mode);
+    if (ret == NVPD_SUCCESS) {
+        NvNumaStatus status = (mode == NV_PERSISTENCE_MODE_ENABLED) ?
+                                NV_NUMA_STATUS_ONLINE : NV_NUMA_STATUS_OFFLINE;
+        ret = set_device_numa_status(device, status);
+        if ((ret != NVPD_SUCCESS) && (old_mode != mode)) {
+            (void) set_device_mode(device, old_mode);
+        }
+    }
+
+    unlock_device(device, &old_signal_set);
+
+    return ret;
+}
+
+/*
+ * lock_registry() - acquires the device registry lock. As with
+ * lock_device(), SIGINT and SIGTERM are blocked while the lock is held.
+ */
+static void lock_registry(sigset_t *old_signal_set)
+{
+    sigset_t signal_set;
+
+    sigemptyset(&signal_set);
+    sigaddset(&signal_set, SIGINT);
+    sigaddset(&signal_set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signal_set, old_signal_set);
+
+    pthread_mutex_lock(&registry.lock);
+}
+
+/*
+ * unlock_registry() - releases the lock acquired by lock_registry().
+ */
+static void unlock_registry(sigset_t *old_signal_set)
+{
+    pthread_mutex_unlock(&registry.lock);
+
+    pthread_sigmask(SIG_SETMASK, old_signal_set, NULL);
+}
+
+/*
+ * device_hash() - returns the registry hash bucket of a PCI location.
+ */
+static unsigned int device_hash(int domain, int bus, int slot)
+{
+    unsigned int key = ((unsigned int)domain << 13) |
+                       (((unsigned int)bus & 0xff) << 5) |
+                       ((unsigned int)slot & 0x1f);
+
+    key ^= key >> 7;
+
+    return key % NVPD_DEVICE_HASH_SIZE;
+}
+
+/*
+ * find_device() - looks up the device at the specified PCI location. Must be
+ * called with the registry lock held.
+ */
+static NvPdDevice *find_device(int domain, int bus, int slot)
+{
+    NvPdDevice *device;
+
+    for (device = registry.hash[device_hash(domain, bus, slot)];
+         device != NULL;
+         device = device->hash_next) {
+        if ((device->pci_info.domain == domain) &&
+            (device->pci_info.bus == bus) &&
+            (device->pci_info.slot == slot)) {
+            return device;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * get_device() - looks up and returns a pointer to the NvPdDevice structure
+ * for the device at the specified PCI location. The device stays valid until
+ * the reference taken on it is dropped with put_device().
+ */
+static NvPdDevice *get_device(int domain, int bus, int slot)
+{
+    NvPdDevice *device;
+    sigset_t old_signal_set;
+
+    lock_registry(&old_signal_set);
+
+    device = find_device(domain, bus, slot);
+    if (device != NULL) {
+        device->refcount++;
+    }
+
+    unlock_registry(&old_signal_set);
+
+    return device;
+}
+
+/*
+ * put_device() - drops a reference to the device, and frees it once the last
+ * reference is gone.
+ */
+static void put_device(NvPdDevice *device)
+{
+    sigset_t old_signal_set;
+    int refcount;
+
+    lock_registry(&old_signal_set);
+    refcount = --device->refcount;
+    unlock_registry(&old_signal_set);
+
+    if (refcount == 0) {
+        release_handoff_fds(device);
+        pthread_mutex_destroy(&device->lock);
+        free(device);
+    }
+}
+
+/*
+ * bind_device_thread() - binds a thread working on the device to the CPUs
+ * local to the device.
+ */
+static void bind_device_thread(void *data)
+{
+    NvPdDevice *device = (NvPdDevice *)data;
+
+    nvNumaBindToLocalCpus(&device->numa_info);
+}
+
+/*
+ * register_device() - allocates the daemon state for a device and adds it to
+ * the registry. Returns NULL if the device is already registered or on
+ * failure.
+ */
+static NvPdDevice *register_device(const NvCfgPciDevice *pci_info)
+{
+    NvPdDevice *device, **prev;
+    sigset_t old_signal_set;
+    unsigned int bucket;
+    int i;
+
+    device = calloc(1, sizeof(NvPdDevice));
+    if (device == NULL) {
+        return NULL;
+    }
+
+    device->nv_cfg_handle = NULL;
+    device->pci_info = *pci_info;
+    device->uvm_pm_mode = NV_UVM_PERSISTENCE_MODE_DISABLED;
+    device->uvm_policy = set_uvm_pm;
+
+    /* nvidia-cfg doesn't fill in the PCI function field, assume 0 */
+    device->pci_info.function = 0;
+    device->mode = NV_PERSISTENCE_MODE_DISABLED;
+
+    /* Initialize nvidia-numa state */
+    device->numa_status = NV_NUMA_STATUS_OFFLINE;
+    nvNumaInitDevice(&device->numa_info, &device->pci_info);
+    device->numa_info.stats = device->stats;
+
+    device->has_previous_state =
+        nvPdJournalLookup(device->pci_info.domain, device->pci_info.bus,
+                          device->pci_info.slot, &device->previous_state);
+
+    /* State handed over by the previous instance takes precedence */
+    device->handoff_device_fd = -1;
+    device->handoff_numa_fd = -1;
+    for (i = 0; i < handoff_state.num_devices; i++) {
+        NvPdHandoffDevice *handoff = &handoff_state.devices[i];
+
+        if ((handoff->state.domain == device->pci_info.domain) &&
+            (handoff->state.bus == device->pci_info.bus) &&
+            (handoff->state.slot == device->pci_info.slot)) {
+            device->has_previous_state = 1;
+            device->previous_state = handoff->state;
+            device->handoff_device_fd = handoff->device_fd;
+            device->handoff_numa_fd = handoff->numa_fd;
+            handoff->device_fd = -1;
+            handoff->numa_fd = -1;
+            break;
+        }
+    }
+
+    pthread_mutex_init(&device->lock, NULL);
+
+    /* The reference owned by the registry */
+    device->refcount = 1;
+
+    lock_registry(&old_signal_set);
+
+    if (find_device(device->pci_info.domain, device->pci_info.bus,
+                    device->pci_info.slot) != NULL) {
+        unlock_registry(&old_signal_set);
+        pthread_mutex_destroy(&device->lock);
+        free(device);
+        return NULL;
+    }
+
+    bucket = device_hash(device->pci_info.domain, device->pci_info.bus,
+                         device->pci_info.slot);
+    device->hash_next = registry.hash[bucket];
+    registry.hash[bucket] = device;
+
+    /* Keep the list in PCI order */
+    for (prev = &registry.list; *prev != NULL; prev = &(*prev)->next) {
+        NvCfgPciDevice *other = &(*prev)->pci_info;
+        if ((other->domain > pci_info->domain) ||
+            ((other->domain == pci_info->domain) &&
+             ((other->bus > pci_info->bus) ||
+              ((other->bus == pci_info->bus) &&
+               (other->slot > pci_info->slot))))) {
+            break;
+        }
+    }
+    device->next = *prev;
+    *prev = device;
+
+    registry.num_devices++;
+
+    unlock_registry(&old_signal_set);
+
+    device->work_queue = nvPdWorkQueueCreateWithInit(1, bind_device_thread,
+                                                     device);
+    if (device->work_queue == NULL) {
+        syslog_device(&device->pci_info, LOG_WARNING,
+                      "failed to create worker thread, commands will "
+                      "block other requests.");
+    }
+
+    SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_DEBUG, "registered");
+
+    return device;
+}
+
+/*
+ * unregister_device() - removes the device from the registry, so that it can
+ * no longer be looked up. The reference owned by the registry is handed over
+ * to the caller.
+ */
+static void unregister_device(NvPdDevice *device)
+{
+    NvPdDevice **prev;
+    sigset_t old_signal_set;
+    unsigned int bucket;
+
+    lock_registry(&old_signal_set);
+
+    bucket = device_hash(device->pci_info.domain, device->pci_info.bus,
+                         device->pci_info.slot);
+    for (prev = &registry.hash[bucket]; *prev != NULL;
+         prev = &(*prev)->hash_next) {
+        if (*prev == device) {
+            *prev = device->hash_next;
+            break;
+        }
+    }
+
+    for (prev = &registry.list; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == device) {
+            *prev = device->next;
+            break;
+        }
+    }
+
+    device->hash_next = NULL;
+    device->next = NULL;
+    registry.num_devices--;
+
+    unlock_registry(&old_signal_set);
+
+    nvPdJournalRemove(device->pci_info.domain, device->pci_info.bus,
+                      device->pci_info.slot);
+
+    SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_DEBUG, "unregistered");
+}
+
+/*
+ * lock_device() - acquires the lock that serializes state changes of the
+ * device. SIGINT and SIGTERM are blocked while the lock is held: their handler
+ * tears down every device, and would otherwise deadlock if it interrupted the
+ * thread holding the lock.
+ */
+static void lock_device(NvPdDevice *device, sigset_t *old_signal_set)
+{
+    sigset_t signal_set;
+
+    sigemptyset(&signal_set);
+    sigaddset(&signal_set, SIGINT);
+    sigaddset(&signal_set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signal_set, old_signal_set);
+
+    pthread_mutex_lock(&device->lock);
+}
+
+/*
+ * unlock_device() - releases the lock acquired by lock_device(), and delivers
+ * any termination signals that arrived while it was held.
+ */
+static void unlock_device(NvPdDevice *device, sigset_t *old_signal_set)
+{
+    pthread_mutex_unlock(&device->lock);
+
+    pthread_sigmask(SIG_SETMASK, old_signal_set, NULL);
+}
+
+/*
+ * get_device_state() - fills in the state of the device, as recorded in the
+ * state journal and handed over to a new instance of the daemon.
+ */
+static void get_device_state(NvPdDevice *device, NvPdJournalEntry *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->domain = device->pci_info.domain;
+    entry->bus = device->pci_info.bus;
+    entry->slot = device->pci_info.slot;
+    entry->function = device->pci_info.function;
+    entry->mode = device->mode;
+    entry->uvm_mode = device->uvm_pm_mode;
+    entry->numa_status = device->numa_status;
+    entry->use_auto_online = device->numa_info.use_auto_online;
+    if (device->numa_info.fd >= 0) {
+        entry->numa_range = device->numa_info.range;
+    }
+}
+
+/*
+ * mark_device_transition() - records the current wall clock time as the time
+ * of the last state change of the device, and the new state of the device in
+ * the state journal.
+ */
+static void mark_device_transition(NvPdDevice *device)
+{
+    struct timespec te;
+    NvPdJournalEntry entry;
+
+    if (clock_gettime(CLOCK_REALTIME, &te) == 0) {
+        device->last_transition_time = te.tv_sec * 1000ULL +
+                                       te.tv_nsec / 1000000ULL;
+    }
+
+    device->num_transitions++;
+
+    get_device_state(device, &entry);
+    nvPdJournalUpdate(&entry);
+
+    notify_device_change(device, NVPD_SUCCESS);
+}
+
+/*
+ * notify_device_change() - sends the state of the device to the clients
+ * subscribed to events, once the state changed, or a change failed. The
+ * device lock must be held, so that events are sent in the order of the
+ * changes.
+ */
+static void notify_device_change(NvPdDevice *device, NvPdStatus status)
+{
+    NvPdMsgEvent event;
+
+    memset(&event, 0, sizeof(event));
+    event.domain = device->pci_info.domain;
+    event.bus = device->pci_info.bus;
+    event.slot = device->pci_info.slot;
+    event.function = device->pci_info.function;
+    event.status = status;
+    event.mode = device->mode;
+    event.uvm_mode = device->uvm_pm_mode;
+    event.numa_status = device->numa_status;
+
+    nvPdMsgServerNotify(&event);
+}
+
+/*
+ * init_complete() - called by the child (daemon) process to signal to the
+ * parent process, via the init pipe created during daemonize(), that
+ * initialization has completed successfully. When running as a Type=notify
+ * systemd service, there is no parent process waiting, and the service
+ * manager is notified instead.
+ */
+static NvPdStatus init_complete(int pipe_write_fd)
+{
+    unsigned char success = 1;
+    sigset_t old_signal_set;
+    int num_devices;
+    int bytes;
+
+    lock_registry(&old_signal_set);
+    num_devices = registry.num_devices;
+    unlock_registry(&old_signal_set);
+
+    nvPdSystemdNotify("READY=1\nSTATUS=Managing %d devices", num_devices);
+
+    if (pipe_write_fd < 0) {
+        return NVPD_SUCCESS;
+    }
+
+    bytes = write(pipe_write_fd, &success, sizeof(success));
+    
+    close(pipe_write_fd);
+
+    if (bytes < 0) {
+        fprintf(stderr, "Failed to write init pipe: %s\n", strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * wait_for_init_complete() - called by the parent process to block on the
+ * init pipe and wait for the child process to signal its successful
+ * initialization.
+ *
+ * The init pipe will be closed upon return from this function.
+ */
+static NvPdStatus wait_for_init_complete(int pipe_read_fd)
+{
+    unsigned char success = 0;
+    int bytes;
+
+    bytes = read(pipe_read_fd, &success, sizeof(success));
+
+    close(pipe_read_fd);
+
+    if (bytes < 0) {
+        fprintf(stderr, "Failed to read init pipe: %s\n", strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    if (bytes != sizeof(success) || !success) {
+        fprintf(stderr, "nvidia-persistenced failed to initialize. "
+                        "Check syslog for more details.\n");
+        return NVPD_ERR_UNKNOWN;
+    }
+
+    return NVPD_SUCCESS;
+}
+
+static NV_STATUS current_timestamp(uint64_t *ts) {
+    struct timespec te;
+    NV_STATUS ret = 0;
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &te);
+    if (ret == 0) {
+        *ts = te.tv_sec * 1000ULL + te.tv_nsec / 1000000ULL; // calculate milliseconds
+        return NV_OK;
+    } else {
+        return NV_ERR_OPERATING_SYSTEM;
+    }
+}
+
+/*
+ * report_uvm_persistence_mode() - records and reports the final result of
+ * attempting to enable UVM persistence mode on the device.
+ */
+static void report_uvm_persistence_mode(NvPdDevice *device, NV_STATUS status)
+{
+    if (status == NV_OK) {
+        syslog_device(&device->pci_info, LOG_INFO,
+                "Enabled UVM Persistence mode.");
+        device->uvm_pm_mode = NV_UVM_PERSISTENCE_MODE_ENABLED;
+        mark_device_transition(device);
+    } else if (status == NV_ERR_NVLINK_FABRIC_NOT_READY) {
+        syslog_device(&device->pci_info, LOG_WARNING,
+                "Could not Enable UVM Persistence mode because "
+                "the NVLink fabric is not ready: 0x%x", status);
+    } else {
+        syslog_device(&device->pci_info, LOG_WARNING,
+        "Could not Enable UVM Persistence mode : 0x%x", status);
+    }
+
+    if (status != NV_OK) {
+        notify_device_change(device, NVPD_ERR_DRIVER);
+    }
+}
+
+/*
+ * ms_to_timespec() - converts a CLOCK_MONOTONIC timestamp in milliseconds,
+ * as returned by current_timestamp(), into a timespec.
+ */
+static void ms_to_timespec(uint64_t ms, struct timespec *ts)
+{
+    ts->tv_sec = ms / 1000ULL;
+    ts->tv_nsec = (ms % 1000ULL) * 1000000ULL;
+}
+
+/*
+ * retry_uvm_persistence_mode() - makes another attempt at enabling UVM
+ * persistence mode on a device that is waiting for its NVLink fabric. On
+ * failure, the next attempt is scheduled with an exponential backoff, until
+ * the fabric timeout expires.
+ */
+static void retry_uvm_persistence_mode(NvPdDevice *device)
+{
+    NV_STATUS status;
+    uint64_t now = 0;
+    uint64_t max_interval;
+    int pending;
+
+    pthread_mutex_lock(&device->lock);
+
+    pthread_mutex_lock(&uvm_retry.lock);
+    pending = device->uvm_retry_pending;
+    pthread_mutex_unlock(&uvm_retry.lock);
+
+    if (!pending) {
+        goto done;
+    }
+
+    status = nv_cfg_api.nvCfgEnableUVMPersistence(device->nv_cfg_handle);
+
+    (void) current_timestamp(&now);
+
+    pthread_mutex_lock(&uvm_retry.lock);
+
+    NVPD_TRACE3(uvm__fabric__retry, NVPD_TRACE_BDF(&device->pci_info),
+                device->uvm_retry_interval, status);
+
+    if ((status == NV_ERR_NVLINK_FABRIC_NOT_READY) &&
+        (now < device->uvm_retry_deadline)) {
+        max_interval = NV_MAX(uvm_fabric_retry_interval_ms,
+                              NVPD_UVM_RETRY_MAX_INTERVAL_MS);
+        device->uvm_retry_interval = NV_MIN(device->uvm_retry_interval * 2,
+                                            max_interval);
+        device->uvm_retry_time = NV_MIN(now + device->uvm_retry_interval,
+                                        device->uvm_retry_deadline);
+    } else {
+        device->uvm_retry_pending = 0;
+    }
+
+    pending = device->uvm_retry_pending;
+
+    pthread_mutex_unlock(&uvm_retry.lock);
+
+    if (!pending) {
+        nvPdStatsRecordDevice(device->stats, NVPD_PHASE_UVM_PERSISTENCE,
+                              device->uvm_enable_start);
+        report_uvm_persistence_mode(device, status);
+    } else {
+        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_DEBUG,
+                              "NVLink fabric not ready, retrying UVM "
+                              "Persistence mode in %llu ms.",
+                              (unsigned long long)device->uvm_retry_interval);
+    }
+
+done:
+    pthread_mutex_unlock(&device->lock);
+}
+
+/*
+ * uvm_retry_thread() - This thread retries enabling UVM persistence mode on
+ * all devices waiting for their NVLink fabric, each time one of them is due.
+ */
+static void *uvm_retry_thread(void *arg)
+{
+    NvPdDevice *device, *iter;
+    struct timespec ts;
+    uint64_t now, wakeup;
+
+    pthread_mutex_lock(&uvm_retry.lock);
+
+    while (!uvm_retry.shutdown) {
+        device = NULL;
+        wakeup = UINT64_MAX;
+        now = 0;
+
+        (void) current_timestamp(&now);
+
+        /* Signals are already blocked on this thread */
+        pthread_mutex_lock(&registry.lock);
+
+        for (iter = registry.list; iter != NULL; iter = iter->next) {
+            if (!iter->uvm_retry_pending) {
+                continue;
+            }
+
+            if (iter->uvm_retry_time <= now) {
+                device = iter;
+                device->refcount++;
+                break;
+            }
+
+            wakeup = NV_MIN(wakeup, iter->uvm_retry_time);
+        }
+
+        pthread_mutex_unlock(&registry.lock);
+
+        if (device != NULL) {
+            pthread_mutex_unlock(&uvm_retry.lock);
+            retry_uvm_persistence_mode(device);
+            put_device(device);
+            pthread_mutex_lock(&uvm_retry.lock);
+            continue;
+        }
+
+        if (wakeup == UINT64_MAX) {
+            pthread_cond_wait(&uvm_retry.cond, &uvm_retry.lock);
+        } else {
+            ms_to_timespec(wakeup, &ts);
+            pthread_cond_timedwait(&uvm_retry.cond, &uvm_retry.lock, &ts);
+        }
+    }
+
+    pthread_mutex_unlock(&uvm_retry.lock);
+
+    return NULL;
+}
+
+/*
+ * start_uvm_retry_thread() - starts the UVM retry thread if it is not
+ * running yet. Must be called with uvm_retry.lock held.
+ */
+static NvPdStatus start_uvm_retry_thread(void)
+{
+    pthread_condattr_t cond_attr;
+    sigset_t signal_set, old_signal_set;
+    int ret;
+
+    if (uvm_retry.thread_started) {
+        return NVPD_SUCCESS;
+    }
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&uvm_retry.cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    /* Leave signal handling to the main thread */
+    sigfillset(&signal_set);
+    pthread_sigmask(SIG_SETMASK, &signal_set, &old_signal_set);
+
+    ret = pthread_create(&uvm_retry.thread, NULL, uvm_retry_thread, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &old_signal_set, NULL);
+
+    if (ret != 0) {
+        syslog(LOG_ERR, "Failed to create UVM retry thread: %s",
+               strerror(ret));
+        pthread_cond_destroy(&uvm_retry.cond);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    uvm_retry.thread_started = 1;
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * stop_uvm_retry_thread() - stops the UVM retry thread, if it is running.
+ */
+static void stop_uvm_retry_thread(void)
+{
+    int thread_started;
+
+    pthread_mutex_lock(&uvm_retry.lock);
+    thread_started = uvm_retry.thread_started;
+    uvm_retry.shutdown = 1;
+    if (thread_started) {
+        pthread_cond_signal(&uvm_retry.cond);
+    }
+    pthread_mutex_unlock(&uvm_retry.lock);
+
+    if (thread_started) {
+        pthread_join(uvm_retry.thread, NULL);
+    }
+}
+
+/*
+ * schedule_uvm_persistence_mode_retry() - hands the device off to the UVM
+ * retry thread, which keeps trying to enable UVM persistence mode until the
+ * NVLink fabric is ready or the fabric timeout expires.
+ */
+static NvPdStatus schedule_uvm_persistence_mode_retry(NvPdDevice *device)
+{
+    NvPdStatus status;
+    uint64_t now;
+
+    if (current_timestamp(&now) != NV_OK) {
+        return NVPD_ERR_UNKNOWN;
+    }
+
+    pthread_mutex_lock(&uvm_retry.lock);
+
+    status = start_uvm_retry_thread();
+    if (status == NVPD_SUCCESS) {
+        device->uvm_retry_pending = 1;
+        device->uvm_retry_deadline = now + uvm_fabric_timeout_ms;
+        device->uvm_retry_interval = uvm_fabric_retry_interval_ms;
+        device->uvm_retry_time = NV_MIN(now + device->uvm_retry_interval,
+                                        device->uvm_retry_deadline);
+        pthread_cond_signal(&uvm_retry.cond);
+    }
+
+    pthread_mutex_unlock(&uvm_retry.lock);
+
+    return status;
+}
+
+/*
+ * cancel_uvm_persistence_mode_retry() - takes the device off the UVM retry
+ * thread's list. Must be called with the device lock held, which guarantees
+ * that no retry is in progress for the device.
+ */
+static void cancel_uvm_persistence_mode_retry(NvPdDevice *device)
+{
+    pthread_mutex_lock(&uvm_retry.lock);
+    if (device->uvm_retry_pending) {
+        device->uvm_retry_pending = 0;
+        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_DEBUG,
+                              "Cancelled pending UVM Persistence mode.");
+    }
+    pthread_mutex_unlock(&uvm_retry.lock);
+}
+
+/*
+ * enable_uvm_persistence_mode() - registers the device with UVM. If the
+ * NVLink fabric is not ready yet, the registration is completed
+ * asynchronously by the UVM retry thread, so that the caller does not block
+ * waiting for the fabric.
+ */
+static void enable_uvm_persistence_mode(NvPdDevice *device) {
+    NV_STATUS status;
+
+    device->uvm_enable_start = nvPdStatsTime();
+
+    status = nv_cfg_api.nvCfgEnableUVMPersistence(device->nv_cfg_handle);
+    NVPD_TRACE3(uvm__fabric__retry, NVPD_TRACE_BDF(&device->pci_info), 0,
+                status);
+    if ((status == NV_ERR_NVLINK_FABRIC_NOT_READY) &&
+        (uvm_fabric_timeout_ms > 0) &&
+        (schedule_uvm_persistence_mode_retry(device) == NVPD_SUCCESS)) {
+        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_NOTICE,
+                              "NVLink fabric not ready, UVM Persistence mode "
+                              "will be enabled once it is.");
+        return;
+    }
+
+    nvPdStatsRecordDevice(device->stats, NVPD_PHASE_UVM_PERSISTENCE,
+                          device->uvm_enable_start);
+    report_uvm_persistence_mode(device, status);
+}
+
+/*
+ * disable_uvm_persistence_mode() - unregisters the device from UVM.
+ */
+static void disable_uvm_persistence_mode(NvPdDevice *device)
+{
+    unsigned int ret;
+
+    ret = nv_cfg_api.nvCfgDisableUVMPersistence(device->nv_cfg_handle);
+    if (ret != 0) {
+        syslog_device(&device->pci_info, LOG_WARNING,
+                "Failed to disable UVM Persistence mode: 0x%x", ret);
+    } else {
+        syslog_device(&device->pci_info, LOG_INFO,
+                "Disabled UVM Persistence mode.");
+        device->uvm_pm_mode = NV_UVM_PERSISTENCE_MODE_DISABLED;
+        mark_device_transition(device);
+    }
+}
+
+/*
+ * read_device_uuid() - records the UUID of an open device, for matching it
+ * against the policy file. Older drivers may not report it.
+ */
+static void read_device_uuid(NvPdDevice *device)
+{
+    char *uuid = NULL;
+
+    if (!nvPdIsDriverFeatureSupported(NVPD_DRIVER_FEATURE_DEVICE_UUID)) {
+        return;
+    }
+
+    if (nv_cfg_api.get_device_uuid(device->nv_cfg_handle, &uuid) &&
+        (uuid != NULL)) {
+        snprintf(device->uuid, sizeof(device->uuid), "%s", uuid);
+    }
+
+    free(uuid);
+}
+
+/*
+ * set_device_mode() - This function performs the heavy lifting in enabling or
+ * disabling device mode for a given device by performing mode checks and
+ * calling libnvidia-cfg to open and close the device.
+ */
+static NvPdStatus set_device_mode(NvPdDevice *device, NvPersistenceMode mode)
+{
+    NvPdStatus status = NVPD_SUCCESS;
+    NvCfgBool success;
+    uint64_t start;
+
+    /* If the device is already in the mode specified, just abort */
+    if (mode == device->mode) {
+        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_NOTICE,
+                              "already in requested persistence mode.");
+        return status;
+    }
+
+    NVPD_TRACE2(set__mode__entry, NVPD_TRACE_BDF(&device->pci_info), mode);
+
+    switch (mode) {
+
+    case NV_PERSISTENCE_MODE_DISABLED:
+
+        /* Stop waiting for the NVLink fabric, if we still are */
+        cancel_uvm_persistence_mode_retry(device);
+
+        /* If UVM persistence is enabled at this point, we must disable it */
+        if (device->uvm_pm_mode == NV_UVM_PERSISTENCE_MODE_ENABLED) {
+            disable_uvm_persistence_mode(device);
+        }
+        /* If the new mode is disabled, we must close the device. */
+        success = nv_cfg_api.close_device(device->nv_cfg_handle);
+        if (!success) {
+            syslog_device(&device->pci_info, LOG_ERR, "failed to close.");
+            status = NVPD_ERR_DRIVER;
+        } else {
+            device->nv_cfg_handle = NULL;
+        }
+
+        break;
+
+    case NV_PERSISTENCE_MODE_ENABLED:
+
+        /* If the new mode is enabled, we must open the device. */
+        start = nvPdStatsTime();
+        success = nv_cfg_api.open_pci_device(device->pci_info.domain,
+                                             device->pci_info.bus,
+                                             device->pci_info.slot,
+                                             device->pci_info.function,
+                                             &device->nv_cfg_handle);
+        nvPdStatsRecordDevice(device->stats, NVPD_PHASE_OPEN_DEVICE, start);
+        if (!success) {
+            syslog_device(&device->pci_info, LOG_ERR, "failed to open.");
+            status = NVPD_ERR_DRIVER;
+        }
+
+        if (success && (device->uuid[0] == '\0')) {
+            read_device_uuid(device);
+        }
+
+        /* If UVM-PM is enabled by user, we must register with UVM */
+        if (success && device->uvm_policy == NV_UVM_PERSISTENCE_MODE_ENABLED) {
+            enable_uvm_persistence_mode(device);
+        }
+
+        break;
+
+    default:
+
+        syslog_device(&device->pci_info, LOG_ERR,
+                      "requested invalid mode %d", mode);
+        status = NVPD_ERR_INVALID_ARGUMENT;
+        break;
+
+    }
+
+    if (status == NVPD_SUCCESS) {
         device->mode = mode;
+        mark_device_transition(device);
+        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_NOTICE,
+                              "persistence mode %s.",
+                              (mode == NV_PERSISTENCE_MODE_ENABLED) ?
+                                "enabled" : "disabled");
+    } else {
+        device->num_failures++;
+        notify_device_change(device, status);
+    }
+
+    NVPD_TRACE3(set__mode__return, NVPD_TRACE_BDF(&device->pci_info), mode,
+                status);
+
+    return status;
+}
+
+/*
+ * set_device_numa_status() - This function invokes the nvidia-numa functions
+ * for onlining or offlining device NUMA memory for a given device.
+ */
+static NvPdStatus set_device_numa_status(NvPdDevice *device,
+                                         NvNumaStatus numa_status)
+{
+    NvPdStatus status = NVPD_SUCCESS;
+
+    /* If the device is already in the state specified, just abort */
+    if (numa_status == device->numa_status) {
+        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_NOTICE,
+                              "NUMA memory already in requested state.");
+        return status;
+    }
+
+    NVPD_TRACE2(set__numa__entry, NVPD_TRACE_BDF(&device->pci_info),
+                numa_status);
+
+    switch (numa_status) {
+
+    case NV_NUMA_STATUS_OFFLINE:
+
+        status = nvNumaOfflineMemory(&device->numa_info);
+        if (status != NVPD_SUCCESS) {
+            syslog_device(&device->pci_info, LOG_ERR,
+                          "failed to offline memory.\n");
+        }
+
+        break;
+
+    case NV_NUMA_STATUS_ONLINE:
+
+        /*
+         * Take over the memory onlined by the previous instance of the
+         * daemon, if the driver confirms its recorded state.
+         */
+        if (device->has_previous_state) {
+            int fd = device->handoff_numa_fd;
+
+            device->has_previous_state = 0;
+            device->handoff_numa_fd = -1;
+
+            if ((device->previous_state.numa_status == NV_NUMA_STATUS_ONLINE) &&
+                !device->previous_state.use_auto_online) {
+                if (nvNumaAdoptMemory(&device->numa_info,
+                                      &device->previous_state.numa_range,
+                                      fd) == NVPD_SUCCESS) {
+                    break;
+                }
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        status = nvNumaOnlineMemory(&device->numa_info);
+        if (status != NVPD_SUCCESS) {
+            syslog_device(&device->pci_info, LOG_ERR,
+                          "failed to online memory.\n");
+        }
+
+        break;
+
+    default:
+
+        syslog_device(&device->pci_info, LOG_ERR,
+                      "requested invalid NUMA status %d", numa_status);
+        status = NVPD_ERR_INVALID_ARGUMENT;
+        break;
+
+    }
+
+    if (status == NVPD_SUCCESS) {
+        device->numa_status = numa_status;
+        mark_device_transition(device);
         SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_NOTICE,
-                              "persistence mode %s.",
-                              (mode == NV_PERSISTENCE_MODE_ENABLED) ?
-                                "enabled" : "disabled");
+                              "NUMA memory %s.",
+                              (numa_status == NV_NUMA_STATUS_ONLINE) ?
+                                "onlined" : "offlined");
+    } else {
+        device->num_failures++;
+        notify_device_change(device, status);
+    }
+
+    NVPD_TRACE3(set__numa__return, NVPD_TRACE_BDF(&device->pci_info),
+                numa_status, status);
+
+    return status;
+}
+
+/*
+ * teardown_device() - disables persistence mode on the device, and offlines
+ * its NUMA memory unless the daemon is restarted warm. Only one thread works
+ * on the device at this point, so the progress of the NUMA memory transition
+ * is tracked without taking the device lock.
+ */
+static void teardown_device(NvPdDevice *device, NvNumaProgress *progress)
+{
+    sigset_t old_signal_set;
+
+    if (device->nv_cfg_handle == NULL) {
+        return;
+    }
+
+    nvNumaBindToLocalCpus(&device->numa_info);
+    device->numa_info.progress = progress;
+
+    if (warm_restart) {
+        /* Leave the NUMA memory online for the next instance */
+        (void) set_device_mode(device, NV_PERSISTENCE_MODE_DISABLED);
+    } else {
+        /*
+         * Unlike set_device_persistence_mode(), persistence mode is not
+         * enabled again if offlining fails or is canceled by the shutdown
+         * deadline: the memory is left online, and the next instance adopts
+         * it from the journal.
+         */
+        lock_device(device, &old_signal_set);
+        if (set_device_mode(device, NV_PERSISTENCE_MODE_DISABLED) ==
+            NVPD_SUCCESS) {
+            (void) set_device_numa_status(device, NV_NUMA_STATUS_OFFLINE);
+        }
+        unlock_device(device, &old_signal_set);
+    }
+
+    device->numa_info.progress = NULL;
+    nvNumaUnbindCpus();
+}
+
+/* State shared with the threads tearing down devices on shutdown */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int remaining;
+} teardown = { PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * teardown_device_work() - tears down a single device. This is run on one of
+ * the teardown threads.
+ */
+static void teardown_device_work(void *data)
+{
+    NvPdTeardownTask *task = (NvPdTeardownTask *)data;
+    uint64_t end_time = 0;
+
+    teardown_device(task->device, &task->progress);
+
+    (void) current_timestamp(&end_time);
+    SYSLOG_DEVICE_VERBOSE(&task->device->pci_info, LOG_INFO,
+                          "torn down in %llu ms.",
+                          (unsigned long long)(end_time - task->start_time));
+
+    pthread_mutex_lock(&teardown.lock);
+    task->done = 1;
+    teardown.remaining--;
+    pthread_cond_signal(&teardown.cond);
+    pthread_mutex_unlock(&teardown.lock);
+}
+
+/*
+ * report_teardown_progress() - logs how far along the devices that are still
+ * being torn down are. Must be called with teardown.lock held.
+ */
+static void report_teardown_progress(const NvPdTeardownTask *tasks,
+                                     int num_tasks)
+{
+    int i;
+
+    for (i = 0; i < num_tasks; i++) {
+        if (tasks[i].done) {
+            continue;
+        }
+
+        if (tasks[i].progress.memblocks_total > 0) {
+            syslog_device(&tasks[i].device->pci_info, LOG_NOTICE,
+                          "still offlining NUMA memory, %u of %u memory "
+                          "blocks done.", tasks[i].progress.memblocks_done,
+                          tasks[i].progress.memblocks_total);
+        } else {
+            syslog_device(&tasks[i].device->pci_info, LOG_NOTICE,
+                          "still being torn down.");
+        }
+    }
+}
+
+/*
+ * teardown_devices() - tears down all devices concurrently, and removes the
+ * devices that are done from the registry.
+ *
+ * If shutdown_timeout is set and the devices are not done within that many
+ * seconds, the NUMA memory transitions still in progress are canceled, which
+ * stops them at the next memory block and brings the blocks already offlined
+ * back online, rather than having the daemon killed in the middle of a
+ * transition. The journal is then kept, so that the next instance of the
+ * daemon takes over the memory left online.
+ *
+ * Either way, this only returns once every teardown thread is done, so that
+ * no thread is still using a device or libnvidia-cfg when the daemon exits.
+ */
+static void teardown_devices(void)
+{
+    NvPdTeardownTask *tasks;
+    NvPdWorkQueue *queue = NULL;
+    NvPdDevice *device;
+    pthread_condattr_t cond_attr;
+    struct timespec ts;
+    uint64_t now = 0, deadline, next_report;
+    int num_tasks = registry.num_devices;
+    int canceled = 0, i;
+
+    if (num_tasks == 0) {
+        return;
+    }
+
+    tasks = calloc(num_tasks, sizeof(NvPdTeardownTask));
+    if (tasks != NULL) {
+        queue = nvPdWorkQueueCreate(num_tasks);
+    }
+
+    if (queue == NULL) {
+        syslog(LOG_WARNING, "Failed to create device teardown threads, "
+                            "devices will be torn down serially");
+
+        while (registry.list != NULL) {
+            device = registry.list;
+            teardown_device(device, NULL);
+            unregister_device(device);
+            put_device(device);
+        }
+
+        free(tasks);
+        return;
+    }
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&teardown.cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    (void) current_timestamp(&now);
+
+    teardown.remaining = num_tasks;
+
+    for (i = 0, device = registry.list; i < num_tasks;
+         i++, device = device->next) {
+        tasks[i].device = device;
+        tasks[i].start_time = now;
+
+        if (nvPdWorkQueueSubmit(queue, teardown_device_work,
+                                &tasks[i]) != NVPD_SUCCESS) {
+            teardown_device_work(&tasks[i]);
+        }
+    }
+
+    deadline = (shutdown_timeout > 0) ?
+                   (now + shutdown_timeout * 1000ULL) : UINT64_MAX;
+    next_report = now + NVPD_TEARDOWN_REPORT_MS;
+
+    pthread_mutex_lock(&teardown.lock);
+
+    while (teardown.remaining > 0) {
+        (void) current_timestamp(&now);
+
+        if (now >= deadline) {
+            syslog(LOG_WARNING, "Devices not torn down within %d seconds, "
+                                "canceling NUMA memory transitions in "
+                                "progress", shutdown_timeout);
+
+            for (i = 0; i < num_tasks; i++) {
+                tasks[i].progress.cancel = 1;
+            }
+
+            /* Keep waiting for the threads to stop, however long it takes */
+            canceled = 1;
+            deadline = UINT64_MAX;
+            continue;
+        }
+
+        if (now >= next_report) {
+            report_teardown_progress(tasks, num_tasks);
+            next_report = now + NVPD_TEARDOWN_REPORT_MS;
+            continue;
+        }
+
+        ms_to_timespec(NV_MIN(deadline, next_report), &ts);
+        pthread_cond_timedwait(&teardown.cond, &teardown.lock, &ts);
+    }
+
+    pthread_mutex_unlock(&teardown.lock);
+
+    nvPdWorkQueueDestroy(queue);
+
+    if (canceled) {
+        nvPdJournalClose(1);
+    }
+
+    for (i = 0; i < num_tasks; i++) {
+        unregister_device(tasks[i].device);
+        put_device(tasks[i].device);
+    }
+
+    free(tasks);
+}
+
+/*
+ * shutdown_daemon() - This function systematically tears down state that was
+ * created while setting up the daemon. This function assumes that it has
+ * control over the runtime files, e.g., that no other instance of the daemon
+ * is using them, so they can be deleted.
+ */
+static void shutdown_daemon(int status)
+{
+    NvPdDevice *device;
+
+    /* Nothing to clean up */
+    if (pid <= 0) {
+        goto shutdown;
+    }
+
+    nvPdSystemdNotify("STOPPING=1");
+
+    /* Clean up and remove the RPC socket */
+    if (socket_fd != -1) {
+        /* Unregister any mappings to the RPC dispatch routines */
+        svc_unregister(NVPD_PROG, VersionOne);
+        svc_unregister(NVPD_PROG, VersionTwo);
+        svc_unregister(NVPD_PROG, VersionThree);
+        svc_unregister(NVPD_PROG, VersionFour);
+
+        if (close(socket_fd) < 0) {
+            syslog(LOG_ERR, "Failed to close socket: %s",
+                   strerror(errno));
+        } else {
+            SYSLOG_VERBOSE(LOG_INFO, "Socket closed.");
+        }
+
+        if (!socket_activated && (unlink(NVPD_SOCKET_PATH) < 0)) {
+            syslog(LOG_ERR, "Failed to unlink socket: %s",
+                   strerror(errno));
+        }
+    }
+
+    nvPdMsgServerShutdown();
+
+    nvPdMetricsShutdown();
+
+    /* Stop adding and removing devices */
+    nvPdHotplugShutdown();
+    nvPdWorkQueueDestroy(hotplug_queue);
+    hotplug_queue = NULL;
+
+    /*
+     * Let the device worker threads finish any commands still queued. No
+     * other thread changes the registry from this point on.
+     */
+    for (device = registry.list; device != NULL; device = device->next) {
+        nvPdWorkQueueDestroy(device->work_queue);
+        device->work_queue = NULL;
+    }
+
+    /* Stop retrying UVM persistence mode before tearing down devices */
+    stop_uvm_retry_thread();
+
+    /*
+     * For a warm restart, keep the journal, so that the next instance of the
+     * daemon finds the state the devices are left in: persistence mode
+     * disabled, as it is below, and NUMA memory online.
+     */
+    if (warm_restart) {
+        for (device = registry.list; device != NULL; device = device->next) {
+            NvPdJournalEntry entry;
+
+            get_device_state(device, &entry);
+            entry.mode = NV_PERSISTENCE_MODE_DISABLED;
+            entry.uvm_mode = NV_UVM_PERSISTENCE_MODE_DISABLED;
+            nvPdJournalUpdate(&entry);
+        }
+
+        nvPdJournalClose(1);
+    }
+
+    /* Detach and free all devices */
+    teardown_devices();
+
+    nvPdJournalClose(0);
+
+    /* Release the libnvidia-cfg handle */
+    if (libnvidia_cfg != NULL) {
+        dlclose(libnvidia_cfg);
+        libnvidia_cfg = NULL;
+    }
+
+    /* Clean up and remove the PID file */
+    if (pid_fd != -1) {
+        /* Unlock the PID file */
+        if (lockf(pid_fd, F_ULOCK, 0) < 0) {
+            syslog(LOG_ERR, "Failed to unlock PID file: %s",
+                   strerror(errno));
+        } else {
+            SYSLOG_VERBOSE(LOG_INFO, "PID file unlocked.");
+        }
+
+        /* Close the PID file */
+        if (close(pid_fd) < 0) {
+            syslog(LOG_ERR, "Failed to close PID file: %s",
+                   strerror(errno));
+        } else {
+            SYSLOG_VERBOSE(LOG_INFO, "PID file closed.");
+        }
+
+        /* Remove the PID file */
+        if (unlink(NVPD_PID_FILE) < 0) {
+            syslog(LOG_ERR, "Failed to unlink PID file: %s",
+                   strerror(errno));
+        }
+    }
+
+    /*
+     * Remove the runtime data directory if the daemon created it. If the
+     * daemon has dropped permissions and is no longer able to remove the
+     * directory, issue a notice instead of a warning, as this is expected.
+     */
+    if (remove_dir && !warm_restart &&
+        (rmdir(NVPD_VAR_RUNTIME_DATA_PATH) < 0) &&
+        (errno != ENOENT)) {
+        if (errno == EACCES) {
+            SYSLOG_VERBOSE(LOG_NOTICE,
+                           "The daemon no longer has permission to remove its "
+                           "runtime data directory %s",
+                           NVPD_VAR_RUNTIME_DATA_PATH);
+        } else {
+            syslog(LOG_WARNING, "Failed to remove runtime data directory: %s",
+                   strerror(errno));
+        }
+    }
+
+    syslog(LOG_NOTICE, "Shutdown (%d)", pid);
+    closelog();
+
+shutdown:
+    exit(status);
+}
+
+/*
+ * release_handoff_fds() - closes the file descriptors handed over by the
+ * previous instance of the daemon that were not taken over.
+ */
+static void release_handoff_fds(NvPdDevice *device)
+{
+    if (device->handoff_device_fd >= 0) {
+        close(device->handoff_device_fd);
+        device->handoff_device_fd = -1;
+    }
+
+    if (device->handoff_numa_fd >= 0) {
+        close(device->handoff_numa_fd);
+        device->handoff_numa_fd = -1;
+    }
+}
+
+/*
+ * release_all_handoff_fds() - drops whatever is left of the state handed over
+ * by the previous instance of the daemon.
+ */
+static void release_all_handoff_fds(void)
+{
+    NvPdDevice *device;
+    sigset_t old_signal_set;
+
+    lock_registry(&old_signal_set);
+    for (device = registry.list; device != NULL; device = device->next) {
+        release_handoff_fds(device);
+    }
+    unlock_registry(&old_signal_set);
+
+    nvPdHandoffFree(&handoff_state);
+}
+
+/*
+ * free_exec_args() - releases the arguments prepared by prepare_exec().
+ */
+static void free_exec_args(NvPdExecArgs *args)
+{
+    if (args->fd >= 0) {
+        close(args->fd);
+        args->fd = -1;
+    }
+
+    if (args->null_fd >= 0) {
+        close(args->null_fd);
+        args->null_fd = -1;
+    }
+
+    free(args->argv);
+    args->argv = NULL;
+}
+
+/*
+ * prepare_exec() - prepares the arguments of a new instance of the daemon,
+ * with the same command line, that receives the state of this instance from
+ * fd. Only async-signal-safe functions may be called in the child of a
+ * multithreaded process, so everything the child needs is set up before
+ * forking.
+ */
+static NvPdStatus prepare_exec(int fd, NvPdExecArgs *args)
+{
+    int argc, i, null_fd;
+
+    memset(args, 0, sizeof(*args));
+    args->fd = -1;
+    args->null_fd = -1;
+
+    /* Keep the socket clear of the standard file descriptors */
+    args->fd = fcntl(fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+    if (args->fd < 0) {
+        goto fail;
+    }
+
+    /*
+     * The standard file descriptors of the daemon are closed; the new
+     * instance expects them to be open like any other process does.
+     */
+    null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (null_fd < 0) {
+        goto fail;
+    }
+
+    args->null_fd = fcntl(null_fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+    close(null_fd);
+    if (args->null_fd < 0) {
+        goto fail;
+    }
+
+    for (argc = 0; self_argv[argc] != NULL; argc++);
+
+    args->argv = calloc(argc + 2, sizeof(char *));
+    if (args->argv == NULL) {
+        free_exec_args(args);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    /* Drop the handoff socket of this instance, if it was handed over too */
+    for (i = 0, argc = 0; self_argv[i] != NULL; i++) {
+        const char *arg = self_argv[i];
+
+        while (*arg == '-') {
+            arg++;
+        }
+
+        if (strncmp(arg, "handoff-fd", strlen("handoff-fd")) == 0) {
+            arg += strlen("handoff-fd");
+            if ((*arg == '\0') && (self_argv[i + 1] != NULL)) {
+                i++;
+                continue;
+            }
+            if ((*arg == '\0') || (*arg == '=')) {
+                continue;
+            }
+        }
+
+        args->argv[argc++] = self_argv[i];
+    }
+
+    snprintf(args->fd_arg, sizeof(args->fd_arg), "--handoff-fd=%d", args->fd);
+    args->argv[argc] = args->fd_arg;
+
+    sigemptyset(&args->signal_set);
+
+    return NVPD_SUCCESS;
+
+fail:
+    syslog(LOG_ERR, "Failed to prepare new daemon instance: %s",
+           strerror(errno));
+    free_exec_args(args);
+    return NVPD_ERR_IO;
+}
+
+/*
+ * exec_new_instance() - executes the new instance of the daemon prepared by
+ * prepare_exec(). Called in the child process, and only returns on failure.
+ */
+static void exec_new_instance(const NvPdExecArgs *args)
+{
+    /* The handoff socket is the only file descriptor to be inherited */
+    if (fcntl(args->fd, F_SETFD, 0) < 0) {
+        return;
+    }
+
+    if ((dup2(args->null_fd, STDIN_FILENO) < 0) ||
+        (dup2(args->null_fd, STDOUT_FILENO) < 0) ||
+        (dup2(args->null_fd, STDERR_FILENO) < 0)) {
+        return;
+    }
+
+    sigprocmask(SIG_SETMASK, &args->signal_set, NULL);
+
+    execv(self_exe, args->argv);
+}
+
+/*
+ * quiesce_device_work() - collects the state of the device to be handed over
+ * on the worker thread of the device, once all work queued to it before the
+ * handoff started is done. The device then stays locked, and its worker
+ * thread waits, until the daemon exits; or until the handoff is canceled.
+ */
+static void quiesce_device_work(void *data)
+{
+    NvPdQuiesceTask *task = data;
+    NvPdDevice *device = task->device;
+    sigset_t old_signal_set;
+    int canceled;
+
+    lock_device(device, &old_signal_set);
+
+    pthread_mutex_lock(&pending_handoff.lock);
+    canceled = pending_handoff.canceled;
+    pthread_mutex_unlock(&pending_handoff.lock);
+
+    if (!canceled) {
+        get_device_state(device, &task->state->state);
+        task->state->numa_fd = device->numa_info.fd;
+        task->state->device_fd =
+            (device->mode == NV_PERSISTENCE_MODE_ENABLED) ?
+                nvNumaOpenDevice(&device->numa_info) : -1;
+    }
+
+    pthread_mutex_lock(&pending_handoff.lock);
+
+    /* The last device to be quiesced lets main() send the state */
+    if (++pending_handoff.num_quiesced == pending_handoff.num_devices) {
+        nvPdEventLoopStop();
+    }
+
+    while (!pending_handoff.canceled) {
+        pthread_cond_wait(&pending_handoff.cond, &pending_handoff.lock);
+    }
+
+    if (++pending_handoff.num_done == pending_handoff.num_devices) {
+        pthread_cond_broadcast(&pending_handoff.cond);
+    }
+
+    pthread_mutex_unlock(&pending_handoff.lock);
+
+    unlock_device(device, &old_signal_set);
+}
+
+/*
+ * start_handoff() - starts handing the state of the daemon over to a newly
+ * executed instance of the daemon, by queueing the quiescing of every device
+ * to its worker thread. The event loop keeps serving requests in the
+ * meantime, even while a device is still busy, e.g., onlining its NUMA
+ * memory; device work is refused from now on, so that every reply deferred
+ * until device work is done has been sent once all devices are quiesced.
+ */
+static NvPdStatus start_handoff(void)
+{
+    NvPdDevice *device;
+    sigset_t old_signal_set;
+    int num_devices, i;
+
+    if ((self_exe[0] == '\0') || (self_argv == NULL)) {
+        syslog(LOG_ERR, "Unable to hand over: the daemon binary is unknown");
+        return NVPD_ERR_UNKNOWN;
+    }
+
+    lock_registry(&old_signal_set);
+
+    num_devices = registry.num_devices;
+
+    for (device = registry.list; device != NULL; device = device->next) {
+        if (device->work_queue == NULL) {
+            unlock_registry(&old_signal_set);
+            syslog_device(&device->pci_info, LOG_ERR,
+                          "unable to hand over without a worker thread.");
+            return NVPD_ERR_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    memset(&pending_handoff.state, 0, sizeof(pending_handoff.state));
+    pending_handoff.devices = calloc(NV_MAX(num_devices, 1),
+                                     sizeof(NvPdDevice *));
+    pending_handoff.tasks = calloc(NV_MAX(num_devices, 1),
+                                   sizeof(NvPdQuiesceTask));
+    pending_handoff.state.devices = calloc(NV_MAX(num_devices, 1),
+                                           sizeof(NvPdHandoffDevice));
+    if ((pending_handoff.devices == NULL) ||
+        (pending_handoff.tasks == NULL) ||
+        (pending_handoff.state.devices == NULL)) {
+        unlock_registry(&old_signal_set);
+        free(pending_handoff.devices);
+        free(pending_handoff.tasks);
+        free(pending_handoff.state.devices);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    pending_handoff.active = 1;
+    pending_handoff.canceled = 0;
+    pending_handoff.num_devices = 0;
+    pending_handoff.num_quiesced = 0;
+    pending_handoff.num_done = 0;
+
+    for (i = 0, device = registry.list; i < num_devices;
+         i++, device = device->next) {
+        NvPdQuiesceTask *task = &pending_handoff.tasks[i];
+
+        task->device = device;
+        task->state = &pending_handoff.state.devices[i];
+        task->state->device_fd = -1;
+        task->state->numa_fd = -1;
+
+        device->refcount++;
+        pending_handoff.devices[i] = device;
+        pending_handoff.state.num_devices++;
+    }
+
+    /*
+     * Queue with the registry lock held, so that no other device work can be
+     * queued after the quiescing of the device.
+     */
+    pthread_mutex_lock(&pending_handoff.lock);
+    for (i = 0; i < num_devices; i++) {
+        device = pending_handoff.devices[i];
+
+        if (nvPdWorkQueueSubmit(device->work_queue, quiesce_device_work,
+                                &pending_handoff.tasks[i]) != NVPD_SUCCESS) {
+            syslog_device(&device->pci_info, LOG_ERR,
+                          "failed to queue handoff.");
+            break;
+        }
+
+        pending_handoff.num_devices++;
+    }
+    pthread_mutex_unlock(&pending_handoff.lock);
+
+    unlock_registry(&old_signal_set);
+
+    if (pending_handoff.num_devices < num_devices) {
+        cancel_handoff();
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    SYSLOG_VERBOSE(LOG_INFO, "Waiting for %d devices to hand over",
+                   num_devices);
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * handoff_quiesced() - returns whether all devices are quiesced, and the
+ * state of the daemon is ready to be handed over.
+ */
+static int handoff_quiesced(void)
+{
+    int quiesced;
+
+    if (!pending_handoff.active) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pending_handoff.lock);
+    quiesced = (pending_handoff.num_quiesced == pending_handoff.num_devices);
+    pthread_mutex_unlock(&pending_handoff.lock);
+
+    return quiesced;
+}
+
+/*
+ * cancel_handoff() - releases the devices quiesced for a handoff, once their
+ * worker threads are done with it, and lets device work be queued again.
+ */
+static void cancel_handoff(void)
+{
+    sigset_t old_signal_set;
+    int i;
+
+    if (!pending_handoff.active) {
+        return;
+    }
+
+    pthread_mutex_lock(&pending_handoff.lock);
+    pending_handoff.canceled = 1;
+    pthread_cond_broadcast(&pending_handoff.cond);
+    while (pending_handoff.num_done < pending_handoff.num_devices) {
+        pthread_cond_wait(&pending_handoff.cond, &pending_handoff.lock);
+    }
+    pthread_mutex_unlock(&pending_handoff.lock);
+
+    lock_registry(&old_signal_set);
+    pending_handoff.active = 0;
+    unlock_registry(&old_signal_set);
+
+    for (i = 0; i < pending_handoff.state.num_devices; i++) {
+        if (pending_handoff.state.devices[i].device_fd >= 0) {
+            close(pending_handoff.state.devices[i].device_fd);
+        }
+        put_device(pending_handoff.devices[i]);
+    }
+
+    free(pending_handoff.state.msg_clients);
+    free(pending_handoff.state.devices);
+    free(pending_handoff.tasks);
+    free(pending_handoff.devices);
+    memset(&pending_handoff.state, 0, sizeof(pending_handoff.state));
+    pending_handoff.tasks = NULL;
+    pending_handoff.devices = NULL;
+}
+
+/*
+ * finish_handoff() - hands the state of the daemon over to a newly executed
+ * instance of the daemon, once all devices are quiesced: the RPC socket, the
+ * state of every device, device file descriptors that keep the devices
+ * initialized until the new instance has opened them itself, and the
+ * connections of the binary protocol clients, which stay subscribed to
+ * events. This is called with the event loop stopped, so that no request is
+ * read anymore.
+ *
+ * On success, the caller is to exit without tearing anything down, leaving
+ * the devices quiesced. On failure, the handoff is canceled, and the daemon
+ * keeps running as before.
+ */
+static NvPdStatus finish_handoff(void)
+{
+    NvPdExecArgs exec_args;
+    NvPdStatus status;
+    int sockets[2] = { -1, -1 };
+    pid_t child;
+
+    pending_handoff.state.socket_fd = socket_fd;
+    pending_handoff.state.socket_activated = socket_activated;
+    pending_handoff.state.remove_dir = remove_dir;
+
+    status = nvPdMsgServerGetHandoff(&pending_handoff.state);
+    if (status != NVPD_SUCCESS) {
+        goto done;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) < 0) {
+        syslog(LOG_ERR, "Failed to create handoff socket: %s",
+               strerror(errno));
+        status = NVPD_ERR_IO;
+        goto done;
+    }
+
+    status = prepare_exec(sockets[1], &exec_args);
+    if (status != NVPD_SUCCESS) {
+        goto done;
+    }
+
+    child = fork();
+    if (child == 0) {
+        exec_new_instance(&exec_args);
+        _exit(EXIT_FAILURE);
+    }
+
+    free_exec_args(&exec_args);
+
+    if (child < 0) {
+        syslog(LOG_ERR, "Failed to fork new daemon instance: %s",
+               strerror(errno));
+        status = NVPD_ERR_IO;
+        goto done;
+    }
+
+    close(sockets[1]);
+    sockets[1] = -1;
+
+    status = nvPdHandoffSend(sockets[0], &pending_handoff.state,
+                             NVPD_HANDOFF_TIMEOUT_MS);
+    if (status == NVPD_SUCCESS) {
+        syslog(LOG_NOTICE, "Handed over to new daemon instance");
+    } else {
+        /* The new instance gives up once the socket is closed */
+        close(sockets[0]);
+        sockets[0] = -1;
+        (void) waitpid(child, NULL, 0);
+    }
+
+done:
+    if (sockets[0] >= 0) {
+        close(sockets[0]);
+    }
+    if (sockets[1] >= 0) {
+        close(sockets[1]);
+    }
+
+    if (status != NVPD_SUCCESS) {
+        cancel_handoff();
+    }
+
+    return status;
+}
+
+/*
+ * close_inherited_fds() - closes the file descriptors this instance of the
+ * daemon inherited from the previous one besides the handoff socket, e.g.,
+ * the connections of its RPC clients, which would otherwise stay open
+ * without ever being answered. Everything that is to be taken over is sent
+ * over the handoff socket.
+ */
+static void close_inherited_fds(int keep_fd)
+{
+    struct dirent *entry;
+    DIR *dir;
+    int fd;
+
+    dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        fd = atoi(entry->d_name);
+        if ((fd > STDERR_FILENO) && (fd != keep_fd) && (fd != dirfd(dir))) {
+            close(fd);
+        }
+    }
+
+    closedir(dir);
+}
+
+/*
+ * exit_after_handoff() - exits once the state of the daemon has been handed
+ * over to a new instance, leaving the devices and the runtime files to it.
+ */
+static void exit_after_handoff(void)
+{
+    /* Closing the PID file releases the lock the new instance waits for */
+    if (pid_fd != -1) {
+        close(pid_fd);
+        pid_fd = -1;
+    }
+
+    syslog(LOG_NOTICE, "Shutdown (%d)", pid);
+    closelog();
+
+    _exit(EXIT_SUCCESS);
+}
+
+/*
+ * load_nvidia_cfg_sym() - This function loads a specific symbol from the
+ * nvidia-cfg library. Arguments are assumed to be valid.
+ */
+static int load_nvidia_cfg_sym(void **sym_ptr, const char *sym_name)
+{
+    *sym_ptr = dlsym(libnvidia_cfg, sym_name);
+    if (*sym_ptr == NULL) {
+        syslog(LOG_ERR, "Failed to load symbol %s from %s: %s",
+               sym_name, NVIDIA_CFG_LIB, dlerror());
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * nvPdIsDriverFeatureSupported() - This function returns whether the
+ * installed libnvidia-cfg supports an optional feature, resolving the entry
+ * points of the feature the first time it is asked about.
+ */
+int nvPdIsDriverFeatureSupported(NvPdDriverFeature feature)
+{
+    NvPdFeatureState state;
+    int i;
+
+    if ((feature < 0) || (feature >= NVPD_NUM_DRIVER_FEATURES) ||
+        (libnvidia_cfg == NULL)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&nv_cfg_features_lock);
+
+    if (nv_cfg_features[feature].state == NVPD_FEATURE_UNKNOWN) {
+        state = NVPD_FEATURE_SUPPORTED;
+
+        for (i = 0; i < NVPD_MAX_FEATURE_SYMBOLS; i++) {
+            if (nv_cfg_features[feature].symbols[i].name == NULL) {
+                continue;
+            }
+            *nv_cfg_features[feature].symbols[i].ptr =
+                dlsym(libnvidia_cfg, nv_cfg_features[feature].symbols[i].name);
+            if (*nv_cfg_features[feature].symbols[i].ptr == NULL) {
+                SYSLOG_VERBOSE(LOG_INFO, "%s does not provide %s",
+                               NVIDIA_CFG_LIB,
+                               nv_cfg_features[feature].symbols[i].name);
+                state = NVPD_FEATURE_UNSUPPORTED;
+            }
+        }
+
+        /* A partially supported feature is not used at all */
+        if (state == NVPD_FEATURE_UNSUPPORTED) {
+            for (i = 0; i < NVPD_MAX_FEATURE_SYMBOLS; i++) {
+                if (nv_cfg_features[feature].symbols[i].ptr != NULL) {
+                    *nv_cfg_features[feature].symbols[i].ptr = NULL;
+                }
+            }
+        }
+
+        nv_cfg_features[feature].state = state;
+
+        SYSLOG_VERBOSE(LOG_INFO, "%s %s %s", NVIDIA_CFG_LIB,
+                       (state == NVPD_FEATURE_SUPPORTED) ? "supports" :
+                                                          "does not support",
+                       nv_cfg_features[feature].name);
+    }
+
+    state = nv_cfg_features[feature].state;
+
+    pthread_mutex_unlock(&nv_cfg_features_lock);
+
+    return (state == NVPD_FEATURE_SUPPORTED);
+}
+
+/*
+ * setup_nvidia_cfg_api() - This function loads the nvidia-cfg dynamic library
+ * and queries the required symbols from it.
+ */
+static NvPdStatus setup_nvidia_cfg_api(const char *nvidia_cfg_path)
+{
+    char *lib_path;
+    int status = 0;
+    int num_devices;
+    NvCfgBool success;
+    NvCfgPciDevice *nv_cfg_devices;
+
+    if (nvidia_cfg_path != NULL) {
+        lib_path = nvstrcat(nvidia_cfg_path, "/", NVIDIA_CFG_LIB, NULL);
+    } else {
+        lib_path = NVIDIA_CFG_LIB;
+    }
+
+    /* Only a few entry points of the library are ever called */
+    libnvidia_cfg = dlopen(lib_path, RTLD_LAZY);
+
+    if (nvidia_cfg_path != NULL) {
+        nvfree(lib_path);
+    }
+
+    if (libnvidia_cfg == NULL) {
+        syslog(LOG_ERR, "Failed to open %s: %s", NVIDIA_CFG_LIB,
+               dlerror());
+        return NVPD_ERR_DRIVER;
+    }
+
+    /* Attempt to load all symbols required. */
+    status |= load_nvidia_cfg_sym((void **)&nv_cfg_api.get_pci_devices,
+                                  "nvCfgGetPciDevices");
+    status |= load_nvidia_cfg_sym((void **)&nv_cfg_api.open_pci_device,
+                                  "nvCfgOpenPciDevice");
+    status |= load_nvidia_cfg_sym((void **)&nv_cfg_api.close_device,
+                                  "nvCfgCloseDevice");
+    if (status != 0) {
+        /* Missing symbols are already called out by load_nvidia_cfg_sym(). */
+        return NVPD_ERR_DRIVER;
+    }
+
+    /* Other features are only resolved once needed, except when required */
+    if ((set_uvm_pm == NV_UVM_PERSISTENCE_MODE_ENABLED) &&
+        !nvPdIsDriverFeatureSupported(NVPD_DRIVER_FEATURE_UVM_PERSISTENCE)) {
+        syslog(LOG_ERR, "UVM Persistence mode is not supported by %s",
+               NVIDIA_CFG_LIB);
+        return NVPD_ERR_DRIVER;
+    }
+
+    /* Make a call to get_pci_devices for the side-effect of creating the device files */
+    success = nv_cfg_api.get_pci_devices(&num_devices, &nv_cfg_devices);
+    if (!success) {
+        syslog(LOG_ERR, "Failed to query NVIDIA devices. Please ensure that "
+                        "the NVIDIA device files (/dev/nvidia*) exist, and "
+                        "that user %u has read and write permissions for "
+                        "those files.", getuid());
+        return NVPD_ERR_DRIVER;
     }
 
-    return status;
+    free(nv_cfg_devices);
+
+    return NVPD_SUCCESS;
 }
 
 /*
- * set_device_numa_status() - This function invokes the nvidia-numa functions
- * for onlining or offlining device NUMA memory for a given device.
+ * get_device_policy() - looks up the policy of the device in the policy
+ * file, if any.
  */
-static NvPdStatus set_device_numa_status(NvPdDevice *device,
-                                         NvNumaStatus numa_status)
+static void get_device_policy(NvPdDevice *device, NvPdPolicy *policy)
 {
-    NvPdStatus status = NVPD_SUCCESS;
+    pthread_mutex_lock(&policy_lock);
+    nvPdPolicyLookup(policy_file, &device->pci_info,
+                     (device->uuid[0] != '\0') ? device->uuid : NULL, policy);
+    pthread_mutex_unlock(&policy_lock);
+}
 
-    /* If the device is already in the state specified, just abort */
-    if (numa_status == device->numa_status) {
-        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_NOTICE,
-                              "NUMA memory already in requested state.");
-        return status;
+/*
+ * policy_differs() - returns whether applying the policy would change the
+ * state of the device. This is called without the device lock, so it may
+ * observe a transition in progress; apply_device_policy() checks again.
+ */
+static int policy_differs(const NvPdDevice *device, const NvPdPolicy *policy)
+{
+    int i;
+
+    if ((policy->persistence_mode != NVPD_POLICY_UNSET) &&
+        (policy->persistence_mode != device->mode)) {
+        return 1;
     }
 
-    switch (numa_status) {
+    if ((policy->uvm_persistence_mode != NVPD_POLICY_UNSET) &&
+        (policy->uvm_persistence_mode != device->uvm_policy)) {
+        return 1;
+    }
 
-    case NV_NUMA_STATUS_OFFLINE:
+    if ((policy->numa_status != NVPD_POLICY_UNSET) &&
+        (policy->numa_status != device->numa_status)) {
+        return 1;
+    }
 
-        status = nvNumaOfflineMemory(&device->numa_info);
-        if (status != NVPD_SUCCESS) {
-            syslog_device(&device->pci_info, LOG_ERR,
-                          "failed to offline memory.\n");
+    for (i = 0; i < NV_NUMA_NUM_HUGEPAGE_SIZES; i++) {
+        if ((policy->hugepages[i] != NVPD_POLICY_UNSET) &&
+            ((unsigned int)policy->hugepages[i] !=
+             device->numa_info.hugepages[i])) {
+            return 1;
         }
+    }
 
-        break;
+    return 0;
+}
 
-    case NV_NUMA_STATUS_ONLINE:
+/*
+ * sync_uvm_persistence_mode() - enables or disables UVM persistence mode on
+ * a device that stays in persistence mode, to match its UVM policy.
+ */
+static void sync_uvm_persistence_mode(NvPdDevice *device)
+{
+    int pending;
 
-        status = nvNumaOnlineMemory(&device->numa_info);
-        if (status != NVPD_SUCCESS) {
-            syslog_device(&device->pci_info, LOG_ERR,
-                          "failed to online memory.\n");
+    if (device->uvm_policy == NV_UVM_PERSISTENCE_MODE_DISABLED) {
+        cancel_uvm_persistence_mode_retry(device);
+        if (device->uvm_pm_mode == NV_UVM_PERSISTENCE_MODE_ENABLED) {
+            disable_uvm_persistence_mode(device);
         }
+        return;
+    }
 
-        break;
+    pthread_mutex_lock(&uvm_retry.lock);
+    pending = device->uvm_retry_pending;
+    pthread_mutex_unlock(&uvm_retry.lock);
 
-    default:
+    if (!pending &&
+        (device->uvm_pm_mode == NV_UVM_PERSISTENCE_MODE_DISABLED)) {
+        enable_uvm_persistence_mode(device);
+    }
+}
 
-        syslog_device(&device->pci_info, LOG_ERR,
-                      "requested invalid NUMA status %d", numa_status);
-        status = NVPD_ERR_INVALID_ARGUMENT;
-        break;
+/*
+ * apply_device_policy() - brings the device to the state given by its
+ * policy. The persistence mode of the device is default_mode where the
+ * policy does not specify it, or stays the same when default_mode is
+ * NVPD_POLICY_UNSET; the other settings stay the same where the policy does
+ * not specify them. As with set_device_persistence_mode(), the NUMA status
+ * follows the persistence mode unless the policy says otherwise.
+ */
+static NvPdStatus apply_device_policy(NvPdDevice *device,
+                                      const NvPdPolicy *policy,
+                                      int default_mode)
+{
+    NvPdStatus ret = NVPD_SUCCESS;
+    NvPersistenceMode old_mode, mode;
+    NvNumaStatus numa_status;
+    unsigned int hugepages[NV_NUMA_NUM_HUGEPAGE_SIZES];
+    sigset_t old_signal_set;
+    int i;
 
+    lock_device(device, &old_signal_set);
+
+    if ((policy->uvm_persistence_mode == NV_UVM_PERSISTENCE_MODE_ENABLED) &&
+        !nvPdIsDriverFeatureSupported(NVPD_DRIVER_FEATURE_UVM_PERSISTENCE)) {
+        syslog_device(&device->pci_info, LOG_WARNING,
+                      "UVM Persistence mode is not supported by the driver.");
+    } else if (policy->uvm_persistence_mode != NVPD_POLICY_UNSET) {
+        device->uvm_policy = policy->uvm_persistence_mode;
     }
 
-    if (status == NVPD_SUCCESS) {
-        device->numa_status = numa_status;
-        SYSLOG_DEVICE_VERBOSE(&device->pci_info, LOG_NOTICE,
-                              "NUMA memory %s.",
-                              (numa_status == NV_NUMA_STATUS_ONLINE) ?
-                                "onlined" : "offlined");
+    /* Before onlining, so that the memory comes up with the right pools */
+    for (i = 0; i < NV_NUMA_NUM_HUGEPAGE_SIZES; i++) {
+        hugepages[i] = (policy->hugepages[i] != NVPD_POLICY_UNSET) ?
+                           policy->hugepages[i] :
+                           device->numa_info.hugepages[i];
+    }
+    nvNumaSetHugepages(&device->numa_info, hugepages);
+
+    old_mode = device->mode;
+    if (policy->persistence_mode != NVPD_POLICY_UNSET) {
+        mode = policy->persistence_mode;
+    } else if (default_mode != NVPD_POLICY_UNSET) {
+        mode = default_mode;
+    } else {
+        mode = old_mode;
+    }
+
+    if (policy->numa_status != NVPD_POLICY_UNSET) {
+        numa_status = policy->numa_status;
+    } else if (mode != old_mode) {
+        numa_status = (mode == NV_PERSISTENCE_MODE_ENABLED) ?
+                          NV_NUMA_STATUS_ONLINE : NV_NUMA_STATUS_OFFLINE;
+    } else {
+        numa_status = device->numa_status;
+    }
+
+    /* As in set_device_persistence_mode(), the mode goes first */
+    if (mode != old_mode) {
+        ret = set_device_mode(device, mode);
+    } else if (mode == NV_PERSISTENCE_MODE_ENABLED) {
+        sync_uvm_persistence_mode(device);
+    }
+
+    if ((ret == NVPD_SUCCESS) && (numa_status != device->numa_status)) {
+        ret = set_device_numa_status(device, numa_status);
+        if ((ret != NVPD_SUCCESS) && (old_mode != mode)) {
+            (void) set_device_mode(device, old_mode);
+        }
+    }
+
+    unlock_device(device, &old_signal_set);
+
+    return ret;
+}
+
+/*
+ * apply_device_policy_from_file() - looks up the policy of the device and
+ * applies it. Opening the device may tell its UUID for the first time, in
+ * which case the policy is looked up again for entries matching the UUID.
+ */
+static NvPdStatus apply_device_policy_from_file(NvPdDevice *device,
+                                                int default_mode)
+{
+    NvPdPolicy policy;
+    NvPdStatus status;
+    int had_uuid = (device->uuid[0] != '\0');
+
+    get_device_policy(device, &policy);
+    status = apply_device_policy(device, &policy, default_mode);
+
+    if ((status == NVPD_SUCCESS) && !had_uuid && (device->uuid[0] != '\0')) {
+        get_device_policy(device, &policy);
+        if (policy_differs(device, &policy)) {
+            status = apply_device_policy(device, &policy, NVPD_POLICY_UNSET);
+        }
     }
 
     return status;
 }
 
 /*
- * shutdown_daemon() - This function systematically tears down state that was
- * created while setting up the daemon. This function assumes that it has
- * control over the runtime files, e.g., that no other instance of the daemon
- * is using them, so they can be deleted.
+ * apply_policy_work() - device work item applying the current policy to a
+ * device whose state differs from it.
  */
-static void shutdown_daemon(int status)
+static void apply_policy_work(void *data)
+{
+    NvPciDevice *pci_device = (NvPciDevice *)data;
+    NvPdDevice *device;
+    NvPdStatus status;
+
+    device = get_device(pci_device->domain, pci_device->bus, pci_device->slot);
+    if (device != NULL) {
+        nvNumaBindToLocalCpus(&device->numa_info);
+        status = apply_device_policy_from_file(device, NVPD_POLICY_UNSET);
+        nvNumaUnbindCpus();
+
+        if (status != NVPD_SUCCESS) {
+            syslog_device(&device->pci_info, LOG_WARNING,
+                          "failed to apply policy (error %d).", status);
+        }
+
+        put_device(device);
+    }
+
+    free(pci_device);
+}
+
+/*
+ * apply_policy() - compares the state of every device against the current
+ * policy, and queues the devices that differ to their worker threads, so
+ * that only they do any work and they do it concurrently.
+ */
+static void apply_policy(void)
 {
+    NvPciDevice *list;
+    NvPciDevice *work;
+    NvPdDevice *device;
+    NvPdPolicy policy;
+    int num_devices, num_changed = 0;
     int i;
 
-    /* Nothing to clean up */
-    if (pid <= 0) {
-        goto shutdown;
+    if (nvPdGetDevices(&list, &num_devices) != NVPD_SUCCESS) {
+        syslog(LOG_ERR, "Failed to apply policy: out of memory");
+        return;
     }
 
-    /* Clean up and remove the RPC socket */
-    if (socket_fd != -1) {
-        /* Unregister any mappings to the RPC dispatch routines */
-        svc_unregister(NVPD_PROG, VersionOne);
-        svc_unregister(NVPD_PROG, VersionTwo);
+    for (i = 0; i < num_devices; i++) {
+        device = get_device(list[i].domain, list[i].bus, list[i].slot);
+        if (device == NULL) {
+            continue;
+        }
 
-        if (close(socket_fd) < 0) {
-            syslog(LOG_ERR, "Failed to close socket: %s",
-                   strerror(errno));
-        } else {
-            SYSLOG_VERBOSE(LOG_INFO, "Socket closed.");
+        get_device_policy(device, &policy);
+        if (policy_differs(device, &policy)) {
+            work = malloc(sizeof(*work));
+            if (work != NULL) {
+                *work = list[i];
+            }
+            if ((work != NULL) &&
+                (nvPdQueueDeviceWork(list[i].domain, list[i].bus,
+                                     list[i].slot, list[i].function,
+                                     apply_policy_work,
+                                     work) == NVPD_SUCCESS)) {
+                num_changed++;
+            } else {
+                free(work);
+                syslog_device(&device->pci_info, LOG_WARNING,
+                              "failed to queue policy update.");
+            }
         }
 
-        if (unlink(NVPD_SOCKET_PATH) < 0) {
-            syslog(LOG_ERR, "Failed to unlink socket: %s",
-                   strerror(errno));
+        put_device(device);
+    }
+
+    free(list);
+
+    syslog(LOG_NOTICE, "Applying policy to %d of %d devices", num_changed,
+           num_devices);
+}
+
+/*
+ * reload_policy() - reads the policy file again and applies the new policy.
+ * If the file cannot be loaded, the current policy stays in effect.
+ */
+static void reload_policy(void)
+{
+    NvPdPolicyFile *new_file, *old_file;
+
+    if (policy_path == NULL) {
+        syslog(LOG_NOTICE, "No policy file to reload");
+        return;
+    }
+
+    if (nvPdPolicyLoad(policy_path, &new_file) != NVPD_SUCCESS) {
+        syslog(LOG_ERR, "Failed to reload policy file %s, keeping the "
+                        "current policy", policy_path);
+        return;
+    }
+
+    pthread_mutex_lock(&policy_lock);
+    old_file = policy_file;
+    policy_file = new_file;
+    pthread_mutex_unlock(&policy_lock);
+
+    nvPdPolicyFree(old_file);
+
+    syslog(LOG_NOTICE, "Reloaded policy file %s", policy_path);
+
+    apply_policy();
+}
+
+/*
+ * setup_device_work() - This function brings up a single device in the
+ * requested persistence mode. It may be run from a worker thread, so it must
+ * not touch any state other than that of its own device.
+ */
+static void setup_device_work(void *data)
+{
+    NvPdSetupTask *task = (NvPdSetupTask *)data;
+
+    /* Do not start on more devices once the daemon is asked to terminate */
+    if (terminate_requested) {
+        task->status = NVPD_ERR_CANCELED;
+        return;
+    }
+
+    /* Setup threads are shared by all devices */
+    nvNumaBindToLocalCpus(&task->device->numa_info);
+
+    /*
+     * Take over the NUMA memory that the previous instance left online
+     * first, so that it is offlined along with disabling persistence mode.
+     */
+    if (task->release_numa) {
+        task->status = set_device_persistence_mode(task->device,
+                                                   NV_PERSISTENCE_MODE_ENABLED);
+    }
+
+    if (task->status == NVPD_SUCCESS) {
+        task->status = apply_device_policy_from_file(task->device, task->mode);
+    }
+
+    nvNumaUnbindCpus();
+
+    nvPdSystemdNotify("STATUS=%s device " PCI_DEVICE_FMT " (%d of %d)",
+                      (task->status == NVPD_SUCCESS) ? "Set up" :
+                                                       "Failed to set up",
+                      task->device->pci_info.domain,
+                      task->device->pci_info.bus,
+                      task->device->pci_info.slot,
+                      task->device->pci_info.function,
+                      __sync_add_and_fetch(task->num_done, 1),
+                      task->num_total);
+}
+
+/*
+ * bring_up_devices() - This function sets the persistence mode of every
+ * device to the given mode, or keeps it enabled on devices handed over in
+ * persistence mode by the previous instance of the daemon, using up to
+ * setup_threads worker threads to process devices concurrently. The policy
+ * file takes precedence over both.
+ *
+ * The state journal is only used to take over the NUMA memory left online
+ * by the previous instance; it does not change the mode of any device. NUMA
+ * memory left online on a device brought up with persistence mode disabled
+ * is offlined. It only returns once every device has
+ * been processed, and reports any devices that failed. Once the daemon is
+ * asked to terminate, the devices not started on yet are left alone.
+ */
+static void bring_up_devices(NvPersistenceMode mode, int setup_threads)
+{
+    NvPdSetupTask *tasks;
+    NvPdWorkQueue *queue = NULL;
+    NvPdDevice *device;
+    NvPdPolicy policy;
+    uint64_t start_time = 0, end_time = 0;
+    int num_devices = registry.num_devices;
+    int num_failed = 0, num_skipped = 0, num_canceled = 0;
+    int num_done = 0;
+    int i;
+
+    tasks = (NvPdSetupTask *)calloc(num_devices, sizeof(NvPdSetupTask));
+    if (tasks == NULL) {
+        syslog(LOG_ERR, "Failed to allocate device setup tasks");
+        return;
+    }
+
+    (void) current_timestamp(&start_time);
+
+    if ((setup_threads > 1) && (num_devices > 1)) {
+        queue = nvPdWorkQueueCreate(NV_MIN(setup_threads, num_devices));
+        if (queue == NULL) {
+            syslog(LOG_WARNING, "Failed to create device setup threads, "
+                                "devices will be set up serially");
         }
     }
 
-    /* Detach and free all devices */
-    if (devices != NULL) {
-        for (i = 0; i < num_devices; i++) {
-            if (devices[i].nv_cfg_handle != NULL) {
-                NvPersistenceMode mode = NV_PERSISTENCE_MODE_DISABLED;
-                (void) nvPdSetDevicePersistenceMode(devices[i].pci_info.domain,
-                                                    devices[i].pci_info.bus,
-                                                    devices[i].pci_info.slot,
-                                                    0, mode);
-            }
+    /* The registry does not change until the daemon starts handling hotplug */
+    for (i = 0, device = registry.list; i < num_devices;
+         i++, device = device->next) {
+        tasks[i].device = device;
+        tasks[i].mode = ((device->handoff_device_fd >= 0) &&
+                         (device->previous_state.mode ==
+                          NV_PERSISTENCE_MODE_ENABLED)) ?
+                            NV_PERSISTENCE_MODE_ENABLED : mode;
+        tasks[i].status = NVPD_SUCCESS;
+        tasks[i].num_done = &num_done;
+
+        get_device_policy(device, &policy);
+        if (policy.persistence_mode != NVPD_POLICY_UNSET) {
+            tasks[i].mode = policy.persistence_mode;
         }
 
-        free(devices);
+        if ((tasks[i].mode == NV_PERSISTENCE_MODE_DISABLED) &&
+            (policy.numa_status != NV_NUMA_STATUS_ONLINE)) {
+            if (device->has_previous_state &&
+                (device->previous_state.numa_status ==
+                 NV_NUMA_STATUS_ONLINE)) {
+                tasks[i].release_numa = 1;
+            } else {
+                tasks[i].skip = 1;
+                num_skipped++;
+            }
+        }
     }
 
-    /* Release the libnvidia-cfg handle */
-    if (libnvidia_cfg != NULL) {
-        dlclose(libnvidia_cfg);
-        libnvidia_cfg = NULL;
-    }
+    nvPdSystemdNotify("STATUS=Setting up %d devices",
+                      num_devices - num_skipped);
 
-    /* Clean up and remove the PID file */
-    if (pid_fd != -1) {
-        /* Unlock the PID file */
-        if (lockf(pid_fd, F_ULOCK, 0) < 0) {
-            syslog(LOG_ERR, "Failed to unlock PID file: %s",
-                   strerror(errno));
-        } else {
-            SYSLOG_VERBOSE(LOG_INFO, "PID file unlocked.");
+    for (i = 0; i < num_devices; i++) {
+        tasks[i].num_total = num_devices - num_skipped;
+
+        if (tasks[i].skip) {
+            continue;
         }
 
-        /* Close the PID file */
-        if (close(pid_fd) < 0) {
-            syslog(LOG_ERR, "Failed to close PID file: %s",
-                   strerror(errno));
-        } else {
-            SYSLOG_VERBOSE(LOG_INFO, "PID file closed.");
+        if ((queue == NULL) ||
+            (nvPdWorkQueueSubmit(queue, setup_device_work,
+                                 &tasks[i]) != NVPD_SUCCESS)) {
+            setup_device_work(&tasks[i]);
         }
+    }
 
-        /* Remove the PID file */
-        if (unlink(NVPD_PID_FILE) < 0) {
-            syslog(LOG_ERR, "Failed to unlink PID file: %s",
-                   strerror(errno));
+    /* Wait for all of the devices to be brought up */
+    nvPdWorkQueueDestroy(queue);
+
+    (void) current_timestamp(&end_time);
+
+    for (i = 0; i < num_devices; i++) {
+        if (tasks[i].status == NVPD_ERR_CANCELED) {
+            num_canceled++;
+        } else if (tasks[i].status != NVPD_SUCCESS) {
+            syslog_device(&tasks[i].device->pci_info, LOG_WARNING,
+                          "failed to set persistence mode on startup "
+                          "(error %d).", tasks[i].status);
+            num_failed++;
+        }
+    }
+
+    if (num_canceled > 0) {
+        syslog(LOG_NOTICE, "Terminating, not bringing up the remaining %d "
+                           "devices", num_canceled);
+    }
+
+    if (num_failed > 0) {
+        syslog(LOG_WARNING, "Failed to bring up %d of %d devices",
+               num_failed, num_devices);
+    }
+
+    SYSLOG_VERBOSE(LOG_INFO, "Brought up %d devices in %llu ms",
+                   num_devices - num_skipped - num_failed - num_canceled,
+                   (unsigned long long)(end_time - start_time));
+
+    free(tasks);
+}
+
+/*
+ * setup_devices() - This function gets a list of devices and initializes the
+ * daemon state for each one.
+ */
+static NvPdStatus setup_devices(NvPersistenceMode default_mode,
+                                int setup_threads)
+{
+    NvCfgBool success;
+    NvCfgPciDevice *nv_cfg_devices;
+    int num_devices;
+    int i;
+
+    success = nv_cfg_api.get_pci_devices(&num_devices, &nv_cfg_devices);
+    if (!success) {
+        syslog(LOG_ERR, "Failed to query NVIDIA devices. Please ensure that "
+                        "the NVIDIA device files (/dev/nvidia*) exist, and "
+                        "that user %u has read and write permissions for "
+                        "those files.", getuid());
+        return NVPD_ERR_DRIVER;
+    }
+
+    if (num_devices < 1) {
+        syslog(LOG_ERR, "Unable to find any NVIDIA devices");
+        return NVPD_ERR_DEVICE_NOT_FOUND;
+    }
+
+    for (i = 0; i < num_devices; i++) {
+        if (register_device(&nv_cfg_devices[i]) == NULL) {
+            syslog(LOG_ERR, "Failed to register device " PCI_DEVICE_FMT,
+                   nv_cfg_devices[i].domain, nv_cfg_devices[i].bus,
+                   nv_cfg_devices[i].slot, 0);
         }
     }
 
-    /*
-     * Remove the runtime data directory if the daemon created it. If the
-     * daemon has dropped permissions and is no longer able to remove the
-     * directory, issue a notice instead of a warning, as this is expected.
-     */
-    if (remove_dir && (rmdir(NVPD_VAR_RUNTIME_DATA_PATH) < 0) &&
-        (errno != ENOENT)) {
-        if (errno == EACCES) {
-            SYSLOG_VERBOSE(LOG_NOTICE,
-                           "The daemon no longer has permission to remove its "
-                           "runtime data directory %s",
-                           NVPD_VAR_RUNTIME_DATA_PATH);
-        } else {
-            syslog(LOG_WARNING, "Failed to remove runtime data directory: %s",
-                   strerror(errno));
-        }
+    /*
+     * Free the NvCfg device array, now that we've extracted all the necessary
+     * info from it.
+     */
+    free(nv_cfg_devices);
+
+    if (registry.num_devices < 1) {
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    default_persistence_mode = default_mode;
+
+    bring_up_devices(default_mode, setup_threads);
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * hotplug_refresh_device() - checks whether a device is already registered,
+ * e.g., an add event followed by a bind event, or the driver was rebound to
+ * the device after a reset. The device file of the device may have changed
+ * in the latter case, so its NUMA information is looked up again. Returns 1
+ * if the device is registered and 0 otherwise.
+ */
+static int hotplug_refresh_device(int domain, int bus, int slot)
+{
+    NvPdDevice *device;
+    sigset_t old_signal_set;
+
+    device = get_device(domain, bus, slot);
+    if (device == NULL) {
+        return 0;
     }
 
-    syslog(LOG_NOTICE, "Shutdown (%d)", pid);
-    closelog();
+    lock_device(device, &old_signal_set);
+    nvNumaInvalidateDevice(&device->numa_info);
+    unlock_device(device, &old_signal_set);
+    put_device(device);
 
-shutdown:
-    exit(status);
+    return 1;
 }
 
 /*
- * load_nvidia_cfg_sym() - This function loads a specific symbol from the
- * nvidia-cfg library. Arguments are assumed to be valid.
+ * hotplug_register_device() - registers a device that appeared after the
+ * daemon started, and brings it up in the default persistence mode, or as
+ * the policy file says.
  */
-static int load_nvidia_cfg_sym(void **sym_ptr, const char *sym_name)
+static void hotplug_register_device(const NvCfgPciDevice *pci_info)
 {
-    *sym_ptr = dlsym(libnvidia_cfg, sym_name);
-    if (*sym_ptr == NULL) {
-        syslog(LOG_ERR, "Failed to load symbol %s from %s: %s",
-               sym_name, NVIDIA_CFG_LIB, dlerror());
-        return -1;
+    NvPdDevice *device;
+    NvPdStatus status;
+
+    device = register_device(pci_info);
+    if (device == NULL) {
+        return;
     }
 
-    return 0;
+    syslog_device(&device->pci_info, LOG_NOTICE, "added.");
+
+    nvNumaBindToLocalCpus(&device->numa_info);
+    status = apply_device_policy_from_file(device, default_persistence_mode);
+    nvNumaUnbindCpus();
+
+    if (status != NVPD_SUCCESS) {
+        syslog_device(&device->pci_info, LOG_WARNING,
+                      "failed to set persistence mode (error %d).",
+                      status);
+    }
 }
 
 /*
- * setup_nvidia_cfg_api() - This function loads the nvidia-cfg dynamic library
- * and queries the required symbols from it.
+ * hotplug_add_device() - registers a device added or bound to the NVIDIA
+ * driver, unless it is already registered.
  */
-static NvPdStatus setup_nvidia_cfg_api(const char *nvidia_cfg_path)
+static void hotplug_add_device(const NvPciDevice *pci_device)
 {
-    char *lib_path;
-    int status = 0;
     NvCfgBool success;
     NvCfgPciDevice *nv_cfg_devices;
+    int num_devices;
+    int i;
 
-    if (nvidia_cfg_path != NULL) {
-        lib_path = nvstrcat(nvidia_cfg_path, "/", NVIDIA_CFG_LIB, NULL);
-    } else {
-        lib_path = NVIDIA_CFG_LIB;
+    if (hotplug_refresh_device(pci_device->domain, pci_device->bus,
+                               pci_device->slot)) {
+        return;
     }
 
-    libnvidia_cfg = dlopen(lib_path, RTLD_NOW);
-
-    if (nvidia_cfg_path != NULL) {
-        nvfree(lib_path);
+    /* This also creates the device files of the new device */
+    success = nv_cfg_api.get_pci_devices(&num_devices, &nv_cfg_devices);
+    if (!success) {
+        syslog(LOG_ERR, "Failed to query NVIDIA devices\n");
+        return;
     }
 
-    if (libnvidia_cfg == NULL) {
-        syslog(LOG_ERR, "Failed to open %s: %s", NVIDIA_CFG_LIB,
-               dlerror());
-        return NVPD_ERR_DRIVER;
+    /* The device may not be usable by the driver yet, or at all */
+    for (i = 0; i < num_devices; i++) {
+        if ((nv_cfg_devices[i].domain == pci_device->domain) &&
+            (nv_cfg_devices[i].bus == pci_device->bus) &&
+            (nv_cfg_devices[i].slot == pci_device->slot)) {
+            hotplug_register_device(&nv_cfg_devices[i]);
+            break;
+        }
     }
 
-    /* Attempt to load all symbols required. */
-    status |= load_nvidia_cfg_sym((void **)&nv_cfg_api.get_pci_devices,
-                                  "nvCfgGetPciDevices");
-    status |= load_nvidia_cfg_sym((void **)&nv_cfg_api.open_pci_device,
-                                  "nvCfgOpenPciDevice");
-    status |= load_nvidia_cfg_sym((void **)&nv_cfg_api.close_device,
-                                  "nvCfgCloseDevice");
-    if (set_uvm_pm == NV_UVM_PERSISTENCE_MODE_ENABLED) {
-        status |= load_nvidia_cfg_sym(
-                (void **)&nv_cfg_api.nvCfgEnableUVMPersistence,
-                                    "nvCfgEnableUVMPersistence");
-        status |= load_nvidia_cfg_sym(
-                (void **)&nv_cfg_api.nvCfgDisableUVMPersistence,
-                                    "nvCfgDisableUVMPersistence");
-    }
-    if (status != 0) {
-        /* Missing symbols are already called out by load_nvidia_cfg_sym(). */
-        return NVPD_ERR_DRIVER;
+    free(nv_cfg_devices);
+}
+
+/*
+ * hotplug_remove_device() - unregisters a device that went away, and tears
+ * down its daemon state once the commands already queued for it are done.
+ */
+static void hotplug_remove_device(const NvPciDevice *pci_device)
+{
+    NvPdDevice *device;
+
+    device = get_device(pci_device->domain, pci_device->bus, pci_device->slot);
+    if (device == NULL) {
+        return;
     }
 
-    /* Make a call to get_pci_devices for the side-effect of creating the device files */
-    success = nv_cfg_api.get_pci_devices(&num_devices, &nv_cfg_devices);
-    if (!success) {
-        syslog(LOG_ERR, "Failed to query NVIDIA devices. Please ensure that "
-                        "the NVIDIA device files (/dev/nvidia*) exist, and "
-                        "that user %u has read and write permissions for "
-                        "those files.", getuid());
-        return NVPD_ERR_DRIVER;
+    /* Commands that have not looked up the device yet will not find it */
+    unregister_device(device);
+
+    nvPdWorkQueueDestroy(device->work_queue);
+    device->work_queue = NULL;
+
+    if (device->nv_cfg_handle != NULL) {
+        (void) set_device_persistence_mode(device,
+                                           NV_PERSISTENCE_MODE_DISABLED);
     }
 
-    return NVPD_SUCCESS;
+    syslog_device(&device->pci_info, LOG_NOTICE, "removed.");
+
+    /* Drop the references of the registry and of this function */
+    put_device(device);
+    put_device(device);
 }
 
 /*
- * setup_devices() - This function gets a list of devices and initializes the
- * daemon state for each one.
+ * hotplug_rescan_devices() - enumerates the devices again after hotplug
+ * events were lost: devices that are not registered yet are added, and
+ * registered devices that are gone are removed.
  */
-static NvPdStatus setup_devices(NvPersistenceMode default_mode)
+static void hotplug_rescan_devices(void)
 {
     NvCfgBool success;
     NvCfgPciDevice *nv_cfg_devices;
-    int i;
+    NvPciDevice *registered;
+    int num_devices, num_registered;
+    int i, j;
 
     success = nv_cfg_api.get_pci_devices(&num_devices, &nv_cfg_devices);
     if (!success) {
-        syslog(LOG_ERR, "Failed to query NVIDIA devices. Please ensure that "
-                        "the NVIDIA device files (/dev/nvidia*) exist, and "
-                        "that user %u has read and write permissions for "
-                        "those files.", getuid());
-        return NVPD_ERR_DRIVER;
+        syslog(LOG_ERR, "Failed to query NVIDIA devices\n");
+        return;
     }
 
-    if (num_devices < 1) {
-        syslog(LOG_ERR, "Unable to find any NVIDIA devices");
-        return NVPD_ERR_DEVICE_NOT_FOUND;
+    if (nvPdGetDevices(&registered, &num_registered) != NVPD_SUCCESS) {
+        syslog(LOG_ERR, "Failed to allocate device list\n");
+        free(nv_cfg_devices);
+        return;
     }
 
-    /* Allocate our own device table */
-    devices = (NvPdDevice *)malloc(num_devices * sizeof(NvPdDevice));
-    if (devices == NULL) {
-        syslog(LOG_ERR, "Failed to create device table");
-        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    for (i = 0; i < num_registered; i++) {
+        for (j = 0; j < num_devices; j++) {
+            if ((nv_cfg_devices[j].domain == registered[i].domain) &&
+                (nv_cfg_devices[j].bus == registered[i].bus) &&
+                (nv_cfg_devices[j].slot == registered[i].slot)) {
+                break;
+            }
+        }
+
+        if (j == num_devices) {
+            hotplug_remove_device(&registered[i]);
+        }
+    }
+
+    for (j = 0; j < num_devices; j++) {
+        if (!hotplug_refresh_device(nv_cfg_devices[j].domain,
+                                    nv_cfg_devices[j].bus,
+                                    nv_cfg_devices[j].slot)) {
+            hotplug_register_device(&nv_cfg_devices[j]);
+        }
     }
 
-    memset(devices, 0, num_devices * sizeof(NvPdDevice));
+    free(registered);
+    free(nv_cfg_devices);
+}
 
-    for (i = 0; i < num_devices; i++) {
-        devices[i].nv_cfg_handle = NULL;
-        devices[i].pci_info = nv_cfg_devices[i];
-        devices[i].uvm_pm_mode = NV_UVM_PERSISTENCE_MODE_DISABLED;
+/*
+ * hotplug_work() - processes a hotplug event on the hotplug thread, so that
+ * bringing devices up and down does not block the event loop.
+ */
+static void hotplug_work(void *data)
+{
+    NvPdHotplugTask *task = (NvPdHotplugTask *)data;
 
-        /* nvidia-cfg doesn't fill in the PCI function field, assume 0 */
-        devices[i].pci_info.function = 0;
-        devices[i].mode = NV_PERSISTENCE_MODE_DISABLED;
+    if (task->action == NVPD_HOTPLUG_ADD) {
+        hotplug_add_device(&task->device);
+    } else if (task->action == NVPD_HOTPLUG_REMOVE) {
+        hotplug_remove_device(&task->device);
+    } else {
+        hotplug_rescan_devices();
+    }
 
-        /* Initialize nvidia-numa state */
-        devices[i].numa_status = NV_NUMA_STATUS_OFFLINE;
-        devices[i].numa_info.fd = -1;
-        devices[i].numa_info.pci_info = &devices[i].pci_info;
+    free(task);
+}
 
-        SYSLOG_DEVICE_VERBOSE(&(devices[i].pci_info), LOG_DEBUG, "registered");
+/*
+ * handle_hotplug_event() - called from the event loop for each NVIDIA device
+ * that is added or removed, and when the devices need to be enumerated
+ * again. Events are processed in order on a dedicated
+ * thread, without affecting the other devices.
+ */
+static void handle_hotplug_event(NvPdHotplugAction action,
+                                 const NvPciDevice *device)
+{
+    NvPdHotplugTask *task;
 
-        if (default_mode != NV_PERSISTENCE_MODE_DISABLED) {
-            (void) nvPdSetDevicePersistenceMode(devices[i].pci_info.domain,
-                                                devices[i].pci_info.bus,
-                                                devices[i].pci_info.slot, 0,
-                                                default_mode);
-        }
+    task = malloc(sizeof(*task));
+    if (task == NULL) {
+        syslog(LOG_ERR, "Failed to allocate hotplug event\n");
+        return;
     }
 
-    /*
-     * Free the NvCfg device array, now that we've extracted all the necessary
-     * info from it.
-     */
-    free(nv_cfg_devices);
+    task->action = action;
+    if (device != NULL) {
+        task->device = *device;
+    }
 
-    return NVPD_SUCCESS;
+    if (nvPdWorkQueueSubmit(hotplug_queue, hotplug_work,
+                            task) != NVPD_SUCCESS) {
+        syslog(LOG_ERR, "Failed to queue hotplug event\n");
+        free(task);
+    }
+}
+
+/*
+ * setup_hotplug() - starts handling hotplug events. This is not fatal to the
+ * daemon, which otherwise only manages the devices present on startup.
+ */
+static void setup_hotplug(void)
+{
+    hotplug_queue = nvPdWorkQueueCreate(1);
+    if (hotplug_queue == NULL) {
+        syslog(LOG_WARNING, "Failed to create hotplug thread, devices added "
+                            "or removed will be ignored\n");
+        return;
+    }
+
+    if (nvPdHotplugInit(handle_hotplug_event) != NVPD_SUCCESS) {
+        syslog(LOG_WARNING, "Devices added or removed will be ignored\n");
+        nvPdWorkQueueDestroy(hotplug_queue);
+        hotplug_queue = NULL;
+    }
 }
 
 /*
@@ -735,21 +3398,63 @@ static NvPdStatus setup_rpc()
 {
     register SVCXPRT *transp;
 
-    /*
-     * We should remove any stale sockets on the filesystem before attempting
-     * to create it again.
-     */
-    (void)unlink(NVPD_SOCKET_PATH);
+    if (handoff_state.socket_fd >= 0) {
+        /* Keep serving on the socket of the previous instance */
+        socket_fd = handoff_state.socket_fd;
+        socket_activated = handoff_state.socket_activated;
+        handoff_state.socket_fd = -1;
+    } else {
+        /*
+         * With socket activation, systemd has been accepting connections on
+         * the socket since before the daemon started, and owns the socket
+         * file.
+         */
+        socket_fd = nvPdSystemdTakeListenFd();
+        socket_activated = (socket_fd >= 0);
+        if (socket_activated) {
+            SYSLOG_VERBOSE(LOG_INFO, "Using socket passed by systemd");
+        }
+    }
 
-    /* Create the socket manually so we can shut it down later */
-    socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (socket_fd < 0) {
-        syslog(LOG_ERR, "Failed to create socket: %s", strerror(errno));
-        return NVPD_ERR_IO;
+    if (socket_fd >= 0) {
+        /*
+         * The socket is already bound and listening. libtirpc fails to
+         * create a Unix-domain service on such a socket, but can wrap it in
+         * a connection-oriented service instead.
+         */
+#if defined(_TIRPC_SVC_H)
+        transp = svc_vc_create(socket_fd, 0, 0);
+#else
+        transp = svcunix_create(socket_fd, 0, 0, NVPD_SOCKET_PATH);
+#endif
+    } else {
+        /*
+         * We should remove any stale sockets on the filesystem before
+         * attempting to create it again.
+         */
+        (void)unlink(NVPD_SOCKET_PATH);
+
+        /* Create the socket manually so we can shut it down later */
+        socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (socket_fd < 0) {
+            syslog(LOG_ERR, "Failed to create socket: %s", strerror(errno));
+            return NVPD_ERR_IO;
+        }
+
+        /* Create the RPC service over the Unix-domain socket */
+        transp = svcunix_create(socket_fd, 0, 0, NVPD_SOCKET_PATH);
+
+        /*
+         * libtirpc ignores the given socket and listens on one of its own,
+         * which is the one to shut down and to hand over.
+         */
+        if ((transp != NULL) && (transp->xp_fd != socket_fd)) {
+            close(socket_fd);
+            socket_fd = transp->xp_fd;
+            (void) fcntl(socket_fd, F_SETFD, FD_CLOEXEC);
+        }
     }
 
-    /* Create the RPC service over the Unix-domain socket */
-    transp = svcunix_create(socket_fd, 0, 0, NVPD_SOCKET_PATH);
     if (transp == NULL) {
         syslog(LOG_ERR, "Failed to create RPC service");
         return NVPD_ERR_RPC;
@@ -765,8 +3470,23 @@ static NvPdStatus setup_rpc()
         return NVPD_ERR_RPC;
     }
 
+    if (!svc_register(transp, NVPD_PROG, VersionThree, nvpd_prog_3, 0)) {
+        syslog(LOG_ERR, "Failed to register RPC V3 service");
+        return NVPD_ERR_RPC;
+    }
+
+    if (!svc_register(transp, NVPD_PROG, VersionFour, nvpd_prog_4, 0)) {
+        syslog(LOG_ERR, "Failed to register RPC V4 service");
+        return NVPD_ERR_RPC;
+    }
+
     SYSLOG_VERBOSE(LOG_INFO, "Local RPC services initialized");
 
+    /* Not fatal; clients can still use the RPC interface */
+    if (seqpacket_socket) {
+        (void) nvPdMsgServerInit(&handoff_state);
+    }
+
     return NVPD_SUCCESS;
 }
 
@@ -782,7 +3502,29 @@ static void signal_handler(int signal)
 
     case SIGINT:
     case SIGTERM:
-        shutdown_daemon(EXIT_SUCCESS);
+        /*
+         * Let main() shut the daemon down outside of signal context, once the
+         * event loop returns. While the daemon is still starting up, devices
+         * being brought up are left to finish first, and the event loop
+         * returns right away once it starts.
+         */
+        terminate_requested = 1;
+        nvPdEventLoopStop();
+        break;
+    case SIGUSR2:
+        /* Hand over to a new instance of the daemon, outside signal context */
+        if (nvPdEventLoopIsRunning()) {
+            handoff_requested = 1;
+            nvPdEventLoopStop();
+        }
+        break;
+    case SIGHUP:
+        /*
+         * Reload the policy file outside signal context. Before the event
+         * loop is running, it returns right away once it starts.
+         */
+        reload_requested = 1;
+        nvPdEventLoopStop();
         break;
     default:
         syslog(LOG_WARNING, "Unable to process signal %d",
@@ -794,7 +3536,9 @@ static void signal_handler(int signal)
 
 /*
  * daemonize() - This function converts the current process into a daemon
- * process.
+ * process. A Type=notify systemd service is already detached by the service
+ * manager, which tracks the process it started, so the daemon does not fork
+ * in that case and no init pipe is returned.
  */
 static int daemonize(uid_t uid, gid_t gid)
 {
@@ -803,6 +3547,7 @@ static int daemonize(uid_t uid, gid_t gid)
     sigset_t signal_set;
     int init_pipe_fds[2];
     int pipe_read_fd, pipe_write_fd;
+    int lock_cmd = F_TLOCK;
     int fd;
 
     /*
@@ -822,6 +3567,13 @@ static int daemonize(uid_t uid, gid_t gid)
 
     sigaction(SIGINT,  &signal_action, NULL);
     sigaction(SIGTERM, &signal_action, NULL);
+    sigaction(SIGUSR2, &signal_action, NULL);
+    sigaction(SIGHUP,  &signal_action, NULL);
+
+    if (nvPdSystemdIsNotifyEnabled()) {
+        pipe_write_fd = -1;
+        goto detached;
+    }
 
     /*
      * Set up the init pipe for coordinating daemon init with main process
@@ -857,9 +3609,6 @@ static int daemonize(uid_t uid, gid_t gid)
         exit((init_status == NVPD_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
-    /* Reset default file permissions */
-    umask(0);
-
     /* Create a new session for the daemon */
     if (setsid() < 0) {
         fprintf(stderr, "Failed to create new daemon session: %s",
@@ -867,6 +3616,13 @@ static int daemonize(uid_t uid, gid_t gid)
         goto shutdown;
     }
 
+    /* Close the read end of the init pipe */
+    close(pipe_read_fd);
+
+detached:
+    /* Reset default file permissions */
+    umask(0);
+
     /* Save off the new pid for logging */
     pid = getpid();
 
@@ -875,9 +3631,6 @@ static int daemonize(uid_t uid, gid_t gid)
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
 
-    /* Close the read end of the init pipe */
-    close(pipe_read_fd);
-
     if (verbose) {
         log_mask = LOG_UPTO(LOG_DEBUG);
     } else {
@@ -950,6 +3703,36 @@ static int daemonize(uid_t uid, gid_t gid)
         goto shutdown;
     }
 
+    /*
+     * When taking over from a running instance, receive its state first. The
+     * previous instance exits once the handoff is acknowledged, which
+     * releases the PID file lock.
+     */
+    if (handoff_fd >= 0) {
+        if (nvPdHandoffReceive(handoff_fd, &handoff_state) != NVPD_SUCCESS) {
+            goto shutdown;
+        }
+
+        remove_dir = handoff_state.remove_dir;
+
+        /*
+         * The previous instance exits once the handoff is acknowledged, so
+         * the service manager has to track this one from now on.
+         */
+        nvPdSystemdNotify("MAINPID=%d", pid);
+
+        if (nvPdHandoffAcknowledge(handoff_fd) != NVPD_SUCCESS) {
+            goto shutdown;
+        }
+
+        close(handoff_fd);
+        handoff_fd = -1;
+        lock_cmd = F_LOCK;
+
+        syslog(LOG_NOTICE, "Took over the state of %d devices",
+               handoff_state.num_devices);
+    }
+
     /*
      * Make sure we're the only instance running.
      * This file should be user-writable, global-readable.
@@ -961,7 +3744,7 @@ static int daemonize(uid_t uid, gid_t gid)
     }
 
     /* Lock the PID file */
-    if (lockf(fd, F_TLOCK, 0) < 0) {
+    if (lockf(fd, lock_cmd, 0) < 0) {
         syslog(LOG_ERR, "Failed to lock PID file: %s", strerror(errno));
         close(fd);
         goto shutdown;
@@ -974,7 +3757,8 @@ static int daemonize(uid_t uid, gid_t gid)
 
     /* Update the PID file with the current process ID */
     sprintf(pid_str, "%d\n", pid);
-    if (write(pid_fd, pid_str, strlen(pid_str)) != strlen(pid_str)) {
+    if ((ftruncate(pid_fd, 0) < 0) ||
+        (write(pid_fd, pid_str, strlen(pid_str)) != strlen(pid_str))) {
         syslog(LOG_ERR, "Failed to update PID file: %s", strerror(errno));
         goto shutdown;
     }
@@ -999,13 +3783,37 @@ int main(int argc, char* argv[])
 {
     NvPdStatus status;
     NvPdOptions options;
+    NvNumaConfig numa_config;
     int pipe_write_fd;
 
     parse_options(argc, argv, &options);
     verbose = options.verbose;
+    handoff_fd = options.handoff_fd;
+
+    if (handoff_fd >= 0) {
+        close_inherited_fds(handoff_fd);
+    }
+
+    /* Remember how this instance was started, to execute the next one */
+    self_argv = argv;
+    if (readlink("/proc/self/exe", self_exe, sizeof(self_exe) - 1) < 0) {
+        self_exe[0] = '\0';
+    }
+
+    /* Before forking, since systemd passes sockets to this process only */
+    nvPdSystemdInit();
     if (options.uvm_persistence_mode == NV_UVM_PERSISTENCE_MODE_ENABLED) {
         set_uvm_pm = NV_UVM_PERSISTENCE_MODE_ENABLED;
     }
+    uvm_fabric_timeout_ms = options.uvm_fabric_timeout * 1000ULL;
+    uvm_fabric_retry_interval_ms = options.uvm_fabric_retry_interval;
+    warm_restart = options.warm_restart;
+    shutdown_timeout = options.shutdown_timeout;
+    seqpacket_socket = options.seqpacket_socket;
+    numa_config.online_threads = options.numa_online_threads;
+    numa_config.hugepages[NV_NUMA_HUGEPAGE_SIZE_2M] = options.numa_hugepages_2m;
+    numa_config.hugepages[NV_NUMA_HUGEPAGE_SIZE_1G] = options.numa_hugepages_1g;
+    nvNumaSetConfig(&numa_config);
 
     pipe_write_fd = daemonize(options.uid, options.gid);
 
@@ -1015,25 +3823,109 @@ int main(int argc, char* argv[])
         goto shutdown;
     }
 
-    status = setup_devices(options.persistence_mode);
+    /* Probe memory hotplug once, rather than on the first NUMA transition */
+    nvNumaProbeEnvironment();
+
+    if (options.policy_file != NULL) {
+        policy_path = options.policy_file;
+        status = nvPdPolicyLoad(policy_path, &policy_file);
+        if (status != NVPD_SUCCESS) {
+            goto shutdown;
+        }
+    }
+
+    status = nvPdEventLoopInit();
+    if (status != NVPD_SUCCESS) {
+        goto shutdown;
+    }
+
+    /* Not fatal; the daemon just cannot adopt state on its next start */
+    (void) nvPdJournalOpen(NVPD_JOURNAL_FILE);
+
+    /*
+     * Start listening for hotplug events before querying the devices, so that
+     * devices added in the meantime are not missed.
+     */
+    setup_hotplug();
+
+    status = setup_devices(options.persistence_mode, options.setup_threads);
     if (status != NVPD_SUCCESS) {
         goto shutdown;
     }
 
+    /* Asked to terminate while the devices were being brought up */
+    if (terminate_requested) {
+        close(pipe_write_fd);
+        shutdown_daemon(EXIT_SUCCESS);
+    }
+
     status = setup_rpc();
     if (status != NVPD_SUCCESS) {
         goto shutdown;
     }
 
+    /*
+     * The devices taken over from the previous instance have been opened by
+     * now, so the file descriptors keeping them initialized can be dropped.
+     * This has to wait until setup_rpc() took over the RPC socket.
+     */
+    release_all_handoff_fds();
+
+    /* Not fatal; the daemon works the same without the metrics file */
+    if (options.metrics_file != NULL) {
+        (void) nvPdMetricsInit(options.metrics_file, options.metrics_interval);
+    }
+
     status = init_complete(pipe_write_fd);
     if (status != NVPD_SUCCESS) {
         goto shutdown;
     }
 
-    svc_run();
+    /*
+     * The event loop only returns once a termination signal is received, the
+     * daemon is asked to reload its policy file, or to hand over to a new
+     * instance.
+     */
+    while (1) {
+        status = nvPdEventLoopRun();
+        if ((status != NVPD_SUCCESS) || terminate_requested) {
+            break;
+        }
+
+        if (handoff_requested) {
+            handoff_requested = 0;
+
+            if (!pending_handoff.active &&
+                (start_handoff() != NVPD_SUCCESS)) {
+                syslog(LOG_WARNING, "Failed to hand over to a new daemon "
+                                    "instance, continuing");
+            }
+        }
+
+        /* The last device to be quiesced stops the event loop */
+        if (handoff_quiesced()) {
+            if (finish_handoff() == NVPD_SUCCESS) {
+                exit_after_handoff();
+            }
+
+            syslog(LOG_WARNING, "Failed to hand over to a new daemon "
+                                "instance, continuing");
+        }
+
+        /* The policy can only be applied once the devices are released */
+        if (reload_requested && !pending_handoff.active) {
+            reload_requested = 0;
+            reload_policy();
+        }
+    }
+
+    cancel_handoff();
+
+    if (status == NVPD_SUCCESS) {
+        shutdown_daemon(EXIT_SUCCESS);
+    }
 
-    /* We should never return from svc_run() in a non-error scenario */
-    syslog(LOG_ERR, "Failed to start local RPC service");
+    syslog(LOG_ERR, "Failed to run local RPC service");
 
 shutdown:
     close(pipe_write_fd);
@@ -28,20 +28,44 @@
 #ifndef _NVIDIA_PERSISTENCED_H_
 #define _NVIDIA_PERSISTENCED_H_
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "nvpd_rpc.h"
+#include "nvidia-numa.h"
+#include "nvidia-work-queue.h"
 
 /* Daemon Options */
 typedef struct {
     NvPersistenceMode persistence_mode;
     NvUVMPersistenceMode uvm_persistence_mode;
     char *nvidia_cfg_path;
+    int setup_threads;
+    int uvm_fabric_timeout;
+    int uvm_fabric_retry_interval;
+    int numa_online_threads;
+    int numa_hugepages_2m;
+    int numa_hugepages_1g;
+    int warm_restart;
+    int handoff_fd;
+    char *metrics_file;
+    int metrics_interval;
+    int shutdown_timeout;
+    int seqpacket_socket;
+    char *policy_file;
     int verbose;
     uid_t uid;
     gid_t gid;
 } NvPdOptions;
 
+/* Device state, counters and phase latencies, for the metrics file */
+typedef struct {
+    NvPdDeviceState state;
+    uint64_t num_transitions;
+    uint64_t num_failures;
+    NvPdHistogram phases[NVPD_NUM_DEVICE_PHASES];
+} NvPdDeviceMetrics;
+
 /* Command Implementations */
 NvPdStatus nvPdSetDevicePersistenceMode(int domain, int bus, int slot,
                                         int function, NvPersistenceMode mode);
@@ -53,10 +77,22 @@ NvPdStatus nvPdSetDevicePersistenceModeOnly(int domain, int bus, int slot,
                                             NvPersistenceMode mode);
 NvPdStatus nvPdSetDeviceNumaStatus(int domain, int bus, int slot,
                                    int function, NvNumaStatus status);
+NvPdStatus nvPdSetDeviceNumaStatusTracked(int domain, int bus, int slot,
+                                          int function, NvNumaStatus status,
+                                          NvNumaProgress *progress);
+NvPdStatus nvPdQueueDeviceWork(int domain, int bus, int slot, int function,
+                               NvPdWorkFunc func, void *data);
+NvPdStatus nvPdGetDevices(NvPciDevice **list, int *count);
+NvPdStatus nvPdGetDeviceStateSnapshot(NvPdDeviceState *states, int *count);
+NvPdStatus nvPdGetDeviceStats(NvPdDeviceStats *stats, int *count);
+NvPdStatus nvPdGetDeviceMetrics(NvPdDeviceMetrics *metrics, int *count);
+int nvPdIsDriverFeatureSupported(NvPdDriverFeature feature);
 
 /* RPC Service Routines */
 extern void nvpd_prog_1(struct svc_req *rqstp, register SVCXPRT *transp);
 extern void nvpd_prog_2(struct svc_req *rqstp, register SVCXPRT *transp);
+extern void nvpd_prog_3(struct svc_req *rqstp, register SVCXPRT *transp);
+extern void nvpd_prog_4(struct svc_req *rqstp, register SVCXPRT *transp);
 
 /* Commandline Parsing */
 extern void parse_options(int argc, char *argv[], NvPdOptions *);
@@ -0,0 +1,401 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-policy.c
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+
+#include "nvidia-policy.h"
+
+#define NVPD_POLICY_LINE_LEN 1024
+
+/* What an entry of the policy file applies to, in increasing precedence */
+typedef enum
+{
+    POLICY_MATCH_DEFAULT = 0,
+    POLICY_MATCH_PCI,
+    POLICY_MATCH_UUID,
+    POLICY_NUM_MATCHES,
+} NvPdPolicyMatch;
+
+typedef struct
+{
+    NvPdPolicyMatch match;
+    NvCfgPciDevice pci_info;
+    char uuid[NVPD_POLICY_UUID_LEN];
+    NvPdPolicy policy;
+} NvPdPolicyEntry;
+
+struct _NvPdPolicyFile
+{
+    int num_entries;
+    NvPdPolicyEntry *entries;
+};
+
+/* The settings of a policy, by name */
+static const struct {
+    const char *name;
+    size_t offset;
+} policy_settings[] = {
+    { "persistence",     offsetof(NvPdPolicy, persistence_mode) },
+    { "uvm-persistence", offsetof(NvPdPolicy, uvm_persistence_mode) },
+    { "numa",            offsetof(NvPdPolicy, numa_status) },
+    { "hugepages-2m",
+      offsetof(NvPdPolicy, hugepages[NV_NUMA_HUGEPAGE_SIZE_2M]) },
+    { "hugepages-1g",
+      offsetof(NvPdPolicy, hugepages[NV_NUMA_HUGEPAGE_SIZE_1G]) },
+};
+
+#define NVPD_NUM_POLICY_SETTINGS \
+    (sizeof(policy_settings) / sizeof(policy_settings[0]))
+
+/*
+ * policy_setting() - returns the i-th setting of policy_settings in policy.
+ */
+static int *policy_setting(const NvPdPolicy *policy, size_t i)
+{
+    return (int *)((char *)policy + policy_settings[i].offset);
+}
+
+/*
+ * init_policy() - unsets every setting of a policy.
+ */
+static void init_policy(NvPdPolicy *policy)
+{
+    int i;
+
+    policy->persistence_mode = NVPD_POLICY_UNSET;
+    policy->uvm_persistence_mode = NVPD_POLICY_UNSET;
+    policy->numa_status = NVPD_POLICY_UNSET;
+    for (i = 0; i < NV_NUMA_NUM_HUGEPAGE_SIZES; i++) {
+        policy->hugepages[i] = NVPD_POLICY_UNSET;
+    }
+}
+
+/*
+ * merge_policy() - overrides the settings of policy with those set in other.
+ */
+static void merge_policy(NvPdPolicy *policy, const NvPdPolicy *other)
+{
+    size_t i;
+
+    for (i = 0; i < NVPD_NUM_POLICY_SETTINGS; i++) {
+        if (*policy_setting(other, i) != NVPD_POLICY_UNSET) {
+            *policy_setting(policy, i) = *policy_setting(other, i);
+        }
+    }
+}
+
+/*
+ * parse_value() - parses the value of the named setting. Returns the value,
+ * or NVPD_POLICY_UNSET if it is invalid.
+ */
+static int parse_value(const char *name, const char *value)
+{
+    char *end;
+    long count;
+
+    if (strcmp(name, "persistence") == 0) {
+        if (strcmp(value, "on") == 0) {
+            return NV_PERSISTENCE_MODE_ENABLED;
+        } else if (strcmp(value, "off") == 0) {
+            return NV_PERSISTENCE_MODE_DISABLED;
+        }
+    } else if (strcmp(name, "uvm-persistence") == 0) {
+        if (strcmp(value, "on") == 0) {
+            return NV_UVM_PERSISTENCE_MODE_ENABLED;
+        } else if (strcmp(value, "off") == 0) {
+            return NV_UVM_PERSISTENCE_MODE_DISABLED;
+        }
+    } else if (strcmp(name, "numa") == 0) {
+        if (strcmp(value, "online") == 0) {
+            return NV_NUMA_STATUS_ONLINE;
+        } else if (strcmp(value, "offline") == 0) {
+            return NV_NUMA_STATUS_OFFLINE;
+        }
+    } else {
+        errno = 0;
+        count = strtol(value, &end, 10);
+        if ((errno == 0) && (end != value) && (*end == '\0') &&
+            (count >= 0) && (count <= INT_MAX)) {
+            return (int)count;
+        }
+    }
+
+    return NVPD_POLICY_UNSET;
+}
+
+/*
+ * parse_device() - parses the device an entry applies to: "default", a PCI
+ * location "[domain:]bus:slot.function" in hexadecimal, or a UUID.
+ */
+static int parse_device(const char *str, NvPdPolicyEntry *entry)
+{
+    unsigned int domain, bus, slot, function;
+    char end;
+    int n;
+
+    memset(entry, 0, sizeof(*entry));
+    init_policy(&entry->policy);
+
+    if (strcmp(str, "default") == 0) {
+        entry->match = POLICY_MATCH_DEFAULT;
+        return 0;
+    }
+
+    n = sscanf(str, "%x:%x:%x.%x%c", &domain, &bus, &slot, &function, &end);
+    if (n != 4) {
+        /* The domain may have been set by a partial match */
+        domain = 0;
+        n = sscanf(str, "%x:%x.%x%c", &bus, &slot, &function, &end) + 1;
+    }
+
+    if (n == 4) {
+        if ((domain > 0xffff) || (bus > 0xff) || (slot > 0x1f) ||
+            (function > 0x7)) {
+            return -1;
+        }
+
+        entry->match = POLICY_MATCH_PCI;
+        entry->pci_info.domain = domain;
+        entry->pci_info.bus = bus;
+        entry->pci_info.slot = slot;
+        entry->pci_info.function = function;
+        return 0;
+    }
+
+    if ((strncasecmp(str, "GPU-", 4) == 0) &&
+        (strlen(str) < sizeof(entry->uuid))) {
+        entry->match = POLICY_MATCH_UUID;
+        strcpy(entry->uuid, str);
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * parse_line() - parses a line of the policy file into entry. Returns 1 if
+ * the line holds an entry, 0 if it is blank or a comment, or -1 if it is
+ * invalid, in which case the reason has been logged.
+ */
+static int parse_line(const char *path, int line_number, char *line,
+                      NvPdPolicyEntry *entry)
+{
+    char *token, *value, *save = NULL;
+    size_t i;
+
+    token = strtok_r(line, " \t\r\n", &save);
+    if ((token == NULL) || (token[0] == '#')) {
+        return 0;
+    }
+
+    if (parse_device(token, entry) < 0) {
+        syslog(LOG_ERR, "%s:%d: Invalid device '%s'", path, line_number,
+               token);
+        return -1;
+    }
+
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        if (token[0] == '#') {
+            break;
+        }
+
+        value = strchr(token, '=');
+        if (value == NULL) {
+            syslog(LOG_ERR, "%s:%d: Expected a setting=value pair instead "
+                            "of '%s'", path, line_number, token);
+            return -1;
+        }
+        *value++ = '\0';
+
+        for (i = 0; i < NVPD_NUM_POLICY_SETTINGS; i++) {
+            if (strcmp(token, policy_settings[i].name) == 0) {
+                break;
+            }
+        }
+
+        if (i == NVPD_NUM_POLICY_SETTINGS) {
+            syslog(LOG_ERR, "%s:%d: Unknown setting '%s'", path, line_number,
+                   token);
+            return -1;
+        }
+
+        *policy_setting(&entry->policy, i) = parse_value(token, value);
+        if (*policy_setting(&entry->policy, i) == NVPD_POLICY_UNSET) {
+            syslog(LOG_ERR, "%s:%d: Invalid value '%s' of setting '%s'",
+                   path, line_number, value, token);
+            return -1;
+        }
+    }
+
+    /* The NUMA memory of a device can only be onlined while it is set up */
+    if ((entry->policy.persistence_mode == NV_PERSISTENCE_MODE_DISABLED) &&
+        (entry->policy.numa_status == NV_NUMA_STATUS_ONLINE)) {
+        syslog(LOG_ERR, "%s:%d: NUMA memory cannot be online without "
+                        "persistence mode", path, line_number);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * nvPdPolicyLoad() - reads and validates the policy file at path. On
+ * failure, the errors found are logged and nothing is returned, so that the
+ * caller can keep its current policy.
+ */
+NvPdStatus nvPdPolicyLoad(const char *path, NvPdPolicyFile **policy_file)
+{
+    NvPdPolicyFile *file;
+    NvPdPolicyEntry entry, *entries;
+    char line[NVPD_POLICY_LINE_LEN];
+    NvPdStatus status = NVPD_SUCCESS;
+    int line_number = 0;
+    int ret;
+    FILE *fp;
+
+    *policy_file = NULL;
+
+    fp = fopen(path, "re");
+    if (fp == NULL) {
+        syslog(LOG_ERR, "Failed to open policy file %s: %s", path,
+               strerror(errno));
+        return NVPD_ERR_IO;
+    }
+
+    file = calloc(1, sizeof(NvPdPolicyFile));
+    if (file == NULL) {
+        fclose(fp);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_number++;
+
+        if ((strchr(line, '\n') == NULL) && !feof(fp)) {
+            syslog(LOG_ERR, "%s:%d: Line too long", path, line_number);
+            status = NVPD_ERR_INVALID_ARGUMENT;
+            break;
+        }
+
+        ret = parse_line(path, line_number, line, &entry);
+        if (ret < 0) {
+            status = NVPD_ERR_INVALID_ARGUMENT;
+            break;
+        } else if (ret == 0) {
+            continue;
+        }
+
+        entries = realloc(file->entries,
+                          (file->num_entries + 1) * sizeof(NvPdPolicyEntry));
+        if (entries == NULL) {
+            status = NVPD_ERR_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        file->entries = entries;
+        file->entries[file->num_entries++] = entry;
+    }
+
+    if ((status == NVPD_SUCCESS) && ferror(fp)) {
+        syslog(LOG_ERR, "Failed to read policy file %s", path);
+        status = NVPD_ERR_IO;
+    }
+
+    fclose(fp);
+
+    if (status != NVPD_SUCCESS) {
+        nvPdPolicyFree(file);
+        return status;
+    }
+
+    *policy_file = file;
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdPolicyFree() - frees a policy file returned by nvPdPolicyLoad().
+ */
+void nvPdPolicyFree(NvPdPolicyFile *policy_file)
+{
+    if (policy_file == NULL) {
+        return;
+    }
+
+    free(policy_file->entries);
+    free(policy_file);
+}
+
+/*
+ * nvPdPolicyLookup() - merges the entries that apply to a device, in order
+ * of precedence, and in the order of the file within the same precedence.
+ */
+void nvPdPolicyLookup(const NvPdPolicyFile *policy_file,
+                      const NvCfgPciDevice *pci_info, const char *uuid,
+                      NvPdPolicy *policy)
+{
+    const NvPdPolicyEntry *entry;
+    int match, i;
+
+    init_policy(policy);
+
+    if (policy_file == NULL) {
+        return;
+    }
+
+    for (match = 0; match < POLICY_NUM_MATCHES; match++) {
+        for (i = 0; i < policy_file->num_entries; i++) {
+            entry = &policy_file->entries[i];
+
+            if (entry->match != match) {
+                continue;
+            }
+
+            if ((match == POLICY_MATCH_PCI) &&
+                ((entry->pci_info.domain != pci_info->domain) ||
+                 (entry->pci_info.bus != pci_info->bus) ||
+                 (entry->pci_info.slot != pci_info->slot) ||
+                 (entry->pci_info.function != pci_info->function))) {
+                continue;
+            }
+
+            if ((match == POLICY_MATCH_UUID) &&
+                ((uuid == NULL) || (strcasecmp(entry->uuid, uuid) != 0))) {
+                continue;
+            }
+
+            merge_policy(policy, &entry->policy);
+        }
+    }
+}
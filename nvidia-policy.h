@@ -0,0 +1,72 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-policy.h
+ */
+
+#ifndef _NVIDIA_POLICY_H_
+#define _NVIDIA_POLICY_H_
+
+#include "nvpd_rpc.h"
+#include "nvidia-cfg.h"
+#include "nvidia-numa.h"
+
+/* Buffer size of a device UUID, such as "GPU-" followed by 36 characters */
+#define NVPD_POLICY_UUID_LEN 64
+
+/* Value of a setting that the policy does not specify */
+#define NVPD_POLICY_UNSET (-1)
+
+/*
+ * The policy of a single device. Each setting is either NVPD_POLICY_UNSET, or
+ * an NvPersistenceMode, NvUVMPersistenceMode, NvNumaStatus or number of huge
+ * pages, respectively.
+ */
+typedef struct
+{
+    int persistence_mode;
+    int uvm_persistence_mode;
+    int numa_status;
+    int hugepages[NV_NUMA_NUM_HUGEPAGE_SIZES];
+} NvPdPolicy;
+
+/*
+ * A policy file, as loaded by nvPdPolicyLoad(). The file is made of lines of
+ * the form "<device> <setting>=<value> ...", see the --policy-file option.
+ */
+typedef struct _NvPdPolicyFile NvPdPolicyFile;
+
+NvPdStatus nvPdPolicyLoad(const char *path, NvPdPolicyFile **policy_file);
+void nvPdPolicyFree(NvPdPolicyFile *policy_file);
+
+/*
+ * Fills in the policy of the device at pci_info, with the given UUID if it is
+ * known, or NULL. The policy_file may be NULL, in which case every setting
+ * is unset.
+ */
+void nvPdPolicyLookup(const NvPdPolicyFile *policy_file,
+                      const NvCfgPciDevice *pci_info, const char *uuid,
+                      NvPdPolicy *policy);
+
+#endif /* _NVIDIA_POLICY_H_ */
@@ -0,0 +1,156 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-stats.c
+ */
+
+#include <time.h>
+
+#include "nvidia-stats.h"
+#include "nvidia-trace.h"
+
+static NvPdHistogram rpc_stats[NVPD_NUM_RPC_PHASES];
+
+/*
+ * nvPdStatsTime() - returns the monotonic time in us, as taken at the start
+ * of a phase.
+ */
+uint64_t nvPdStatsTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * get_bucket() - returns the bucket counting samples of the given duration.
+ */
+static int get_bucket(uint64_t us)
+{
+    int bucket = 0;
+
+    while ((us != 0) && (bucket < NVPD_STATS_NUM_BUCKETS - 1)) {
+        us >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/*
+ * get_elapsed() - returns the time in microseconds since start_us, as
+ * returned by nvPdStatsTime().
+ */
+static uint64_t get_elapsed(uint64_t start_us)
+{
+    uint64_t now = nvPdStatsTime();
+
+    return (now > start_us) ? (now - start_us) : 0;
+}
+
+/*
+ * record_sample() - adds a sample of us microseconds to the histogram.
+ */
+static void record_sample(NvPdHistogram *histogram, uint64_t us)
+{
+    uint64_t max;
+
+    __sync_fetch_and_add(&histogram->count, 1);
+    __sync_fetch_and_add(&histogram->total_us, us);
+    __sync_fetch_and_add(&histogram->buckets[get_bucket(us)], 1);
+
+    max = histogram->max_us;
+    while (us > max) {
+        max = __sync_val_compare_and_swap(&histogram->max_us, max, us);
+    }
+}
+
+/*
+ * nvPdStatsRecord() - records a sample of a phase that started at start_us,
+ * as returned by nvPdStatsTime(), and ends now.
+ */
+void nvPdStatsRecord(NvPdHistogram *histogram, uint64_t start_us)
+{
+    record_sample(histogram, get_elapsed(start_us));
+}
+
+/*
+ * nvPdStatsRecordDevice() - records a sample of a device phase, in the phase
+ * histograms of the device. Nothing is recorded if phases is NULL.
+ */
+void nvPdStatsRecordDevice(NvPdHistogram *phases, NvPdDevicePhase phase,
+                           uint64_t start_us)
+{
+    if ((phases != NULL) && (phase >= 0) && (phase < NVPD_NUM_DEVICE_PHASES)) {
+        nvPdStatsRecord(&phases[phase], start_us);
+    }
+}
+
+/*
+ * nvPdStatsRecordRpc() - records a sample of an RPC handler, from the time
+ * the request was dispatched until the reply was sent.
+ */
+void nvPdStatsRecordRpc(NvPdRpcPhase phase, uint64_t start_us)
+{
+    uint64_t us = get_elapsed(start_us);
+
+    NVPD_TRACE2(rpc__return, phase, us);
+
+    if ((phase >= 0) && (phase < NVPD_NUM_RPC_PHASES)) {
+        record_sample(&rpc_stats[phase], us);
+    }
+}
+
+/*
+ * nvPdStatsCopy() - copies count histograms that may be updated meanwhile.
+ * Each field is read atomically, but the copy as a whole is not a consistent
+ * snapshot; samples recorded during the copy may be partially included.
+ */
+void nvPdStatsCopy(NvPdHistogram *dst, const NvPdHistogram *src, int count)
+{
+    const volatile NvPdHistogram *from;
+    int i, j;
+
+    for (i = 0; i < count; i++) {
+        from = &src[i];
+
+        dst[i].count = from->count;
+        dst[i].total_us = from->total_us;
+        dst[i].max_us = from->max_us;
+        for (j = 0; j < NVPD_STATS_NUM_BUCKETS; j++) {
+            dst[i].buckets[j] = from->buckets[j];
+        }
+    }
+}
+
+/*
+ * nvPdStatsGetRpc() - copies the histograms of all RPC handlers, indexed by
+ * NvPdRpcPhase.
+ */
+void nvPdStatsGetRpc(NvPdHistogram *rpc)
+{
+    nvPdStatsCopy(rpc, rpc_stats, NVPD_NUM_RPC_PHASES);
+}
@@ -0,0 +1,54 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-stats.h
+ */
+
+#ifndef _NVIDIA_STATS_H_
+#define _NVIDIA_STATS_H_
+
+#include <stdint.h>
+
+#include "nvpd_rpc.h"
+
+/*
+ * Latency histograms of the phases of bringing up and tearing down devices,
+ * kept per device, and of the RPC handlers, kept for the whole daemon.
+ *
+ * Bucket 0 counts samples shorter than 1 us, and bucket i > 0 counts samples
+ * of [2^(i-1), 2^i) us; the last bucket also counts all longer samples.
+ * Histograms are updated atomically in place, without any allocation, and
+ * may be read while they are being updated.
+ */
+uint64_t nvPdStatsTime(void);
+
+void nvPdStatsRecord(NvPdHistogram *histogram, uint64_t start_us);
+void nvPdStatsRecordDevice(NvPdHistogram *phases, NvPdDevicePhase phase,
+                           uint64_t start_us);
+void nvPdStatsRecordRpc(NvPdRpcPhase phase, uint64_t start_us);
+
+void nvPdStatsCopy(NvPdHistogram *dst, const NvPdHistogram *src, int count);
+void nvPdStatsGetRpc(NvPdHistogram *rpc);
+
+#endif /* _NVIDIA_STATS_H_ */
@@ -25,6 +25,9 @@
  * syslog
  */
 
+#include <string.h>
+#include <time.h>
+
 #include "nvidia-syslog-utils.h"
 
 int verbose = 0;
@@ -68,3 +71,183 @@ void syslog_device(NvCfgPciDevice *device_pci_info, int priority,
 
     nvfree(device_str);
 }
+
+/*
+ * get_time_us() - returns the time in microseconds, from the monotonic clock.
+ */
+static uint64_t get_time_us(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * nvPdLogSummaryBegin() - starts collecting a summary, to be logged with the
+ * given priority and label by nvPdLogSummaryEnd().
+ */
+void nvPdLogSummaryBegin(NvPdLogSummary *summary, int priority,
+                         const char *label)
+{
+    memset(summary, 0, sizeof(*summary));
+
+    pthread_mutex_init(&summary->lock, NULL);
+    summary->enabled = verbose;
+    summary->priority = priority;
+    summary->label = label;
+
+    if (summary->enabled) {
+        summary->start_us = get_time_us();
+    }
+}
+
+/*
+ * nvPdLogSummaryAdd() - adds the item id to the summary. If error is not 0,
+ * it is kept as the negative error code to report with the summary.
+ *
+ * Items are merged into the range they extend. Items are usually added in
+ * order, within each thread adding them, so only a few ranges are needed;
+ * items beyond the last range that fits are only counted.
+ */
+void nvPdLogSummaryAdd(NvPdLogSummary *summary, uint64_t id, int error)
+{
+    int i;
+
+    if (!summary->enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&summary->lock);
+
+    summary->count++;
+    if (error != 0) {
+        summary->last_error = error;
+    }
+
+    for (i = 0; i < summary->num_ranges; i++) {
+        if (id == summary->ranges[i].last + 1) {
+            summary->ranges[i].last = id;
+            break;
+        }
+        if (id + 1 == summary->ranges[i].first) {
+            summary->ranges[i].first = id;
+            break;
+        }
+    }
+
+    if (i == summary->num_ranges) {
+        if (summary->num_ranges < NVPD_LOG_SUMMARY_MAX_RANGES) {
+            summary->ranges[i].first = id;
+            summary->ranges[i].last = id;
+            summary->num_ranges++;
+        } else {
+            summary->ranges_dropped++;
+        }
+    }
+
+    pthread_mutex_unlock(&summary->lock);
+}
+
+/*
+ * nvPdLogSummaryEnd() - logs the summary in a single record, unless no items
+ * were added, and releases it.
+ */
+void nvPdLogSummaryEnd(NvPdLogSummary *summary)
+{
+    char ranges[NVPD_LOG_SUMMARY_MAX_RANGES * 44];
+    size_t len = 0;
+    uint64_t first, last;
+    int i, j;
+
+    if (summary->enabled && (summary->count > 0)) {
+        /* Threads add items out of order; list the ranges in order */
+        for (i = 1; i < summary->num_ranges; i++) {
+            for (j = i; (j > 0) && (summary->ranges[j - 1].first >
+                                    summary->ranges[j].first); j--) {
+                first = summary->ranges[j].first;
+                last = summary->ranges[j].last;
+                summary->ranges[j] = summary->ranges[j - 1];
+                summary->ranges[j - 1].first = first;
+                summary->ranges[j - 1].last = last;
+            }
+        }
+
+        ranges[0] = '\0';
+
+        for (i = 0; i < summary->num_ranges; i++) {
+            first = summary->ranges[i].first;
+            last = summary->ranges[i].last;
+
+            /* Ranges that grew into each other are listed as one */
+            while ((i + 1 < summary->num_ranges) &&
+                   (summary->ranges[i + 1].first == last + 1)) {
+                last = summary->ranges[++i].last;
+            }
+
+            if (first == last) {
+                len += snprintf(ranges + len, sizeof(ranges) - len, "%s%llu",
+                                (len > 0) ? "," : "",
+                                (unsigned long long)first);
+            } else {
+                len += snprintf(ranges + len, sizeof(ranges) - len,
+                                "%s%llu-%llu", (len > 0) ? "," : "",
+                                (unsigned long long)first,
+                                (unsigned long long)last);
+            }
+        }
+
+        syslog(summary->priority, "%s %s%s (%llu total) in %llu us%s%s",
+               summary->label, ranges,
+               (summary->ranges_dropped > 0) ? ",..." : "",
+               (unsigned long long)summary->count,
+               (unsigned long long)(get_time_us() - summary->start_us),
+               (summary->last_error != 0) ? ": " : "",
+               (summary->last_error != 0) ?
+                   strerror(-summary->last_error) : "");
+    }
+
+    pthread_mutex_destroy(&summary->lock);
+    summary->enabled = 0;
+    summary->count = 0;
+}
+
+/*
+ * syslog_rate_limit() - returns whether another record may be logged under
+ * the rate limit. When a new interval begins, the number of records dropped
+ * in the previous one is logged first.
+ */
+int syslog_rate_limit(NvPdLogRateLimit *rate_limit)
+{
+    uint64_t now = get_time_us() / 1000;
+    unsigned int suppressed = 0;
+    int allowed;
+
+    pthread_mutex_lock(&rate_limit->lock);
+
+    if ((rate_limit->window_start_ms == 0) ||
+        (now - rate_limit->window_start_ms >= rate_limit->interval_ms)) {
+        suppressed = rate_limit->suppressed;
+        rate_limit->window_start_ms = now;
+        rate_limit->count = 0;
+        rate_limit->suppressed = 0;
+    }
+
+    allowed = (rate_limit->count < rate_limit->burst);
+    if (allowed) {
+        rate_limit->count++;
+    } else {
+        rate_limit->suppressed++;
+    }
+
+    pthread_mutex_unlock(&rate_limit->lock);
+
+    if (suppressed > 0) {
+        syslog(LOG_NOTICE, "%u similar messages suppressed", suppressed);
+    }
+
+    return allowed;
+}
@@ -28,6 +28,8 @@
 #ifndef _NVIDIA_SYSLOG_UTILS_H_
 #define _NVIDIA_SYSLOG_UTILS_H_
 
+#include <pthread.h>
+#include <stdint.h>
 #include <syslog.h>
 
 #include "common-utils.h"
@@ -49,4 +51,60 @@ void syslog_device(NvCfgPciDevice *device_pci_info, int priority,
         syslog(priority, format, ##__VA_ARGS__);                        \
 } while(0)
 
+/*
+ * Log summaries collect events that happen once per item of a larger
+ * operation, such as one per memory block of a NUMA memory transition, and
+ * log them in a single record once the operation is done: the ranges of item
+ * IDs, how many items there were, and how long the operation took. Items may
+ * be added from multiple threads. Summaries only collect items in verbose
+ * mode.
+ */
+#define NVPD_LOG_SUMMARY_MAX_RANGES 16
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    int enabled;
+    int priority;
+    const char *label;
+    uint64_t start_us;
+    uint64_t count;
+    uint64_t ranges_dropped;
+    int last_error;
+    int num_ranges;
+    struct {
+        uint64_t first;
+        uint64_t last;
+    } ranges[NVPD_LOG_SUMMARY_MAX_RANGES];
+} NvPdLogSummary;
+
+void nvPdLogSummaryBegin(NvPdLogSummary *summary, int priority,
+                         const char *label);
+void nvPdLogSummaryAdd(NvPdLogSummary *summary, uint64_t id, int error);
+void nvPdLogSummaryEnd(NvPdLogSummary *summary);
+
+/*
+ * Rate limits allow up to burst records per interval_ms from one call site;
+ * the number of records dropped is logged with the next record allowed.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    unsigned int interval_ms;
+    unsigned int burst;
+    uint64_t window_start_ms;
+    unsigned int count;
+    unsigned int suppressed;
+} NvPdLogRateLimit;
+
+#define NVPD_LOG_RATE_LIMIT_INIT(interval_ms, burst) \
+    { PTHREAD_MUTEX_INITIALIZER, (interval_ms), (burst), 0, 0, 0 }
+
+int syslog_rate_limit(NvPdLogRateLimit *rate_limit);
+
+#define SYSLOG_RATE_LIMITED(rate_limit, priority, format, ...) do {      \
+    if (syslog_rate_limit(rate_limit))                                  \
+        syslog(priority, format, ##__VA_ARGS__);                        \
+} while(0)
+
 #endif /* _NVIDIA_SYSLOG_UTILS_H_ */
@@ -0,0 +1,235 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-systemd.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "nvidia-systemd.h"
+#include "nvpd_defs.h"
+
+/* The first file descriptor passed by systemd, see sd_listen_fds(3) */
+#define NVPD_SYSTEMD_LISTEN_FDS_START 3
+
+#define NVPD_SYSTEMD_MAX_NOTIFY_LEN 256
+
+static int listen_fd = -1;
+
+static int notify_fd = -1;
+static struct sockaddr_un notify_addr;
+static socklen_t notify_addr_len;
+
+/*
+ * check_listen_fd() - checks that the socket passed by systemd is the one the
+ * daemon would otherwise create itself: a listening Unix-domain stream socket
+ * bound to the RPC socket path, which clients connect to.
+ */
+static int check_listen_fd(int fd)
+{
+    struct sockaddr_un addr;
+    socklen_t len = sizeof(addr);
+    int type, listening;
+    socklen_t opt_len;
+
+    memset(&addr, 0, sizeof(addr));
+    if (getsockname(fd, (struct sockaddr *)&addr, &len) < 0) {
+        syslog(LOG_ERR, "Failed to query socket passed by systemd: %s",
+               strerror(errno));
+        return 0;
+    }
+
+    opt_len = sizeof(type);
+    if ((addr.sun_family != AF_UNIX) ||
+        (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &opt_len) < 0) ||
+        (type != SOCK_STREAM)) {
+        syslog(LOG_ERR, "Socket passed by systemd is not a Unix-domain "
+                        "stream socket");
+        return 0;
+    }
+
+    opt_len = sizeof(listening);
+    if ((getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening,
+                    &opt_len) < 0) || !listening) {
+        syslog(LOG_ERR, "Socket passed by systemd is not listening");
+        return 0;
+    }
+
+    if (strncmp(addr.sun_path, NVPD_SOCKET_PATH, sizeof(addr.sun_path)) != 0) {
+        /* systemd rewrites paths below /var/run to /run */
+        if ((strncmp(NVPD_SOCKET_PATH, "/var", 4) != 0) ||
+            (strncmp(addr.sun_path, NVPD_SOCKET_PATH + 4,
+                     sizeof(addr.sun_path)) != 0)) {
+            syslog(LOG_ERR, "Socket passed by systemd is bound to %s instead "
+                            "of %s", addr.sun_path, NVPD_SOCKET_PATH);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * init_listen_fd() - takes the listening socket passed by systemd, if any.
+ * The environment variables are cleared so that they are not inherited by a
+ * new instance of the daemon, which receives the socket in the handoff.
+ */
+static void init_listen_fd(void)
+{
+    const char *listen_pid = getenv("LISTEN_PID");
+    const char *listen_fds = getenv("LISTEN_FDS");
+    int num_fds, fd;
+
+    if ((listen_pid == NULL) || (listen_fds == NULL) ||
+        (strtol(listen_pid, NULL, 10) != getpid())) {
+        return;
+    }
+
+    num_fds = atoi(listen_fds);
+
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    for (fd = NVPD_SYSTEMD_LISTEN_FDS_START;
+         fd < NVPD_SYSTEMD_LISTEN_FDS_START + num_fds; fd++) {
+        (void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        if ((listen_fd < 0) && check_listen_fd(fd)) {
+            listen_fd = fd;
+        } else {
+            syslog(LOG_WARNING, "Ignoring socket %d passed by systemd", fd);
+            close(fd);
+        }
+    }
+}
+
+/*
+ * init_notify() - opens a socket for sending notifications to the service
+ * manager, if it expects any. Abstract socket addresses start with '@'.
+ */
+static void init_notify(void)
+{
+    const char *path = getenv("NOTIFY_SOCKET");
+    size_t len;
+
+    if ((path == NULL) || ((path[0] != '/') && (path[0] != '@'))) {
+        return;
+    }
+
+    len = strlen(path);
+    if (len >= sizeof(notify_addr.sun_path)) {
+        syslog(LOG_WARNING, "Ignoring systemd notification socket %s", path);
+        return;
+    }
+
+    memset(&notify_addr, 0, sizeof(notify_addr));
+    notify_addr.sun_family = AF_UNIX;
+    memcpy(notify_addr.sun_path, path, len);
+    if (notify_addr.sun_path[0] == '@') {
+        notify_addr.sun_path[0] = '\0';
+    }
+    notify_addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+
+    notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (notify_fd < 0) {
+        syslog(LOG_WARNING, "Failed to create systemd notification socket: "
+                            "%s", strerror(errno));
+    }
+}
+
+/*
+ * nvPdSystemdInit() - picks up the sockets passed by systemd, and enables
+ * notifications if the daemon runs as a Type=notify service.
+ */
+void nvPdSystemdInit(void)
+{
+    init_listen_fd();
+    init_notify();
+}
+
+/*
+ * nvPdSystemdTakeListenFd() - returns the listening RPC socket passed by
+ * systemd, or -1 if there is none. The caller owns the socket from then on.
+ */
+int nvPdSystemdTakeListenFd(void)
+{
+    int fd = listen_fd;
+
+    listen_fd = -1;
+
+    return fd;
+}
+
+/*
+ * nvPdSystemdIsNotifyEnabled() - whether the service manager waits for the
+ * daemon to report its readiness, in which case the daemon is not to fork.
+ */
+int nvPdSystemdIsNotifyEnabled(void)
+{
+    return (notify_fd >= 0);
+}
+
+/*
+ * nvPdSystemdNotify() - sends a newline-separated list of variable
+ * assignments to the service manager, see sd_notify(3). This may be called
+ * from any thread, and does nothing unless notifications are enabled.
+ */
+void nvPdSystemdNotify(const char *format, ...)
+{
+    char msg[NVPD_SYSTEMD_MAX_NOTIFY_LEN];
+    va_list ap;
+    int len;
+
+    if (notify_fd < 0) {
+        return;
+    }
+
+    va_start(ap, format);
+    len = vsnprintf(msg, sizeof(msg), format, ap);
+    va_end(ap);
+
+    if (len < 0) {
+        return;
+    }
+
+    if (len >= (int)sizeof(msg)) {
+        len = sizeof(msg) - 1;
+    }
+
+    if (sendto(notify_fd, msg, len, MSG_NOSIGNAL,
+               (struct sockaddr *)&notify_addr, notify_addr_len) < 0) {
+        syslog(LOG_DEBUG, "Failed to notify systemd: %s", strerror(errno));
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-systemd.h
+ */
+
+#ifndef _NVIDIA_SYSTEMD_H_
+#define _NVIDIA_SYSTEMD_H_
+
+/*
+ * When started by systemd, the daemon may be passed its listening RPC socket
+ * (socket activation), and reports its startup progress and readiness to the
+ * service manager over the notification socket (Type=notify). Both are
+ * implemented directly on top of the environment variables and the datagram
+ * protocol, so that the daemon does not depend on libsystemd.
+ *
+ * nvPdSystemdInit() must be called before the daemon forks, since systemd
+ * passes sockets to a specific process ID.
+ */
+void nvPdSystemdInit(void);
+int nvPdSystemdTakeListenFd(void);
+int nvPdSystemdIsNotifyEnabled(void);
+void nvPdSystemdNotify(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+#endif /* _NVIDIA_SYSTEMD_H_ */
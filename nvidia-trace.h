@@ -0,0 +1,101 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-trace.h
+ */
+
+#ifndef _NVIDIA_TRACE_H_
+#define _NVIDIA_TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * Static tracepoints (USDT) of the daemon, listed by bpftrace or perf as
+ * usdt:nvidia-persistenced:nvidia_persistenced:<name>. They are only built
+ * with NVPD_USDT=1, which requires <sys/sdt.h> from systemtap; otherwise the
+ * probes compile to nothing, and their arguments are not evaluated.
+ *
+ * Devices are identified by their BDF, packed as with NVPD_TRACE_BDF(), and
+ * memory blocks by their memblock ID, as in /sys/devices/system/memory.
+ *
+ *   rpc__entry(phase, bdf)            RPC handler entry; bdf is
+ *                                     NVPD_TRACE_NO_BDF unless the request
+ *                                     names a single device
+ *   rpc__return(phase, elapsed_us)    reply sent, including deferred replies
+ *   set__mode__entry(bdf, mode)       only for actual changes, as are
+ *                                     set__numa__entry/return
+ *   set__mode__return(bdf, mode, status)
+ *   set__numa__entry(bdf, numa_status)
+ *   set__numa__return(bdf, numa_status, status)
+ *   numa__info(bdf, ret, numa_status) NV_ESC_NUMA_INFO ioctl
+ *   numa__status(bdf, numa_status, ret)
+ *                                     NV_ESC_SET_NUMA_STATUS ioctl
+ *   memblock__entry(bdf, memblock, state)
+ *   memblock__return(bdf, memblock, state, ret)
+ *                                     write of a memblock state file
+ *   uvm__fabric__retry(bdf, interval_ms, ret)
+ *                                     UVM persistence mode attempt, made
+ *                                     interval_ms after the previous one
+ *                                     (0 for the first one)
+ *
+ * Phases are NvPdRpcPhase values, modes NvPersistenceMode values, statuses
+ * NvPdStatus values, and ret is 0 or a negative errno value, or the NV_STATUS
+ * returned by nvidia-cfg for uvm__fabric__retry. NUMA statuses are
+ * NvNumaStatus values for set__numa__*, and NV_IOCTL_NUMA_STATUS_* values
+ * otherwise, as are memblock states.
+ */
+
+#define NVPD_TRACE_NO_BDF   0xffffffffU
+
+#define NVPD_TRACE_BDF(pci) \
+    ((((uint32_t)(pci)->domain & 0xffff) << 16) | \
+     (((uint32_t)(pci)->bus & 0xff) << 8) | \
+     (((uint32_t)(pci)->slot & 0x1f) << 3) | \
+     ((uint32_t)(pci)->function & 0x7))
+
+#if defined(NVPD_USDT)
+
+#include <sys/sdt.h>
+
+#define NVPD_TRACE2(name, a1, a2) \
+    DTRACE_PROBE2(nvidia_persistenced, name, a1, a2)
+#define NVPD_TRACE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(nvidia_persistenced, name, a1, a2, a3)
+#define NVPD_TRACE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(nvidia_persistenced, name, a1, a2, a3, a4)
+
+#else
+
+/* Keep the arguments referenced, so that disabling probes adds no warnings */
+#define NVPD_TRACE2(name, a1, a2) \
+    do { if (0) { (void)(a1); (void)(a2); } } while (0)
+#define NVPD_TRACE3(name, a1, a2, a3) \
+    do { if (0) { (void)(a1); (void)(a2); (void)(a3); } } while (0)
+#define NVPD_TRACE4(name, a1, a2, a3, a4) \
+    do { if (0) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } \
+    while (0)
+
+#endif /* NVPD_USDT */
+
+#endif /* _NVIDIA_TRACE_H_ */
@@ -0,0 +1,224 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-work-queue.c
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "nvidia-work-queue.h"
+
+typedef struct _NvPdWorkItem
+{
+    NvPdWorkFunc func;
+    void *data;
+    struct _NvPdWorkItem *next;
+} NvPdWorkItem;
+
+struct _NvPdWorkQueue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    NvPdWorkItem *head;
+    NvPdWorkItem *tail;
+    int shutdown;
+    int num_threads;
+    pthread_t *threads;
+    NvPdWorkFunc init;
+    void *init_data;
+};
+
+/*
+ * work_queue_thread() - the main loop of each worker thread. Work items are
+ * pulled off the head of the queue until the queue is empty and has been
+ * asked to shut down.
+ */
+static void *work_queue_thread(void *arg)
+{
+    NvPdWorkQueue *queue = arg;
+    NvPdWorkItem *item;
+
+    if (queue->init != NULL) {
+        queue->init(queue->init_data);
+    }
+
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+
+        while ((queue->head == NULL) && !queue->shutdown) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        }
+
+        item = queue->head;
+        if (item == NULL) {
+            /* Shutting down, and no work left */
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+
+        queue->head = item->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+
+        item->func(item->data);
+        free(item);
+    }
+
+    return NULL;
+}
+
+/*
+ * nvPdWorkQueueCreate() - creates a work queue serviced by num_threads worker
+ * threads. Returns NULL on failure.
+ *
+ * Worker threads are created with all signals blocked, so that process-wide
+ * signals continue to be delivered to the main thread.
+ */
+NvPdWorkQueue *nvPdWorkQueueCreate(int num_threads)
+{
+    return nvPdWorkQueueCreateWithInit(num_threads, NULL, NULL);
+}
+
+/*
+ * nvPdWorkQueueCreateWithInit() - like nvPdWorkQueueCreate(), but each worker
+ * thread calls init(init_data) before running any work items, e.g., to set
+ * up the placement of the thread. Work may be submitted right away.
+ */
+NvPdWorkQueue *nvPdWorkQueueCreateWithInit(int num_threads, NvPdWorkFunc init,
+                                           void *init_data)
+{
+    NvPdWorkQueue *queue;
+    sigset_t signal_set, old_signal_set;
+    int i, ret;
+
+    if (num_threads < 1) {
+        return NULL;
+    }
+
+    queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    queue->threads = calloc(num_threads, sizeof(pthread_t));
+    if (queue->threads == NULL) {
+        free(queue);
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    queue->init = init;
+    queue->init_data = init_data;
+
+    sigfillset(&signal_set);
+    pthread_sigmask(SIG_SETMASK, &signal_set, &old_signal_set);
+
+    for (i = 0; i < num_threads; i++) {
+        ret = pthread_create(&queue->threads[i], NULL, work_queue_thread,
+                             queue);
+        if (ret != 0) {
+            syslog(LOG_ERR, "Failed to create worker thread: %s",
+                   strerror(ret));
+            break;
+        }
+        queue->num_threads++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signal_set, NULL);
+
+    if (queue->num_threads == 0) {
+        nvPdWorkQueueDestroy(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+/*
+ * nvPdWorkQueueSubmit() - appends a work item to the tail of the queue.
+ */
+NvPdStatus nvPdWorkQueueSubmit(NvPdWorkQueue *queue, NvPdWorkFunc func,
+                               void *data)
+{
+    NvPdWorkItem *item;
+
+    item = malloc(sizeof(*item));
+    if (item == NULL) {
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    item->func = func;
+    item->data = data;
+    item->next = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->tail != NULL) {
+        queue->tail->next = item;
+    } else {
+        queue->head = item;
+    }
+    queue->tail = item;
+
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * nvPdWorkQueueDestroy() - waits for all submitted work items to complete,
+ * then stops the worker threads and frees the queue.
+ */
+void nvPdWorkQueueDestroy(NvPdWorkQueue *queue)
+{
+    int i;
+
+    if (queue == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->shutdown = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (i = 0; i < queue->num_threads; i++) {
+        pthread_join(queue->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+
+    free(queue->threads);
+    free(queue);
+}
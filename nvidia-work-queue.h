@@ -0,0 +1,49 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvidia-work-queue.h
+ */
+
+#ifndef _NVIDIA_WORK_QUEUE_H_
+#define _NVIDIA_WORK_QUEUE_H_
+
+#include "nvpd_rpc.h"
+
+/*
+ * A work queue is a FIFO of work items serviced by a fixed number of worker
+ * threads. Work items submitted to a queue with a single thread are executed
+ * in submission order.
+ */
+typedef struct _NvPdWorkQueue NvPdWorkQueue;
+
+typedef void (*NvPdWorkFunc)(void *data);
+
+NvPdWorkQueue *nvPdWorkQueueCreate(int num_threads);
+NvPdWorkQueue *nvPdWorkQueueCreateWithInit(int num_threads, NvPdWorkFunc init,
+                                           void *init_data);
+NvPdStatus nvPdWorkQueueSubmit(NvPdWorkQueue *queue, NvPdWorkFunc func,
+                               void *data);
+void nvPdWorkQueueDestroy(NvPdWorkQueue *queue);
+
+#endif /* _NVIDIA_WORK_QUEUE_H_ */
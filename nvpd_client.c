@@ -0,0 +1,630 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvpd_client.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvpd_client.h"
+#include "nvpd_msg.h"
+#include "nvpd_rpc.h"
+
+/* Cached persistence mode of a device */
+typedef struct
+{
+    NvPdClientDevice device;
+    int mode;
+    uint64_t time_ms;   /* when the mode was received; 0 if it is unknown */
+    uint32_t event_seq; /* number of the last event on the device, if any */
+} NvPdClientCacheEntry;
+
+/* Any message received from the daemon */
+typedef union
+{
+    NvPdMsgReply reply;
+    NvPdMsgEvent event;
+} NvPdClientMsg;
+
+struct _NvPdClient
+{
+    pthread_mutex_t lock;
+    int fd;
+    uint32_t next_seq;
+    int subscribed;
+    uint32_t last_event_seq;
+    unsigned int cache_timeout_ms;
+    int num_entries;
+    int max_entries;
+    NvPdClientCacheEntry *entries;
+};
+
+/*
+ * get_time_ms() - returns the monotonic time in ms.
+ */
+static uint64_t get_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * find_entry() - returns the cache entry of the device, adding one if create
+ * is set. Returns NULL if there is no entry, or it could not be added.
+ */
+static NvPdClientCacheEntry *find_entry(NvPdClient *client,
+                                        const NvPdClientDevice *device,
+                                        int create)
+{
+    NvPdClientCacheEntry *entries, *entry;
+    int i, max_entries;
+
+    for (i = 0; i < client->num_entries; i++) {
+        entry = &client->entries[i];
+        if ((entry->device.domain == device->domain) &&
+            (entry->device.bus == device->bus) &&
+            (entry->device.slot == device->slot) &&
+            (entry->device.function == device->function)) {
+            return entry;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (client->num_entries == client->max_entries) {
+        max_entries = (client->max_entries > 0) ? client->max_entries * 2 : 8;
+        entries = realloc(client->entries,
+                          max_entries * sizeof(NvPdClientCacheEntry));
+        if (entries == NULL) {
+            return NULL;
+        }
+        client->entries = entries;
+        client->max_entries = max_entries;
+    }
+
+    entry = &client->entries[client->num_entries++];
+    memset(entry, 0, sizeof(*entry));
+    entry->device = *device;
+
+    return entry;
+}
+
+/*
+ * update_cache() - records the persistence mode of the device once it is
+ * known from a reply, or forgets it once a change failed, in which case the
+ * mode is not known. The reply is outdated if an event on the device came
+ * after the request was sent, that is after event number since_seq.
+ */
+static void update_cache(NvPdClient *client, const NvPdClientDevice *device,
+                         int status, int mode, uint32_t since_seq)
+{
+    NvPdClientCacheEntry *entry;
+
+    if (client->cache_timeout_ms == 0) {
+        return;
+    }
+
+    entry = find_entry(client, device, status == NVPD_SUCCESS);
+    if (entry == NULL) {
+        return;
+    }
+
+    /* Keep the mode of an event that came after the request */
+    if ((entry->event_seq != 0) &&
+        ((int32_t)(entry->event_seq - since_seq) > 0)) {
+        return;
+    }
+
+    entry->mode = mode;
+    entry->time_ms = (status == NVPD_SUCCESS) ? get_time_ms() : 0;
+}
+
+/*
+ * handle_event() - updates the cache with the state of a device sent by the
+ * daemon. The whole cache is dropped if events were missed.
+ */
+static void handle_event(NvPdClient *client, const NvPdMsgEvent *event)
+{
+    NvPdClientCacheEntry *entry;
+    NvPdClientDevice device;
+
+    if (client->cache_timeout_ms == 0) {
+        return;
+    }
+
+    if (event->seq != client->last_event_seq + 1) {
+        client->num_entries = 0;
+    }
+    client->last_event_seq = event->seq;
+
+    device.domain = event->domain;
+    device.bus = event->bus;
+    device.slot = event->slot;
+    device.function = event->function;
+
+    entry = find_entry(client, &device, 1);
+    if (entry == NULL) {
+        return;
+    }
+
+    entry->mode = event->mode;
+    entry->time_ms = get_time_ms();
+    entry->event_seq = event->seq;
+}
+
+/*
+ * receive_message() - receives the next reply or event from the daemon, and
+ * handles it if it is an event. Returns 1 if a reply was received, 2 if an
+ * event was received, 0 if there was nothing to receive without blocking,
+ * and -1 if the connection failed.
+ */
+static int receive_message(NvPdClient *client, NvPdMsgReply *reply, int flags)
+{
+    NvPdClientMsg msg;
+    ssize_t len;
+
+    do {
+        len = recv(client->fd, &msg, sizeof(msg), flags);
+    } while ((len < 0) && (errno == EINTR));
+
+    if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) &&
+        (flags & MSG_DONTWAIT)) {
+        return 0;
+    }
+
+    if ((len == (ssize_t) sizeof(msg.event)) &&
+        (msg.event.type == NVPD_MSG_EVENT)) {
+        handle_event(client, &msg.event);
+        return 2;
+    }
+
+    if (len != (ssize_t) sizeof(msg.reply)) {
+        return -1;
+    }
+
+    *reply = msg.reply;
+
+    return 1;
+}
+
+/*
+ * connect_daemon() - connects to the daemon, unless already connected.
+ */
+static int connect_daemon(NvPdClient *client)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (client->fd >= 0) {
+        return NVPD_SUCCESS;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, NVPD_MSG_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return NVPD_ERR_DAEMON_NOT_PRESENT;
+    }
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return NVPD_ERR_DAEMON_NOT_PRESENT;
+    }
+
+    client->fd = fd;
+    client->subscribed = 0;
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * disconnect_daemon() - closes the connection to the daemon. The cache is
+ * dropped, since the daemon may be restarted before the next connection.
+ */
+static void disconnect_daemon(NvPdClient *client)
+{
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+
+    client->subscribed = 0;
+    client->num_entries = 0;
+}
+
+/*
+ * transact() - sends count requests, with at most NVPD_MSG_MAX_PENDING of
+ * them outstanding at once, and stores the reply to each request at the same
+ * index in replies.
+ */
+static int transact(NvPdClient *client, NvPdMsgRequest *requests,
+                    NvPdMsgReply *replies, int count)
+{
+    NvPdMsgReply reply;
+    uint32_t first_seq = client->next_seq;
+    uint32_t index;
+    int sent = 0, received = 0;
+    int ret;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        requests[i].version = NVPD_MSG_VERSION;
+        requests[i].seq = first_seq + i;
+    }
+    client->next_seq += count;
+
+    while (received < count) {
+        while ((sent < count) && (sent - received < NVPD_MSG_MAX_PENDING)) {
+            if (send(client->fd, &requests[sent], sizeof(requests[sent]),
+                     MSG_NOSIGNAL) != (ssize_t) sizeof(requests[sent])) {
+                return NVPD_ERR_IO;
+            }
+            sent++;
+        }
+
+        ret = receive_message(client, &reply, 0);
+        if (ret < 0) {
+            return NVPD_ERR_IO;
+        } else if (ret != 1) {
+            continue;
+        }
+
+        index = reply.seq - first_seq;
+        if ((index >= (uint32_t) count) ||
+            (reply.type != requests[index].type)) {
+            continue;
+        }
+
+        replies[index] = reply;
+        received++;
+    }
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * subscribe() - subscribes to events on the new connection, so that the
+ * cache is updated on changes made by other clients. Older daemons do not
+ * support it, in which case cached modes expire instead.
+ */
+static int subscribe(NvPdClient *client)
+{
+    NvPdMsgRequest request;
+    NvPdMsgReply reply;
+    int status;
+
+    memset(&request, 0, sizeof(request));
+    request.type = NVPD_MSG_SUBSCRIBE;
+
+    status = transact(client, &request, &reply, 1);
+    if (status != NVPD_SUCCESS) {
+        return status;
+    }
+
+    /* Remember the outcome, so that subscribing is only tried once */
+    client->subscribed = (reply.status == NVPD_SUCCESS) ? 1 : -1;
+    client->last_event_seq = (uint32_t) reply.value;
+
+    return NVPD_SUCCESS;
+}
+
+/*
+ * send_requests() - sends the requests to the daemon, connecting to it as
+ * needed. If the connection fails, the requests are sent once more on a new
+ * connection, in case the daemon was restarted since the connection was
+ * opened; all requests are idempotent. Events numbered after since_seq came
+ * after the requests were sent.
+ */
+static int send_requests(NvPdClient *client, NvPdMsgRequest *requests,
+                         NvPdMsgReply *replies, int count,
+                         uint32_t *since_seq)
+{
+    int status = NVPD_ERR_IO;
+    int attempt;
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        status = connect_daemon(client);
+        if (status != NVPD_SUCCESS) {
+            return status;
+        }
+
+        if ((client->cache_timeout_ms > 0) && (client->subscribed == 0)) {
+            status = subscribe(client);
+        }
+
+        if (status == NVPD_SUCCESS) {
+            *since_seq = client->last_event_seq;
+            status = transact(client, requests, replies, count);
+            if (status == NVPD_SUCCESS) {
+                return NVPD_SUCCESS;
+            }
+        }
+
+        disconnect_daemon(client);
+    }
+
+    return status;
+}
+
+/*
+ * receive_events() - handles the events received since the last request,
+ * to bring the cache up to date before it is used.
+ */
+static void receive_events(NvPdClient *client)
+{
+    NvPdMsgReply reply;
+    int ret;
+
+    if (client->subscribed != 1) {
+        return;
+    }
+
+    do {
+        ret = receive_message(client, &reply, MSG_DONTWAIT);
+    } while (ret == 2);
+
+    if (ret != 0) {
+        /* Nothing but events is expected between requests */
+        disconnect_daemon(client);
+    }
+}
+
+/*
+ * init_request() - fills in a request on a device, except for the fields
+ * filled in by transact().
+ */
+static void init_request(NvPdMsgRequest *request, NvPdMsgType type,
+                         const NvPdClientDevice *device, int value)
+{
+    memset(request, 0, sizeof(*request));
+    request->type = type;
+    request->domain = device->domain;
+    request->bus = device->bus;
+    request->slot = device->slot;
+    request->function = device->function;
+    request->value = value;
+}
+
+/*
+ * send_device_request() - sends a single request on a device, and returns
+ * the status of its reply. Must be called with the client lock held.
+ */
+static int send_device_request(NvPdClient *client, NvPdMsgType type,
+                               const NvPdClientDevice *device, int value,
+                               NvPdMsgReply *reply, uint32_t *since_seq)
+{
+    NvPdMsgRequest request;
+    int status;
+
+    init_request(&request, type, device, value);
+    memset(reply, 0, sizeof(*reply));
+
+    status = send_requests(client, &request, reply, 1, since_seq);
+
+    return (status == NVPD_SUCCESS) ? reply->status : status;
+}
+
+NvPdClient *nvPdClientOpen(void)
+{
+    NvPdClient *client = calloc(1, sizeof(*client));
+
+    if (client == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&client->lock, NULL);
+    client->fd = -1;
+    client->next_seq = 1;
+
+    return client;
+}
+
+void nvPdClientClose(NvPdClient *client)
+{
+    if (client == NULL) {
+        return;
+    }
+
+    disconnect_daemon(client);
+    pthread_mutex_destroy(&client->lock);
+    free(client->entries);
+    free(client);
+}
+
+void nvPdClientSetCacheTimeout(NvPdClient *client, unsigned int ms)
+{
+    pthread_mutex_lock(&client->lock);
+
+    client->cache_timeout_ms = ms;
+
+    /* Reconnect without subscribing, if no longer caching */
+    if ((ms == 0) && (client->subscribed == 1)) {
+        disconnect_daemon(client);
+    }
+    if (ms == 0) {
+        client->num_entries = 0;
+    }
+
+    pthread_mutex_unlock(&client->lock);
+}
+
+int nvPdClientGetPersistenceMode(NvPdClient *client,
+                                 const NvPdClientDevice *device, int *mode)
+{
+    NvPdClientCacheEntry *entry;
+    NvPdMsgReply reply;
+    uint32_t since_seq = 0;
+    int status;
+
+    pthread_mutex_lock(&client->lock);
+
+    /*
+     * While subscribed, the cache is up to date once the pending events are
+     * handled, and cached modes do not expire.
+     */
+    if (client->cache_timeout_ms > 0) {
+        receive_events(client);
+
+        entry = find_entry(client, device, 0);
+        if ((entry != NULL) && (entry->time_ms != 0) &&
+            ((client->subscribed == 1) ||
+             (get_time_ms() - entry->time_ms < client->cache_timeout_ms))) {
+            *mode = entry->mode;
+            pthread_mutex_unlock(&client->lock);
+            return NVPD_SUCCESS;
+        }
+    }
+
+    status = send_device_request(client, NVPD_MSG_GET_PERSISTENCE_MODE,
+                                 device, 0, &reply, &since_seq);
+    if (status == NVPD_SUCCESS) {
+        *mode = reply.value;
+    }
+
+    update_cache(client, device, status, reply.value, since_seq);
+
+    pthread_mutex_unlock(&client->lock);
+
+    return status;
+}
+
+int nvPdClientSetPersistenceMode(NvPdClient *client,
+                                 const NvPdClientDevice *device, int mode)
+{
+    NvPdMsgReply reply;
+    uint32_t since_seq = 0;
+    int status;
+
+    pthread_mutex_lock(&client->lock);
+
+    status = send_device_request(client, NVPD_MSG_SET_PERSISTENCE_MODE,
+                                 device, mode, &reply, &since_seq);
+    update_cache(client, device, status, mode, since_seq);
+
+    pthread_mutex_unlock(&client->lock);
+
+    return status;
+}
+
+int nvPdClientSetPersistenceModeOnly(NvPdClient *client,
+                                     const NvPdClientDevice *device,
+                                     int mode)
+{
+    NvPdMsgReply reply;
+    uint32_t since_seq = 0;
+    int status;
+
+    pthread_mutex_lock(&client->lock);
+
+    status = send_device_request(client, NVPD_MSG_SET_PERSISTENCE_MODE_ONLY,
+                                 device, mode, &reply, &since_seq);
+    update_cache(client, device, status, mode, since_seq);
+
+    pthread_mutex_unlock(&client->lock);
+
+    return status;
+}
+
+int nvPdClientSetNumaStatus(NvPdClient *client,
+                            const NvPdClientDevice *device, int numa_status)
+{
+    NvPdMsgReply reply;
+    uint32_t since_seq = 0;
+    int status;
+
+    pthread_mutex_lock(&client->lock);
+
+    status = send_device_request(client, NVPD_MSG_SET_NUMA_STATUS,
+                                 device, numa_status, &reply, &since_seq);
+
+    pthread_mutex_unlock(&client->lock);
+
+    return status;
+}
+
+int nvPdClientSetPersistenceModeMulti(NvPdClient *client,
+                                      const NvPdClientDevice *devices,
+                                      int count, int mode, int *statuses)
+{
+    NvPdMsgRequest *requests;
+    NvPdMsgReply *replies;
+    uint32_t since_seq = 0;
+    int status;
+    int i;
+
+    if (count <= 0) {
+        return NVPD_SUCCESS;
+    }
+
+    requests = calloc(count, sizeof(NvPdMsgRequest));
+    replies = calloc(count, sizeof(NvPdMsgReply));
+    if ((requests == NULL) || (replies == NULL)) {
+        free(requests);
+        free(replies);
+        return NVPD_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < count; i++) {
+        init_request(&requests[i], NVPD_MSG_SET_PERSISTENCE_MODE, &devices[i],
+                     mode);
+    }
+
+    pthread_mutex_lock(&client->lock);
+
+    status = send_requests(client, requests, replies, count, &since_seq);
+
+    for (i = 0; i < count; i++) {
+        statuses[i] = (status == NVPD_SUCCESS) ? replies[i].status : status;
+        update_cache(client, &devices[i], statuses[i], mode, since_seq);
+    }
+
+    pthread_mutex_unlock(&client->lock);
+
+    /* The overall status is that of the first device that failed */
+    for (i = 0; (status == NVPD_SUCCESS) && (i < count); i++) {
+        status = statuses[i];
+    }
+
+    free(requests);
+    free(replies);
+
+    return status;
+}
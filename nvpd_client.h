@@ -0,0 +1,92 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvpd_client.h
+ */
+
+#ifndef _NVPD_CLIENT_H_
+#define _NVPD_CLIENT_H_
+
+/*
+ * Client library of nvidia-persistenced, for tools that query or change the
+ * state of devices often, such as container hooks. It talks to the binary
+ * protocol of nvpd_msg.h, which the daemon serves with '--seqpacket-socket',
+ * over a single connection that is kept open between calls, and reopened
+ * once if the daemon was restarted meanwhile.
+ *
+ * Requests on several devices are pipelined, so that they are executed by
+ * the daemon concurrently. The persistence mode of each device can also be
+ * cached, so that repeated queries do not cost a round trip to the daemon;
+ * the cache is kept up to date with the change events of the daemon.
+ *
+ * All functions return 0 (NVPD_SUCCESS) or an NvPdStatus value of
+ * nvpd_rpc.h: NVPD_ERR_DAEMON_NOT_PRESENT if the daemon cannot be reached,
+ * and NVPD_ERR_IO if the connection failed during the request. A client may
+ * be used from several threads, but requests are serialized.
+ */
+
+typedef struct _NvPdClient NvPdClient;
+
+typedef struct {
+    unsigned int domain;
+    unsigned int bus;
+    unsigned int slot;
+    unsigned int function;
+} NvPdClientDevice;
+
+/* Returns NULL if out of memory; the daemon is connected to on first use */
+NvPdClient *nvPdClientOpen(void);
+void nvPdClientClose(NvPdClient *client);
+
+/*
+ * Answer persistence mode queries from the cache, once the mode of the
+ * device was received from the daemon, including as the result of a change
+ * made through this client. The client subscribes to the change events of
+ * the daemon, and updates the cache with the changes made by other clients
+ * before each query, so cached modes do not expire. With daemons that do
+ * not send events, cached modes expire ms milliseconds after they were
+ * received instead. The default of 0 disables the cache.
+ */
+void nvPdClientSetCacheTimeout(NvPdClient *client, unsigned int ms);
+
+int nvPdClientGetPersistenceMode(NvPdClient *client,
+                                 const NvPdClientDevice *device, int *mode);
+int nvPdClientSetPersistenceMode(NvPdClient *client,
+                                 const NvPdClientDevice *device, int mode);
+int nvPdClientSetPersistenceModeOnly(NvPdClient *client,
+                                     const NvPdClientDevice *device,
+                                     int mode);
+int nvPdClientSetNumaStatus(NvPdClient *client,
+                            const NvPdClientDevice *device, int numa_status);
+
+/*
+ * Change the persistence mode of count devices at once, and store the result
+ * of each change in statuses. Returns the first status that is not
+ * NVPD_SUCCESS, in the order of the devices.
+ */
+int nvPdClientSetPersistenceModeMulti(NvPdClient *client,
+                                      const NvPdClientDevice *devices,
+                                      int count, int mode, int *statuses);
+
+#endif /* _NVPD_CLIENT_H_ */
@@ -32,7 +32,10 @@
 
 #define NVPD_DAEMON_NAME            "nvidia-persistenced"
 
+/* May be given at build time, e.g., for the benchmark build */
+#ifndef NVPD_VAR_RUNTIME_DATA_PATH
 #define NVPD_VAR_RUNTIME_DATA_PATH  "/var/run/" NVPD_DAEMON_NAME
+#endif
 #define NVPD_SOCKET_NAME            "socket"
 #define NVPD_SOCKET_PATH            NVPD_VAR_RUNTIME_DATA_PATH "/" \
                                     NVPD_SOCKET_NAME
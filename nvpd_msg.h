@@ -0,0 +1,119 @@
+/*
+ * nvidia-persistenced: A daemon for maintaining persistent driver state,
+ * specifically for use by the NVIDIA Linux driver.
+ *
+ * Copyright (C) 2026 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * nvpd_msg.h
+ */
+
+#ifndef _NVPD_MSG_H_
+#define _NVPD_MSG_H_
+
+#include <stdint.h>
+
+/*
+ * Binary protocol of nvidia-persistenced, served with '--seqpacket-socket'
+ * as a lightweight alternative to the RPC interface, for clients that query
+ * or change the state of single devices at a high rate. It does not depend
+ * on the RPC library, so this header is self-contained.
+ *
+ * Clients connect a SOCK_SEQPACKET socket to NVPD_MSG_SOCKET_PATH, and send
+ * each request as one NvPdMsgRequest message. Each request is answered by
+ * one NvPdMsgReply message with the same type and seq. Requests may be
+ * pipelined, and requests on different devices may complete out of order,
+ * so replies are to be matched by seq. All fields are in host byte order.
+ *
+ * As with the RPC interface, requests that change device state are only
+ * accepted from clients running as root, and fail with NVPD_ERR_PERMISSIONS
+ * otherwise. The status of replies is an NvPdStatus value of nvpd_rpc.h.
+ * Requests of another protocol version are answered with
+ * NVPD_ERR_INVALID_ARGUMENT, and a reply of the version of the daemon.
+ *
+ * After an NVPD_MSG_SUBSCRIBE request, which any client may send, the daemon
+ * also sends an NvPdMsgEvent message on the connection whenever the state
+ * of a device changes, or a change fails. Events are numbered in the order
+ * they happened, across all devices, and the reply to the subscription
+ * carries the number of the last event before it. Events are dropped for a
+ * subscriber that does not keep up with them, so a gap in the numbers means
+ * that events were missed, and the state of devices is to be queried again.
+ * Messages are told apart by their type.
+ */
+
+/* Same runtime data directory as NVPD_SOCKET_PATH of nvpd_defs.h */
+#ifndef NVPD_VAR_RUNTIME_DATA_PATH
+#define NVPD_VAR_RUNTIME_DATA_PATH  "/var/run/nvidia-persistenced"
+#endif
+#define NVPD_MSG_SOCKET_NAME        "seqpacket"
+#define NVPD_MSG_SOCKET_PATH        NVPD_VAR_RUNTIME_DATA_PATH "/" \
+                                    NVPD_MSG_SOCKET_NAME
+
+#define NVPD_MSG_VERSION            1
+
+/* Number of requests of a client that may be outstanding at once */
+#define NVPD_MSG_MAX_PENDING        64
+
+typedef enum {
+    NVPD_MSG_SET_PERSISTENCE_MODE       = 1,
+    NVPD_MSG_GET_PERSISTENCE_MODE       = 2,
+    NVPD_MSG_SET_PERSISTENCE_MODE_ONLY  = 3,
+    NVPD_MSG_SET_NUMA_STATUS            = 4,
+    NVPD_MSG_SUBSCRIBE                  = 5,
+    NVPD_MSG_EVENT                      = 6,
+} NvPdMsgType;
+
+typedef struct {
+    uint16_t version;   /* NVPD_MSG_VERSION */
+    uint16_t type;      /* NvPdMsgType */
+    uint32_t seq;       /* chosen by the client, returned in the reply */
+    uint32_t domain;
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint8_t reserved;   /* must be 0 */
+    int32_t value;      /* NvPersistenceMode or NvNumaStatus to set */
+} NvPdMsgRequest;
+
+typedef struct {
+    uint16_t version;
+    uint16_t type;
+    uint32_t seq;
+    int32_t status;     /* NvPdStatus */
+    int32_t value;      /* NvPersistenceMode, for NVPD_MSG_GET_* requests;
+                           last event number, for NVPD_MSG_SUBSCRIBE */
+} NvPdMsgReply;
+
+typedef struct {
+    uint16_t version;
+    uint16_t type;      /* NVPD_MSG_EVENT */
+    uint32_t seq;       /* event number */
+    uint32_t domain;
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint8_t reserved;
+    int32_t status;     /* NVPD_SUCCESS, or the NvPdStatus of a failed change */
+    int32_t mode;       /* state of the device after the event */
+    int32_t uvm_mode;
+    int32_t numa_status;
+} NvPdMsgEvent;
+
+#endif /* _NVPD_MSG_H_ */
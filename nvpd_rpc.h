@@ -27,6 +27,7 @@ enum NvPdStatus {
 	NVPD_ERR_USER_NOT_FOUND = 9,
 	NVPD_ERR_NUMA_FAILURE = 10,
 	NVPD_ERR_UNKNOWN = 11,
+	NVPD_ERR_CANCELED = 12,
 };
 typedef enum NvPdStatus NvPdStatus;
 
@@ -80,6 +81,174 @@ struct SetNumaStatusArgs {
 	NvNumaStatus status;
 };
 typedef struct SetNumaStatusArgs SetNumaStatusArgs;
+#define NVPD_MAX_BATCH_DEVICES 256
+
+struct SetPersistenceModeBatchArgs {
+	bool_t all_devices;
+	struct {
+		u_int devices_len;
+		NvPciDevice *devices_val;
+	} devices;
+	NvPersistenceMode mode;
+};
+typedef struct SetPersistenceModeBatchArgs SetPersistenceModeBatchArgs;
+
+struct SetNumaStatusBatchArgs {
+	bool_t all_devices;
+	struct {
+		u_int devices_len;
+		NvPciDevice *devices_val;
+	} devices;
+	NvNumaStatus status;
+};
+typedef struct SetNumaStatusBatchArgs SetNumaStatusBatchArgs;
+
+struct NvPdDeviceStatus {
+	NvPciDevice device;
+	NvPdStatus status;
+};
+typedef struct NvPdDeviceStatus NvPdDeviceStatus;
+
+struct BatchRes {
+	NvPdStatus status;
+	struct {
+		u_int results_len;
+		NvPdDeviceStatus *results_val;
+	} results;
+};
+typedef struct BatchRes BatchRes;
+
+struct NvPdDeviceState {
+	NvPciDevice device;
+	NvPersistenceMode mode;
+	NvUVMPersistenceMode uvm_mode;
+	NvNumaStatus numa_status;
+	bool_t use_auto_online;
+	u_quad_t last_transition_time;
+};
+typedef struct NvPdDeviceState NvPdDeviceState;
+
+struct GetDeviceStatesRes {
+	NvPdStatus status;
+	struct {
+		u_int devices_len;
+		NvPdDeviceState *devices_val;
+	} devices;
+};
+typedef struct GetDeviceStatesRes GetDeviceStatesRes;
+
+enum NvPdJobState {
+	NVPD_JOB_QUEUED = 0,
+	NVPD_JOB_RUNNING = 1,
+	NVPD_JOB_DONE = 2,
+};
+typedef enum NvPdJobState NvPdJobState;
+
+struct SubmitNumaJobArgs {
+	NvPciDevice device;
+	NvNumaStatus status;
+};
+typedef struct SubmitNumaJobArgs SubmitNumaJobArgs;
+
+struct SubmitNumaJobRes {
+	NvPdStatus status;
+	union {
+		u_int job_id;
+	} SubmitNumaJobRes_u;
+};
+typedef struct SubmitNumaJobRes SubmitNumaJobRes;
+
+struct NumaJobArgs {
+	u_int job_id;
+};
+typedef struct NumaJobArgs NumaJobArgs;
+
+struct NvPdNumaJobProgress {
+	u_int job_id;
+	NvPciDevice device;
+	NvNumaStatus target_status;
+	NvPdJobState state;
+	NvPdStatus result;
+	u_int memblocks_done;
+	u_int memblocks_total;
+	u_quad_t bytes_done;
+	u_quad_t elapsed_ms;
+};
+typedef struct NvPdNumaJobProgress NvPdNumaJobProgress;
+
+struct GetNumaJobRes {
+	NvPdStatus status;
+	union {
+		NvPdNumaJobProgress progress;
+	} GetNumaJobRes_u;
+};
+typedef struct GetNumaJobRes GetNumaJobRes;
+
+enum NvPdDevicePhase {
+	NVPD_PHASE_OPEN_DEVICE = 0,
+	NVPD_PHASE_UVM_PERSISTENCE = 1,
+	NVPD_PHASE_PROBE_MEMORY = 2,
+	NVPD_PHASE_CHECK_AUTO_ONLINE = 3,
+	NVPD_PHASE_CHANGE_NODE_STATE = 4,
+	NVPD_PHASE_RETIRE_PAGES = 5,
+};
+typedef enum NvPdDevicePhase NvPdDevicePhase;
+#define NVPD_NUM_DEVICE_PHASES 6
+
+enum NvPdRpcPhase {
+	NVPD_PHASE_RPC_SET_PERSISTENCE_MODE = 0,
+	NVPD_PHASE_RPC_GET_PERSISTENCE_MODE = 1,
+	NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_ONLY = 2,
+	NVPD_PHASE_RPC_SET_NUMA_STATUS = 3,
+	NVPD_PHASE_RPC_SET_PERSISTENCE_MODE_BATCH = 4,
+	NVPD_PHASE_RPC_SET_NUMA_STATUS_BATCH = 5,
+	NVPD_PHASE_RPC_GET_DEVICE_STATES = 6,
+	NVPD_PHASE_RPC_SUBMIT_NUMA_JOB = 7,
+	NVPD_PHASE_RPC_GET_NUMA_JOB = 8,
+	NVPD_PHASE_RPC_CANCEL_NUMA_JOB = 9,
+	NVPD_PHASE_RPC_GET_STATS = 10,
+	NVPD_PHASE_RPC_GET_DRIVER_FEATURES = 11,
+};
+typedef enum NvPdRpcPhase NvPdRpcPhase;
+#define NVPD_NUM_RPC_PHASES 12
+#define NVPD_STATS_NUM_BUCKETS 32
+
+struct NvPdHistogram {
+	u_quad_t count;
+	u_quad_t total_us;
+	u_quad_t max_us;
+	u_quad_t buckets[NVPD_STATS_NUM_BUCKETS];
+};
+typedef struct NvPdHistogram NvPdHistogram;
+
+struct NvPdDeviceStats {
+	NvPciDevice device;
+	NvPdHistogram phases[NVPD_NUM_DEVICE_PHASES];
+};
+typedef struct NvPdDeviceStats NvPdDeviceStats;
+
+struct GetStatsRes {
+	NvPdStatus status;
+	NvPdHistogram rpc[NVPD_NUM_RPC_PHASES];
+	struct {
+		u_int devices_len;
+		NvPdDeviceStats *devices_val;
+	} devices;
+};
+typedef struct GetStatsRes GetStatsRes;
+
+enum NvPdDriverFeature {
+	NVPD_DRIVER_FEATURE_UVM_PERSISTENCE = 0,
+	NVPD_DRIVER_FEATURE_DEVICE_UUID = 1,
+};
+typedef enum NvPdDriverFeature NvPdDriverFeature;
+#define NVPD_NUM_DRIVER_FEATURES 2
+
+struct GetDriverFeaturesRes {
+	NvPdStatus status;
+	bool_t supported[NVPD_NUM_DRIVER_FEATURES];
+};
+typedef struct GetDriverFeaturesRes GetDriverFeaturesRes;
 
 #define NVPD_PROG 35006
 #define VersionOne 1
@@ -122,6 +291,70 @@ extern  NvPdStatus * nvpdsetnumastatus_2();
 extern  NvPdStatus * nvpdsetnumastatus_2_svc();
 extern int nvpd_prog_2_freeresult ();
 #endif /* K&R C */
+#define VersionThree 3
+
+#if defined(__STDC__) || defined(__cplusplus)
+#define nvPdSetPersistenceModeBatch 1
+extern  BatchRes * nvpdsetpersistencemodebatch_3(SetPersistenceModeBatchArgs *, CLIENT *);
+extern  BatchRes * nvpdsetpersistencemodebatch_3_svc(SetPersistenceModeBatchArgs *, struct svc_req *);
+#define nvPdSetNumaStatusBatch 2
+extern  BatchRes * nvpdsetnumastatusbatch_3(SetNumaStatusBatchArgs *, CLIENT *);
+extern  BatchRes * nvpdsetnumastatusbatch_3_svc(SetNumaStatusBatchArgs *, struct svc_req *);
+#define nvPdGetDeviceStates 3
+extern  GetDeviceStatesRes * nvpdgetdevicestates_3(void *, CLIENT *);
+extern  GetDeviceStatesRes * nvpdgetdevicestates_3_svc(void *, struct svc_req *);
+extern int nvpd_prog_3_freeresult (SVCXPRT *, xdrproc_t, caddr_t);
+
+#else /* K&R C */
+#define nvPdSetPersistenceModeBatch 1
+extern  BatchRes * nvpdsetpersistencemodebatch_3();
+extern  BatchRes * nvpdsetpersistencemodebatch_3_svc();
+#define nvPdSetNumaStatusBatch 2
+extern  BatchRes * nvpdsetnumastatusbatch_3();
+extern  BatchRes * nvpdsetnumastatusbatch_3_svc();
+#define nvPdGetDeviceStates 3
+extern  GetDeviceStatesRes * nvpdgetdevicestates_3();
+extern  GetDeviceStatesRes * nvpdgetdevicestates_3_svc();
+extern int nvpd_prog_3_freeresult ();
+#endif /* K&R C */
+#define VersionFour 4
+
+#if defined(__STDC__) || defined(__cplusplus)
+#define nvPdSubmitNumaJob 1
+extern  SubmitNumaJobRes * nvpdsubmitnumajob_4(SubmitNumaJobArgs *, CLIENT *);
+extern  SubmitNumaJobRes * nvpdsubmitnumajob_4_svc(SubmitNumaJobArgs *, struct svc_req *);
+#define nvPdGetNumaJob 2
+extern  GetNumaJobRes * nvpdgetnumajob_4(NumaJobArgs *, CLIENT *);
+extern  GetNumaJobRes * nvpdgetnumajob_4_svc(NumaJobArgs *, struct svc_req *);
+#define nvPdCancelNumaJob 3
+extern  NvPdStatus * nvpdcancelnumajob_4(NumaJobArgs *, CLIENT *);
+extern  NvPdStatus * nvpdcancelnumajob_4_svc(NumaJobArgs *, struct svc_req *);
+#define nvPdGetStats 4
+extern  GetStatsRes * nvpdgetstats_4(void *, CLIENT *);
+extern  GetStatsRes * nvpdgetstats_4_svc(void *, struct svc_req *);
+#define nvPdGetDriverFeatures 5
+extern  GetDriverFeaturesRes * nvpdgetdriverfeatures_4(void *, CLIENT *);
+extern  GetDriverFeaturesRes * nvpdgetdriverfeatures_4_svc(void *, struct svc_req *);
+extern int nvpd_prog_4_freeresult (SVCXPRT *, xdrproc_t, caddr_t);
+
+#else /* K&R C */
+#define nvPdSubmitNumaJob 1
+extern  SubmitNumaJobRes * nvpdsubmitnumajob_4();
+extern  SubmitNumaJobRes * nvpdsubmitnumajob_4_svc();
+#define nvPdGetNumaJob 2
+extern  GetNumaJobRes * nvpdgetnumajob_4();
+extern  GetNumaJobRes * nvpdgetnumajob_4_svc();
+#define nvPdCancelNumaJob 3
+extern  NvPdStatus * nvpdcancelnumajob_4();
+extern  NvPdStatus * nvpdcancelnumajob_4_svc();
+#define nvPdGetStats 4
+extern  GetStatsRes * nvpdgetstats_4();
+extern  GetStatsRes * nvpdgetstats_4_svc();
+#define nvPdGetDriverFeatures 5
+extern  GetDriverFeaturesRes * nvpdgetdriverfeatures_4();
+extern  GetDriverFeaturesRes * nvpdgetdriverfeatures_4_svc();
+extern int nvpd_prog_4_freeresult ();
+#endif /* K&R C */
 
 /* the xdr functions */
 
@@ -135,6 +368,25 @@ extern  bool_t xdr_GetPersistenceModeArgs (XDR *, GetPersistenceModeArgs*);
 extern  bool_t xdr_GetPersistenceModeRes (XDR *, GetPersistenceModeRes*);
 extern  bool_t xdr_NvNumaStatus (XDR *, NvNumaStatus*);
 extern  bool_t xdr_SetNumaStatusArgs (XDR *, SetNumaStatusArgs*);
+extern  bool_t xdr_SetPersistenceModeBatchArgs (XDR *, SetPersistenceModeBatchArgs*);
+extern  bool_t xdr_SetNumaStatusBatchArgs (XDR *, SetNumaStatusBatchArgs*);
+extern  bool_t xdr_NvPdDeviceStatus (XDR *, NvPdDeviceStatus*);
+extern  bool_t xdr_BatchRes (XDR *, BatchRes*);
+extern  bool_t xdr_NvPdDeviceState (XDR *, NvPdDeviceState*);
+extern  bool_t xdr_GetDeviceStatesRes (XDR *, GetDeviceStatesRes*);
+extern  bool_t xdr_NvPdJobState (XDR *, NvPdJobState*);
+extern  bool_t xdr_SubmitNumaJobArgs (XDR *, SubmitNumaJobArgs*);
+extern  bool_t xdr_SubmitNumaJobRes (XDR *, SubmitNumaJobRes*);
+extern  bool_t xdr_NumaJobArgs (XDR *, NumaJobArgs*);
+extern  bool_t xdr_NvPdNumaJobProgress (XDR *, NvPdNumaJobProgress*);
+extern  bool_t xdr_GetNumaJobRes (XDR *, GetNumaJobRes*);
+extern  bool_t xdr_NvPdDevicePhase (XDR *, NvPdDevicePhase*);
+extern  bool_t xdr_NvPdRpcPhase (XDR *, NvPdRpcPhase*);
+extern  bool_t xdr_NvPdHistogram (XDR *, NvPdHistogram*);
+extern  bool_t xdr_NvPdDeviceStats (XDR *, NvPdDeviceStats*);
+extern  bool_t xdr_GetStatsRes (XDR *, GetStatsRes*);
+extern  bool_t xdr_NvPdDriverFeature (XDR *, NvPdDriverFeature*);
+extern  bool_t xdr_GetDriverFeaturesRes (XDR *, GetDriverFeaturesRes*);
 
 #else /* K&R C */
 extern bool_t xdr_NvPdStatus ();
@@ -146,6 +398,25 @@ extern bool_t xdr_GetPersistenceModeArgs ();
 extern bool_t xdr_GetPersistenceModeRes ();
 extern bool_t xdr_NvNumaStatus ();
 extern bool_t xdr_SetNumaStatusArgs ();
+extern bool_t xdr_SetPersistenceModeBatchArgs ();
+extern bool_t xdr_SetNumaStatusBatchArgs ();
+extern bool_t xdr_NvPdDeviceStatus ();
+extern bool_t xdr_BatchRes ();
+extern bool_t xdr_NvPdDeviceState ();
+extern bool_t xdr_GetDeviceStatesRes ();
+extern bool_t xdr_NvPdJobState ();
+extern bool_t xdr_SubmitNumaJobArgs ();
+extern bool_t xdr_SubmitNumaJobRes ();
+extern bool_t xdr_NumaJobArgs ();
+extern bool_t xdr_NvPdNumaJobProgress ();
+extern bool_t xdr_GetNumaJobRes ();
+extern bool_t xdr_NvPdDevicePhase ();
+extern bool_t xdr_NvPdRpcPhase ();
+extern bool_t xdr_NvPdHistogram ();
+extern bool_t xdr_NvPdDeviceStats ();
+extern bool_t xdr_GetStatsRes ();
+extern bool_t xdr_NvPdDriverFeature ();
+extern bool_t xdr_GetDriverFeaturesRes ();
 
 #endif /* K&R C */
 
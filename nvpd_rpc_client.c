@@ -0,0 +1,190 @@
+/*
+ * Please do not edit this file.
+ * It was generated using rpcgen.
+ */
+
+#include <memory.h> /* for memset */
+#include "nvpd_rpc.h"
+
+/* Default timeout can be changed using clnt_control() */
+static struct timeval TIMEOUT = { 25, 0 };
+
+NvPdStatus *
+nvpdsetpersistencemode_1(SetPersistenceModeArgs *argp, CLIENT *clnt)
+{
+	static NvPdStatus clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdSetPersistenceMode,
+		(xdrproc_t) xdr_SetPersistenceModeArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_NvPdStatus, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+GetPersistenceModeRes *
+nvpdgetpersistencemode_1(GetPersistenceModeArgs *argp, CLIENT *clnt)
+{
+	static GetPersistenceModeRes clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdGetPersistenceMode,
+		(xdrproc_t) xdr_GetPersistenceModeArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_GetPersistenceModeRes, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+NvPdStatus *
+nvpdsetpersistencemodeonly_2(SetPersistenceModeArgs *argp, CLIENT *clnt)
+{
+	static NvPdStatus clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdSetPersistenceModeOnly,
+		(xdrproc_t) xdr_SetPersistenceModeArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_NvPdStatus, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+NvPdStatus *
+nvpdsetnumastatus_2(SetNumaStatusArgs *argp, CLIENT *clnt)
+{
+	static NvPdStatus clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdSetNumaStatus,
+		(xdrproc_t) xdr_SetNumaStatusArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_NvPdStatus, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+BatchRes *
+nvpdsetpersistencemodebatch_3(SetPersistenceModeBatchArgs *argp, CLIENT *clnt)
+{
+	static BatchRes clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdSetPersistenceModeBatch,
+		(xdrproc_t) xdr_SetPersistenceModeBatchArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_BatchRes, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+BatchRes *
+nvpdsetnumastatusbatch_3(SetNumaStatusBatchArgs *argp, CLIENT *clnt)
+{
+	static BatchRes clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdSetNumaStatusBatch,
+		(xdrproc_t) xdr_SetNumaStatusBatchArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_BatchRes, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+GetDeviceStatesRes *
+nvpdgetdevicestates_3(void *argp, CLIENT *clnt)
+{
+	static GetDeviceStatesRes clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdGetDeviceStates,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_GetDeviceStatesRes, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+SubmitNumaJobRes *
+nvpdsubmitnumajob_4(SubmitNumaJobArgs *argp, CLIENT *clnt)
+{
+	static SubmitNumaJobRes clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdSubmitNumaJob,
+		(xdrproc_t) xdr_SubmitNumaJobArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_SubmitNumaJobRes, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+GetNumaJobRes *
+nvpdgetnumajob_4(NumaJobArgs *argp, CLIENT *clnt)
+{
+	static GetNumaJobRes clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdGetNumaJob,
+		(xdrproc_t) xdr_NumaJobArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_GetNumaJobRes, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+NvPdStatus *
+nvpdcancelnumajob_4(NumaJobArgs *argp, CLIENT *clnt)
+{
+	static NvPdStatus clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdCancelNumaJob,
+		(xdrproc_t) xdr_NumaJobArgs, (caddr_t) argp,
+		(xdrproc_t) xdr_NvPdStatus, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+GetStatsRes *
+nvpdgetstats_4(void *argp, CLIENT *clnt)
+{
+	static GetStatsRes clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdGetStats,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_GetStatsRes, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
+
+GetDriverFeaturesRes *
+nvpdgetdriverfeatures_4(void *argp, CLIENT *clnt)
+{
+	static GetDriverFeaturesRes clnt_res;
+
+	memset((char *)&clnt_res, 0, sizeof(clnt_res));
+	if (clnt_call (clnt, nvPdGetDriverFeatures,
+		(xdrproc_t) xdr_void, (caddr_t) argp,
+		(xdrproc_t) xdr_GetDriverFeaturesRes, (caddr_t) &clnt_res,
+		TIMEOUT) != RPC_SUCCESS) {
+		return (NULL);
+	}
+	return (&clnt_res);
+}
@@ -114,3 +114,124 @@ nvpd_prog_2(struct svc_req *rqstp, register SVCXPRT *transp)
 	}
 	return;
 }
+
+void
+nvpd_prog_3(struct svc_req *rqstp, register SVCXPRT *transp)
+{
+	union {
+		SetPersistenceModeBatchArgs nvpdsetpersistencemodebatch_3_arg;
+		SetNumaStatusBatchArgs nvpdsetnumastatusbatch_3_arg;
+	} argument;
+	char *result;
+	xdrproc_t _xdr_argument, _xdr_result;
+	char *(*local)(char *, struct svc_req *);
+
+	switch (rqstp->rq_proc) {
+	case NULLPROC:
+		(void) svc_sendreply (transp, (xdrproc_t) xdr_void, (char *)NULL);
+		return;
+
+	case nvPdSetPersistenceModeBatch:
+		_xdr_argument = (xdrproc_t) xdr_SetPersistenceModeBatchArgs;
+		_xdr_result = (xdrproc_t) xdr_BatchRes;
+		local = (char *(*)(char *, struct svc_req *)) nvpdsetpersistencemodebatch_3_svc;
+		break;
+
+	case nvPdSetNumaStatusBatch:
+		_xdr_argument = (xdrproc_t) xdr_SetNumaStatusBatchArgs;
+		_xdr_result = (xdrproc_t) xdr_BatchRes;
+		local = (char *(*)(char *, struct svc_req *)) nvpdsetnumastatusbatch_3_svc;
+		break;
+
+	case nvPdGetDeviceStates:
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_GetDeviceStatesRes;
+		local = (char *(*)(char *, struct svc_req *)) nvpdgetdevicestates_3_svc;
+		break;
+
+	default:
+		svcerr_noproc (transp);
+		return;
+	}
+	memset ((char *)&argument, 0, sizeof (argument));
+	if (!svc_getargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		svcerr_decode (transp);
+		return;
+	}
+	result = (*local)((char *)&argument, rqstp);
+	if (result != NULL && !svc_sendreply(transp, (xdrproc_t) _xdr_result, result)) {
+		svcerr_systemerr (transp);
+	}
+	if (!svc_freeargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		syslog (LOG_ERR, "%s", "unable to free arguments");
+		exit (1);
+	}
+	return;
+}
+
+void
+nvpd_prog_4(struct svc_req *rqstp, register SVCXPRT *transp)
+{
+	union {
+		SubmitNumaJobArgs nvpdsubmitnumajob_4_arg;
+		NumaJobArgs nvpdgetnumajob_4_arg;
+		NumaJobArgs nvpdcancelnumajob_4_arg;
+	} argument;
+	char *result;
+	xdrproc_t _xdr_argument, _xdr_result;
+	char *(*local)(char *, struct svc_req *);
+
+	switch (rqstp->rq_proc) {
+	case NULLPROC:
+		(void) svc_sendreply (transp, (xdrproc_t) xdr_void, (char *)NULL);
+		return;
+
+	case nvPdSubmitNumaJob:
+		_xdr_argument = (xdrproc_t) xdr_SubmitNumaJobArgs;
+		_xdr_result = (xdrproc_t) xdr_SubmitNumaJobRes;
+		local = (char *(*)(char *, struct svc_req *)) nvpdsubmitnumajob_4_svc;
+		break;
+
+	case nvPdGetNumaJob:
+		_xdr_argument = (xdrproc_t) xdr_NumaJobArgs;
+		_xdr_result = (xdrproc_t) xdr_GetNumaJobRes;
+		local = (char *(*)(char *, struct svc_req *)) nvpdgetnumajob_4_svc;
+		break;
+
+	case nvPdCancelNumaJob:
+		_xdr_argument = (xdrproc_t) xdr_NumaJobArgs;
+		_xdr_result = (xdrproc_t) xdr_NvPdStatus;
+		local = (char *(*)(char *, struct svc_req *)) nvpdcancelnumajob_4_svc;
+		break;
+
+	case nvPdGetStats:
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_GetStatsRes;
+		local = (char *(*)(char *, struct svc_req *)) nvpdgetstats_4_svc;
+		break;
+
+	case nvPdGetDriverFeatures:
+		_xdr_argument = (xdrproc_t) xdr_void;
+		_xdr_result = (xdrproc_t) xdr_GetDriverFeaturesRes;
+		local = (char *(*)(char *, struct svc_req *)) nvpdgetdriverfeatures_4_svc;
+		break;
+
+	default:
+		svcerr_noproc (transp);
+		return;
+	}
+	memset ((char *)&argument, 0, sizeof (argument));
+	if (!svc_getargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		svcerr_decode (transp);
+		return;
+	}
+	result = (*local)((char *)&argument, rqstp);
+	if (result != NULL && !svc_sendreply(transp, (xdrproc_t) _xdr_result, result)) {
+		svcerr_systemerr (transp);
+	}
+	if (!svc_freeargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		syslog (LOG_ERR, "%s", "unable to free arguments");
+		exit (1);
+	}
+	return;
+}
@@ -94,3 +94,236 @@ xdr_SetNumaStatusArgs (XDR *xdrs, SetNumaStatusArgs *objp)
 		 return FALSE;
 	return TRUE;
 }
+
+bool_t
+xdr_SetPersistenceModeBatchArgs (XDR *xdrs, SetPersistenceModeBatchArgs *objp)
+{
+	 if (!xdr_bool (xdrs, &objp->all_devices))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->devices.devices_val, (u_int *) &objp->devices.devices_len, NVPD_MAX_BATCH_DEVICES,
+		sizeof (NvPciDevice), (xdrproc_t) xdr_NvPciDevice))
+		 return FALSE;
+	 if (!xdr_NvPersistenceMode (xdrs, &objp->mode))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_SetNumaStatusBatchArgs (XDR *xdrs, SetNumaStatusBatchArgs *objp)
+{
+	 if (!xdr_bool (xdrs, &objp->all_devices))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->devices.devices_val, (u_int *) &objp->devices.devices_len, NVPD_MAX_BATCH_DEVICES,
+		sizeof (NvPciDevice), (xdrproc_t) xdr_NvPciDevice))
+		 return FALSE;
+	 if (!xdr_NvNumaStatus (xdrs, &objp->status))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdDeviceStatus (XDR *xdrs, NvPdDeviceStatus *objp)
+{
+	 if (!xdr_NvPciDevice (xdrs, &objp->device))
+		 return FALSE;
+	 if (!xdr_NvPdStatus (xdrs, &objp->status))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_BatchRes (XDR *xdrs, BatchRes *objp)
+{
+	 if (!xdr_NvPdStatus (xdrs, &objp->status))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->results.results_val, (u_int *) &objp->results.results_len, NVPD_MAX_BATCH_DEVICES,
+		sizeof (NvPdDeviceStatus), (xdrproc_t) xdr_NvPdDeviceStatus))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdDeviceState (XDR *xdrs, NvPdDeviceState *objp)
+{
+	 if (!xdr_NvPciDevice (xdrs, &objp->device))
+		 return FALSE;
+	 if (!xdr_NvPersistenceMode (xdrs, &objp->mode))
+		 return FALSE;
+	 if (!xdr_NvUVMPersistenceMode (xdrs, &objp->uvm_mode))
+		 return FALSE;
+	 if (!xdr_NvNumaStatus (xdrs, &objp->numa_status))
+		 return FALSE;
+	 if (!xdr_bool (xdrs, &objp->use_auto_online))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->last_transition_time))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_GetDeviceStatesRes (XDR *xdrs, GetDeviceStatesRes *objp)
+{
+	 if (!xdr_NvPdStatus (xdrs, &objp->status))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->devices.devices_val, (u_int *) &objp->devices.devices_len, NVPD_MAX_BATCH_DEVICES,
+		sizeof (NvPdDeviceState), (xdrproc_t) xdr_NvPdDeviceState))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdJobState (XDR *xdrs, NvPdJobState *objp)
+{
+	 if (!xdr_enum (xdrs, (enum_t *) objp))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_SubmitNumaJobArgs (XDR *xdrs, SubmitNumaJobArgs *objp)
+{
+	 if (!xdr_NvPciDevice (xdrs, &objp->device))
+		 return FALSE;
+	 if (!xdr_NvNumaStatus (xdrs, &objp->status))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_SubmitNumaJobRes (XDR *xdrs, SubmitNumaJobRes *objp)
+{
+	 if (!xdr_NvPdStatus (xdrs, &objp->status))
+		 return FALSE;
+	switch (objp->status) {
+	case NVPD_SUCCESS:
+		 if (!xdr_u_int (xdrs, &objp->SubmitNumaJobRes_u.job_id))
+			 return FALSE;
+		break;
+	default:
+		break;
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_NumaJobArgs (XDR *xdrs, NumaJobArgs *objp)
+{
+	 if (!xdr_u_int (xdrs, &objp->job_id))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdNumaJobProgress (XDR *xdrs, NvPdNumaJobProgress *objp)
+{
+	 if (!xdr_u_int (xdrs, &objp->job_id))
+		 return FALSE;
+	 if (!xdr_NvPciDevice (xdrs, &objp->device))
+		 return FALSE;
+	 if (!xdr_NvNumaStatus (xdrs, &objp->target_status))
+		 return FALSE;
+	 if (!xdr_NvPdJobState (xdrs, &objp->state))
+		 return FALSE;
+	 if (!xdr_NvPdStatus (xdrs, &objp->result))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->memblocks_done))
+		 return FALSE;
+	 if (!xdr_u_int (xdrs, &objp->memblocks_total))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->bytes_done))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->elapsed_ms))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_GetNumaJobRes (XDR *xdrs, GetNumaJobRes *objp)
+{
+	 if (!xdr_NvPdStatus (xdrs, &objp->status))
+		 return FALSE;
+	switch (objp->status) {
+	case NVPD_SUCCESS:
+		 if (!xdr_NvPdNumaJobProgress (xdrs, &objp->GetNumaJobRes_u.progress))
+			 return FALSE;
+		break;
+	default:
+		break;
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdDevicePhase (XDR *xdrs, NvPdDevicePhase *objp)
+{
+	 if (!xdr_enum (xdrs, (enum_t *) objp))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdRpcPhase (XDR *xdrs, NvPdRpcPhase *objp)
+{
+	 if (!xdr_enum (xdrs, (enum_t *) objp))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdHistogram (XDR *xdrs, NvPdHistogram *objp)
+{
+	 if (!xdr_u_quad_t (xdrs, &objp->count))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->total_us))
+		 return FALSE;
+	 if (!xdr_u_quad_t (xdrs, &objp->max_us))
+		 return FALSE;
+	 if (!xdr_vector (xdrs, (char *)objp->buckets, NVPD_STATS_NUM_BUCKETS,
+		sizeof (u_quad_t), (xdrproc_t) xdr_u_quad_t))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdDeviceStats (XDR *xdrs, NvPdDeviceStats *objp)
+{
+	 if (!xdr_NvPciDevice (xdrs, &objp->device))
+		 return FALSE;
+	 if (!xdr_vector (xdrs, (char *)objp->phases, NVPD_NUM_DEVICE_PHASES,
+		sizeof (NvPdHistogram), (xdrproc_t) xdr_NvPdHistogram))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_GetStatsRes (XDR *xdrs, GetStatsRes *objp)
+{
+	 if (!xdr_NvPdStatus (xdrs, &objp->status))
+		 return FALSE;
+	 if (!xdr_vector (xdrs, (char *)objp->rpc, NVPD_NUM_RPC_PHASES,
+		sizeof (NvPdHistogram), (xdrproc_t) xdr_NvPdHistogram))
+		 return FALSE;
+	 if (!xdr_array (xdrs, (char **)&objp->devices.devices_val, (u_int *) &objp->devices.devices_len, NVPD_MAX_BATCH_DEVICES,
+		sizeof (NvPdDeviceStats), (xdrproc_t) xdr_NvPdDeviceStats))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_NvPdDriverFeature (XDR *xdrs, NvPdDriverFeature *objp)
+{
+	 if (!xdr_enum (xdrs, (enum_t *) objp))
+		 return FALSE;
+	return TRUE;
+}
+
+bool_t
+xdr_GetDriverFeaturesRes (XDR *xdrs, GetDriverFeaturesRes *objp)
+{
+	 if (!xdr_NvPdStatus (xdrs, &objp->status))
+		 return FALSE;
+	 if (!xdr_vector (xdrs, (char *)objp->supported, NVPD_NUM_DRIVER_FEATURES,
+		sizeof (bool_t), (xdrproc_t) xdr_bool))
+		 return FALSE;
+	return TRUE;
+}
@@ -31,6 +31,19 @@ enum {
     PERSISTENCE_MODE_OPTION = 1024,
     NVIDIA_CFG_PATH_OPTION,
     UVM_PERSISTENCE_MODE_OPTION,
+    SETUP_THREADS_OPTION,
+    UVM_FABRIC_TIMEOUT_OPTION,
+    UVM_FABRIC_RETRY_INTERVAL_OPTION,
+    NUMA_ONLINE_THREADS_OPTION,
+    NUMA_HUGEPAGES_2M_OPTION,
+    NUMA_HUGEPAGES_1G_OPTION,
+    WARM_RESTART_OPTION,
+    HANDOFF_FD_OPTION,
+    METRICS_FILE_OPTION,
+    METRICS_INTERVAL_OPTION,
+    SHUTDOWN_TIMEOUT_OPTION,
+    SEQPACKET_SOCKET_OPTION,
+    POLICY_FILE_OPTION,
 };
 
 static const NVGetoptOption __options[] = {
@@ -104,6 +117,162 @@ static const NVGetoptOption __options[] = {
       "NVIDIA Accelerated Linux Graphics Driver README chapter on"
       "PCI-Express Runtime D3 (RTD3) Power Management" },
 
+    { "uvm-fabric-timeout",
+      UVM_FABRIC_TIMEOUT_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "SECONDS",
+      "When UVM persistence mode is enabled and the NVLink fabric of a "
+      "device is not ready yet, nvidia-persistenced keeps the device in "
+      "persistence mode and keeps retrying to enable UVM persistence mode "
+      "in the background, without delaying startup. This option sets how "
+      "long, in &SECONDS&, to keep retrying before giving up. "
+      "The default is 30 seconds." },
+
+    { "uvm-fabric-retry-interval",
+      UVM_FABRIC_RETRY_INTERVAL_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "MILLISECONDS",
+      "The initial interval, in &MILLISECONDS&, between attempts to enable "
+      "UVM persistence mode on a device whose NVLink fabric is not ready. "
+      "The interval doubles after every attempt, up to a maximum of 8 "
+      "seconds or the initial interval, whichever is larger. "
+      "The default is 1000 milliseconds." },
+
+    { "setup-threads",
+      SETUP_THREADS_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "THREADS",
+      "By default, nvidia-persistenced brings up devices one at a time on "
+      "startup. Use '--setup-threads' to bring up to &THREADS& devices up "
+      "concurrently, which can considerably reduce startup time on systems "
+      "with many devices. Startup still completes only after every device "
+      "has been brought up, and any devices that failed to enter the "
+      "requested persistence mode are reported to syslog." },
+
+    { "numa-online-threads",
+      NUMA_ONLINE_THREADS_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "THREADS",
+      "By default, nvidia-persistenced onlines the NUMA memory of a device "
+      "one memory block at a time. Use '--numa-online-threads' to online "
+      "the memory blocks of a device from up to &THREADS& threads. "
+      "The memory is still onlined into ZONE_MOVABLE; blocks that cannot be "
+      "onlined out of order are retried in order once the other blocks are "
+      "online. As the kernel serializes memory block state changes, this "
+      "only reduces the time it takes to online the memory of a device on "
+      "kernels where onlining a block spends much of its time outside of "
+      "that serialization; measure it (e.g., with 'make bench') before "
+      "using more than one thread. Devices are onlined in parallel with "
+      "each other regardless, see '--setup-threads'." },
+
+    { "numa-hugepages-2m",
+      NUMA_HUGEPAGES_2M_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "COUNT",
+      "Reserve &COUNT& 2 MB huge pages on the NUMA node of each device, "
+      "right after its NUMA memory is onlined, so that applications do not "
+      "have to allocate them from memory that may be fragmented by then. "
+      "The huge pages are released again before the memory is offlined. By "
+      "default, no huge pages are reserved." },
+
+    { "numa-hugepages-1g",
+      NUMA_HUGEPAGES_1G_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "COUNT",
+      "Like '--numa-hugepages-2m', but reserves &COUNT& 1 GB huge pages." },
+
+    { "warm-restart",
+      WARM_RESTART_OPTION,
+      NVGETOPT_IS_BOOLEAN | NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "nvidia-persistenced records the state of every device in "
+      "/var/run/nvidia-persistenced/state while it runs. By default, "
+      "nvidia-persistenced disables persistence mode and offlines the NUMA "
+      "memory of every device on exit, and removes this file. Use "
+      "'--warm-restart' to leave the NUMA memory of devices online on exit "
+      "and keep the recorded state instead. The next instance of "
+      "nvidia-persistenced then takes over the NUMA memory of the devices it "
+      "brings up in persistence mode without onlining it again, provided the "
+      "driver still reports the same NUMA memory as online, and offlines it "
+      "on devices that it brings up with persistence mode disabled. The "
+      "persistence mode of each device is chosen as usual, from the "
+      "command line and the policy file. The recorded state is also used "
+      "after nvidia-persistenced exits unexpectedly." },
+
+    { "shutdown-timeout",
+      SHUTDOWN_TIMEOUT_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "SECONDS",
+      "On exit, nvidia-persistenced tears down all devices concurrently, "
+      "and by default waits for that to complete, however long offlining "
+      "their NUMA memory takes. If &SECONDS& is not 0 and the teardown "
+      "takes longer than that, any NUMA memory offlining still in progress "
+      "is stopped at the next memory block, the memory blocks it offlined "
+      "are brought back online, and the state of the devices is recorded "
+      "for the next instance of nvidia-persistenced, as with "
+      "'--warm-restart'. nvidia-persistenced still waits for this to "
+      "complete before exiting, so &SECONDS& should be set well below the "
+      "stop timeout of the service manager. The default is 0." },
+
+    { "metrics-file",
+      METRICS_FILE_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "PATH",
+      "Write metrics about the devices and requests handled by "
+      "nvidia-persistenced to &PATH& in the Prometheus text format, for "
+      "collection by the textfile collector of the Prometheus node exporter. "
+      "The metrics include the persistence mode, UVM persistence mode and "
+      "NUMA status of each device, counters of state changes and failures, "
+      "and latency histograms of device setup phases and RPC requests. The "
+      "file is replaced atomically on each update, and removed on exit. By "
+      "default, no metrics are written." },
+
+    { "metrics-interval",
+      METRICS_INTERVAL_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "SECONDS",
+      "When '--metrics-file' is given, rewrite the metrics file every "
+      "&SECONDS& seconds. The default is 15 seconds." },
+
+    { "seqpacket-socket",
+      SEQPACKET_SOCKET_OPTION,
+      NVGETOPT_IS_BOOLEAN | NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "In addition to the RPC interface, serve a lightweight binary "
+      "protocol on the SOCK_SEQPACKET socket "
+      "/var/run/nvidia-persistenced/seqpacket, for clients that query or "
+      "change the persistence mode or NUMA status of single devices at a "
+      "high rate. The message format is defined in nvpd_msg.h. As with the "
+      "RPC interface, only root may change the state of devices. By "
+      "default, only the RPC interface is served." },
+
+    { "policy-file",
+      POLICY_FILE_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "PATH",
+      "Read the policy of each device from the file &PATH&, in which each "
+      "line names a device, either by its PCI location, such as "
+      "'0000:01:00.0', or by its UUID, or 'default' for all devices, followed "
+      "by any of 'persistence=on|off', 'uvm-persistence=on|off', "
+      "'numa=online|offline', 'hugepages-2m=COUNT' and 'hugepages-1g=COUNT'. "
+      "A UUID applies once the device was opened, and takes precedence over a "
+      "PCI location, which takes precedence over 'default'. Settings missing "
+      "from the policy of a device are taken from the other options on "
+      "startup, and left unchanged afterwards. On SIGHUP, the file is read "
+      "again, and only the devices whose policy differs from their current "
+      "state are changed. Lines starting with '#' are ignored. By default, "
+      "no policy file is read." },
+
+    /*
+     * Internal option, used by nvidia-persistenced to pass its state to the
+     * new instance it executes on SIGUSR2.
+     */
+    { "handoff-fd",
+      HANDOFF_FD_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT,
+      NULL,
+      NULL },
+
     { "nvidia-cfg-path",
       NVIDIA_CFG_PATH_OPTION,
       NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
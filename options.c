@@ -100,6 +100,19 @@ static void setup_option_defaults(NvPdOptions *options)
     options->persistence_mode = NV_PERSISTENCE_MODE_ENABLED;
     options->uvm_persistence_mode = NV_UVM_PERSISTENCE_MODE_DISABLED;
     options->nvidia_cfg_path = NULL;
+    options->setup_threads = 1;
+    options->uvm_fabric_timeout = 30;
+    options->uvm_fabric_retry_interval = 1000;
+    options->numa_online_threads = 1;
+    options->numa_hugepages_2m = 0;
+    options->numa_hugepages_1g = 0;
+    options->warm_restart = 0;
+    options->handoff_fd = -1;
+    options->metrics_file = NULL;
+    options->metrics_interval = 15;
+    options->shutdown_timeout = 0;
+    options->seqpacket_socket = 0;
+    options->policy_file = NULL;
     options->verbose = 0;
     options->uid = getuid();
     options->gid = getgid();
@@ -113,6 +126,7 @@ void parse_options(int argc, char *argv[], NvPdOptions *options)
 {
     int short_name;
     int boolval;
+    int intval;
     char *strval;
     struct passwd *pw_entry;
     struct group *gr_entry;
@@ -123,7 +137,7 @@ void parse_options(int argc, char *argv[], NvPdOptions *options)
     while (1)
     {
         short_name = nvgetopt(argc, argv, __options, &strval, &boolval,
-                              NULL,      /* intval    */
+                              &intval,   /* intval    */
                               NULL,      /* doubleval */
                               NULL);     /* disable   */
         if (short_name == -1)
@@ -181,6 +195,86 @@ void parse_options(int argc, char *argv[], NvPdOptions *options)
                     options->uvm_persistence_mode = NV_UVM_PERSISTENCE_MODE_DISABLED;
                 }
                 break;
+            case SETUP_THREADS_OPTION:
+                if (intval < 1) {
+                    nv_error_msg("Invalid number of setup threads '%d'; "
+                                 "at least one thread is required.", intval);
+                    exit(EXIT_FAILURE);
+                }
+                options->setup_threads = intval;
+                break;
+            case UVM_FABRIC_TIMEOUT_OPTION:
+                if (intval < 0) {
+                    nv_error_msg("Invalid NVLink fabric timeout '%d'.",
+                                 intval);
+                    exit(EXIT_FAILURE);
+                }
+                options->uvm_fabric_timeout = intval;
+                break;
+            case UVM_FABRIC_RETRY_INTERVAL_OPTION:
+                if (intval < 1) {
+                    nv_error_msg("Invalid NVLink fabric retry interval '%d'.",
+                                 intval);
+                    exit(EXIT_FAILURE);
+                }
+                options->uvm_fabric_retry_interval = intval;
+                break;
+            case WARM_RESTART_OPTION:
+                options->warm_restart = boolval;
+                break;
+            case NUMA_ONLINE_THREADS_OPTION:
+                if (intval < 1) {
+                    nv_error_msg("Invalid number of NUMA onlining threads "
+                                 "'%d'; at least one thread is required.",
+                                 intval);
+                    exit(EXIT_FAILURE);
+                }
+                options->numa_online_threads = intval;
+                break;
+            case NUMA_HUGEPAGES_2M_OPTION:
+            case NUMA_HUGEPAGES_1G_OPTION:
+                if (intval < 0) {
+                    nv_error_msg("Invalid number of huge pages '%d'.",
+                                 intval);
+                    exit(EXIT_FAILURE);
+                }
+                if (short_name == NUMA_HUGEPAGES_2M_OPTION) {
+                    options->numa_hugepages_2m = intval;
+                } else {
+                    options->numa_hugepages_1g = intval;
+                }
+                break;
+            case HANDOFF_FD_OPTION:
+                if (intval < 0) {
+                    nv_error_msg("Invalid handoff file descriptor '%d'.",
+                                 intval);
+                    exit(EXIT_FAILURE);
+                }
+                options->handoff_fd = intval;
+                break;
+            case METRICS_FILE_OPTION:
+                options->metrics_file = strval;
+                break;
+            case METRICS_INTERVAL_OPTION:
+                if (intval < 1) {
+                    nv_error_msg("Invalid metrics interval '%d'.", intval);
+                    exit(EXIT_FAILURE);
+                }
+                options->metrics_interval = intval;
+                break;
+            case SHUTDOWN_TIMEOUT_OPTION:
+                if (intval < 0) {
+                    nv_error_msg("Invalid shutdown timeout '%d'.", intval);
+                    exit(EXIT_FAILURE);
+                }
+                options->shutdown_timeout = intval;
+                break;
+            case SEQPACKET_SOCKET_OPTION:
+                options->seqpacket_socket = boolval;
+                break;
+            case POLICY_FILE_OPTION:
+                options->policy_file = strval;
+                break;
             case NVIDIA_CFG_PATH_OPTION:
                 options->nvidia_cfg_path = strval;
                 break;